@@ -38,6 +38,7 @@
 #include "cplx_wavelet_dec.h"
 #include "median.h"
 #include "iccstore.h"
+#include "fftwplans.h"
 #include "imagesource.h"
 #include "rt_algo.h"
 #include "guidedfilter.h"
@@ -1910,25 +1911,26 @@ BENCHFUN
             // calculate min size of numblox_W.
             int min_numblox_W = ceil((static_cast<float>((MIN(imwidth, ((numtiles_W - 1) * tileWskip) + tilewidth)) - ((numtiles_W - 1) * tileWskip))) / (offset)) + 2 * blkrad;
 
-            // these are needed only for creation of the plans and will be freed before entering the parallel loop
+            // the plans are owned by the process-wide cache, and are reused
+            // across calls (and, via the FFTW wisdom, across sessions)
             fftwf_plan plan_forward_blox[2];
             fftwf_plan plan_backward_blox[2];
 
             if (denoiseLuminance) {
-                float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-                float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(max_numblox_W * TS * TS * sizeof(float)));
-
-                int nfwd[2] = {TS, TS};
+                // only the alignment of these matters, the plans are
+                // executed on the per-thread LbloxArray/fLbloxArray buffers
+                float *Lbloxtmp  = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)));
+                float *fLbloxtmp = reinterpret_cast<float*>(fftwf_malloc(sizeof(float)));
 
                 //for DCT:
-                fftw_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
-                fftw_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
+                fftwf_r2r_kind fwdkind[2] = {FFTW_REDFT10, FFTW_REDFT10};
+                fftwf_r2r_kind bwdkind[2] = {FFTW_REDFT01, FFTW_REDFT01};
 
                 // Creating the plans with FFTW_MEASURE instead of FFTW_ESTIMATE speeds up the execute a bit
-                plan_forward_blox[0]  = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[0] = fftwf_plan_many_r2r(2, nfwd, max_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_forward_blox[1]  = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, Lbloxtmp, nullptr, 1, TS * TS, fLbloxtmp, nullptr, 1, TS * TS, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
-                plan_backward_blox[1] = fftwf_plan_many_r2r(2, nfwd, min_numblox_W, fLbloxtmp, nullptr, 1, TS * TS, Lbloxtmp, nullptr, 1, TS * TS, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plan_forward_blox[0]  = fftw::plan_many_r2r_2d(TS, TS, max_numblox_W, TS * TS, Lbloxtmp, fLbloxtmp, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plan_backward_blox[0] = fftw::plan_many_r2r_2d(TS, TS, max_numblox_W, TS * TS, fLbloxtmp, Lbloxtmp, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plan_forward_blox[1]  = fftw::plan_many_r2r_2d(TS, TS, min_numblox_W, TS * TS, Lbloxtmp, fLbloxtmp, fwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
+                plan_backward_blox[1] = fftw::plan_many_r2r_2d(TS, TS, min_numblox_W, TS * TS, fLbloxtmp, Lbloxtmp, bwdkind, FFTW_MEASURE | FFTW_DESTROY_INPUT);
                 fftwf_free(Lbloxtmp);
                 fftwf_free(fLbloxtmp);
             }
@@ -2018,6 +2020,9 @@ BENCHFUN
 
                 for (int tiletop = 0; tiletop < imheight; tiletop += tileHskip) {
                     for (int tileleft = 0; tileleft < imwidth ; tileleft += tileWskip) {
+                        if (is_cancelled(im.cancel_token)) {
+                            continue;
+                        }
                         //printf("titop=%d tileft=%d\n",tiletop/tileHskip, tileleft/tileWskip);
                         pos = (tiletop / tileHskip) * numtiles_W + tileleft / tileWskip ;
                         int tileright = MIN(imwidth, tileleft + tilewidth);
@@ -2655,14 +2660,6 @@ BENCHFUN
                     }
                 }
             }
-
-            if (denoiseLuminance) {
-                // destroy the plans
-                fftwf_destroy_plan(plan_forward_blox[0]);
-                fftwf_destroy_plan(plan_backward_blox[0]);
-                fftwf_destroy_plan(plan_forward_blox[1]);
-                fftwf_destroy_plan(plan_backward_blox[1]);
-            }
         // } while (memoryAllocationFailed && numTries < 2 && (options.rgbDenoiseThreadLimit == 0) && !ponder);
 
         if (memoryAllocationFailed) {
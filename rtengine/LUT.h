@@ -71,6 +71,7 @@
 #include "opthelper.h"
 #include "rt_math.h"
 #include "noncopyable.h"
+#include "simd.h"
 
 // Bit representations of flags
 enum {
@@ -485,6 +486,33 @@ public:
         return (p1 + p2 * diff);
     }
 
+    // out[i] = (*this)[in[i]] for n values, using the widest SIMD path
+    // available at runtime (see simd.h). in and out can be the same
+    // buffer. Requires LUTs which clip at upper and lower bounds
+    template<typename U = T, typename = typename std::enable_if<std::is_same<U, float>::value>::type>
+    void lookup(const float *in, float *out, int n) const
+    {
+        const rtengine::simd::Kernels *k = rtengine::simd::get_kernels();
+        if (k) {
+            k->lut_interpolate(data, maxs, in, out, n);
+            return;
+        }
+        int i = 0;
+#ifdef __SSE2__
+        for (; i < n - 3; i += 4) {
+            STVFU(out[i], (*this)[LVFU(in[i])]);
+        }
+#endif
+        for (; i < n; ++i) {
+            out[i] = (*this)[in[i]];
+        }
+    }
+
+    const T *getData() const
+    {
+        return data;
+    }
+
 #ifndef NDEBUG
     // Debug facility ; dump the content of the LUT in a file. No control of the filename is done
     void dump(Glib::ustring fname)
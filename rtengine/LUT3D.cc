@@ -105,7 +105,7 @@ inline int GetLut3DIndexBlueFast(int indexR, int indexG, int indexB, int dim, in
 
 } // namespace
 
-inline void LUT3D::apply_tetra(float &r, float &g, float &b)
+inline void LUT3D::apply_tetra(float &r, float &g, float &b) const
 {
     const float dimMinusOne = dim_minus_one_;
     const float m_step = dimMinusOne;
@@ -298,4 +298,12 @@ inline void LUT3D::apply_tetra(float &r, float &g, float &b)
     b = out[2];
 }
 
+
+void LUT3D::operator()(float *r, float *g, float *b, int n) const
+{
+    for (int i = 0; i < n; ++i) {
+        apply_tetra(r[i], g[i], b[i]);
+    }
+}
+
 } // namespace rtengine
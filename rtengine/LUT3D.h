@@ -39,12 +39,15 @@ public:
 
     void init(int dim, initializer &f, bool input_is_01=true);
     bool operator()(float &r, float &g, float &b);
+    // converts n pixels of planar data in place. The input must be in
+    // [0, 1], regardless of input_is_01
+    void operator()(float *r, float *g, float *b, int n) const;
 
     int dimension() const { return dim_; }
     operator bool() const;
 
 private:
-    void apply_tetra(float &r, float &g, float &b);
+    void apply_tetra(float &r, float &g, float &b) const;
 
     bool input_is_01_;
     int dim_;
@@ -19,21 +19,26 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <utility>
 #include <memory>
+#include "bufferpool.h"
 
 
 namespace rtengine {
 
-// Aligned buffer that should be faster
+// Aligned buffer that should be faster. Large buffers are taken from (and
+// returned to) the buffer_pool
 template <class T> class AlignedBuffer {
 
 private:
     void *real ;
     char alignment;
     size_t allocatedSize;
+    size_t capacity; // size of the block pointed to by real
     int unitSize;
 
 public:
@@ -48,6 +53,7 @@ public:
         real(nullptr),
         alignment(align),
         allocatedSize(0),
+        capacity(0),
         unitSize(0),
         data(nullptr)
     {
@@ -58,9 +64,7 @@ public:
 
     ~AlignedBuffer ()
     {
-        if (real) {
-            free(real);
-        }
+        buffer_pool::deallocate(real, capacity);
     }
 
     /** @brief Return true if there's no memory allocated
@@ -78,12 +82,11 @@ public:
     bool resize(size_t size, int structSize=0)
     {
         if (size == 0) {
-            if (real) {
-                free(real);
-            }
+            buffer_pool::deallocate(real, capacity);
             real = nullptr;
             data = nullptr;
             allocatedSize = 0;
+            capacity = 0;
             unitSize = 0;
             return true;
         }
@@ -91,20 +94,33 @@ public:
         size_t elemsz = structSize ? structSize : sizeof(T);
         size_t amount = size * elemsz;
         if (amount != allocatedSize) {
-            unitSize = elemsz;
-            allocatedSize = amount;
             size_t space = amount + alignment;
-            real = realloc(real, space);
             void *p = real;
-            if (!p || (alignment && !std::align(alignment, amount, p, space))) {
-                if (real) {
-                    free(real);
-                    real = nullptr;
-                    data = nullptr;
-                    allocatedSize = 0;
-                    unitSize = 0;
-                    return false;
+            if (buffer_pool::round_size(space) != capacity) {
+                // like realloc, keep the contents of the old block
+                size_t newcapacity = 0;
+                p = buffer_pool::allocate(space, newcapacity);
+                if (p && data) {
+                    void *dst = p;
+                    size_t s = space;
+                    if (!alignment || std::align(alignment, amount, dst, s)) {
+                        memcpy(dst, data, std::min(amount, allocatedSize));
+                    }
                 }
+                buffer_pool::deallocate(real, capacity);
+                real = p;
+                capacity = newcapacity;
+            }
+            unitSize = elemsz;
+            allocatedSize = amount;
+            if (!p || (alignment && !std::align(alignment, amount, p, space))) {
+                buffer_pool::deallocate(real, capacity);
+                real = nullptr;
+                data = nullptr;
+                allocatedSize = 0;
+                capacity = 0;
+                unitSize = 0;
+                return false;
             }
             data = static_cast<T *>(p);
         }
@@ -117,6 +133,7 @@ public:
         std::swap(real, other.real);
         std::swap(alignment, other.alignment);
         std::swap(allocatedSize, other.allocatedSize);
+        std::swap(capacity, other.capacity);
         std::swap(data, other.data);
     }
 
@@ -181,6 +181,9 @@ void RawImageSource::amaze_demosaic_RT(int winx, int winy, int winw, int winh, c
 
         for (int top = winy - 16; top < winy + height; top += ts - 32) {
             for (int left = winx - 16; left < winx + width; left += ts - 32) {
+                if (is_cancelled(cancel_token)) {
+                    continue;
+                }
                 memset(&nyquist[3 * tsh], 0, sizeof(unsigned char) * (ts - 6) * tsh);
                 //location of tile bottom edge
                 int bottom = min(top + ts, winy + height + 16);
@@ -0,0 +1,214 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "opthelper.h"
+
+namespace rtengine {
+
+/******************************************************************************
+ * MSB-first bit reader working directly on an in-memory buffer (typically
+ * the mmap'd raw file), for the dcraw-derived decoders.
+ *
+ * Bits are kept in a 64-bit buffer which is refilled several bytes at a
+ * time, so that get() and huff() only branch on an (almost never taken)
+ * refill. With jpeg_stuffing, the JPEG byte stuffing (0xff 0x00 -> 0xff) is
+ * removed and reading stops at markers (0xff followed by anything else),
+ * like getbithuff_t with zero_after_ff.
+ *
+ * Reading past the end of the data (or past a marker) returns zero bits and
+ * sets the overrun() flag; after that, get() and huff() return 0.
+ *
+ * The class is trivial (it is part of DCraw::jhead, which is memset), so it
+ * must be set up with init() before use.
+ ******************************************************************************/
+
+class BitReader {
+public:
+    void init(const void *data, std::size_t size, std::size_t pos, bool jpeg_stuffing)
+    {
+        data_ = static_cast<const std::uint8_t *>(data);
+        size_ = size;
+        pos_ = pos < size ? pos : size;
+        seg_start_ = pos_;
+        stuffing_ = jpeg_stuffing;
+        reset_bits();
+    }
+
+    /// reads nbits (at most 25, 0 for larger values like getbithuff_t)
+    unsigned get(int nbits)
+    {
+        if (UNLIKELY(overrun_ || nbits > 25)) {
+            return 0;
+        }
+        if (UNLIKELY(bits_ < nbits)) {
+            refill();
+        }
+        const unsigned c = peek(nbits);
+        consume(nbits);
+        return c;
+    }
+
+    /// decodes a symbol with a dcraw Huffman table (see DCraw::make_decoder):
+    /// huff[0] is the maximum code length, huff[1 + code] = len << 8 | value
+    unsigned huff(const unsigned short *huff)
+    {
+        if (UNLIKELY(overrun_)) {
+            return 0;
+        }
+        const int nbits = huff[0];
+        if (UNLIKELY(bits_ < nbits)) {
+            refill();
+        }
+        const unsigned short h = huff[1 + peek(nbits)];
+        consume(h >> 8);
+        return h & 0xff;
+    }
+
+    /// skips to the byte after the next restart marker (0xff 0xdN) and
+    /// starts reading from there, discarding the buffered bits
+    void skip_to_restart_marker()
+    {
+        // the buffered bits were read from the bytes before position(), and
+        // within entropy-coded data 0xff is always followed by 0x00, so
+        // scanning from there finds the same marker as scanning from the
+        // exact position would
+        std::size_t p = position();
+        p = p >= seg_start_ + 2 ? p - 2 : seg_start_;
+        unsigned mark = 0;
+        while (p < size_) {
+            mark = (mark << 8 | data_[p++]) & 0xffff;
+            if ((mark & 0xfff0) == 0xffd0) {
+                break;
+            }
+        }
+        pos_ = p;
+        seg_start_ = p;
+        reset_bits();
+    }
+
+    /// offset of the first byte not (fully) consumed yet. Approximate in
+    /// the presence of byte stuffing; meant for progress reporting and for
+    /// resynchronizing the file cursor after decoding
+    std::size_t position() const
+    {
+        return pos_ - (bits_ - pad_) / 8;
+    }
+
+    bool overrun() const
+    {
+        return overrun_;
+    }
+
+private:
+    unsigned peek(int nbits) const
+    {
+        // two shifts to get 0 for nbits == 0 without branching
+        return (buf_ >> 1) >> (63 - nbits);
+    }
+
+    void consume(int nbits)
+    {
+        buf_ <<= nbits;
+        bits_ -= nbits;
+        if (UNLIKELY(bits_ < pad_)) {
+            overrun_ = true;
+        }
+    }
+
+    void reset_bits()
+    {
+        buf_ = 0;
+        bits_ = 0;
+        pad_ = 0;
+        stopped_ = false;
+        overrun_ = false;
+    }
+
+    static std::uint64_t load_be64(const std::uint8_t *p)
+    {
+        std::uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) {
+            v = v << 8 | p[i];
+        }
+        return v;
+    }
+
+    static bool has_ff(std::uint64_t w)
+    {
+        const std::uint64_t v = ~w;
+        return (v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL;
+    }
+
+    void refill()
+    {
+        if (LIKELY(!stopped_ && pos_ + 8 <= size_)) {
+            const std::uint64_t w = load_be64(data_ + pos_);
+            if (!stuffing_ || !has_ff(w)) {
+                const int nbytes = (63 - bits_) >> 3;
+                buf_ |= (w & (~std::uint64_t(0) << (64 - 8 * nbytes))) >> bits_;
+                pos_ += nbytes;
+                bits_ += 8 * nbytes;
+                return;
+            }
+        }
+        refill_slow();
+    }
+
+    void refill_slow()
+    {
+        while (bits_ <= 56) {
+            if (stopped_ || pos_ >= size_) {
+                // pad with zeros, keeping track of how many bits are invalid
+                stopped_ = true;
+                pad_ += 64 - bits_;
+                bits_ = 64;
+                return;
+            }
+            const unsigned c = data_[pos_++];
+            if (stuffing_ && c == 0xff) {
+                const unsigned next = pos_ < size_ ? data_[pos_] : 0xff;
+                if (pos_ < size_) {
+                    ++pos_;
+                }
+                if (next != 0) {
+                    stopped_ = true;
+                    continue;
+                }
+            }
+            buf_ |= std::uint64_t(c) << (56 - bits_);
+            bits_ += 8;
+        }
+    }
+
+    const std::uint8_t *data_;
+    std::size_t size_;
+    std::size_t pos_;
+    std::size_t seg_start_; // start of the current restart interval
+    std::uint64_t buf_;
+    int bits_;  // number of bits in buf_ (including padding)
+    int pad_;   // number of padding zero bits at the end of buf_
+    bool stuffing_;
+    bool stopped_;
+    bool overrun_;
+};
+
+} // namespace rtengine
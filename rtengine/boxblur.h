@@ -28,6 +28,7 @@
 #include "alignedbuffer.h"
 #include "rt_math.h"
 #include "opthelper.h"
+#include "simd.h"
 #include "StopWatch.h"
 
 
@@ -335,11 +336,15 @@ inline void boxblur (float** src, float** dst, int radius, int W, int H, bool mu
     }
 
     constexpr int numCols = 8; // process numCols columns at once for better usage of L1 cpu cache
+    // wider SIMD kernels for the vertical blur, if available (see simd.h)
+    const simd::Kernels *kernels = simd::get_kernels();
+    const int blockCols = kernels ? kernels->block_width : numCols;
+    const int start = kernels ? W - W % blockCols : 0;
 #ifdef _OPENMP
     #pragma omp parallel if (multiThread)
 #endif
     {
-        std::unique_ptr<float[]> buffer(new float[numCols * (radius + 1)]);
+        std::unique_ptr<float[]> buffer(new float[std::max(numCols, blockCols) * (radius + 1)]);
 
         //horizontal blur
         float* const lineBuffer = buffer.get();
@@ -382,6 +387,15 @@ inline void boxblur (float** src, float** dst, int radius, int W, int H, bool mu
         }
 
         //vertical blur
+        if (kernels) {
+#ifdef _OPENMP
+            #pragma omp for nowait
+#endif
+            for (int col = 0; col < start; col += blockCols) {
+                kernels->boxblur_vertical_block(dst, col, radius, H, buffer.get());
+            }
+        }
+
 #ifdef __SSE2__
         vfloat (* const rowBuffer)[2] = (vfloat(*)[2]) buffer.get();
         const vfloat leninitv = F2V(radius + 1);
@@ -453,7 +467,7 @@ inline void boxblur (float** src, float** dst, int radius, int W, int H, bool mu
         #pragma omp for nowait
 #endif
 
-        for (int col = 0; col < W - numCols + 1; col += 8) {
+        for (int col = start; col < W - numCols + 1; col += 8) {
             float len = radius + 1;
 
             for (int k = 0; k < numCols; k++) {
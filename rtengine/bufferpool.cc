@@ -0,0 +1,230 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace rtengine { namespace buffer_pool {
+
+namespace {
+
+#ifdef __linux__
+constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+#endif
+
+std::atomic<size_t> total_allocated_bytes(0);
+
+
+void *alloc_block(size_t size)
+{
+#ifdef __linux__
+    void *p = nullptr;
+    if (posix_memalign(&p, HUGE_PAGE_SIZE, size) != 0) {
+        return nullptr;
+    }
+    if (size >= HUGE_PAGE_SIZE) {
+        madvise(p, size, MADV_HUGEPAGE);
+    }
+    return p;
+#else
+    return malloc(size);
+#endif
+}
+
+
+class Pool {
+public:
+    static Pool &get()
+    {
+        // intentionally leaked, as AlignedBuffers with static storage might
+        // be destroyed after it otherwise
+        static Pool *instance = new Pool();
+        return *instance;
+    }
+
+    void init(size_t max_cached, int verbose)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_cached_ = max_cached;
+        verbose_ = verbose;
+        trim(max_cached_);
+    }
+
+    void cleanup()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (verbose_) {
+            std::cout << "buffer pool: " << stats_.requests << " requests, "
+                      << (stats_.requests ? 100 * stats_.hits / stats_.requests : 0)
+                      << "% hit rate, peak resident size "
+                      << (stats_.peak >> 20) << " MB" << std::endl;
+        }
+        max_cached_ = 0;
+        trim(0);
+    }
+
+    void *allocate(size_t size, size_t &capacity)
+    {
+        capacity = round_size(size);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.requests;
+            auto it = free_.find(capacity);
+            if (it != free_.end() && !it->second.empty()) {
+                void *p = it->second.back();
+                it->second.pop_back();
+                stats_.cached -= capacity;
+                ++stats_.hits;
+                return p;
+            }
+        }
+
+        void *p = alloc_block(capacity);
+        if (p) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_.resident += capacity;
+            stats_.peak = std::max(stats_.peak, stats_.resident);
+        }
+        return p;
+    }
+
+    void deallocate(void *p, size_t capacity)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stats_.cached + capacity <= max_cached_) {
+                free_[capacity].push_back(p);
+                stats_.cached += capacity;
+                return;
+            }
+            stats_.resident -= capacity;
+        }
+        free(p);
+    }
+
+    Stats get_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    Pool():
+        max_cached_(0),
+        verbose_(0),
+        stats_{0, 0, 0, 0, 0}
+    {
+    }
+
+    // frees cached blocks, largest first, until at most limit bytes are cached
+    void trim(size_t limit)
+    {
+        for (auto it = free_.rbegin(); it != free_.rend() && stats_.cached > limit; ++it) {
+            auto &blocks = it->second;
+            while (!blocks.empty() && stats_.cached > limit) {
+                free(blocks.back());
+                blocks.pop_back();
+                stats_.cached -= it->first;
+                stats_.resident -= it->first;
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<size_t, std::vector<void *>> free_;
+    size_t max_cached_;
+    int verbose_;
+    Stats stats_;
+};
+
+} // namespace
+
+
+void init(size_t max_cached, int verbose)
+{
+    Pool::get().init(max_cached, verbose);
+}
+
+
+void cleanup()
+{
+    Pool::get().cleanup();
+}
+
+
+size_t round_size(size_t size)
+{
+    if (size < MIN_POOLED_SIZE) {
+        return size;
+    }
+    // four size classes per power of two
+    size_t step = 1;
+    while ((step << 3) <= size) {
+        step <<= 1;
+    }
+    return (size + step - 1) / step * step;
+}
+
+
+void *allocate(size_t size, size_t &capacity)
+{
+    total_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (size < MIN_POOLED_SIZE) {
+        capacity = size;
+        return malloc(size);
+    }
+    return Pool::get().allocate(size, capacity);
+}
+
+
+void deallocate(void *p, size_t capacity)
+{
+    if (!p) {
+        return;
+    } else if (capacity < MIN_POOLED_SIZE) {
+        free(p);
+    } else {
+        Pool::get().deallocate(p, capacity);
+    }
+}
+
+
+Stats get_stats()
+{
+    return Pool::get().get_stats();
+}
+
+
+size_t total_allocated()
+{
+    return total_allocated_bytes.load(std::memory_order_relaxed);
+}
+
+}} // namespace rtengine::buffer_pool
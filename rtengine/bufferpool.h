@@ -0,0 +1,67 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace rtengine { namespace buffer_pool {
+
+/******************************************************************************
+ * Process-wide pool of large memory blocks, backing AlignedBuffer (and hence
+ * the image classes and array2D).
+ *
+ * Requests of at least MIN_POOLED_SIZE bytes are rounded up to a size class
+ * (four classes per power of two, so at most 25% is wasted), and released
+ * blocks are kept in per-class free lists for reuse, up to a total of
+ * max_cached bytes (see init()). This avoids the page faults and the
+ * munmap/mmap churn of allocating the same big buffers over and over at each
+ * preview update. On Linux, blocks are aligned to 2MB and marked as eligible
+ * for transparent huge pages. Smaller requests go straight to malloc/free.
+ *
+ * All the functions are thread-safe.
+ ******************************************************************************/
+
+constexpr size_t MIN_POOLED_SIZE = 1 << 20;
+
+struct Stats {
+    size_t requests;  ///< number of pooled allocations
+    size_t hits;      ///< number of pooled allocations served from the free lists
+    size_t resident;  ///< bytes currently allocated by the pool (in use or cached)
+    size_t cached;    ///< bytes currently in the free lists
+    size_t peak;      ///< peak value of resident
+};
+
+void init(size_t max_cached, int verbose);
+void cleanup();
+
+/// returns a block of at least size bytes, whose actual size is stored in
+/// capacity. The block must be returned with deallocate(p, capacity)
+void *allocate(size_t size, size_t &capacity);
+void deallocate(void *p, size_t capacity);
+
+/// the capacity of the block that allocate(size) would return
+size_t round_size(size_t size);
+
+Stats get_stats();
+
+/// total number of bytes requested with allocate() so far, by all the
+/// threads (including the OpenMP workers)
+size_t total_allocated();
+
+}} // namespace rtengine::buffer_pool
@@ -0,0 +1,50 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+
+namespace rtengine {
+
+/**
+ * Cooperative cancellation of long computations. The owner calls cancel()
+ * from any thread, and the computation polls cancelled() at convenient
+ * points (between pipeline steps, per tile or per row), bailing out as soon
+ * as possible. The output of a cancelled computation is unspecified, so the
+ * owner is responsible for recomputing it.
+ */
+class CancellationToken {
+public:
+    CancellationToken(): cancelled_(false) {}
+
+    void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+    void reset() { cancelled_.store(false, std::memory_order_relaxed); }
+    bool cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<bool> cancelled_;
+};
+
+
+inline bool is_cancelled(const CancellationToken *token)
+{
+    return token && token->cancelled();
+}
+
+} // namespace rtengine
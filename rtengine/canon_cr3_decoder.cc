@@ -630,26 +630,20 @@ libraw_inline void _BitScanReverse(DWORD *Index, unsigned long Mask)
 
 #define LIBRAW_EXCEPTION_IO_EOF std::exception()
 
-struct LibRaw_abstract_datastream {
-    IMFILE *ifp;
-    
-    void lock() {}
-    void unlock() {}
-    void seek(int p, int how) { fseek(ifp, p, how); }
-    int read(void* dst, int es, int count)
-    { return fread(dst, es, count, ifp); }
-};
-
+// The bitstreams read directly from the in-memory file (see fdata()):
+// mdatBuf is a window of at most CRX_BUF_SIZE bytes into it, so that every
+// subband of every tile has its own independent reader and the tiles can be
+// decoded concurrently without serializing the I/O.
 struct CrxBitstream
 {
-  uint8_t mdatBuf[CRX_BUF_SIZE];
+  const uint8_t *mdatBuf;
   uint64_t mdatSize;
   uint64_t curBufOffset;
   uint32_t curPos;
   uint32_t curBufSize;
   uint32_t bitData;
   int32_t bitsLeft;
-  LibRaw_abstract_datastream *input;
+  IMFILE *input;
 };
 
 struct CrxBandParam
@@ -758,7 +752,7 @@ struct CrxImage
   uint64_t mdatSize;
   int16_t *outBufs[4]; // one per plane
   int16_t *planeBuf;
-  LibRaw_abstract_datastream *input;
+  IMFILE *input;
 #ifdef LIBRAW_CR3_MEMPOOL
   libraw_memmgr memmgr;
   CrxImage() : memmgr(0) {}
@@ -794,25 +788,24 @@ static inline void crxFillBuffer(CrxBitstream *bitStrm)
   {
     bitStrm->curPos = 0;
     bitStrm->curBufOffset += bitStrm->curBufSize;
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp critical
-#endif
-    {
-#ifndef LIBRAW_USE_OPENMP
-      bitStrm->input->lock();
-#endif
-      bitStrm->input->seek(bitStrm->curBufOffset, SEEK_SET);
-      bitStrm->curBufSize = bitStrm->input->read(bitStrm->mdatBuf, 1, _min(bitStrm->mdatSize, CRX_BUF_SIZE));
-#ifndef LIBRAW_USE_OPENMP
-      bitStrm->input->unlock();
-#endif
-      if (bitStrm->curBufSize < 1) // nothing read
-        throw LIBRAW_EXCEPTION_IO_EOF;
-      bitStrm->mdatSize -= bitStrm->curBufSize;
-    }
+    const uint64_t fileSize = bitStrm->input->size;
+    const uint64_t avail = bitStrm->curBufOffset < fileSize ? fileSize - bitStrm->curBufOffset : 0;
+    bitStrm->curBufSize = _min(_min(bitStrm->mdatSize, avail), CRX_BUF_SIZE);
+    if (bitStrm->curBufSize < 1) // nothing left in the file
+      throw LIBRAW_EXCEPTION_IO_EOF;
+    bitStrm->mdatBuf = fdata(bitStrm->curBufOffset, bitStrm->input);
+    bitStrm->mdatSize -= bitStrm->curBufSize;
   }
 }
 
+libraw_inline uint32_t crxBitstreamReadWord(const CrxBitstream *bitStrm)
+{
+  // the window points into the file data, so it is not necessarily aligned
+  uint32_t word;
+  memcpy(&word, bitStrm->mdatBuf + bitStrm->curPos, sizeof(word));
+  return _byteswap_ulong(word);
+}
+
 libraw_inline int crxBitstreamGetZeros(CrxBitstream *bitStrm)
 {
   uint32_t nonZeroBit = 0;
@@ -833,7 +826,7 @@ libraw_inline int crxBitstreamGetZeros(CrxBitstream *bitStrm)
     {
       while (bitStrm->curPos + 4 <= bitStrm->curBufSize)
       {
-        nextData = _byteswap_ulong(*(uint32_t *)(bitStrm->mdatBuf + bitStrm->curPos));
+        nextData = crxBitstreamReadWord(bitStrm);
         bitStrm->curPos += 4;
         crxFillBuffer(bitStrm);
         if (nextData)
@@ -875,7 +868,7 @@ libraw_inline uint32_t crxBitstreamGetBits(CrxBitstream *bitStrm, int bits)
     // get them from stream
     if (bitStrm->curPos + 4 <= bitStrm->curBufSize)
     {
-      nextWord = _byteswap_ulong(*(uint32_t *)(bitStrm->mdatBuf + bitStrm->curPos));
+      nextWord = crxBitstreamReadWord(bitStrm);
       bitStrm->curPos += 4;
       crxFillBuffer(bitStrm);
       bitStrm->bitsLeft = 32 - (bits - bitsLeft);
@@ -2521,56 +2514,58 @@ static unsigned sgetn (int n, unsigned char *s)
 } // namespace
 
 
-int DCraw::crxDecodePlane(void *p, uint32_t planeNumber)
+int DCraw::crxDecodeTile(void *p, int tileNumber, uint32_t planeNumber)
 {
   CrxImage *img = (CrxImage *)p;
-  int imageRow = 0;
-  for (int tRow = 0; tRow < img->tileRows; tRow++)
+  CrxTile *tile = img->tiles + tileNumber;
+  CrxPlaneComp *planeComp = tile->comps + planeNumber;
+  uint64_t tileMdatOffset = tile->dataOffset + tile->mdatQPDataSize + tile->mdatExtraSize + planeComp->dataOffset;
+  // all the tiles but the last ones in each row/column have the same size
+  int imageRow = (tileNumber / img->tileCols) * img->tiles[0].height;
+  int imageCol = (tileNumber % img->tileCols) * img->tiles[0].width;
+
+  try
   {
-    int imageCol = 0;
-    for (int tCol = 0; tCol < img->tileCols; tCol++)
-    {
-      CrxTile *tile = img->tiles + tRow * img->tileCols + tCol;
-      CrxPlaneComp *planeComp = tile->comps + planeNumber;
-      uint64_t tileMdatOffset = tile->dataOffset + tile->mdatQPDataSize + tile->mdatExtraSize + planeComp->dataOffset;
+    // decode single tile
+    if (crxSetupSubbandData(img, planeComp, tile, tileMdatOffset))
+      return -1;
 
-      // decode single tile
-      if (crxSetupSubbandData(img, planeComp, tile, tileMdatOffset))
+    if (img->levels)
+    {
+      if (crxIdwt53FilterInitialize(planeComp, img->levels, tile->qStep))
         return -1;
-
-      if (img->levels)
+      for (int i = 0; i < tile->height; ++i)
       {
-        if (crxIdwt53FilterInitialize(planeComp, img->levels, tile->qStep))
+        if (crxIdwt53FilterDecode(planeComp, img->levels - 1, tile->qStep) ||
+            crxIdwt53FilterTransform(planeComp, img->levels - 1))
           return -1;
-        for (int i = 0; i < tile->height; ++i)
-        {
-          if (crxIdwt53FilterDecode(planeComp, img->levels - 1, tile->qStep) ||
-              crxIdwt53FilterTransform(planeComp, img->levels - 1))
-            return -1;
-          int32_t *lineData = crxIdwt53FilterGetLine(planeComp, img->levels - 1);
-          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
-        }
+        int32_t *lineData = crxIdwt53FilterGetLine(planeComp, img->levels - 1);
+        crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
       }
-      else
+    }
+    else
+    {
+      // we have the only subband in this case
+      if (!planeComp->subBands->dataSize)
       {
-        // we have the only subband in this case
-        if (!planeComp->subBands->dataSize)
-        {
-          memset(planeComp->subBands->bandBuf, 0, planeComp->subBands->bandSize);
-          return 0;
-        }
+        memset(planeComp->subBands->bandBuf, 0, planeComp->subBands->bandSize);
+        return 0;
+      }
 
-        for (int i = 0; i < tile->height; ++i)
-        {
-          if (crxDecodeLine(planeComp->subBands->bandParam, planeComp->subBands->bandBuf))
-            return -1;
-          int32_t *lineData = (int32_t *)planeComp->subBands->bandBuf;
-          crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
-        }
+      for (int i = 0; i < tile->height; ++i)
+      {
+        if (crxDecodeLine(planeComp->subBands->bandParam, planeComp->subBands->bandBuf))
+          return -1;
+        int32_t *lineData = (int32_t *)planeComp->subBands->bandBuf;
+        crxConvertPlaneLine(img, imageRow + i, imageCol, planeNumber, lineData, tile->width);
       }
-      imageCol += tile->width;
     }
-    imageRow += img->tiles[tRow * img->tileCols].height;
+  }
+  catch (...)
+  {
+    // truncated file, see crxFillBuffer. This might run in a parallel
+    // region, so the exception can't be propagated from here
+    return -1;
   }
 
   return 0;
@@ -3304,22 +3299,25 @@ int crxFreeImageData(CrxImage *img)
 
 } // namespace
 
-void DCraw::crxLoadDecodeLoop(void *img, int nPlanes)
+void DCraw::crxLoadDecodeLoop(void *p, int nPlanes)
 {
-#ifdef LIBRAW_USE_OPENMP
-  int results[4]; // nPlanes is always <= 4
-#pragma omp parallel for
-  for (int32_t plane = 0; plane < nPlanes; ++plane)
-    results[plane] = crxDecodePlane(img, plane);
+  // every (tile, plane) pair is coded independently, reads its data through
+  // its own bitstreams and writes to its own part of the output, so all of
+  // them can be decoded in parallel. Large sensors (R5, R3) have several
+  // tiles per plane, so this scales beyond the (at most 4) planes
+  CrxImage *img = (CrxImage *)p;
+  const int nJobs = img->tileRows * img->tileCols * nPlanes;
+  int errors = 0;
 
-  for (int32_t plane = 0; plane < nPlanes; ++plane)
-    if (results[plane])
-      derror();
-#else
-  for (int32_t plane = 0; plane < nPlanes; ++plane)
-    if (crxDecodePlane(img, plane))
-      derror();
+#ifdef LIBRAW_USE_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(+:errors)
 #endif
+  for (int job = 0; job < nJobs; ++job)
+    if (crxDecodeTile(img, job / nPlanes, job % nPlanes))
+      ++errors;
+
+  if (errors)
+    derror();
 }
 
 void DCraw::crxConvertPlaneLineDf(void *p, int imageRow) { crxConvertPlaneLine((CrxImage *)p, imageRow); }
@@ -3346,8 +3344,7 @@ void DCraw::crxLoadRaw()
       RT_canon_CR3_data
           .crx_header[RT_canon_CR3_data.crx_track_selected];
 
-  LibRaw_abstract_datastream input = { ifp };
-  img.input = &input; //libraw_internal_data.internal_data.input;
+  img.input = ifp;
 
   // update sizes for the planes
   if (hdr.nPlanes == 4)
@@ -3364,20 +3361,8 @@ void DCraw::crxLoadRaw()
   uint8_t *hdrBuf = (uint8_t *)malloc(hdr.mdatHdrSize * 2);
 
   // read image header
-#ifdef LIBRAW_USE_OPENMP
-#pragma omp critical
-#endif
-  {
-#ifndef LIBRAW_USE_OPENMP
-    /*libraw_internal_data.internal_data.input->*/input.lock();
-#endif
-    /*libraw_internal_data.internal_data.input->*/input.seek(
-        data_offset, SEEK_SET);
-    /*libraw_internal_data.internal_data.input->*/input.read(hdrBuf, 1, hdr.mdatHdrSize);
-#ifndef LIBRAW_USE_OPENMP
-      /*libraw_internal_data.internal_data.input->*/input.unlock();
-#endif
-  }
+  fseek(ifp, data_offset, SEEK_SET);
+  fread(hdrBuf, 1, hdr.mdatHdrSize, ifp);
 
   // parse and setup the image data
   if (crxSetupImageData(&hdr, &img, (int16_t *)raw_image,
@@ -3389,6 +3374,9 @@ void DCraw::crxLoadRaw()
   free(hdrBuf);
 
   crxLoadDecodeLoop(&img, hdr.nPlanes);
+  // the tiles were read directly from memory, account for them in the
+  // progress bar
+  imfile_consume(ifp, hdr.MediaOffset + hdr.MediaSize);
 
   if (img.encType == 3)
     crxLoadFinalizeLoopE3(&img, img.planeHeight);
@@ -26,6 +26,7 @@
 /*RT*/#include <omp.h>
 /*RT*/#endif
 
+#include <atomic>
 #include <utility>
 #include <vector>
 #include "opthelper.h"
@@ -275,6 +276,10 @@ void CLASS merror (void *ptr, const char *where)
 }
 
 void CLASS derror()
+{
+#ifdef _OPENMP
+#pragma omp critical(dcraw_derror) // tiles can be decoded in parallel
+#endif
 {
   if (!data_error) {
     fprintf (stderr, "%s: ", ifname);
@@ -288,6 +293,7 @@ void CLASS derror()
 #endif
   }
   data_error++;
+}
 /*RT Issue 2467  longjmp (failure, 1);*/
 }
 
@@ -617,36 +623,6 @@ inline unsigned CLASS getbithuff_t::operator() (int nbits, ushort *huff)
 #define getbits(n) getbithuff(n,0)
 #define gethuff(h) getbithuff(*h,h+1)
 
-inline unsigned CLASS nikbithuff_t::operator() (int nbits, ushort *huff)
-{
-    unsigned c;
-
-    if (UNLIKELY(nbits == 0)) {
-        return 0;
-    }
-    if (vbits < nbits && LIKELY((c = fgetc(ifp)) != EOF)) {
-        bitbuf = (bitbuf << 8) | c;
-        vbits += 8;
-        if (vbits < nbits && LIKELY((c = fgetc(ifp)) != EOF)) {
-            bitbuf = (bitbuf << 8) | c;
-            vbits += 8;
-        }
-    }
-    c = bitbuf << (32-vbits) >> (32-nbits);
-    if (huff) {
-        vbits -= huff[c] >> 8;
-        c = (uchar) huff[c];
-        derror(vbits < 0);
-    } else {
-        vbits -= nbits;
-    }
-    return c;
-}
-
-#define nikinit(n) nikbithuff()
-#define nikbits(n) nikbithuff(n,0)
-#define nikhuff(h) nikbithuff(*h,h+1)
-
 /*
    Construct a decode tree according the specification in *source.
    The first 16 bytes specify how many codes should be 1-bit, 2-bit
@@ -845,6 +821,11 @@ struct jhead {
 };
 
 int CLASS ljpeg_start (struct jhead *jh, int info_only)
+{
+  return ljpeg_start (jh, info_only, ifp, zero_after_ff);
+}
+
+int CLASS ljpeg_start (struct jhead *jh, int info_only, IMFILE *ifp, unsigned &zero_after_ff)
 {
   ushort c, tag, len;
   uchar data[0x10000];
@@ -921,24 +902,47 @@ inline int CLASS ljpeg_diff (ushort *huff)
   return diff;
 }
 
+/* same as above, with the fast in-memory bit reader */
+inline int CLASS ljpeg_diff (ushort *huff, rtengine::BitReader &bits)
+{
+  int len, diff;
+
+  len = bits.huff(huff);
+  if (len == 16 && (!dng_version || dng_version >= 0x1010000))
+    return -32768;
+  diff = bits.get(len);
+  if ((diff & (1 << (len-1))) == 0)
+    diff -= (1 << len) - 1;
+  return diff;
+}
+
 ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
+{
+  return ljpeg_row (jrow, jh, ifp);
+}
+
+/*
+   The entropy-coded data is read directly from the in-memory file with
+   jh->reader (started at the current position of ifp at row 0), and ifp is
+   moved forward once per row, for progress reporting.
+ */
+ushort * CLASS ljpeg_row (int jrow, struct jhead *jh, IMFILE *ifp)
 {
   int col, c, diff, pred, spred=0;
-  ushort mark=0, *row[3];
+  ushort *row[3];
+  rtengine::BitReader &bits = jh->reader;
 
   if (jrow * jh->wide % jh->restart == 0) {
     FORC(6) jh->vpred[c] = 1 << (jh->bits-1);
-    if (jrow) {
-      fseek (ifp, -2, SEEK_CUR);
-      do mark = (mark << 8) + (c = fgetc(ifp));
-      while (c != EOF && mark >> 4 != 0xffd);
-    }
-    getbits(-1);
+    if (jrow)
+      bits.skip_to_restart_marker();
+    else
+      bits.init (fdata(0, ifp), ifp->size, ftell(ifp), true);
   }
   FORC3 row[c] = (jh->row + ((jrow & 1) + 1) * (jh->wide*jh->clrs*((jrow+c) & 1)));
   for (col=0; col < jh->wide; col++)
     FORC(jh->clrs) {
-      diff = ljpeg_diff (jh->huff[c]);
+      diff = ljpeg_diff (jh->huff[c], bits);
       if (jh->sraw && c <= jh->sraw && (col | c))
 		    pred = spred;
       else if (col) pred = row[0][-jh->clrs];
@@ -956,6 +960,8 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
       if (c <= jh->sraw) spred = **row;
       row[0]++; row[1]++;
     }
+  if (UNLIKELY(bits.overrun())) derror();
+  imfile_consume (ifp, bits.position());
   return row[2];
 }
 
@@ -1174,7 +1180,7 @@ void CLASS lossless_dnglj92_load_raw()
     }
 
 #ifdef _OPENMP
-    #pragma omp parallel for num_threads(std::min<int>(tileCount, omp_get_num_procs()))
+    #pragma omp parallel for num_threads(std::min<int>(tileCount, omp_get_max_threads()))
 #endif
     for (size_t t = 0; t < tileCount; ++t) {
         size_t tcol = t * tile_width;
@@ -1193,12 +1199,99 @@ void CLASS lossless_dnglj92_load_raw()
     }
 }
 
+/*
+   Decodes the lossless JPEG tiles of a DNG in parallel, each worker using its
+   own cursor and bit reader over the in-memory file. Returns false (without
+   decoding anything) if the image is not made of several lossless tiles, in
+   which case the sequential decoder must be used.
+ */
+bool CLASS lossless_dng_load_raw_parallel()
+{
+  if (tile_length >= INT_MAX || tile_width <= 0 || !ifp->data) return false;
+
+  const size_t tilesWide = (raw_width + tile_width - 1) / tile_width;
+  const size_t tilesHigh = (raw_height + tile_length - 1) / tile_length;
+  const size_t tileCount = tilesWide * tilesHigh;
+  if (tileCount < 2) return false;
+
+  const ssize_t save = ftell(ifp);
+  std::vector<ssize_t> tileOffsets(tileCount);
+  for (size_t t = 0; t < tileCount; ++t) {
+    tileOffsets[t] = get4();
+  }
+  fseek (ifp, save, SEEK_SET);
+
+  // only the lossless (0xc3) variant is handled here: the lossy one uses
+  // global state in ljpeg_idct()
+  for (size_t t = 0; t < tileCount; ++t) {
+    ljpeg_tile_reader reader(ifp, tileOffsets[t]);
+    struct jhead jh;
+    if (!ljpeg_start (&jh, 1, reader.ifp, reader.zero_after_ff) || jh.algo != 0xc3) {
+      return false;
+    }
+  }
+
+  // like the sequential decoder, stop at the first tile that can't be
+  // started (the remaining ones are skipped, as we can't break out of the
+  // parallel loop), and report the error
+  std::atomic<bool> failed(false);
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (size_t t = 0; t < tileCount; ++t) {
+    if (failed) continue;
+    const unsigned trow = (t / tilesWide) * tile_length;
+    const unsigned tcol = (t % tilesWide) * tile_width;
+    ljpeg_tile_reader reader(ifp, tileOffsets[t]);
+    struct jhead jh;
+    if (!ljpeg_start (&jh, 0, reader.ifp, reader.zero_after_ff)) {
+      failed = true;
+      continue;
+    }
+    unsigned jwide = jh.wide;
+    if (filters || (colors == 1 && jh.clrs > 1)) jwide *= jh.clrs;
+    jwide /= MIN (is_raw, tiff_samples);
+    unsigned row = 0, col = 0;
+    for (unsigned jrow=0; jrow < jh.high; jrow++) {
+      ushort *rp = ljpeg_row (jrow, &jh, reader.ifp);
+      for (unsigned jcol=0; jcol < jwide; jcol++) {
+        adobe_copy_pixel (trow+row, tcol+col, &rp);
+        if (++col >= tile_width || col >= raw_width)
+          row += 1 + (col = 0);
+      }
+    }
+    ljpeg_end (&jh);
+  }
+
+  if (failed) derror();
+
+  fseek (ifp, save + 4 * tileCount, SEEK_SET);
+  return true;
+}
+
+/*
+   Returns true if load_raw runs OpenMP parallel regions for the current
+   image, i.e. if it is worth giving it a share of the threads.
+ */
+bool CLASS has_parallel_decoder() const
+{
+  if (load_raw == &CLASS deflate_dng_load_raw ||
+      load_raw == &CLASS lossless_dnglj92_load_raw) return true;
+  if (load_raw == &CLASS lossless_dng_load_raw)
+    return tile_length < INT_MAX && tile_width > 0 &&
+      (raw_width > tile_width || raw_height > tile_length);
+  return false;
+}
+
 void CLASS lossless_dng_load_raw()
 {
   unsigned save, trow=0, tcol=0, jwide, jrow, jcol, row, col, i, j;
   struct jhead jh;
   ushort *rp;
 
+  if (lossless_dng_load_raw_parallel()) return;
+
   while (trow < raw_height) {
     save = ftell(ifp);
     if (tile_length < INT_MAX)
@@ -1357,7 +1450,8 @@ void CLASS nikon_load_raw()
 
     huff = make_decoder (nikon_tree[tree]);
     fseek (ifp, data_offset, SEEK_SET);
-    nikinit();
+    rtengine::BitReader bits;
+    bits.init(fdata(0, ifp), ifp->size, ftell(ifp), false);
     if (split) {
         for (int min = 0, row = 0; row < height; row++) {
             if (row == split) {
@@ -1366,10 +1460,10 @@ void CLASS nikon_load_raw()
                 max += (min = 16) << 1;
             }
             for (int col=0; col < raw_width; col++) {
-                int i = nikhuff(huff);
+                int i = bits.huff(huff);
                 int len = i & 15;
                 int shl = i >> 4;
-                int diff = ((nikbits(len-shl) << 1) + 1) << shl >> 1;
+                int diff = ((bits.get(len-shl) << 1) + 1) << shl >> 1;
                 if ((diff & (1 << (len-1))) == 0)
                     diff -= (1 << len) - !shl;
                 if (col < 2) hpred[col] = vpred[row & 1][col] += diff;
@@ -1377,12 +1471,14 @@ void CLASS nikon_load_raw()
                 derror((ushort)(hpred[col & 1] + min) >= max);
                 RAW(row,col) = curve[hpred[col & 1]];
             }
+            derror(bits.overrun());
+            imfile_consume(ifp, bits.position());
         }
     } else {
         for (int row=0; row < height; row++) {
             for (int col=0; col < 2; col++) {
-                int len = nikhuff(huff);
-                int diff = nikbits(len);
+                int len = bits.huff(huff);
+                int diff = bits.get(len);
                 if ((diff & (1 << (len-1))) == 0)
                     diff -= (1 << len) - 1;
                 hpred[col] = vpred[row & 1][col] += diff;
@@ -1390,18 +1486,19 @@ void CLASS nikon_load_raw()
                 RAW(row,col) = curve[hpred[col]];
             }
             for (int col=2; col < raw_width; col++) {
-                int len = nikhuff(huff);
-                int diff = nikbits(len);
+                int len = bits.huff(huff);
+                int diff = bits.get(len);
                 if ((diff & (1 << (len-1))) == 0)
                     diff -= (1 << len) - 1;
                 hpred[col & 1] += diff;
                 derror(hpred[col & 1] >= max);
                 RAW(row,col) = curve[hpred[col & 1]];
             }
+            derror(bits.overrun());
+            imfile_consume(ifp, bits.position());
         }
     }
     free (huff);
-    data_error += nikbithuff.errorCount();
     if(data_error) {
         std::cerr << ifname << " decoded with " << data_error << " errors. File possibly corrupted." << std::endl;
     }
@@ -10921,16 +11018,13 @@ void CLASS deflate_dng_load_raw() {
       tileOffsets[t] = get4();
     }
     size_t tileBytes[tileCount];
-    uLongf maxCompressed = 0;
     if (tileCount == 1) {
-      tileBytes[0] = maxCompressed = ifd->bytes;
+      tileBytes[0] = ifd->bytes;
     } else {
       fseek(ifp, ifd->bytes, SEEK_SET);
       for (size_t t = 0; t < tileCount; ++t) {
         tileBytes[t] = get4();
         //fprintf(stderr, "Tile %d at %d, size %d\n", t, tileOffsets[t], tileBytes[t]);
-        if (maxCompressed < tileBytes[t])
-          maxCompressed = tileBytes[t];
       }
     }
     uLongf dstLen = tile_width * tile_length * 4;
@@ -10939,7 +11033,6 @@ void CLASS deflate_dng_load_raw() {
 #pragma omp parallel
 #endif
 {
-    Bytef * cBuffer = new Bytef[maxCompressed];
     Bytef * uBuffer = new Bytef[dstLen];
 
 #ifdef _OPENMP
@@ -10948,14 +11041,13 @@ void CLASS deflate_dng_load_raw() {
     for (size_t y = 0; y < raw_height; y += tile_length) {
         for (size_t x = 0; x < raw_width; x += tile_width) {
             size_t t = (y / tile_length) * tilesWide + (x / tile_width);
-#ifdef _OPENMP
-            #pragma omp critical
-#endif
-            {
-                fseek(ifp, tileOffsets[t], SEEK_SET);
-                fread(cBuffer, 1, tileBytes[t], ifp);
+            // the file is in memory: inflate the tiles directly from there,
+            // so that workers don't have to serialize on the shared cursor
+            int err = Z_DATA_ERROR;
+            if (tileOffsets[t] <= size_t(ifp->size)) {
+                const size_t srcLen = std::min<size_t>(tileBytes[t], ifp->size - tileOffsets[t]);
+                err = decompress(srcLen, dstLen, fdata(tileOffsets[t], ifp), uBuffer);
             }
-            int err = decompress(tileBytes[t], dstLen, cBuffer, uBuffer);
             if (err != Z_OK) {
                 fprintf(stderr, "DNG Deflate: Failed uncompressing tile %d, with error %d\n", (int)t, err);
             } else if (ifd->sample_format == 3) {  // Floating point data
@@ -10976,7 +11068,6 @@ void CLASS deflate_dng_load_raw() {
         }
     }
 
-    delete [] cBuffer;
     delete [] uBuffer;
 }
   }
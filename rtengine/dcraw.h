@@ -21,6 +21,7 @@
 #define DCRAW_H
 
 #include "myfile.h"
+#include "bitreader.h"
 #include <csetjmp>
 
 
@@ -64,7 +65,6 @@ public:
     ,RT_OpcodeList2_start(-1)
     ,RT_OpcodeList2_len(0)
 	,getbithuff(this,ifp,zero_after_ff)
-	,nikbithuff(ifp)
     {
         shrink=0;
         memset(&hbd, 0, sizeof(hbd));
@@ -263,6 +263,7 @@ protected:
     struct jhead {
       int algo, bits, high, wide, clrs, sraw, psv, restart, vpred[6];
       ushort quant[64], idct[64], *huff[20], *free[20], *row;
+      rtengine::BitReader reader; // used by ljpeg_row
     };
 
     struct tiff_tag {
@@ -330,25 +331,23 @@ private:
 };
 getbithuff_t getbithuff;
 
-class nikbithuff_t
+// private file cursor over the (in-memory) input file, used to decode
+// independent lossless JPEG tiles in parallel
+class ljpeg_tile_reader
 {
 public:
-   explicit nikbithuff_t(IMFILE *&i):bitbuf(0),errors(0),vbits(0),ifp(i){}
-   void operator()() {bitbuf = vbits = 0;};
-   unsigned operator()(int nbits, ushort *huff);
-   unsigned errorCount() { return errors; }
-private:
-   inline bool derror(bool condition){
-       if (UNLIKELY(condition)) {
-           ++errors;
-       }
-	   return condition;
+   ljpeg_tile_reader(const IMFILE *src, ssize_t offset):
+       file(*src), ifp(&file), zero_after_ff(0)
+   {
+       file.plistener = nullptr;
+       file.eof = false;
+       fseek(ifp, offset, SEEK_SET);
    }
-   unsigned bitbuf, errors;
-   int vbits;
-   IMFILE *&ifp;
+
+   IMFILE file;
+   IMFILE *ifp;
+   unsigned zero_after_ff;
 };
-nikbithuff_t nikbithuff;
 
 ushort * make_decoder_ref (const uchar **source);
 ushort * make_decoder (const uchar *source);
@@ -356,9 +355,12 @@ void crw_init_tables (unsigned table, ushort *huff[2]);
 int canon_has_lowbits();
 void canon_load_raw();
 int ljpeg_start (struct jhead *jh, int info_only);
+int ljpeg_start (struct jhead *jh, int info_only, IMFILE *ifp, unsigned &zero_after_ff);
 void ljpeg_end (struct jhead *jh);
 int ljpeg_diff (ushort *huff);
+int ljpeg_diff (ushort *huff, rtengine::BitReader &bits);
 ushort * ljpeg_row (int jrow, struct jhead *jh);
+ushort * ljpeg_row (int jrow, struct jhead *jh, IMFILE *ifp);
 void lossless_jpeg_load_raw();
 void ljpeg_idct (struct jhead *jh);
 
@@ -366,6 +368,8 @@ void ljpeg_idct (struct jhead *jh);
 void canon_sraw_load_raw();
 void adobe_copy_pixel (unsigned row, unsigned col, ushort **rp);
 void lossless_dng_load_raw();
+bool lossless_dng_load_raw_parallel();
+bool has_parallel_decoder() const;
 void lossless_dnglj92_load_raw();
 void packed_dng_load_raw();
 void deflate_dng_load_raw();
@@ -621,7 +625,7 @@ void selectCRXTrack(short maxTrack);
 int parseCR3(unsigned long long oAtomList,
              unsigned long long szAtomList, short &nesting,
              char *AtomNameStack, short &nTrack, short &TrackType);
-int crxDecodePlane(void *p, uint32_t planeNumber);
+int crxDecodeTile(void *p, int tileNumber, uint32_t planeNumber);
 void crxLoadDecodeLoop(void *img, int nPlanes);
 void crxConvertPlaneLineDf(void *p, int imageRow);
 void crxLoadFinalizeLoopE3(void *p, int planeHeight);
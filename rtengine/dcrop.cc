@@ -326,6 +326,11 @@ void Crop::update(int todo)
 
         if (need_drcomp) {
             pipeline_stop_[0] = parent->ipf.process(ImProcFunctions::Pipeline::PREVIEW, ImProcFunctions::Stage::STAGE_0, f);
+            if (parent->ipf.cancelled() && f == parent->drcomp_11_dcrop_cache) {
+                // don't keep a partially processed image in the cache
+                parent->drcomp_11_dcrop_cache = nullptr;
+                drCompCrop.reset(f);
+            }
         }
         stop = pipeline_stop_[0];
 
@@ -402,6 +407,11 @@ void Crop::update(int todo)
     }
     stop = stop || pipeline_stop_[3];
 
+    if (parent->ipf.cancelled()) {
+        // stale update, a new one is pending
+        return;
+    }
+
     // all pipette buffer processing should be finished now
     PipetteBuffer::setReady();
 
@@ -686,8 +696,10 @@ bool Crop::tryUpdate()
     bool needsNewThread = true;
 
     if (updating) {
-        // tells to the updater thread that a new update is pending
+        // tells to the updater thread that a new update is pending, and
+        // interrupts the current one
         newUpdatePending = true;
+        cancel_token_.cancel();
         // no need for a new thread, the current one will do the job
         needsNewThread = false;
     } else {
@@ -733,7 +745,12 @@ void Crop::fullUpdate()
     }
     while (newUpdatePending) {
         newUpdatePending = false;
+        cancel_token_.reset();
+        // if the update is cancelled, newUpdatePending is set and the loop
+        // runs it again
+        parent->ipf.setCancellationToken(&cancel_token_);
         update(ALL);
+        parent->ipf.setCancellationToken(nullptr);
     }
     if (parent->tweakOperator) {
         parent->restoreParams();
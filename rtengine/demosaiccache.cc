@@ -0,0 +1,306 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "demosaiccache.h"
+#include "halffloat.h"
+#include "settings.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <glibmm.h>
+#include <glib/gstdio.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace rtengine {
+
+extern const Settings *settings;
+
+namespace demosaic_cache {
+
+namespace {
+
+const char *const MAGIC = "ARTD1\n";
+constexpr size_t MAGIC_SIZE = 6;
+constexpr size_t KEY_SIZE = 32;
+constexpr size_t HEADER_SIZE = MAGIC_SIZE + KEY_SIZE + 2 * sizeof(guint32) + sizeof(double);
+const char *const EXTENSION = ".artd";
+
+std::mutex store_mutex;
+std::atomic<int> pending_stores(0);
+
+
+Glib::ustring get_fname(const std::string &key)
+{
+    return Glib::build_filename(settings->demosaic_cache_dir, key + EXTENSION);
+}
+
+
+// removes the least recently used entries until the total size of the cache
+// is at most limit bytes
+void evict(size_t limit)
+{
+    struct Entry {
+        std::string fname;
+        size_t size;
+        time_t mtime;
+    };
+    std::vector<Entry> entries;
+    size_t total = 0;
+
+    try {
+        Glib::Dir dir(settings->demosaic_cache_dir);
+        for (const auto &name : dir) {
+            if (name.size() <= std::strlen(EXTENSION) || name.compare(name.size() - std::strlen(EXTENSION), std::string::npos, EXTENSION) != 0) {
+                continue;
+            }
+            auto fname = Glib::build_filename(settings->demosaic_cache_dir, name);
+            GStatBuf st;
+            if (g_stat(fname.c_str(), &st) == 0) {
+                entries.push_back({fname, size_t(st.st_size), st.st_mtime});
+                total += st.st_size;
+            }
+        }
+    } catch (Glib::FileError &) {
+        return;
+    }
+
+    if (total <= limit) {
+        return;
+    }
+
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) -> bool
+              {
+                  return a.mtime < b.mtime;
+              });
+    for (const auto &e : entries) {
+        if (total <= limit) {
+            break;
+        }
+        if (g_remove(e.fname.c_str()) == 0) {
+            total -= e.size;
+            if (settings->verbose > 1) {
+                std::cout << "demosaic cache: removed " << e.fname << std::endl;
+            }
+        }
+    }
+}
+
+
+// writes the header and the already converted planes of an entry, after
+// making room for it in the cache
+bool write_entry(const std::string &key, int W, int H, double contrastThreshold, const std::vector<uint16_t> &data, size_t evict_limit)
+{
+    std::lock_guard<std::mutex> lock(store_mutex);
+
+    g_mkdir_with_parents(settings->demosaic_cache_dir.c_str(), 0777);
+    evict(evict_limit);
+
+    const Glib::ustring fname = get_fname(key);
+    const Glib::ustring tmpname = fname + ".tmp";
+    FILE *f = g_fopen(tmpname.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    bool ok = true;
+    {
+        const guint32 w = W, h = H;
+        std::string header;
+        header.reserve(HEADER_SIZE);
+        header.append(MAGIC, MAGIC_SIZE);
+        header.append(key);
+        header.append(reinterpret_cast<const char *>(&w), sizeof(guint32));
+        header.append(reinterpret_cast<const char *>(&h), sizeof(guint32));
+        header.append(reinterpret_cast<const char *>(&contrastThreshold), sizeof(double));
+        ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    }
+
+    ok = ok && fwrite(data.data(), sizeof(uint16_t), data.size(), f) == data.size();
+    ok = (fclose(f) == 0) && ok;
+
+#ifdef WIN32
+    g_remove(fname.c_str());
+#endif
+    if (!ok || g_rename(tmpname.c_str(), fname.c_str()) != 0) {
+        g_remove(tmpname.c_str());
+        if (settings->verbose) {
+            std::cerr << "demosaic cache: failed to save " << fname << std::endl;
+        }
+        return false;
+    }
+
+    if (settings->verbose) {
+        std::cout << "demosaic cache: saved " << fname << std::endl;
+    }
+    return true;
+}
+
+} // namespace
+
+
+bool enabled()
+{
+    return settings->demosaic_cache_size > 0 && !settings->demosaic_cache_dir.empty();
+}
+
+
+bool load(const std::string &key, int W, int H, array2D<float> &red, array2D<float> &green, array2D<float> &blue, double &contrastThreshold)
+{
+    if (!enabled() || key.size() != KEY_SIZE) {
+        return false;
+    }
+
+    const Glib::ustring fname = get_fname(key);
+    if (!Glib::file_test(fname, Glib::FILE_TEST_EXISTS)) {
+        return false;
+    }
+
+    GError *err = nullptr;
+    GMappedFile *mf = g_mapped_file_new(fname.c_str(), FALSE, &err);
+    if (!mf) {
+        if (err) {
+            g_error_free(err);
+        }
+        return false;
+    }
+
+    const char *data = g_mapped_file_get_contents(mf);
+    const size_t size = g_mapped_file_get_length(mf);
+    const size_t plane_size = size_t(W) * H;
+
+    bool ok = size == HEADER_SIZE + 3 * plane_size * sizeof(uint16_t)
+        && memcmp(data, MAGIC, MAGIC_SIZE) == 0
+        && memcmp(data + MAGIC_SIZE, key.c_str(), KEY_SIZE) == 0;
+    if (ok) {
+        data += MAGIC_SIZE + KEY_SIZE;
+        guint32 w = 0, h = 0;
+        memcpy(&w, data, sizeof(guint32));
+        data += sizeof(guint32);
+        memcpy(&h, data, sizeof(guint32));
+        data += sizeof(guint32);
+        ok = (w == guint32(W) && h == guint32(H));
+        memcpy(&contrastThreshold, data, sizeof(double));
+        data += sizeof(double);
+    }
+
+    if (ok) {
+        array2D<float> *planes[3] = { &red, &green, &blue };
+        for (int c = 0; c < 3; ++c) {
+            array2D<float> &dst = *planes[c];
+            dst(W, H);
+            const char *src = data + c * plane_size * sizeof(uint16_t);
+#ifdef _OPENMP
+#           pragma omp parallel for
+#endif
+            for (int y = 0; y < H; ++y) {
+                const char *in = src + size_t(y) * W * sizeof(uint16_t);
+                float *out = dst[y];
+                for (int x = 0; x < W; ++x) {
+                    uint16_t v;
+                    memcpy(&v, in + x * sizeof(uint16_t), sizeof(uint16_t));
+                    out[x] = DNG_HalfToFloat(v) * 65535.f;
+                }
+            }
+        }
+    }
+
+    g_mapped_file_unref(mf);
+
+    if (ok) {
+        // mark the entry as recently used
+        g_utime(fname.c_str(), nullptr);
+        if (settings->verbose) {
+            std::cout << "demosaic cache: loaded " << fname << std::endl;
+        }
+    }
+
+    return ok;
+}
+
+
+bool store(const std::string &key, int W, int H, const array2D<float> &red, const array2D<float> &green, const array2D<float> &blue, double contrastThreshold)
+{
+    if (!enabled() || key.size() != KEY_SIZE) {
+        return false;
+    }
+
+    const size_t limit = size_t(settings->demosaic_cache_size) << 20;
+    const size_t plane_size = size_t(W) * H;
+    const size_t entry_size = HEADER_SIZE + 3 * plane_size * sizeof(uint16_t);
+    if (entry_size > limit) {
+        return false;
+    }
+
+    // don't pile up copies of the planes if the disk is slow
+    int expected = 0;
+    if (!pending_stores.compare_exchange_strong(expected, 1)) {
+        return false;
+    }
+
+    std::shared_ptr<std::vector<uint16_t>> buf;
+    try {
+        buf = std::make_shared<std::vector<uint16_t>>(3 * plane_size);
+    } catch (std::bad_alloc &) {
+        pending_stores = 0;
+        return false;
+    }
+
+    const array2D<float> *planes[3] = { &red, &green, &blue };
+    for (int c = 0; c < 3; ++c) {
+        const array2D<float> &src = *planes[c];
+        uint16_t *dst = buf->data() + c * plane_size;
+#ifdef _OPENMP
+#       pragma omp parallel for
+#endif
+        for (int y = 0; y < H; ++y) {
+            const float *in = src[y];
+            uint16_t *out = dst + size_t(y) * W;
+            for (int x = 0; x < W; ++x) {
+                out[x] = DNG_FloatToHalf(in[x] / 65535.f);
+            }
+        }
+    }
+
+    const auto write =
+        [=]() -> void
+        {
+            write_entry(key, W, H, contrastThreshold, *buf, limit - entry_size);
+            pending_stores = 0;
+        };
+
+    try {
+        ThreadPool::add_task(ThreadPool::Priority::LOWEST, write);
+    } catch (std::exception &) {
+        pending_stores = 0;
+        return false;
+    }
+    return true;
+}
+
+}} // namespace rtengine::demosaic_cache
@@ -0,0 +1,61 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "array2D.h"
+#include <string>
+
+namespace rtengine { namespace demosaic_cache {
+
+/******************************************************************************
+ * On-disk cache of demosaiced red/green/blue planes, so that reopening an
+ * image in the editor does not need to demosaic it again.
+ *
+ * Entries are stored in Settings::demosaic_cache_dir, one file per key (an
+ * MD5 digest of the file identity, of the parameters affecting the
+ * demosaiced data and of VERSION, see RawImageSource::demosaic). File
+ * format:
+ *
+ * "ARTD1\n" header
+ * key (32 bytes)
+ * width, height (guint32)
+ * dual demosaic contrast threshold (double)
+ * red, green and blue planes, as half floats scaled by 1/65535
+ *
+ * The total size of the cache is bounded by Settings::demosaic_cache_size
+ * (in MB, 0 disables the cache); when a new entry exceeds it, the least
+ * recently used entries are removed. All the functions are thread-safe.
+ *
+ * store() only converts the planes: the eviction and the writing of the file
+ * are done in the background on the ThreadPool, so that the caller (e.g. the
+ * preview update thread) doesn't wait for the disk. If a previous entry is
+ * still being written, the new one is not stored.
+ ******************************************************************************/
+
+// part of the cache key. Bump it whenever the file format or the output of
+// the demosaicers changes, so that stale entries are never used
+constexpr int VERSION = 2;
+
+bool enabled();
+
+bool load(const std::string &key, int W, int H, array2D<float> &red, array2D<float> &green, array2D<float> &blue, double &contrastThreshold);
+
+bool store(const std::string &key, int W, int H, const array2D<float> &red, const array2D<float> &green, const array2D<float> &blue, double contrastThreshold);
+
+}} // namespace rtengine::demosaic_cache
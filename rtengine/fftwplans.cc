@@ -0,0 +1,300 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fftwplans.h"
+
+#include <map>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+
+#include <glibmm.h>
+#include <glib/gstdio.h>
+
+namespace rtengine { namespace fftw {
+
+namespace {
+
+enum class Op {
+    R2R_2D,
+    MANY_R2R_2D,
+    R2C_2D,
+    C2R_2D
+};
+
+// upper bound for the SIMD alignment used by FFTW
+constexpr size_t MAX_ALIGNMENT = 64;
+
+// maximum number of cached plans. When the cache is full, the least recently
+// used plan is destroyed. This must be (much) larger than the number of plans
+// a caller uses while holding fftwMutex, so that a plan is never evicted
+// before its user is done with it
+constexpr size_t MAX_PLANS = 64;
+
+
+class PlanCache {
+public:
+    static PlanCache &get()
+    {
+        static PlanCache instance;
+        return instance;
+    }
+
+    void init(const Glib::ustring &wisdom_file, int verbose)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        wisdom_file_ = wisdom_file;
+        verbose_ = verbose;
+
+#ifdef RT_FFTW3F_OMP
+        fftwf_init_threads();
+#endif
+
+        if (!wisdom_file_.empty()) {
+            FILE *f = g_fopen(wisdom_file_.c_str(), "r");
+            if (f) {
+                bool ok = fftwf_import_wisdom_from_file(f);
+                fclose(f);
+                if (verbose_) {
+                    std::cout << "FFTW wisdom " << (ok ? "loaded from " : "could not be loaded from ") << wisdom_file_ << std::endl;
+                }
+            }
+        }
+    }
+
+    void cleanup()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (verbose_ && (num_created_ || num_reused_)) {
+            std::cout << "FFTW plan cache: " << num_created_ << " plans created in "
+                      << planning_time_ << " ms, " << num_reused_ << " reused (saving "
+                      << saved_time_ << " ms of planning)" << std::endl;
+        }
+
+        for (auto &p : plans_) {
+            fftwf_destroy_plan(p.second.plan);
+        }
+        plans_.clear();
+
+        if (!wisdom_file_.empty() && num_created_) {
+            save_wisdom();
+        }
+    }
+
+    template <class Make>
+    fftwf_plan plan(std::vector<int> key, unsigned flags, int nthreads,
+                    void *in, size_t in_bytes, void *out, size_t out_bytes,
+                    Make make)
+    {
+#ifndef RT_FFTW3F_OMP
+        nthreads = 1;
+#endif
+        const bool in_place = (in == out);
+        const int in_align = fftwf_alignment_of(static_cast<float *>(in));
+        const int out_align = in_place ? -1 : fftwf_alignment_of(static_cast<float *>(out));
+
+        key.push_back(flags);
+        key.push_back(nthreads);
+        key.push_back(in_align);
+        key.push_back(out_align);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = plans_.find(key);
+        if (it != plans_.end()) {
+            ++num_reused_;
+            saved_time_ += it->second.time;
+            it->second.last_use = ++tick_;
+            return it->second.plan;
+        }
+
+        while (plans_.size() >= MAX_PLANS) {
+            evict_lru();
+        }
+
+        // plan on scratch arrays with the same alignment as the given ones
+        char *in_buf = static_cast<char *>(fftwf_malloc(in_bytes + MAX_ALIGNMENT));
+        char *out_buf = in_place ? in_buf : static_cast<char *>(fftwf_malloc(out_bytes + MAX_ALIGNMENT));
+        if (!in_buf || !out_buf) {
+            fftwf_free(in_buf);
+            if (!in_place) {
+                fftwf_free(out_buf);
+            }
+            return nullptr;
+        }
+
+#ifdef RT_FFTW3F_OMP
+        fftwf_plan_with_nthreads(nthreads);
+#endif
+
+        const auto start = std::chrono::steady_clock::now();
+        fftwf_plan p = make(in_buf + in_align, out_buf + (in_place ? in_align : out_align));
+        const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        fftwf_free(in_buf);
+        if (!in_place) {
+            fftwf_free(out_buf);
+        }
+
+        if (p) {
+            plans_[key] = Plan{p, elapsed, ++tick_};
+            ++num_created_;
+            planning_time_ += elapsed;
+            if (verbose_ > 1) {
+                std::cout << "FFTW plan " << int(key[0]) << " created in " << elapsed << " ms" << std::endl;
+            }
+        }
+
+        return p;
+    }
+
+private:
+    struct Plan {
+        fftwf_plan plan;
+        double time; // ms spent creating the plan
+        size_t last_use;
+    };
+
+    PlanCache():
+        tick_(0),
+        verbose_(0),
+        num_created_(0),
+        num_reused_(0),
+        planning_time_(0),
+        saved_time_(0)
+    {
+    }
+
+    void evict_lru()
+    {
+        auto lru = plans_.begin();
+        for (auto it = plans_.begin(); it != plans_.end(); ++it) {
+            if (it->second.last_use < lru->second.last_use) {
+                lru = it;
+            }
+        }
+        if (verbose_ > 1) {
+            std::cout << "FFTW plan " << int(lru->first[0]) << " evicted" << std::endl;
+        }
+        fftwf_destroy_plan(lru->second.plan);
+        plans_.erase(lru);
+    }
+
+    void save_wisdom()
+    {
+        g_mkdir_with_parents(Glib::path_get_dirname(wisdom_file_).c_str(), 0777);
+
+        const Glib::ustring tmpname = wisdom_file_ + ".tmp";
+        FILE *f = g_fopen(tmpname.c_str(), "w");
+        if (!f) {
+            return;
+        }
+        fftwf_export_wisdom_to_file(f);
+        const bool ok = (fclose(f) == 0);
+
+#ifdef WIN32
+        g_remove(wisdom_file_.c_str());
+#endif
+        if (!ok || g_rename(tmpname.c_str(), wisdom_file_.c_str()) != 0) {
+            g_remove(tmpname.c_str());
+            if (verbose_) {
+                std::cerr << "failed to save FFTW wisdom to " << wisdom_file_ << std::endl;
+            }
+        }
+    }
+
+    std::mutex mutex_;
+    std::map<std::vector<int>, Plan> plans_;
+    size_t tick_;
+    Glib::ustring wisdom_file_;
+    int verbose_;
+    size_t num_created_;
+    size_t num_reused_;
+    double planning_time_;
+    double saved_time_;
+};
+
+} // namespace
+
+
+void init(const Glib::ustring &wisdom_file, int verbose)
+{
+    PlanCache::get().init(wisdom_file, verbose);
+}
+
+
+void cleanup()
+{
+    PlanCache::get().cleanup();
+}
+
+
+fftwf_plan plan_r2r_2d(int n0, int n1, float *in, float *out, fftwf_r2r_kind kind0, fftwf_r2r_kind kind1, unsigned flags, int nthreads)
+{
+    const size_t sz = sizeof(float) * n0 * n1;
+    return PlanCache::get().plan(
+        {int(Op::R2R_2D), n0, n1, int(kind0), int(kind1)}, flags, nthreads,
+        in, sz, out, sz,
+        [&](char *i, char *o) -> fftwf_plan
+        {
+            return fftwf_plan_r2r_2d(n0, n1, reinterpret_cast<float *>(i), reinterpret_cast<float *>(o), kind0, kind1, flags);
+        });
+}
+
+
+fftwf_plan plan_many_r2r_2d(int n0, int n1, int howmany, int dist, float *in, float *out, const fftwf_r2r_kind *kind, unsigned flags, int nthreads)
+{
+    const size_t sz = sizeof(float) * howmany * dist;
+    return PlanCache::get().plan(
+        {int(Op::MANY_R2R_2D), n0, n1, howmany, dist, int(kind[0]), int(kind[1])}, flags, nthreads,
+        in, sz, out, sz,
+        [&](char *i, char *o) -> fftwf_plan
+        {
+            const int n[2] = {n0, n1};
+            return fftwf_plan_many_r2r(2, n, howmany, reinterpret_cast<float *>(i), nullptr, 1, dist, reinterpret_cast<float *>(o), nullptr, 1, dist, kind, flags);
+        });
+}
+
+
+fftwf_plan plan_dft_r2c_2d(int n0, int n1, float *in, fftwf_complex *out, unsigned flags, int nthreads)
+{
+    return PlanCache::get().plan(
+        {int(Op::R2C_2D), n0, n1}, flags, nthreads,
+        in, sizeof(float) * n0 * n1, out, sizeof(fftwf_complex) * n0 * (n1 / 2 + 1),
+        [&](char *i, char *o) -> fftwf_plan
+        {
+            return fftwf_plan_dft_r2c_2d(n0, n1, reinterpret_cast<float *>(i), reinterpret_cast<fftwf_complex *>(o), flags);
+        });
+}
+
+
+fftwf_plan plan_dft_c2r_2d(int n0, int n1, fftwf_complex *in, float *out, unsigned flags, int nthreads)
+{
+    return PlanCache::get().plan(
+        {int(Op::C2R_2D), n0, n1}, flags, nthreads,
+        in, sizeof(fftwf_complex) * n0 * (n1 / 2 + 1), out, sizeof(float) * n0 * n1,
+        [&](char *i, char *o) -> fftwf_plan
+        {
+            return fftwf_plan_dft_c2r_2d(n0, n1, reinterpret_cast<fftwf_complex *>(i), reinterpret_cast<float *>(o), flags);
+        });
+}
+
+}} // namespace rtengine::fftw
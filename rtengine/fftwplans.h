@@ -0,0 +1,59 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <fftw3.h>
+#include <glibmm/ustring.h>
+
+namespace rtengine { namespace fftw {
+
+/******************************************************************************
+ * Process-wide cache of FFTW plans, keyed by transform kind and size.
+ *
+ * The plans are created on scratch arrays with the same alignment and
+ * in-place-ness as the given ones (so that planning with FFTW_MEASURE does
+ * not clobber the caller's data), and they must be executed with the
+ * new-array execute functions (fftwf_execute_r2r, fftwf_execute_dft_r2c,
+ * fftwf_execute_dft_c2r). The returned plans are owned by the cache and must
+ * not be destroyed. The cache keeps a bounded number of plans and destroys
+ * the least recently used ones, so the plan_* functions must be called with
+ * fftwMutex held, and the returned plans are valid only until the mutex is
+ * released: callers that run several transforms must look the plans up
+ * again (which is cheap) every time they take the mutex.
+ *
+ * nthreads is the number of threads the plan will use (only meaningful when
+ * FFTW is built with threads support).
+ *
+ * The FFTW wisdom accumulated during a session is saved at cleanup and
+ * loaded again at init, so that expensive plans are computed only once.
+ ******************************************************************************/
+
+void init(const Glib::ustring &wisdom_file, int verbose);
+void cleanup();
+
+fftwf_plan plan_r2r_2d(int n0, int n1, float *in, float *out, fftwf_r2r_kind kind0, fftwf_r2r_kind kind1, unsigned flags, int nthreads=1);
+
+// howmany n0 x n1 transforms, with contiguous data and distance dist
+// between consecutive transforms
+fftwf_plan plan_many_r2r_2d(int n0, int n1, int howmany, int dist, float *in, float *out, const fftwf_r2r_kind *kind, unsigned flags, int nthreads=1);
+
+fftwf_plan plan_dft_r2c_2d(int n0, int n1, float *in, fftwf_complex *out, unsigned flags, int nthreads=1);
+fftwf_plan plan_dft_c2r_2d(int n0, int n1, fftwf_complex *in, float *out, unsigned flags, int nthreads=1);
+
+}} // namespace rtengine::fftw
@@ -53,9 +53,7 @@ namespace rtengine {
 #endif
 
 
-namespace {
-
-int calculate_subsampling(int w, int h, int r)
+int guidedFilterSubsampling(int w, int h, int r)
 {
     if (r == 1) {
         return 1;
@@ -74,17 +72,15 @@ int calculate_subsampling(int w, int h, int r)
     return LIM(r / 2, 2, 4);
 }
 
-} // namespace
-
 
-void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling)
+void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling, const CancellationToken *cancel)
 {
 
     const int W = src.width();
     const int H = src.height();
 
     if (subsampling <= 0) {
-        subsampling = calculate_subsampling(W, H, r);
+        subsampling = guidedFilterSubsampling(W, H, r);
     }
 
     enum Op { MUL, DIVEPSILON, ADD, SUB, ADDMUL, SUBMUL };
@@ -99,6 +95,9 @@ void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2
             #pragma omp parallel for if (multithread)
 #endif
             for (int y = 0; y < h; ++y) {
+                if (is_cancelled(cancel)) {
+                    continue;
+                }
                 for (int x = 0; x < w; ++x) {
                     float r;
                     float aa = a[y][x];
@@ -160,8 +159,11 @@ void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2
     const size_t h = H / subsampling;
 
     const auto f_mean =
-        [multithread](array2D<float> &d, array2D<float> &s, int rad) -> void
+        [multithread, cancel](array2D<float> &d, array2D<float> &s, int rad) -> void
         {
+            if (is_cancelled(cancel)) {
+                return;
+            }
             rad = LIM(rad, 0, (min(s.width(), s.height()) - 1) / 2 - 1);
             boxblur(s, d, rad, s.width(), s.height(), multithread);
         };
@@ -233,6 +235,9 @@ void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2
 #   pragma omp parallel for if (multithread)
 #endif
     for (int y = 0; y < Hd; ++y) {
+        if (is_cancelled(cancel)) {
+            continue;
+        }
         float ymrs = y * row_scale; 
         for (int x = 0; x < Wd; ++x) {
             q[y][x] = getBilinearValue(meana, x * col_scale, ymrs) * I[y][x] + getBilinearValue(meanb, x * col_scale, ymrs);
@@ -241,7 +246,7 @@ void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2
 }
 
 
-void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling)
+void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling, const CancellationToken *cancel)
 {
 #ifdef _OPENMP
 #    pragma omp parallel for if (multithread)
@@ -252,7 +257,10 @@ void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &ch
         }
     }
 
-    guidedFilter(guide, chan, chan, r, eps, multithread, subsampling);
+    guidedFilter(guide, chan, chan, r, eps, multithread, subsampling, cancel);
+    if (is_cancelled(cancel)) {
+        return;
+    }
 
 #ifdef _OPENMP
 #    pragma omp parallel for if (multithread)
@@ -265,9 +273,9 @@ void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &ch
 }
 
 
-void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling)
+void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling, const CancellationToken *cancel)
 {
-    guidedFilterLog(chan, base, chan, r, eps, multithread, subsampling);
+    guidedFilterLog(chan, base, chan, r, eps, multithread, subsampling, cancel);
 }
 
 } // namespace rtengine
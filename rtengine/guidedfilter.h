@@ -21,13 +21,21 @@
 #pragma once
 
 #include "array2D.h"
+#include "cancellation.h"
 
 namespace rtengine {
 
-void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling=0);
+// if cancel is given, it is polled per row, and the filter returns early
+// (with unspecified output) when it is cancelled
+void guidedFilter(const array2D<float> &guide, const array2D<float> &src, array2D<float> &dst, int r, float epsilon, bool multithread, int subsampling=0, const CancellationToken *cancel=nullptr);
 
-void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0);
+// the subsampling factor used by guidedFilter() for a w x h image and
+// radius r, when none is given. The filter runs on a grid of (w / s) x (h / s)
+// points, so it is aligned with the image only if w and h are multiples of s
+int guidedFilterSubsampling(int w, int h, int r);
 
-void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0);
+void guidedFilterLog(float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0, const CancellationToken *cancel=nullptr);
+
+void guidedFilterLog(const array2D<float> &guide, float base, array2D<float> &chan, int r, float eps, bool multithread, int subsampling=0, const CancellationToken *cancel=nullptr);
 
 } // namespace rtengine
@@ -0,0 +1,86 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "LUT3D.h"
+#include "LUT.h"
+#include <glibmm/ustring.h>
+#include <lcms2.h>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace rtengine {
+
+/******************************************************************************
+ * An lcms RGB to RGB transform (TYPE_RGB_FLT in and out) baked into a 3D LUT,
+ * applied with tetrahedral interpolation directly on planar data.
+ *
+ * The LUT works in a shaper space. When both profiles are matrix-shaper ones
+ * and the transform between their linear values is affine (checked on the
+ * grid), the input TRCs are undone, the LUT stores linear values and the
+ * output TRCs are applied after the interpolation, so that the LUT reproduces
+ * the matrix exactly. Otherwise the LUT stores the output of the transform;
+ * if the input profile is a matrix-shaper one, the grid is uniform in a 1/2.4
+ * power of its linear values, else in the input values. Pixels outside the
+ * [0, 65535] range covered by the grid, and pixels in grid cells crossing the
+ * gamut boundary, are converted with the transform itself.
+ *
+ * LUTs are shared through a process-wide cache (see get()), so that they are
+ * computed only once per combination of profiles and intents.
+ ******************************************************************************/
+
+class ICCLut {
+public:
+    // grid sizes for the preview and for the output. See the measurements in
+    // icclut.cc
+    static constexpr int PREVIEW_SIZE = 33;
+    static constexpr int OUTPUT_SIZE = 65;
+
+    // xform must convert from iprof to oprof (possibly through a proofing
+    // profile)
+    ICCLut(cmsHTRANSFORM xform, cmsHPROFILE iprof, cmsHPROFILE oprof, int dim);
+    ~ICCLut();
+
+    // converts n pixels from r, g, b (in [0, 65535]) to ro, go, bo (in
+    // [0, 1]). The output can alias the input. xform must be the transform
+    // used to compute the LUT, or an equivalent one
+    void operator()(cmsHTRANSFORM xform, const float *r, const float *g, const float *b, float *ro, float *go, float *bo, int n) const;
+
+    // returns the LUT for key, computing it from xform if it is not in the
+    // cache. key must identify the profiles, intents and flags of xform; a
+    // digest of the contents of iprof and oprof is added to it
+    static std::shared_ptr<const ICCLut> get(const Glib::ustring &key, cmsHTRANSFORM xform, cmsHPROFILE iprof, cmsHPROFILE oprof, int dim);
+
+private:
+    ICCLut(const ICCLut &) = delete;
+    ICCLut &operator=(const ICCLut &) = delete;
+
+    LUT3D lut_;
+    // per grid cell, whether it is close to the gamut boundary
+    std::vector<uint8_t> boundary_;
+    // input value -> grid coordinate, per channel
+    LUTf shaper_[3];
+    // square root of linear output -> output value, per channel
+    LUTf trc_[3];
+    // linear output -> output value, for values outside [0, 1]
+    cmsToneCurve *trc_curve_[3];
+};
+
+} // namespace rtengine
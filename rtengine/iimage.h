@@ -22,6 +22,8 @@
 
 #include <glibmm.h>
 #include <vector>
+#include <string>
+#include <cstring>
 #include "rt_math.h"
 #include "alignedbuffer.h"
 #include "imagedimensions.h"
@@ -1171,6 +1173,48 @@ public:
         }
     }
 
+    // Same as above, for in-memory buffers. readData returns false if data
+    // is too short
+    bool readData(const char *data, size_t size)
+    {
+        const size_t rowsz = sizeof(T) * width;
+        if (size < rowsz * height * 3) {
+            return false;
+        }
+
+        for (int i = 0; i < height; i++, data += rowsz) {
+            memcpy(r(i), data, rowsz);
+        }
+
+        for (int i = 0; i < height; i++, data += rowsz) {
+            memcpy(g(i), data, rowsz);
+        }
+
+        for (int i = 0; i < height; i++, data += rowsz) {
+            memcpy(b(i), data, rowsz);
+        }
+
+        return true;
+    }
+
+    void writeData(std::string &out) const
+    {
+        const size_t rowsz = sizeof(T) * width;
+        out.reserve(out.size() + rowsz * height * 3);
+
+        for (int i = 0; i < height; i++) {
+            out.append(reinterpret_cast<const char *>(r(i)), rowsz);
+        }
+
+        for (int i = 0; i < height; i++) {
+            out.append(reinterpret_cast<const char *>(g(i)), rowsz);
+        }
+
+        for (int i = 0; i < height; i++) {
+            out.append(reinterpret_cast<const char *>(b(i)), rowsz);
+        }
+    }
+
 };
 
 // --------------------------------------------------------------------
@@ -1733,6 +1777,32 @@ public:
         }
     }
 
+    // Same as above, for in-memory buffers. readData returns false if data
+    // is too short
+    bool readData(const char *data, size_t size)
+    {
+        const size_t rowsz = sizeof(T) * 3 * width;
+        if (size < rowsz * height) {
+            return false;
+        }
+
+        for (int i = 0; i < height; i++, data += rowsz) {
+            memcpy(r(i), data, rowsz);
+        }
+
+        return true;
+    }
+
+    void writeData(std::string &out) const
+    {
+        const size_t rowsz = sizeof(T) * 3 * width;
+        out.reserve(out.size() + rowsz * height);
+
+        for (int i = 0; i < height; i++) {
+            out.append(reinterpret_cast<const char *>(r(i)), rowsz);
+        }
+    }
+
 };
 
 // --------------------------------------------------------------------
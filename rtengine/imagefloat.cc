@@ -21,6 +21,7 @@
 #include "image16.h"
 #include "image8.h"
 #include <cstring>
+#include <algorithm>
 #include "rtengine.h"
 #include "mytime.h"
 #include "iccstore.h"
@@ -1043,4 +1044,68 @@ void Imagefloat::getLab(int y, int x, float &L, float &a, float &b)
     }
 }
 
+void Imagefloat::getLab(int y, int x, int w, float *L, float *a, float *b)
+{
+    get_ws();
+
+    const float *rr = r(y) + x;
+    const float *gg = g(y) + x;
+    const float *bb = this->b(y) + x;
+    int j = 0;
+
+    switch (mode()) {
+    case Mode::RGB:
+#ifdef __SSE2__
+        for (; j < w - 3; j += 4) {
+            vfloat Lv, av, bv;
+            Color::rgb2lab(LVFU(rr[j]), LVFU(gg[j]), LVFU(bb[j]), Lv, av, bv, vws_);
+            STVFU(L[j], Lv);
+            STVFU(a[j], av);
+            STVFU(b[j], bv);
+        }
+#endif
+        for (; j < w; ++j) {
+            rgb_to_lab(y, x + j, L[j], a[j], b[j]);
+        }
+        break;
+    case Mode::XYZ:
+#ifdef __SSE2__
+        for (; j < w - 3; j += 4) {
+            vfloat Lv, av, bv;
+            Color::XYZ2Lab(LVFU(rr[j]), LVFU(gg[j]), LVFU(bb[j]), Lv, av, bv);
+            STVFU(L[j], Lv);
+            STVFU(a[j], av);
+            STVFU(b[j], bv);
+        }
+#endif
+        for (; j < w; ++j) {
+            xyz_to_lab(y, x + j, L[j], a[j], b[j]);
+        }
+        break;
+    case Mode::YUV:
+#ifdef __SSE2__
+        for (; j < w - 3; j += 4) {
+            vfloat Rv, Gv, Bv;
+            vfloat Xv, Yv, Zv;
+            vfloat Lv, av, bv;
+            Color::yuv2rgb(LVFU(gg[j]), LVFU(bb[j]), LVFU(rr[j]), Rv, Gv, Bv, vws_);
+            Color::rgbxyz(Rv, Gv, Bv, Xv, Yv, Zv, vws_);
+            Color::XYZ2Lab(Xv, Yv, Zv, Lv, av, bv);
+            STVFU(L[j], Lv);
+            STVFU(a[j], av);
+            STVFU(b[j], bv);
+        }
+#endif
+        for (; j < w; ++j) {
+            yuv_to_lab(y, x + j, L[j], a[j], b[j]);
+        }
+        break;
+    default:
+        std::copy(gg, gg + w, L);
+        std::copy(rr, rr + w, a);
+        std::copy(bb, bb + w, b);
+        break;
+    }
+}
+
 } // namespace rtengine
@@ -127,6 +127,8 @@ public:
 
     void toLab(LabImage &dst, bool multithread);
     void getLab(int y, int x, float &L, float &a, float &b);
+    // converts the w pixels of row y starting at column x
+    void getLab(int y, int x, int w, float *L, float *a, float *b);
 
 private:
     void rgb_to_xyz(bool multithread);
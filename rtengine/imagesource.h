@@ -31,6 +31,7 @@
 #include "image8.h"
 #include "image16.h"
 #include "imagefloat.h"
+#include "cancellation.h"
 
 namespace rtengine {
 
@@ -75,6 +76,9 @@ public:
     virtual bool isRGBSourceModified() const = 0; // tracks whether cached rgb output of demosaic has been modified
 
     virtual void setBorder(unsigned int border) {}
+    virtual void setCancellationToken(const CancellationToken *token) {}
+    // allows demosaic() to use the on-disk cache of demosaiced images
+    virtual void setUseDemosaicCache(bool yes) {}
     virtual void setCurrentFrame(unsigned int frameNum) = 0;
     virtual int getFrameCount() = 0;
     virtual int getFlatFieldAutoClipValue() = 0;
@@ -31,6 +31,7 @@
 #include "metadata.h"
 #include "perspectivecorrection.h"
 #include "threadpool.h"
+#include "perftrace.h"
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -41,8 +42,6 @@ using rtengine::procparams::WBParams;
 
 namespace {
 
-constexpr int VECTORSCOPE_SIZE = 128;
-
 using rtengine::Coord2D;
 
 } // namespace
@@ -71,32 +70,22 @@ ImProcCoordinator::ImProcCoordinator():
     allocated(false), 
 
     vhist16(65536),
-    histRed(256), histRedRaw(256),
-    histGreen(256), histGreenRaw(256),
-    histBlue(256), histBlueRaw(256),
-    histLuma(256),
+    histRedRaw(256),
+    histGreenRaw(256),
+    histBlueRaw(256),
     histToneCurve(256),
     histLCurve(256),
     histCCurve(256),
     //histLLCurve(256),
     histLCAM(256),
     histCCAM(256),
-    histChroma(256),
     histLRETI(256),
 
     hist_lrgb_dirty(false),
     hist_raw_dirty(false),
-    vectorscopeScale(0),
     vectorscope_hc_dirty(false),
     vectorscope_hs_dirty(false),
-    vectorscope_hc(VECTORSCOPE_SIZE, VECTORSCOPE_SIZE),
-    vectorscope_hs(VECTORSCOPE_SIZE, VECTORSCOPE_SIZE),
-    waveformScale(0),
     waveform_dirty(false),
-    waveformRed(0, 0),
-    waveformGreen(0, 0),
-    waveformBlue(0, 0),
-    waveformLuma(0, 0),
     
     fw(0), fh(0), tr(0),
     fullw(1), fullh(1),
@@ -137,6 +126,7 @@ ImProcCoordinator::ImProcCoordinator():
 void ImProcCoordinator::assign(ImageSource* imgsrc)
 {
     this->imgsrc = imgsrc;
+    imgsrc->setUseDemosaicCache(true);
     denoiseInfoStore.valid = false;
 }
 
@@ -218,6 +208,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
     }
 
     ipf.setPipetteBuffer(nullptr);
+    ipf.setCancellationToken(&cancel_token_);
     bool stop = false;
                     
     if (((todo & ALL) == ALL) || (todo & M_MONITOR) || panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar)) {
@@ -320,7 +311,16 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             }
             bool autoContrast = imgsrc->getSensorType() == ST_BAYER ? params.raw.bayersensor.dualDemosaicAutoContrast : params.raw.xtranssensor.dualDemosaicAutoContrast;
             double contrastThreshold = imgsrc->getSensorType() == ST_BAYER ? params.raw.bayersensor.dualDemosaicContrast : params.raw.xtranssensor.dualDemosaicContrast;
+            imgsrc->setCancellationToken(&cancel_token_);
             imgsrc->demosaic(rp, autoContrast, contrastThreshold); //enabled demosaic
+            imgsrc->setCancellationToken(nullptr);
+
+            if (cancel_token_.cancelled()) {
+                // the raw data must be demosaiced again in the next update
+                highDetailRawComputed = false;
+                ipf.setCancellationToken(nullptr);
+                return;
+            }
 
             if (imgsrc->getSensorType() == ST_BAYER && bayerAutoContrastListener && autoContrast) {
                 bayerAutoContrastListener->autoContrastChanged(autoContrast ? contrastThreshold : -1.0);
@@ -450,6 +450,7 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
             oprevi = new Imagefloat(pW, pH, op);
             ipf.transform(op, oprevi, 0, 0, 0, 0, pW, pH, fw, fh,
                           imgsrc->getMetaData(), imgsrc->getRotateDegree(), false);
+            stop = stop || cancel_token_.cancelled();
         }
     
         readyphase++;
@@ -536,6 +537,19 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
         }
     }
 
+    // the crop windows share ipf; they are preempted only when updated on
+    // their own (see Crop::fullUpdate)
+    ipf.setCancellationToken(nullptr);
+
+    if (cancel_token_.cancelled()) {
+        // the update is stale, process() will restart it with the new changes
+        if (orig_prev != oprevi && oprevi != spotprev) {
+            delete oprevi;
+            oprevi = nullptr;
+        }
+        return;
+    }
+
     // process crop, if needed
     for (size_t i = 0; i < crops.size(); i++)
         if (crops[i]->hasListener() && (panningRelatedChange || (highDetailNeeded && options.prevdemo != PD_Sidecar) || (todo & (M_MONITOR | M_RGBCURVE | M_LUMACURVE)) || crops[i]->get_skip() == 1)) {
@@ -579,18 +593,20 @@ void ImProcCoordinator::updatePreviewImage(int todo, bool panningRelatedChange)
 
         hist_lrgb_dirty = vectorscope_hc_dirty = vectorscope_hs_dirty = waveform_dirty = true;
         if (hListener) {
+            int kinds = 0;
             if (hListener->updateHistogram()) {
-                updateLRGBHistograms();
+                kinds |= Scopes::HISTOGRAM;
             }
             if (hListener->updateVectorscopeHC()) {
-                updateVectorscopeHC();
+                kinds |= Scopes::VECTORSCOPE_HC;
             }
             if (hListener->updateVectorscopeHS()) {
-                updateVectorscopeHS();
+                kinds |= Scopes::VECTORSCOPE_HS;
             }
             if (hListener->updateWaveform()) {
-                updateWaveforms();
+                kinds |= Scopes::WAVEFORM;
             }
+            updateScopes(kinds);
             notifyHistogramChanged();
         }
     }
@@ -759,10 +775,10 @@ void ImProcCoordinator::notifyHistogramChanged()
 {
     if (hListener) {
         hListener->histogramChanged(
-            histRed,
-            histGreen,
-            histBlue,
-            histLuma,
+            scopes.histRed,
+            scopes.histGreen,
+            scopes.histBlue,
+            scopes.histLuma,
             histToneCurve,
             histLCurve,
             histCCurve,
@@ -771,16 +787,16 @@ void ImProcCoordinator::notifyHistogramChanged()
             histRedRaw,
             histGreenRaw,
             histBlueRaw,
-            histChroma,
+            scopes.histChroma,
             histLRETI,
-            vectorscopeScale,
-            vectorscope_hc,
-            vectorscope_hs,
-            waveformScale,
-            waveformRed,
-            waveformGreen,
-            waveformBlue,
-            waveformLuma
+            scopes.vectorscopeScale,
+            scopes.vectorscopeHC,
+            scopes.vectorscopeHS,
+            scopes.waveformScale,
+            scopes.waveformRed,
+            scopes.waveformGreen,
+            scopes.waveformBlue,
+            scopes.waveformLuma
         );
     }
 }
@@ -788,189 +804,13 @@ void ImProcCoordinator::notifyHistogramChanged()
 
 bool ImProcCoordinator::updateLRGBHistograms()
 {
-
-    if (!hist_lrgb_dirty) {
+    if (!workimg || !hist_lrgb_dirty) {
         return false;
     }
 
-    int x1, y1, x2, y2;
-    params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-#ifdef _OPENMP
-    #pragma omp parallel sections
-#endif
-    {
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histLuma.clear();
-            histChroma.clear();
-
-            for (int i = y1; i < y2; i++)
-                for (int j = x1; j < x2; j++)
-                {
-                    float L, a, b;
-                    bufs_[2]->getLab(i, j, L, a, b);
-                    histChroma[(int)(sqrtf(SQR(a) + SQR(b)) / 188.f)]++;      //188 = 48000/256
-                    histLuma[(int)(L / 128.f)]++;
-                }
-        }
-// #ifdef _OPENMP
-//         #pragma omp section
-// #endif
-//         {
-//             histLuma.clear();
-
-//             for (int i = y1; i < y2; i++)
-//                 for (int j = x1; j < x2; j++)
-//                 {
-//                     histLuma[(int)(nprevl->L[i][j] / 128.f)]++;
-//                 }
-//         }
-#ifdef _OPENMP
-        #pragma omp section
-#endif
-        {
-            histRed.clear();
-            histGreen.clear();
-            histBlue.clear();
-
-            for (int i = y1; i < y2; i++)
-            {
-                int ofs = (i * pW + x1) * 3;
-
-                for (int j = x1; j < x2; j++) {
-                    int r = workimg->data[ofs++];
-                    int g = workimg->data[ofs++];
-                    int b = workimg->data[ofs++];
-
-                    histRed[r]++;
-                    histGreen[g]++;
-                    histBlue[b]++;
-                }
-            }
-        }
-    }
-
-    hist_lrgb_dirty = false;
-    return true;
-
-}
-
-
-namespace {
-
-void rgb2lab(const Image8 &src, int x, int y, int w, int h, float L[], float a[], float b[], const procparams::ColorManagementParams &icm)
-{ // Adapted from ImProcFunctions::lab2rgb
-    const int src_width = src.getWidth();
-    const int src_height = src.getHeight();
-
-    if (x < 0) {
-        x = 0;
-    }
-
-    if (y < 0) {
-        y = 0;
-    }
-
-    if (x + w > src_width) {
-        w = src_width - x;
-    }
-
-    if (y + h > src_height) {
-        h = src_height - y;
-    }
-
-    Glib::ustring profile;
-
-    cmsHPROFILE oprof = nullptr;
-
-    if (settings->HistogramWorking) {
-        profile = icm.workingProfile;
-    } else {
-        profile = icm.outputProfile;
-
-        if (icm.outputProfile.empty() || icm.outputProfile == ColorManagementParams::NoICMString) {
-            profile = "sRGB";
-        }
-        oprof = ICCStore::getInstance()->getProfile(profile);
-    }
-
-    if (oprof) {
-        cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE; // NOCACHE is important for thread safety
-
-        if (icm.outputBPC) {
-            flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
-        }
-
-        lcmsMutex->lock();
-        cmsHPROFILE LabIProf  = cmsCreateLab4Profile(nullptr);
-        cmsHTRANSFORM hTransform = cmsCreateTransform (oprof, TYPE_RGB_8, LabIProf, TYPE_Lab_FLT, icm.outputIntent, flags);
-        cmsCloseProfile(LabIProf);
-        lcmsMutex->unlock();
-
-        // cmsDoTransform is relatively expensive
-#ifdef _OPENMP
-        #pragma omp parallel
-#endif
-        {
-            AlignedBuffer<float> oBuf(3 * w);
-            float *outbuffer = oBuf.data;
-            int condition = y + h;
-
-#ifdef _OPENMP
-            #pragma omp for schedule(dynamic,16)
-#endif
-
-            for (int i = y; i < condition; i++) {
-                const int ix = 3 * (x + i * src_width);
-                int iy = 0;
-                float* rL = L + (i - y) * w;
-                float* ra = a + (i - y) * w;
-                float* rb = b + (i - y) * w;
-
-                cmsDoTransform (hTransform, src.data + ix, outbuffer, w);
-
-                for (int j = 0; j < w; j++) {
-                    rL[j] = outbuffer[iy++] * 327.68f;
-                    ra[j] = outbuffer[iy++] * 327.68f;
-                    rb[j] = outbuffer[iy++] * 327.68f;
-                }
-            }
-        } // End of parallelization
-
-        cmsDeleteTransform(hTransform);
-    } else {
-        TMatrix wprof = ICCStore::getInstance()->workingSpaceMatrix(profile);
-        const float wp[3][3] = {
-            {static_cast<float>(wprof[0][0]), static_cast<float>(wprof[0][1]), static_cast<float>(wprof[0][2])},
-            {static_cast<float>(wprof[1][0]), static_cast<float>(wprof[1][1]), static_cast<float>(wprof[1][2])},
-            {static_cast<float>(wprof[2][0]), static_cast<float>(wprof[2][1]), static_cast<float>(wprof[2][2])}
-        };
-
-        const int x2 = x + w;
-        const int y2 = y + h;
-        constexpr float rgb_factor = 65355.f / 255.f;
-
-#ifdef _OPENMP
-#       pragma omp parallel for schedule(dynamic,16) //if (multiThread)
-#endif
-        for (int i = y; i < y2; i++) {
-            int offset = (i - y) * w;
-            for (int j = x; j < x2; j++) {
-                float X, Y, Z;
-                // lab2rgb uses gamma2curve, which is gammatab_srgb.
-                const auto &igamma = Color::igammatab_srgb;
-                Color::rgbxyz(igamma[rgb_factor * src.r(i, j)], igamma[rgb_factor * src.g(i, j)], igamma[rgb_factor * src.b(i, j)], X, Y, Z, wp);
-                Color::XYZ2Lab(X, Y, Z, L[offset], a[offset], b[offset]);
-                offset++;
-            }
-        }
-    }
+    return updateScopes(Scopes::HISTOGRAM);
 }
 
-} // namespace
 
 bool ImProcCoordinator::updateVectorscopeHC()
 {
@@ -978,54 +818,7 @@ bool ImProcCoordinator::updateVectorscopeHC()
         return false;
     }
 
-    int x1, y1, x2, y2;
-    params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-    constexpr int size = VECTORSCOPE_SIZE;
-    constexpr float norm_factor = size / (128.f * 655.36f);
-    vectorscope_hc.fill(0);
-
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
-
-    const std::unique_ptr<float[]> a(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> b(new float[vectorscopeScale]);
-    const std::unique_ptr<float[]> L(new float[vectorscopeScale]);
-    rgb2lab(*workimg, x1, y1, x2 - x1, y2 - y1, L.get(), a.get(), b.get(), params.icm);
-    
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            for (int j = x1, ofs_lab = (i - y1) * (x2 - x1); j < x2; ++j, ++ofs_lab) {
-                const int col = norm_factor * a[ofs_lab] + size / 2 + 0.5f;
-                const int row = norm_factor * b[ofs_lab] + size / 2 + 0.5f;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
-                }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
-#endif
-        {
-            for (int y = 0; y < vectorscope_hc.height(); ++y) {
-#ifdef _OPENMP
-#               pragma omp simd
-#endif
-                for (int x = 0; x < vectorscope_hc.width(); ++x) {
-                    vectorscope_hc[y][x] += vectorscopeThr[y][x];
-                }
-            }
-        }
-    }
-
-    vectorscope_hc_dirty = false;
-    return true;
+    return updateScopes(Scopes::VECTORSCOPE_HC);
 }
 
 
@@ -1035,55 +828,7 @@ bool ImProcCoordinator::updateVectorscopeHS()
         return false;
     }
 
-    int x1, y1, x2, y2;
-    params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-
-    constexpr int size = VECTORSCOPE_SIZE;
-    vectorscope_hs.fill(0);
-
-    vectorscopeScale = (x2 - x1) * (y2 - y1);
-
-#ifdef _OPENMP
-    #pragma omp parallel
-#endif
-    {
-        array2D<int> vectorscopeThr(size, size, ARRAY2D_CLEAR_DATA);
-#ifdef _OPENMP
-        #pragma omp for nowait
-#endif
-        for (int i = y1; i < y2; ++i) {
-            int ofs = (i * pW + x1) * 3;
-            for (int j = x1; j < x2; ++j) {
-                const float red = 257.f * workimg->data[ofs++];
-                const float green = 257.f * workimg->data[ofs++];
-                const float blue = 257.f * workimg->data[ofs++];
-                float h, s, l;
-                Color::rgb2hslfloat(red, green, blue, h, s, l);
-                const auto sincosval = xsincosf(2.f * RT_PI_F * h);
-                const int col = s * sincosval.y * (size / 2) + size / 2;
-                const int row = s * sincosval.x * (size / 2) + size / 2;
-                if (col >= 0 && col < size && row >= 0 && row < size) {
-                    vectorscopeThr[row][col]++;
-                }
-            }
-        }
-#ifdef _OPENMP
-        #pragma omp critical
-#endif
-        {
-            for (int y = 0; y < vectorscope_hs.height(); ++y) {
-#ifdef _OPENMP
-#               pragma omp simd
-#endif
-                for (int x = 0; x < vectorscope_hs.width(); ++x) {
-                    vectorscope_hs[y][x] += vectorscopeThr[y][x];
-                }
-            }
-        }
-    }
-
-    vectorscope_hs_dirty = false;
-    return true;
+    return updateScopes(Scopes::VECTORSCOPE_HS);
 }
 
 
@@ -1091,10 +836,7 @@ bool ImProcCoordinator::updateWaveforms()
 {
     if (!workimg) {
         // free memory
-        waveformRed.free();
-        waveformGreen.free();
-        waveformBlue.free();
-        waveformLuma.free();
+        scopes.reset();
         return true;
     }
 
@@ -1102,42 +844,33 @@ bool ImProcCoordinator::updateWaveforms()
         return false;
     }
 
+    return updateScopes(Scopes::WAVEFORM);
+}
+
+
+bool ImProcCoordinator::updateScopes(int kinds)
+{
+    if (!workimg || !kinds) {
+        return false;
+    }
+
     int x1, y1, x2, y2;
     params.crop.mapToResized(pW, pH, scale, x1, x2, y1, y2);
-    int waveform_width = waveformRed.width();
-
-    if (waveform_width != x2 - x1) {
-        // Resize waveform arrays.
-        waveform_width = x2 - x1;
-        waveformRed(waveform_width, 256);
-        waveformGreen(waveform_width, 256);
-        waveformBlue(waveform_width, 256);
-        waveformLuma(waveform_width, 256);
-    }
-
-    // Start with zero.
-    waveformRed.fill(0);
-    waveformGreen.fill(0);
-    waveformBlue.fill(0);
-    waveformLuma.fill(0);
-
-    constexpr float luma_factor = 255.f / 32768.f;
-    for (int i = y1; i < y2; i++) {
-        int ofs = (i * pW + x1) * 3;
-        //float* L_row = nprevl->L[i] + x1;
-
-        for (int j = 0; j < waveform_width; j++) {
-            waveformRed[workimg->data[ofs++]][j]++;
-            waveformGreen[workimg->data[ofs++]][j]++;
-            waveformBlue[workimg->data[ofs++]][j]++;
-            float L, a, b;
-            bufs_[2]->getLab(i, j, L, a, b);
-            waveformLuma[LIM<int>(L * luma_factor, 0, 255)][j]++;
-        }
-    }
 
-    waveformScale = y2 - y1;
-    waveform_dirty = false;
+    scopes.update(kinds, workimg, bufs_[2], x1, y1, x2, y2, params.icm);
+
+    if (kinds & Scopes::HISTOGRAM) {
+        hist_lrgb_dirty = false;
+    }
+    if (kinds & Scopes::VECTORSCOPE_HC) {
+        vectorscope_hc_dirty = false;
+    }
+    if (kinds & Scopes::VECTORSCOPE_HS) {
+        vectorscope_hs_dirty = false;
+    }
+    if (kinds & Scopes::WAVEFORM) {
+        waveform_dirty = false;
+    }
     return true;
 }
 
@@ -1455,6 +1188,9 @@ void ImProcCoordinator::startProcessing(int changeCode)
 {
     paramsUpdateMutex.lock();
     changeSinceLast |= changeCode;
+    if (updaterRunning && (changeCode & (M_VOID - 1))) {
+        cancel_token_.cancel();
+    }
     paramsUpdateMutex.unlock();
 
     startProcessing();
@@ -1475,6 +1211,7 @@ void ImProcCoordinator::process()
         params = nextParams;
         int change = changeSinceLast;
         changeSinceLast = 0;
+        cancel_token_.reset();
         if (tweakOperator) {
             // TWEAKING THE PROCPARAMS FOR THE SPOT ADJUSTMENT MODE
             backupParams();
@@ -1489,12 +1226,26 @@ void ImProcCoordinator::process()
 
         // M_VOID means no update, and is a bit higher that the rest
         if (change & (M_VOID - 1)) {
-            updatePreviewImage(change, panningRelatedChange);
+            perf::Trace trace("preview update");
+            {
+                perf::TraceScope traceScope(&trace);
+                perf::Scope scope("update", "total");
+                updatePreviewImage(change, panningRelatedChange);
+            }
             changed = true;
+
+            std::lock_guard<std::mutex> lock(perf_summary_mutex_);
+            perf_summary_ = perf::summary(trace);
         }
 
         paramsUpdateMutex.lock();
 
+        if (cancel_token_.cancelled()) {
+            // the intermediate results of the interrupted update are not
+            // valid, so redo its work together with the new changes
+            changeSinceLast |= change;
+        }
+
         if (tweakOperator) {
             restoreParams();
         }
@@ -1512,6 +1263,13 @@ void ImProcCoordinator::process()
     }
 }
 
+std::string ImProcCoordinator::getPerfSummary()
+{
+    std::lock_guard<std::mutex> lock(perf_summary_mutex_);
+    return perf_summary_;
+}
+
+
 ProcParams* ImProcCoordinator::beginUpdateParams()
 {
     paramsUpdateMutex.lock();
@@ -1528,6 +1286,9 @@ void ImProcCoordinator::endUpdateParams(ProcEvent change)
 void ImProcCoordinator::endUpdateParams(int changeFlags)
 {
     changeSinceLast |= changeFlags;
+    if (updaterRunning && (changeFlags & (M_VOID - 1))) {
+        cancel_token_.cancel();
+    }
 
     paramsUpdateMutex.unlock();
     startProcessing();
@@ -27,6 +27,7 @@
 #include "procevents.h"
 #include "dcrop.h"
 #include "LUT.h"
+#include "scopes.h"
 #include "../rtgui/threadutils.h"
 
 #include <mutex>
@@ -91,22 +92,19 @@ protected:
     // Precomputed values used by DetailedCrop ----------------------------------------------
 
     LUTu vhist16;
-    LUTu histRed, histRedRaw;
-    LUTu histGreen, histGreenRaw;
-    LUTu histBlue, histBlueRaw;
-    LUTu histLuma, histToneCurve, histLCurve, histCCurve;
-    LUTu /*histLLCurve,*/ histLCAM, histCCAM, histChroma, histLRETI;
+    LUTu histRedRaw;
+    LUTu histGreenRaw;
+    LUTu histBlueRaw;
+    LUTu histToneCurve, histLCurve, histCCurve;
+    LUTu /*histLLCurve,*/ histLCAM, histCCAM, histLRETI;
 
     bool hist_lrgb_dirty;
     /// Used to simulate a lazy update of the raw histogram.
     bool hist_raw_dirty;
-    int vectorscopeScale;
     bool vectorscope_hc_dirty, vectorscope_hs_dirty;
-    array2D<int> vectorscope_hc, vectorscope_hs;
-    /// Waveform's intensity. Same as height of reference image.
-    int waveformScale;
     bool waveform_dirty;
-    array2D<int> waveformRed, waveformGreen, waveformBlue, waveformLuma;    
+    /// L, RGB and chroma histograms, vectorscopes and waveforms of workimg.
+    Scopes scopes;
     // ------------------------------------------------------------------------------------
 
     int fw, fh, tr, fullw, fullh;
@@ -155,6 +153,9 @@ protected:
     bool updateVectorscopeHS();
     /// Updates all waveforms. Returns true unless not updated.
     bool updateWaveforms();
+    /// Updates the given scopes (a combination of Scopes::Kind) in a single
+    /// pass. Returns true unless not updated.
+    bool updateScopes(int kinds);
     
     MyMutex mProcessing;
     ProcParams params;
@@ -176,6 +177,11 @@ protected:
     MyMutex paramsUpdateMutex;
     int  changeSinceLast;
     bool updaterRunning;
+    // cancelled when new changes arrive while the preview is being updated,
+    // so that the updater drops the stale work and starts over
+    CancellationToken cancel_token_;
+    std::mutex perf_summary_mutex_;
+    std::string perf_summary_;
     ProcParams nextParams;
     bool destroying;
     void startProcessing ();
@@ -246,6 +252,7 @@ public:
     void getMonitorProfile (Glib::ustring& profile, RenderingIntent& intent) const override;
     void setSoftProofing   (bool softProof, GamutCheck gamutCheck) override;
     void setSharpMask      (bool sharpMask) override;
+    std::string getPerfSummary() override;
     bool updateTryLock () override
     {
         //return updaterThreadStart.trylock();
@@ -42,6 +42,7 @@
 #include "../rtgui/ppversion.h"
 #include "../rtgui/guiutils.h"
 #include "refreshmap.h"
+#include "perftrace.h"
 
 namespace rtengine {
 
@@ -68,6 +69,8 @@ ImProcFunctions::ImProcFunctions(const ProcParams* iparams, bool imultiThread):
     histCCurve(nullptr),
     histLCurve(nullptr),
     show_sharpening_mask(false),
+    in_place(false),
+    cancel_token(nullptr),
     plistener(nullptr),
     progress_step(0),
     progress_end(1)
@@ -97,6 +100,7 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
     gamutWarning.reset(nullptr);
 
     monitorTransform = nullptr;
+    monitorLut = nullptr;
     monitor = nullptr;
 
     if (!monitorProfile.empty()) {
@@ -226,6 +230,11 @@ void ImProcFunctions::updateColorProfiles (const Glib::ustring& monitorProfile,
 
             monitorTransform = cmsCreateTransform (iprof, TYPE_RGB_FLT, 
                                                    monitor, TYPE_RGB_FLT, monitorIntent, flags);
+
+            // soft-proofing transforms are not baked, see icclut.cc
+            if (monitorTransform && settings->icc_lut_transforms) {
+                monitorLut = ICCLut::get(Glib::ustring::compose("monitor|%1|%2|%3|%4", params->icm.outputProfile, monitorProfile, int(monitorIntent), flags), monitorTransform, iprof, monitor, ICCLut::PREVIEW_SIZE);
+            }
         }
 
         if (gamutCheck && gamutprof) {
@@ -350,26 +359,6 @@ void proPhotoBlue(Imagefloat *rgb, bool multiThread)
     }
 }
 
-
-void dcpProfile(Imagefloat *img, DCPProfile *dcp, const DCPProfile::ApplyState *as, bool multithread)
-{
-    if (dcp && as) {
-        img->setMode(Imagefloat::Mode::RGB, multithread);
-        
-        const int H = img->getHeight();
-        const int W = img->getWidth();
-#ifdef _OPENMP
-#       pragma omp parallel for if (multithread)
-#endif
-        for (int y = 0; y < H; ++y) {
-            float *r = img->r(y);
-            float *g = img->g(y);
-            float *b = img->b(y);
-            dcp->step2ApplyTile(r, g, b, W, 1, 1, *as);
-        }
-    }
-}
-
 } // namespace
 
 
@@ -534,6 +523,11 @@ namespace {
 
 constexpr int NUM_PIPELINE_STEPS = 23;
 
+// width of the tiles processed by chains of pointwise operations: small
+// enough for the three channels of a tile to stay in cache across all the
+// operations of the chain
+constexpr int POINTWISE_TILE_SIZE = 2048;
+
 } // namespace
 
 void ImProcFunctions::setProgressListener(ProgressListener *pl, int num_previews)
@@ -549,8 +543,12 @@ void ImProcFunctions::setProgressListener(ProgressListener *pl, int num_previews
 
 
 template <class Ret, class Method>
-Ret ImProcFunctions::apply(Method op, Imagefloat *img)
+Ret ImProcFunctions::apply(Method op, Imagefloat *img, const char *name)
 {
+    if (cancelled()) {
+        return Ret();
+    }
+    perf::Scope scope("step", name);
     if (plistener) {
         float percent = float(++progress_step) / float(progress_end);
         plistener->setProgress(percent);
@@ -559,13 +557,108 @@ Ret ImProcFunctions::apply(Method op, Imagefloat *img)
 }
 
 
+bool ImProcFunctions::dcpProfileOp(PointwiseOp &op)
+{
+    if (dcpProf && dcpApplyState) {
+        const DCPProfile *dcp = dcpProf;
+        const DCPProfile::ApplyState *as = dcpApplyState;
+        op =
+            [dcp,as](int thread_id, int W, float *r, float *g, float *b) -> void
+            {
+                dcp->step2ApplyTile(r, g, b, W, 1, 1, *as);
+            };
+    }
+    return true;
+}
+
+
+void ImProcFunctions::dcpProfile(Imagefloat *img)
+{
+    PointwiseOp op;
+    dcpProfileOp(op);
+    applyPointwise(img, { op });
+}
+
+
+bool ImProcFunctions::pointwise(bool (ImProcFunctions::*get_op)(PointwiseOp &), std::vector<PointwiseOp> &chain)
+{
+    PointwiseOp op;
+    if (!settings->fuse_pointwise_ops || !(this->*get_op)(op)) {
+        return false;
+    }
+    if (plistener) {
+        float percent = float(++progress_step) / float(progress_end);
+        plistener->setProgress(percent);
+    }
+    if (op) {
+        chain.push_back(std::move(op));
+    }
+    return true;
+}
+
+
+void ImProcFunctions::applyPointwise(Imagefloat *img, const std::vector<PointwiseOp> &ops)
+{
+    std::vector<const PointwiseOp *> chain;
+    for (auto &op : ops) {
+        if (op) {
+            chain.push_back(&op);
+        }
+    }
+    if (chain.empty()) {
+        return;
+    }
+
+    perf::Scope scope("step", "pointwise");
+    img->setMode(Imagefloat::Mode::RGB, multiThread);
+
+    const int W = img->getWidth();
+    const int H = img->getHeight();
+    const int tiles_per_row = (W + POINTWISE_TILE_SIZE - 1) / POINTWISE_TILE_SIZE;
+
+#ifdef _OPENMP
+#   pragma omp parallel for schedule(dynamic, 16) if (multiThread)
+#endif
+    for (int i = 0; i < H * tiles_per_row; ++i) {
+        if (cancelled()) {
+            continue;
+        }
+#ifdef _OPENMP
+        const int thread_id = omp_get_thread_num();
+#else
+        const int thread_id = 0;
+#endif
+        const int y = i / tiles_per_row;
+        const int x = (i % tiles_per_row) * POINTWISE_TILE_SIZE;
+        const int w = std::min(W - x, POINTWISE_TILE_SIZE);
+        float *r = img->r(y) + x;
+        float *g = img->g(y) + x;
+        float *b = img->b(y) + x;
+        for (auto op : chain) {
+            (*op)(thread_id, w, r, g, b);
+        }
+    }
+}
+
+
 bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
 {
     bool stop = false;
     cur_pipeline = pipeline;
 
-#define STEP_(op) apply<void>(&ImProcFunctions::op, img)
-#define STEP_s_(op) apply<bool>(&ImProcFunctions::op, img)
+    // consecutive pointwise steps are collected here, and executed together
+    // tile by tile at the next step that needs the whole image (a barrier)
+    std::vector<PointwiseOp> chain;
+    const auto barrier =
+        [&]() -> void
+        {
+            applyPointwise(img, chain);
+            chain.clear();
+        };
+
+#define STEP_(op) apply<void>(&ImProcFunctions::op, img, #op)
+#define STEP_s_(op) apply<bool>(&ImProcFunctions::op, img, #op)
+#define STEP_p_(op) if (!pointwise(&ImProcFunctions::op##Op, chain)) { barrier(); STEP_(op); }
         
     switch (stage) {
     case Stage::STAGE_0:
@@ -598,19 +691,29 @@ bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
         stop = stop || STEP_s_(textureBoost);
         if (!stop) { 
             STEP_(logEncoding);
-            STEP_(saturationVibrance);
-            dcpProfile(img, dcpProf, dcpApplyState, multiThread);
+            STEP_p_(saturationVibrance);
+            if (settings->fuse_pointwise_ops) {
+                PointwiseOp op;
+                dcpProfileOp(op);
+                if (op) {
+                    chain.push_back(std::move(op));
+                }
+            } else {
+                dcpProfile(img);
+            }
             if (!params->filmSimulation.after_tone_curve) {
-                STEP_(filmSimulation);
+                STEP_p_(filmSimulation);
             }
+            barrier();
             STEP_(toneCurve);
             if (params->filmSimulation.after_tone_curve) {
-                STEP_(filmSimulation);
+                STEP_p_(filmSimulation);
             }
-            STEP_(rgbCurves);
-            STEP_(labAdjustments);
+            STEP_p_(rgbCurves);
+            STEP_p_(labAdjustments);
             // stop = stop || STEP_s_(textureBoost);
-            STEP_(softLight);
+            STEP_p_(softLight);
+            barrier();
         }
         stop = stop || STEP_s_(localContrast);
         if (!stop) {
@@ -629,7 +732,7 @@ bool ImProcFunctions::process(Pipeline pipeline, Stage stage, Imagefloat *img)
         }
         break;
     }
-    return stop;
+    return stop || cancelled();
 }
 
 
@@ -34,6 +34,10 @@
 #include "cplx_wavelet_dec.h"
 #include "pipettebuffer.h"
 #include "gamutwarning.h"
+#include "icclut.h"
+#include "cancellation.h"
+#include "resample.h"
+#include <functional>
 
 namespace rtengine {
 
@@ -43,9 +47,10 @@ struct ImProcData {
     const ProcParams *params;
     double scale;
     bool multiThread;
+    const CancellationToken *cancel_token; // polled by the long tile/row loops
 
-    explicit ImProcData(const ProcParams *p=nullptr, double s=1.0, bool m=true):
-        params(p), scale(s), multiThread(m) {}
+    explicit ImProcData(const ProcParams *p=nullptr, double s=1.0, bool m=true, const CancellationToken *c=nullptr):
+        params(p), scale(s), multiThread(m), cancel_token(c) {}
 };
 
 
@@ -60,7 +65,7 @@ public:
     void setScale(double iscale);
 
     void updateColorProfiles(const Glib::ustring& monitorProfile, RenderingIntent monitorIntent, bool softProof, GamutCheck gamutCheck);
-    void setMonitorTransform(cmsHTRANSFORM xform) { monitorTransform = xform; }
+    void setMonitorTransform(cmsHTRANSFORM xform) { monitorTransform = xform; monitorLut = nullptr; }
 
     void setDCPProfile(DCPProfile *dcp, const DCPProfile::ApplyState &as)
     {
@@ -96,6 +101,13 @@ public:
     void setViewport(int ox, int oy, int fw, int fh);
     void setOutputHistograms(LUTu *histToneCurve, LUTu *histCCurve, LUTu *histLCurve);
     void setShowSharpeningMask(bool yes);
+    // allows operations to overwrite their input images, to avoid allocating
+    // full-size temporary copies (in-place export)
+    void setInPlace(bool yes) { in_place = yes; }
+    // if set, process() and the long-running operations poll the token and
+    // return early (with unspecified output) when it is cancelled
+    void setCancellationToken(const CancellationToken *token) { cancel_token = token; }
+    bool cancelled() const { return is_cancelled(cancel_token); }
     //----------------------------------------------------------------------
     
     //----------------------------------------------------------------------
@@ -109,6 +121,8 @@ public:
     bool prsharpening(Imagefloat *img);
     void transform(Imagefloat* original, Imagefloat* transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const FramesMetaData *metadata, int rawRotationDeg, bool highQuality);    
     void resize(Imagefloat* src, Imagefloat* dst, float dScale);
+    // resizes src (converted to RGB) to all the outputs in dst, in a single pass
+    void resize(Imagefloat *src, const std::vector<ResampleOutput> &dst);
     void Lanczos(Imagefloat *src, Imagefloat *dst, float scale);
     void impulsedenoise(Imagefloat *rgb);   //Emil's impulse denoise
     bool textureBoost(Imagefloat *rgb);
@@ -159,7 +173,7 @@ public:
     
     Image8 *rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch, const procparams::ColorManagementParams &icm, bool consider_histogram_settings = true);
 
-    Imagefloat *rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm);
+    Imagefloat *rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm, bool in_place=false);
 
     void rgb2lab(Imagefloat &src, LabImage &dst, const Glib::ustring &workingSpace);
     void rgb2lab(Imagefloat &src, LabImage &dst) { rgb2lab(src, dst, params->icm.workingProfile); }
@@ -209,6 +223,7 @@ public:
 private:
     cmsHPROFILE monitor;
     cmsHTRANSFORM monitorTransform;
+    std::shared_ptr<const ICCLut> monitorLut;
     std::unique_ptr<GamutWarning> gamutWarning;
 
     const ProcParams* params;
@@ -233,6 +248,8 @@ private:
     LUTu *histLCurve;
 
     bool show_sharpening_mask;
+    bool in_place;
+    const CancellationToken *cancel_token;
 
     ProgressListener *plistener;
     int progress_step;
@@ -241,8 +258,8 @@ private:
     
 private:
     void transformLuminanceOnly(Imagefloat* original, Imagefloat* transformed, int cx, int cy, int oW, int oH, int fW, int fH, bool creative);
-    void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap);
-    void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap);
+    void transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const Glib::ustring &lens_id);
+    void transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int oW, int oH, const LensCorrection *pLCPMap, const Glib::ustring &lens_id);
 
     void expcomp(Imagefloat *rgb, const procparams::ExposureParams *expparams);
     
@@ -256,7 +273,32 @@ private:
     bool needsLensfun();
 
     template <class Ret, class Method>
-    Ret apply(Method op, Imagefloat *img);
+    Ret apply(Method op, Imagefloat *img, const char *name);
+
+    //----------------------------------------------------------------------
+    // fused execution of pointwise operations
+    //----------------------------------------------------------------------
+    // A pointwise operation, applied in place to W pixels of an RGB image
+    // row. thread_id is the index of the calling thread in the current
+    // parallel region.
+    typedef std::function<void(int thread_id, int W, float *r, float *g, float *b)> PointwiseOp;
+
+    // The following return false if the corresponding step can't be executed
+    // as a pointwise operation with the current settings (e.g. because it
+    // needs some global statistics of the image, or because it has to fill a
+    // pipette buffer or a histogram). If the step is a no-op, op is left
+    // empty.
+    bool saturationVibranceOp(PointwiseOp &op);
+    bool dcpProfileOp(PointwiseOp &op);
+    bool filmSimulationOp(PointwiseOp &op);
+    bool rgbCurvesOp(PointwiseOp &op);
+    bool labAdjustmentsOp(PointwiseOp &op);
+    bool softLightOp(PointwiseOp &op);
+
+    void dcpProfile(Imagefloat *img);
+
+    bool pointwise(bool (ImProcFunctions::*get_op)(PointwiseOp &), std::vector<PointwiseOp> &chain);
+    void applyPointwise(Imagefloat *img, const std::vector<PointwiseOp> &ops);
 };
 
 
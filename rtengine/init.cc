@@ -35,6 +35,9 @@
 #include "metadata.h"
 #include "imgiomanager.h"
 #include "threadpool.h"
+#include "fftwplans.h"
+#include "simd.h"
+#include "bufferpool.h"
 
 #ifdef _OPENMP
 # include <omp.h>
@@ -49,7 +52,6 @@ const Settings* settings;
 
 MyMutex *lcmsMutex = nullptr;
 MyMutex *fftwMutex = nullptr;
-MyMutex *librawMutex = nullptr;
 
 int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDir, bool loadAll)
 {
@@ -66,6 +68,9 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
 #endif
     }
     ThreadPool::init(num_threads);
+    fftw::init(settings->fftw_wisdom_file, settings->verbose);
+    buffer_pool::init(size_t(settings->buffer_pool_size) << 20, settings->verbose);
+    simd::init(settings->verbose);
 
 #ifdef _OPENMP
 #pragma omp parallel sections if (!settings->verbose)
@@ -132,9 +137,6 @@ int init (const Settings* s, Glib::ustring baseDir, Glib::ustring userSettingsDi
     delete lcmsMutex;
     lcmsMutex = new MyMutex;
     fftwMutex = new MyMutex;
-#ifdef ART_USE_LIBRAW
-    librawMutex = new MyMutex;
-#endif
 
     return 0;
 }
@@ -146,6 +148,8 @@ void cleanup ()
     Color::cleanup ();
     RawImageSource::cleanup ();
 
+    fftw::cleanup();
+    buffer_pool::cleanup();
 #ifdef RT_FFTW3F_OMP
     fftwf_cleanup_threads();
 #else
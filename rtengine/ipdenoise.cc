@@ -1152,7 +1152,7 @@ void ImProcFunctions::denoise(ImageSource *imgsrc, const ColorTemp &currWB, Imag
         plistener->setProgress(0.1);
     }
 
-    ImProcData im(params, scale, multiThread);
+    ImProcData im(params, scale, multiThread, cancel_token);
     double ecomp = params->exposure.enabled ? params->exposure.expcomp : 0.0;
     ExposureParams expparams;
     expparams.enabled = true;
@@ -1168,7 +1168,7 @@ void ImProcFunctions::denoise(ImageSource *imgsrc, const ColorTemp &currWB, Imag
         plistener->setProgress(0.8);
     }
 
-    if (denoiseParams.smoothingEnabled) {
+    if (denoiseParams.smoothingEnabled && !cancelled()) {
         denoise::denoiseGuidedSmoothing(im, img);
         if (denoiseParams.nlStrength) {
             img->setMode(Imagefloat::Mode::YUV, multiThread);
@@ -18,6 +18,7 @@
  *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <memory>
 #include "improcfun.h"
 #include "curves.h"
 #include "color.h"
@@ -30,22 +31,20 @@
 
 namespace rtengine {
 
-void ImProcFunctions::filmSimulation(Imagefloat *img)
+bool ImProcFunctions::filmSimulationOp(PointwiseOp &op)
 {
     if (!params->filmSimulation.enabled) {
-        return;
+        return true;
     }
 
-    img->setMode(Imagefloat::Mode::RGB, multiThread);
-
 #ifdef _OPENMP
     int num_threads = multiThread ? omp_get_max_threads() : 1;
 #else
     int num_threads = 1;
 #endif
-    CLUTApplication clut(params->filmSimulation.clutFilename, params->icm.workingProfile, float(params->filmSimulation.strength)/100.f, num_threads);
+    std::shared_ptr<CLUTApplication> clut(new CLUTApplication(params->filmSimulation.clutFilename, params->icm.workingProfile, float(params->filmSimulation.strength)/100.f, num_threads));
 
-    if (clut) {
+    if (*clut) {
         CLUTApplication::Quality q = CLUTApplication::Quality::HIGHEST;
         switch (cur_pipeline) {
         case Pipeline::THUMBNAIL:
@@ -62,14 +61,27 @@ void ImProcFunctions::filmSimulation(Imagefloat *img)
         default:
             break;
         }
-        if (clut.set_param_values(params->filmSimulation.lut_params, q)) {
-            clut(img);
+        if (clut->set_param_values(params->filmSimulation.lut_params, q)) {
+            op =
+                [clut](int thread_id, int W, float *r, float *g, float *b) -> void
+                {
+                    clut->apply(thread_id, W, r, g, b);
+                };
         } else if (plistener) {
             plistener->error(Glib::ustring::compose(M("TP_FILMSIMULATION_LABEL") + " - " + M("ERROR_MSG_INVALID_LUT_PARAMS"), params->filmSimulation.clutFilename));
         }
     } else if (plistener) {
         plistener->error(Glib::ustring::compose(M("TP_FILMSIMULATION_LABEL") + " - " + M("ERROR_MSG_FILE_READ"), params->filmSimulation.clutFilename.empty() ? "(" + M("GENERAL_NONE") + ")" : params->filmSimulation.clutFilename));
     }
+    return true;
+}
+
+
+void ImProcFunctions::filmSimulation(Imagefloat *img)
+{
+    PointwiseOp op;
+    filmSimulationOp(op);
+    applyPointwise(img, { op });
 }
 
 } // namespace rtengine
@@ -22,9 +22,11 @@
 #include <omp.h>
 #endif
 
+#include <memory>
 #include "improcfun.h"
 #include "curves.h"
 #include "settings.h"
+#include "iccstore.h"
 #include "mytime.h"
 
 namespace rtengine {
@@ -182,6 +184,80 @@ void get_ab_curves(LUTf &aout, LUTf &bout, const std::vector<double> &acurve, co
 }
 
 
+void lab_adjustments_row(const LUTf &lcurve, const LUTf &acurve, const LUTf &bcurve, float chroma, int W, float *L, float *a, float *b)
+{
+    lcurve.lookup(L, L, W);
+
+    int x = 0;
+#ifdef __SSE2__
+    const vfloat chromav = F2V(chroma);
+    const vfloat v32768 = F2V(32768.f);
+    for (; x < W-3; x += 4) {
+        STVF(a[x], (acurve[LVF(a[x]) + v32768] - v32768) * chromav);
+        STVF(b[x], (bcurve[LVF(b[x]) + v32768] - v32768) * chromav);
+    }
+#endif
+    for (; x < W; ++x) {
+        a[x] = (acurve[a[x] + 32768.f] - 32768.f) * chroma;
+        b[x] = (bcurve[b[x] + 32768.f] - 32768.f) * chroma;
+    }
+}
+
+
+// in-place conversion of a row from RGB to Lab, with the same layout as
+// Imagefloat::Mode::LAB (g = L, r = a, b = b), and back
+void rgb2lab_row(TMatrix ws, int W, float *r, float *g, float *b)
+{
+    int x = 0;
+#ifdef __SSE2__
+    vfloat vws[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            vws[i][j] = F2V(ws[i][j]);
+        }
+    }
+    vfloat Lv, av, bv;
+    for (; x < W-3; x += 4) {
+        Color::rgb2lab(LVF(r[x]), LVF(g[x]), LVF(b[x]), Lv, av, bv, vws);
+        STVF(g[x], Lv);
+        STVF(r[x], av);
+        STVF(b[x], bv);
+    }
+#endif
+    for (; x < W; ++x) {
+        float L, a, bb;
+        Color::rgb2lab(r[x], g[x], b[x], L, a, bb, ws);
+        g[x] = L;
+        r[x] = a;
+        b[x] = bb;
+    }
+}
+
+
+void lab2rgb_row(TMatrix iws, int W, float *r, float *g, float *b)
+{
+    int x = 0;
+#ifdef __SSE2__
+    vfloat viws[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            viws[i][j] = F2V(iws[i][j]);
+        }
+    }
+    vfloat Rv, Gv, Bv;
+    for (; x < W-3; x += 4) {
+        Color::lab2rgb(LVF(g[x]), LVF(r[x]), LVF(b[x]), Rv, Gv, Bv, viws);
+        STVF(r[x], Rv);
+        STVF(g[x], Gv);
+        STVF(b[x], Bv);
+    }
+#endif
+    for (; x < W; ++x) {
+        Color::lab2rgb(g[x], r[x], b[x], r[x], g[x], b[x], iws);
+    }
+}
+
+
 void lab_adjustments(const ImProcData &im, Imagefloat *img, LUTf &lcurve, LUTf &acurve, LUTf &bcurve, LUTu *histLCurve, PipetteBuffer *pipetteBuffer)
 {
     const auto params = im.params;
@@ -252,37 +328,12 @@ void lab_adjustments(const ImProcData &im, Imagefloat *img, LUTf &lcurve, LUTf &
     }
 
     const float chroma = (params->labCurve.chromaticity + 100.0f) / 100.0f;
-#ifdef __SSE2__
-    const vfloat chromav = F2V(chroma);
-    const vfloat v32768 = F2V(32768.f);
-#endif
     
 #ifdef _OPENMP
 #   pragma omp parallel for if (multiThread)
 #endif
     for (int y = 0; y < H; ++y) {
-        int x = 0;
-#ifdef __SSE2__
-        for (; x < W-3; x += 4) {
-            vfloat L = LVF(img->g(y, x));
-            vfloat a = LVF(img->r(y, x));
-            vfloat b = LVF(img->b(y, x));
-            L = lcurve[L];
-            a = (acurve[a + v32768] - v32768) * chromav;
-            b = (bcurve[b + v32768] - v32768) * chromav;
-            STVF(img->g(y, x), L);
-            STVF(img->r(y, x), a);
-            STVF(img->b(y, x), b);
-        }
-#endif
-        for (; x < W; ++x) {
-            float &L = img->g(y, x);
-            float &a = img->r(y, x);
-            float &b = img->b(y, x);
-            L = lcurve[L];
-            a = (acurve[a + 32768.f] - 32768.f) * chroma;
-            b = (bcurve[b + 32768.f] - 32768.f) * chroma;
-        }
+        lab_adjustments_row(lcurve, acurve, bcurve, chroma, W, img->g(y), img->r(y), img->b(y));
     }
 }
 
@@ -343,4 +394,52 @@ void ImProcFunctions::labAdjustments(Imagefloat *rgb)
     lab_adjustments(ImProcData(params, scale, multiThread), rgb, lcurve, acurve, bcurve, histLCurve, pipetteBuffer);
 }
 
+
+bool ImProcFunctions::labAdjustmentsOp(PointwiseOp &op)
+{
+    if (pipetteBuffer) {
+        EditUniqueID editID = pipetteBuffer->getEditID();
+        if ((editID == EUID_Lab_LCurve || editID == EUID_Lab_aCurve || editID == EUID_Lab_bCurve) &&
+            pipetteBuffer->getDataProvider()->getCurrSubscriber()->getPipetteBufferType() == BT_SINGLEPLANE_FLOAT) {
+            return false;
+        }
+    }
+
+    if (!params->labCurve.enabled) {
+        return true;
+    }
+
+    if (histLCurve || params->labCurve.contrast != 0) {
+        // these need the L histogram of the whole image
+        return false;
+    }
+
+    struct LabCurves {
+        LUTf lcurve;
+        LUTf acurve;
+        LUTf bcurve;
+    };
+    std::shared_ptr<LabCurves> curves(new LabCurves());
+    curves->lcurve(32770, 0);
+    curves->acurve(65536);
+    curves->bcurve(65536);
+
+    LUTu hist16;
+    get_L_curve(curves->lcurve, params->labCurve.brightness, 0, params->labCurve.lcurve, hist16, scale);
+    get_ab_curves(curves->acurve, curves->bcurve, params->labCurve.acurve, params->labCurve.bcurve, scale);
+
+    const float chroma = (params->labCurve.chromaticity + 100.0f) / 100.0f;
+    TMatrix ws = ICCStore::getInstance()->workingSpaceMatrix(params->icm.workingProfile);
+    TMatrix iws = ICCStore::getInstance()->workingSpaceInverseMatrix(params->icm.workingProfile);
+
+    op =
+        [=](int thread_id, int W, float *r, float *g, float *b) -> void
+        {
+            rgb2lab_row(ws, W, r, g, b);
+            lab_adjustments_row(curves->lcurve, curves->acurve, curves->bcurve, chroma, W, g, r, b);
+            lab2rgb_row(iws, W, r, g, b);
+        };
+    return true;
+}
+
 } // namespace rtengine
@@ -248,7 +248,7 @@ void evaluate_params(wavelet_decomposition &wd, float *mean, float *meanN, float
 }
 
 
-void local_contrast_wavelets(array2D<float> &Y, const LocalContrastParams::Region &params, double scale, bool multiThread)
+void local_contrast_wavelets(array2D<float> &Y, const LocalContrastParams::Region &params, double scale, bool multiThread, const CancellationToken *cancel)
 {
     const int W = Y.width();
     const int H = Y.height();
@@ -364,6 +364,9 @@ void local_contrast_wavelets(array2D<float> &Y, const LocalContrastParams::Regio
 
     for (int dir = 1; dir < 4; dir++) {
         for (int level = 0; level < maxlvl; ++level) {
+            if (is_cancelled(cancel)) {
+                return;
+            }
             int W_L = wd.level_W(level);
             int H_L = wd.level_H(level);
             float **wl = wd.level_coeffs(level);
@@ -451,7 +454,7 @@ bool ImProcFunctions::localContrast(Imagefloat *rgb)
             show_mask_idx = -1;
         }
         std::vector<array2D<float>> mask(n);
-        if (!generateMasks(rgb, params->localContrast.labmasks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr)) {
+        if (!generateMasks(rgb, params->localContrast.labmasks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, &mask, nullptr, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr, cur_pipeline == Pipeline::PREVIEW || cur_pipeline == Pipeline::NAVIGATOR)) {
             return true; // show mask is active, nothing more to do
         }
 
@@ -460,18 +463,21 @@ bool ImProcFunctions::localContrast(Imagefloat *rgb)
         
         array2D<float> L(W, H, rgb->g.ptrs);
 
-        for (int i = 0; i < n; ++i) {
+        for (int i = 0; i < n && !cancelled(); ++i) {
             if (!params->localContrast.labmasks[i].enabled) {
                 continue;
             }
             
             auto &r = params->localContrast.regions[i];
-            local_contrast_wavelets(L, r, scale, multiThread);
+            local_contrast_wavelets(L, r, scale, multiThread, cancel_token);
             const auto &blend = mask[i];
 #ifdef _OPENMP
 #           pragma omp parallel for if (multiThread)
 #endif
             for (int y = 0; y < H; ++y) {
+                if (cancelled()) {
+                    continue;
+                }
                 for (int x = 0; x < W; ++x) {
                     float l = rgb->g(y, x);
                     rgb->g(y, x) = intp(blend[y][x], L[y][x], l);
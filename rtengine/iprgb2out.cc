@@ -26,6 +26,7 @@
 #include "curves.h"
 #include "alignedbuffer.h"
 #include "color.h"
+#include "simd.h"
 
 #define BENCHMARK
 #include "StopWatch.h"
@@ -36,6 +37,16 @@ extern const Settings* settings;
 
 namespace {
 
+inline void copyAndClampPlanarLine(const float *r, const float *g, const float *b, unsigned char *dst, const int W)
+{
+    for (int j = 0, i = 0; j < W; ++j) {
+        dst[i++] = uint16ToUint8Rounded(CLIP(r[j] * MAXVALF));
+        dst[i++] = uint16ToUint8Rounded(CLIP(g[j] * MAXVALF));
+        dst[i++] = uint16ToUint8Rounded(CLIP(b[j] * MAXVALF));
+    }
+}
+
+
 inline void copyAndClampLine(const float *src, unsigned char *dst, const int W, bool scale=true)
 {
     if (scale) {
@@ -56,6 +67,7 @@ inline void copyAndClamp(Imagefloat *src, unsigned char *dst, const float rgb_xy
     
     const int W = src->getWidth();
     const int H = src->getHeight();
+    const simd::Kernels *kernels = simd::get_kernels();
 
 #ifdef _OPENMP
         #pragma omp parallel for schedule(dynamic,16) if (multiThread)
@@ -67,6 +79,11 @@ inline void copyAndClamp(Imagefloat *src, unsigned char *dst, const float rgb_xy
         
         int ix = i * 3 * W;
 
+        if (kernels) {
+            kernels->xyz2rgb8(rx, ry, rz, dst + ix, W, rgb_xyz, Color::gamma2curve.getData());
+            continue;
+        }
+
         float R, G, B;
         float x_, y_, z_;
 
@@ -248,6 +265,7 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
         const int W = img->getWidth();
         const int H = img->getHeight();
         unsigned char * data = image->data;
+        const bool use_lut = monitorLut && !bypass_out;
 
         // cmsDoTransform is relatively expensive
 #ifdef _OPENMP
@@ -293,7 +311,12 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
                 }
 
                 iy = 0;
-                if (!bypass_out) {
+                if (use_lut) {
+                    // no interleaving needed, the output is in [0, 1] in
+                    // the three planes of outbuffer
+                    (*monitorLut)(monitorTransform, img->r(i), img->g(i), img->b(i), outbuffer, outbuffer + W, outbuffer + 2 * W, W);
+                    copyAndClampPlanarLine(outbuffer, outbuffer + W, outbuffer + 2 * W, data + ix, W);
+                } else if (!bypass_out) {
                     float *rr = img->r(i);
                     float *rg = img->g(i);
                     float *rb = img->b(i);
@@ -315,8 +338,10 @@ void ImProcFunctions::rgb2monitor(Imagefloat *img, Image8* image, bool bypass_ou
                     }
                 }
                 
-                cmsDoTransform(monitorTransform, buffer, outbuffer, W);
-                copyAndClampLine(outbuffer, data + ix, W);
+                if (!use_lut) {
+                    cmsDoTransform(monitorTransform, buffer, outbuffer, W);
+                    copyAndClampLine(outbuffer, data + ix, W);
+                }
 
                 if (gamutWarning) {
                     gamutWarning->markLine(image, i, gwSrcBuf.data, gwBuf1.data, gwBuf2.data);
@@ -371,6 +396,7 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
         img->setMode(Imagefloat::Mode::RGB, true);
 
         cmsHTRANSFORM hTransform = nullptr;
+        std::shared_ptr<const ICCLut> lut;
 
         ARTOutputProfile op(oprof, icm, img->colorSpace(), 256);
 
@@ -386,6 +412,10 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
             auto iprof = ICCStore::getInstance()->workingSpace(img->colorSpace());
             hTransform = cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);  // NOCACHE is important for thread safety
             lcmsMutex->unlock();
+
+            if (hTransform && settings->icc_lut_transforms) {
+                lut = ICCLut::get(Glib::ustring::compose("%1|%2|%3|%4", img->colorSpace(), profile, int(icm.outputIntent), flags), hTransform, iprof, oprof, ICCLut::PREVIEW_SIZE);
+            }
         }
 
         unsigned char *data = image->data;
@@ -412,6 +442,12 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
                 float* rg = img->g(i);
                 float* rb = img->b(i);
 
+                if (lut) {
+                    (*lut)(hTransform, rr + cx, rg + cx, rb + cx, outbuffer, outbuffer + cw, outbuffer + 2 * cw, cw);
+                    copyAndClampPlanarLine(outbuffer, outbuffer + cw, outbuffer + 2 * cw, data + ix, cw);
+                    continue;
+                }
+
                 for (int j = cx; j < cx + cw; j++) {
                     buffer[iy++] = rr[j] / 65535.f;
                     buffer[iy++] = rg[j] / 65535.f;
@@ -439,7 +475,7 @@ Image8* ImProcFunctions::rgb2out(Imagefloat *img, int cx, int cy, int cw, int ch
 }
 
 
-Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm)
+Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorManagementParams &icm, bool in_place)
 {
     //BENCHFUN
         
@@ -447,8 +483,10 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
     constexpr int cy = 0;
     const int cw = img->getWidth();
     const int ch = img->getHeight();
-        
-    Imagefloat* image = new Imagefloat(cw, ch);
+
+    // all the conversions below work pixel by pixel (or row by row through
+    // a temporary buffer), so they can also write to the input image
+    Imagefloat* image = in_place ? img : new Imagefloat(cw, ch);
     cmsHPROFILE oprof = ICCStore::getInstance()->getProfile(icm.outputProfile);
 
     if (oprof) {
@@ -472,7 +510,29 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
             cmsHTRANSFORM hTransform = cmsCreateTransform(iprof, TYPE_RGB_FLT, oprof, TYPE_RGB_FLT, icm.outputIntent, flags);
             lcmsMutex->unlock();
 
-            image->ExecCMSTransform(hTransform, img);
+            std::shared_ptr<const ICCLut> lut;
+            if (hTransform && settings->icc_lut_transforms) {
+                lut = ICCLut::get(Glib::ustring::compose("%1|%2|%3|%4", img->colorSpace(), icm.outputProfile, int(icm.outputIntent), flags), hTransform, iprof, oprof, cur_pipeline == Pipeline::OUTPUT ? ICCLut::OUTPUT_SIZE : ICCLut::PREVIEW_SIZE);
+            }
+
+            if (lut) {
+#ifdef _OPENMP
+#               pragma omp parallel for schedule(dynamic,16) if (multiThread)
+#endif
+                for (int y = 0; y < ch; ++y) {
+                    float *rr = image->r(y);
+                    float *rg = image->g(y);
+                    float *rb = image->b(y);
+                    (*lut)(hTransform, img->r(y), img->g(y), img->b(y), rr, rg, rb, cw);
+                    for (int x = 0; x < cw; ++x) {
+                        rr[x] *= 65535.f;
+                        rg[x] *= 65535.f;
+                        rb[x] *= 65535.f;
+                    }
+                }
+            } else {
+                image->ExecCMSTransform(hTransform, img);
+            }
             cmsDeleteTransform(hTransform);
         }
     } else if (icm.outputProfile != procparams::ColorManagementParams::NoProfileString) {
@@ -497,8 +557,16 @@ Imagefloat* ImProcFunctions::rgb2out(Imagefloat *img, const procparams::ColorMan
             }
         }
     } else {
-        img->copyTo(image);
-        image->setMode(Imagefloat::Mode::RGB, multiThread);
+        if (image != img) {
+            img->copyTo(image);
+            image->setMode(Imagefloat::Mode::RGB, multiThread);
+        }
+    }
+
+    if (in_place) {
+        // same state as a newly allocated image
+        image->assignMode(Imagefloat::Mode::RGB);
+        image->assignColorSpace("sRGB");
     }
 
     return image;
@@ -18,6 +18,8 @@
  *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <array>
+#include <memory>
 #include "improcfun.h"
 #include "curves.h"
 #include "color.h"
@@ -56,7 +58,21 @@ void RGBCurve(const std::vector<double>& curvePoints, LUTf & outCurve, int skip)
         outCurve.reset();
     }
 }
-   
+
+
+void apply_rgb_curves(const LUTf &rCurve, const LUTf &gCurve, const LUTf &bCurve, int W, float *r, float *g, float *b)
+{
+    if (rCurve) {
+        rCurve.lookup(r, r, W);
+    }
+    if (gCurve) {
+        gCurve.lookup(g, g, W);
+    }
+    if (bCurve) {
+        bCurve.lookup(b, b, W);
+    }
+}
+
 } // namespace
 
 
@@ -116,33 +132,36 @@ void ImProcFunctions::rgbCurves(Imagefloat *img)
 #       pragma omp parallel for if (multiThread)
 #endif
         for (int y = 0; y < H; ++y) {
-            int x = 0;
-#ifdef __SSE2__
-            for (; x < W-3; x += 4) {
-                if (rCurve) {
-                    STVF(img->r(y, x), rCurve[LVF(img->r(y, x))]);
-                }
-                if (gCurve) {
-                    STVF(img->g(y, x), gCurve[LVF(img->g(y, x))]);
-                }
-                if (bCurve) {
-                    STVF(img->b(y, x), bCurve[LVF(img->b(y, x))]);
-                }
-            }
-#endif // __SSE2__
-            for (; x < W; ++x) {
-                if (rCurve) {
-                    img->r(y, x) = rCurve[img->r(y, x)];
-                }
-                if (gCurve) {
-                    img->g(y, x) = gCurve[img->g(y, x)];
-                }
-                if (bCurve) {
-                    img->b(y, x) = bCurve[img->b(y, x)];
-                }
-            }
+            apply_rgb_curves(rCurve, gCurve, bCurve, W, img->r(y), img->g(y), img->b(y));
         }
     }
 }
 
+
+bool ImProcFunctions::rgbCurvesOp(PointwiseOp &op)
+{
+    EditUniqueID eid = pipetteBuffer ? pipetteBuffer->getEditID() : EUID_None;
+    if ((eid == EUID_RGB_R || eid == EUID_RGB_G || eid == EUID_RGB_B) && pipetteBuffer->getDataProvider()->getCurrSubscriber()->getPipetteBufferType() == BT_SINGLEPLANE_FLOAT) {
+        return false;
+    }
+    
+    if (!params->rgbCurves.enabled) {
+        return true;
+    }
+
+    std::shared_ptr<std::array<LUTf, 3>> curves(new std::array<LUTf, 3>());
+    RGBCurve(params->rgbCurves.rcurve, (*curves)[0], scale);
+    RGBCurve(params->rgbCurves.gcurve, (*curves)[1], scale);
+    RGBCurve(params->rgbCurves.bcurve, (*curves)[2], scale);
+
+    if ((*curves)[0] || (*curves)[1] || (*curves)[2]) {
+        op =
+            [curves](int thread_id, int W, float *r, float *g, float *b) -> void
+            {
+                apply_rgb_curves((*curves)[0], (*curves)[1], (*curves)[2], W, r, g, b);
+            };
+    }
+    return true;
+}
+
 } // namespace rtengine
@@ -41,45 +41,50 @@ float apply_vibrance(float x, float vib)
 } // namespace
 
 
-void ImProcFunctions::saturationVibrance(Imagefloat *rgb)
+bool ImProcFunctions::saturationVibranceOp(PointwiseOp &op)
 {
     if (params->saturation.enabled &&
         (params->saturation.saturation || params->saturation.vibrance)) {
-        rgb->setMode(Imagefloat::Mode::RGB, multiThread);
-        const int W = rgb->getWidth();
-        const int H = rgb->getHeight();
         const float saturation = 1.f + params->saturation.saturation / 100.f;
         const float vibrance = 1.f - params->saturation.vibrance / 1000.f;
         TMatrix ws = ICCStore::getInstance()->workingSpaceMatrix(params->icm.workingProfile);
         const float noise = pow_F(2.f, -16.f);
         const bool vib = params->saturation.vibrance;
-        
-#ifdef _OPENMP
-#       pragma omp parallel for if (multiThread)
-#endif
-        for (int i = 0; i < H; ++i) {
-            for (int j = 0; j < W; ++j) {
-                float &r = rgb->r(i, j);
-                float &g = rgb->g(i, j);
-                float &b = rgb->b(i, j);
-                float l = Color::rgbLuminance(r, g, b, ws);
-                float rl = r - l;
-                float gl = g - l;
-                float bl = b - l;
-                if (vib) {
-                    rl = apply_vibrance(rl, vibrance);
-                    gl = apply_vibrance(gl, vibrance);
-                    bl = apply_vibrance(bl, vibrance);
-                    assert(rl == rl);
-                    assert(gl == gl);
-                    assert(bl == bl);
+
+        op =
+            [=](int thread_id, int W, float *R, float *G, float *B) -> void
+            {
+                for (int j = 0; j < W; ++j) {
+                    float &r = R[j];
+                    float &g = G[j];
+                    float &b = B[j];
+                    float l = Color::rgbLuminance(r, g, b, ws);
+                    float rl = r - l;
+                    float gl = g - l;
+                    float bl = b - l;
+                    if (vib) {
+                        rl = apply_vibrance(rl, vibrance);
+                        gl = apply_vibrance(gl, vibrance);
+                        bl = apply_vibrance(bl, vibrance);
+                        assert(rl == rl);
+                        assert(gl == gl);
+                        assert(bl == bl);
+                    }
+                    r = max(l + saturation * rl, noise);
+                    g = max(l + saturation * gl, noise);
+                    b = max(l + saturation * bl, noise);
                 }
-                r = max(l + saturation * rl, noise);
-                g = max(l + saturation * gl, noise);
-                b = max(l + saturation * bl, noise);
-            }
-        }
+            };
     }
+    return true;
+}
+
+
+void ImProcFunctions::saturationVibrance(Imagefloat *rgb)
+{
+    PointwiseOp op;
+    saturationVibranceOp(op);
+    applyPointwise(rgb, { op });
 }
 
 } // namespace rtengine
@@ -318,7 +318,7 @@ enum class Channel {
 };
 
 
-void guided_smoothing(array2D<float> &R, array2D<float> &G, array2D<float> &B, const TMatrix &ws, const TMatrix &iws, Channel chan, int radius, float epsilon, double scale, bool multithread)
+void guided_smoothing(array2D<float> &R, array2D<float> &G, array2D<float> &B, const TMatrix &ws, const TMatrix &iws, Channel chan, int radius, float epsilon, double scale, bool multithread, const CancellationToken *cancel=nullptr)
 {
     const auto rgb2yuv =
         [&](float R, float G, float B, float &Y, float &u, float &v) -> void
@@ -345,9 +345,9 @@ void guided_smoothing(array2D<float> &R, array2D<float> &G, array2D<float> &B, c
         const bool luminance = (chan == Channel::L);
 
         if (rgb) {
-            rtengine::guidedFilterLog(10.f, R, r, epsilon, multithread);
-            rtengine::guidedFilterLog(10.f, G, r, epsilon, multithread);
-            rtengine::guidedFilterLog(10.f, B, r, epsilon, multithread);
+            rtengine::guidedFilterLog(10.f, R, r, epsilon, multithread, 0, cancel);
+            rtengine::guidedFilterLog(10.f, G, r, epsilon, multithread, 0, cancel);
+            rtengine::guidedFilterLog(10.f, B, r, epsilon, multithread, 0, cancel);
         } else {
             array2D<float> guide(W, H, ARRAY2D_ALIGNED);
 #ifdef _OPENMP
@@ -359,9 +359,9 @@ void guided_smoothing(array2D<float> &R, array2D<float> &G, array2D<float> &B, c
                     guide[y][x] = xlin2log(max(l, 0.f), 10.f);
                 }
             }
-            rtengine::guidedFilterLog(guide, 10.f, R, r, epsilon, multithread);
-            rtengine::guidedFilterLog(guide, 10.f, G, r, epsilon, multithread);
-            rtengine::guidedFilterLog(guide, 10.f, B, r, epsilon, multithread);
+            rtengine::guidedFilterLog(guide, 10.f, R, r, epsilon, multithread, 0, cancel);
+            rtengine::guidedFilterLog(guide, 10.f, G, r, epsilon, multithread, 0, cancel);
+            rtengine::guidedFilterLog(guide, 10.f, B, r, epsilon, multithread, 0, cancel);
 
 #ifdef _OPENMP
 #           pragma omp parallel for if (multithread)
@@ -705,7 +705,7 @@ void denoiseGuidedSmoothing(ImProcData &im, Imagefloat *rgb)
 
     const float c_eps = 0.001f;
 
-    guided_smoothing(R, G, B, ws, iws, Channel::C, im.params->denoise.guidedChromaRadius, c_eps, im.scale, im.multiThread);
+    guided_smoothing(R, G, B, ws, iws, Channel::C, im.params->denoise.guidedChromaRadius, c_eps, im.scale, im.multiThread, im.cancel_token);
     
     rgb->normalizeFloatTo65535(im.multiThread);
 }
@@ -740,7 +740,7 @@ bool ImProcFunctions::guidedSmoothing(Imagefloat *rgb)
             show_mask_idx = -1;
         }
         std::vector<array2D<float>> mask(n);
-        if (!generateMasks(rgb, params->smoothing.labmasks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, nullptr, &mask, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr)) {
+        if (!generateMasks(rgb, params->smoothing.labmasks, offset_x, offset_y, full_width, full_height, scale, multiThread, show_mask_idx, nullptr, &mask, cur_pipeline == Pipeline::NAVIGATOR ? plistener : nullptr, cur_pipeline == Pipeline::PREVIEW || cur_pipeline == Pipeline::NAVIGATOR)) {
             return true; // show mask is active, nothing more to do
         }
 
@@ -840,8 +840,8 @@ bool ImProcFunctions::guidedSmoothing(Imagefloat *rgb)
             } else {
                 const float epsilon = std::max(0.001f * std::pow(2, -r.epsilon), 1e-6);
                 int radius = r.radius;
-                for (int i = 0; i < r.iterations; ++i) {
-                    guided_smoothing(R, G, B, ws, iws, ch, radius, epsilon, scale, multiThread);
+                for (int i = 0; i < r.iterations && !cancelled(); ++i) {
+                    guided_smoothing(R, G, B, ws, iws, ch, radius, epsilon, scale, multiThread, cancel_token);
                 }
             }
             
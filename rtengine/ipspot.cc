@@ -26,6 +26,8 @@
 #include "guidedfilter.h"
 #include <iostream>
 #include <set>
+#include <vector>
+#include <algorithm>
 
 #define BENCHMARK
 #include "StopWatch.h"
@@ -82,71 +84,159 @@ inline float feather_factor(float x, float radius, float sigma)
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-void heal_laplace_loop(Imagefloat *img, const array2D<int32_t> &mask)
-{
-    const int width = img->getWidth();
-    const int height = img->getHeight();
-    
-    const int MAX_ITER = std::min(std::max(width, height) * 2, 1000);
+// Multigrid solver for the Laplace equation on the masked pixels of the
+// image, with the unmasked ones (and the image border) acting as Dirichlet
+// boundary conditions. Uses cell-centered V-cycles with red-black
+// Gauss-Seidel smoothing, so the result doesn't depend on the number of
+// threads
+class LaplaceMultigrid {
+public:
+    LaplaceMultigrid(const array2D<int32_t> &mask)
+    {
+        const int W = mask.width();
+        const int H = mask.height();
+
+        levels_.emplace_back(W, H);
+        auto &fine = levels_.back();
+        for (int y = 1; y < H-1; ++y) {
+            for (int x = 1; x < W-1; ++x) {
+                fine.interior[y * W + x] = (mask[y][x] != 0);
+            }
+        }
+
+        while (levels_.back().W > MIN_SIZE && levels_.back().H > MIN_SIZE) {
+            const Level &prev = levels_.back();
+            Level next((prev.W + 1) / 2, (prev.H + 1) / 2);
+            for (int y = 0; y < prev.H; ++y) {
+                for (int x = 0; x < prev.W; ++x) {
+                    if (prev.interior[y * prev.W + x]) {
+                        next.interior[(y/2) * next.W + x/2] = 1;
+                    }
+                }
+            }
+            levels_.push_back(std::move(next));
+        }
+    }
 
-    constexpr float w = 1.4f;
-    constexpr float w1 = 1.f - w;
-    constexpr float w2 = w / 4.f;
+    void operator()(float **chan)
+    {
+        Level &fine = levels_[0];
+        for (int y = 0; y < fine.H; ++y) {
+            std::copy(chan[y], chan[y] + fine.W, &fine.u[y * fine.W]);
+        }
 
-    const auto next =
-        [&](float **chan, int x, int y) -> void
+        for (int i = 0; i < NUM_CYCLES; ++i) {
+            vcycle(0);
+        }
+
+        for (int y = 0; y < fine.H; ++y) {
+            std::copy(&fine.u[y * fine.W], &fine.u[y * fine.W] + fine.W, chan[y]);
+        }
+    }
+
+private:
+    static constexpr int MIN_SIZE = 8;
+    static constexpr int NUM_CYCLES = 8;
+    static constexpr int NUM_SMOOTH = 2;
+    static constexpr int NUM_COARSEST_SMOOTH = 64;
+
+    struct Level {
+        int W;
+        int H;
+        std::vector<float> u; // solution (finest level) or correction
+        std::vector<float> f; // right hand side
+        std::vector<float> r; // residual
+        std::vector<uint8_t> interior;
+
+        Level(int w, int h):
+            W(w), H(h), u(w * h), f(w * h), r(w * h), interior(w * h) {}
+
+        float get(int x, int y) const
         {
-            float &cur = chan[y][x];
-            float left = chan[y][x-1];
-            float top = chan[y-1][x];
-            float right = chan[y][x+1];
-            float bottom = chan[y+1][x];
-            float upd = cur * w1 + (left + top + right + bottom) * w2;
-            cur = upd;
-        };
+            // the correction is 0 outside of the domain
+            return (x >= 0 && x < W && y >= 0 && y < H) ? u[y * W + x] : 0.f;
+        }
 
-#ifdef __SSE2__
-    const vfloat w1v = F2V(w1);
-    const vfloat w2v = F2V(w2);
-    const vint iZEROv = vcast_vi_i(0);
-    
-    const auto vnext =
-        [&](float **chan, int x, int y) -> void
+        float neighbours(int x, int y) const
         {
-            vfloat cur = LVFU(chan[y][x]);
-            vfloat left = LVFU(chan[y][x-1]);
-            vfloat top = LVFU(chan[y-1][x]);
-            vfloat right = LVFU(chan[y][x+1]);
-            vfloat bottom = LVFU(chan[y+1][x]);
-            vfloat upd = cur * w1v + (left + top + right + bottom) * w2v;
-            STVFU(chan[y][x], upd);
-        };
-#endif
+            return get(x-1, y) + get(x+1, y) + get(x, y-1) + get(x, y+1);
+        }
+    };
 
-    for (int iter = 0; iter < MAX_ITER; ++iter) {
-#ifdef _OPENMP
-#       pragma omp parallel for schedule(dynamic,16)
-#endif
-        for (int y = 1; y < height-1; ++y) {
-            int x = 1;
-#ifdef __SSE2__
-            for (; x < width-1-3; x+=4) {
-                vint m = _mm_loadu_si128(reinterpret_cast<vint *>(&mask[y][x]));
-                if (vtest(vnotm(vmaski_eq(m, iZEROv)))) {
-                    vnext(img->r.ptrs, x, y);
-                    vnext(img->g.ptrs, x, y);
-                    vnext(img->b.ptrs, x, y);
+    void smooth(Level &l, int iterations)
+    {
+        for (int i = 0; i < iterations; ++i) {
+            for (int color = 0; color < 2; ++color) {
+                for (int y = 0; y < l.H; ++y) {
+                    for (int x = (y + color) & 1; x < l.W; x += 2) {
+                        const int idx = y * l.W + x;
+                        if (l.interior[idx]) {
+                            l.u[idx] = 0.25f * (l.neighbours(x, y) + l.f[idx]);
+                        }
+                    }
                 }
             }
-#endif
-            for (; x < width-1; ++x) {
-                if (mask[y][x]) {
-                    next(img->r.ptrs, x, y);
-                    next(img->g.ptrs, x, y);
-                    next(img->b.ptrs, x, y);
+        }
+    }
+
+    void vcycle(size_t k)
+    {
+        Level &l = levels_[k];
+
+        if (k + 1 == levels_.size()) {
+            smooth(l, NUM_COARSEST_SMOOTH);
+            return;
+        }
+
+        smooth(l, NUM_SMOOTH);
+
+        // residual, restricted to the coarse level by summing 2x2 blocks
+        // (the coarse operator has a 4x larger grid spacing squared)
+        Level &c = levels_[k+1];
+        std::fill(c.f.begin(), c.f.end(), 0.f);
+        std::fill(c.u.begin(), c.u.end(), 0.f);
+        for (int y = 0; y < l.H; ++y) {
+            for (int x = 0; x < l.W; ++x) {
+                const int idx = y * l.W + x;
+                if (l.interior[idx]) {
+                    c.f[(y/2) * c.W + x/2] += l.f[idx] - (4.f * l.u[idx] - l.neighbours(x, y));
                 }
             }
         }
+
+        vcycle(k + 1);
+
+        // bilinear prolongation of the correction
+        for (int y = 0; y < l.H; ++y) {
+            const int cy = y / 2;
+            const int ny = LIM(cy + ((y & 1) ? 1 : -1), 0, c.H-1);
+            for (int x = 0; x < l.W; ++x) {
+                const int idx = y * l.W + x;
+                if (l.interior[idx]) {
+                    const int cx = x / 2;
+                    const int nx = LIM(cx + ((x & 1) ? 1 : -1), 0, c.W-1);
+                    l.u[idx] += 0.5625f * c.u[cy * c.W + cx] + 0.1875f * (c.u[cy * c.W + nx] + c.u[ny * c.W + cx]) + 0.0625f * c.u[ny * c.W + nx];
+                }
+            }
+        }
+
+        smooth(l, NUM_SMOOTH);
+    }
+
+    std::vector<Level> levels_;
+};
+
+
+void heal_laplace(Imagefloat *img, const array2D<int32_t> &mask)
+{
+    LaplaceMultigrid solver(mask);
+    float **chan[3] = { img->r.ptrs, img->g.ptrs, img->b.ptrs };
+
+#ifdef _OPENMP
+#   pragma omp parallel for firstprivate(solver)
+#endif
+    for (int c = 0; c < 3; ++c) {
+        solver(chan[c]);
     }
 }
 
@@ -187,7 +277,7 @@ void heal(Imagefloat *src, Imagefloat *dst,
             diff.b(y, x) = w * (dst->b(dy, dx) - src->b(sy, sx));
         }
     }
-    heal_laplace_loop(&diff, mask);
+    heal_laplace(&diff, mask);
 
     const float sigma = find_sigma(radius, featherRadius);
 
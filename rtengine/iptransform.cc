@@ -27,7 +27,10 @@
 #include "rtlensfun.h"
 #include "perspectivecorrection.h"
 #include "lensexif.h"
+#include "cache.h"
 #include "../rtgui/multilangmgr.h"
+#include <sstream>
+#include <memory>
 
 
 using namespace std;
@@ -360,6 +363,183 @@ void get_rotation(const ProcParams *params, double &cost, double &sint)
     }
 }
 
+
+// Coarse grid of the displacements computed by a LensCorrection, in the
+// coordinates of the full (uncropped) image. The displacement of each pixel
+// is obtained by bilinear interpolation of the grid, which is much cheaper
+// than calling the (virtual, double precision) correction functions for
+// every pixel. Lens distortion and CA are smooth enough that the
+// interpolation error is negligible
+class LensDisplacementMesh {
+public:
+    static constexpr int STEP = 16;
+
+    enum Channel {
+        DISTORTION = 0,
+        CA_RED = 1,
+        CA_GREEN = 2,
+        CA_BLUE = 3
+    };
+
+    LensDisplacementMesh(const LensCorrection *corr, int W, int H, double scale, bool distortion, bool ca, bool multiThread):
+        // one extra node on each side, for pixels at the borders
+        gw_(W / STEP + 3),
+        gh_(H / STEP + 3)
+    {
+        for (int c = 0; c < 4; ++c) {
+            if (c == DISTORTION ? distortion : ca) {
+                dx_[c].resize(gw_ * gh_);
+                dy_[c].resize(gw_ * gh_);
+            }
+        }
+
+#ifdef _OPENMP
+#       pragma omp parallel for if (multiThread)
+#endif
+        for (int j = 0; j < gh_; ++j) {
+            const double Y = (j - 1) * STEP;
+            for (int i = 0; i < gw_; ++i) {
+                const double X = (i - 1) * STEP;
+                const int idx = j * gw_ + i;
+                if (distortion) {
+                    double x = X, y = Y;
+                    corr->correctDistortion(x, y, 0, 0, scale);
+                    dx_[DISTORTION][idx] = x - scale * X;
+                    dy_[DISTORTION][idx] = y - scale * Y;
+                }
+                if (ca) {
+                    for (int c = 0; c < 3; ++c) {
+                        double x = X, y = Y;
+                        corr->correctCA(x, y, 0, 0, c);
+                        dx_[CA_RED + c][idx] = x - X;
+                        dy_[CA_RED + c][idx] = y - Y;
+                    }
+                }
+            }
+        }
+    }
+
+    // displacements of the pixels [0, width) of row y of a crop at (cx, cy).
+    // For DISTORTION, the corrected position of pixel x is
+    // (scale * x + dx[x], scale * y + dy[x]); for the CA channels, it is
+    // (x + dx[x], y + dy[x])
+    void getRow(Channel chan, int y, int cx, int cy, int width, float *dx, float *dy) const
+    {
+        const float *gx = dx_[chan].data();
+        const float *gy = dy_[chan].data();
+
+        const int Y = y + cy + STEP;
+        const int j = LIM(Y / STEP, 0, gh_ - 2);
+        const float ty = float(Y - j * STEP) / STEP;
+        const float *gx0 = gx + j * gw_;
+        const float *gx1 = gx0 + gw_;
+        const float *gy0 = gy + j * gw_;
+        const float *gy1 = gy0 + gw_;
+
+        const auto vlerp =
+            [ty](const float *r0, const float *r1, int i) -> float
+            {
+                return r0[i] + ty * (r1[i] - r0[i]);
+            };
+
+#ifdef __SSE2__
+        const vfloat rampv = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+        const vfloat fourv = F2V(4.f);
+#endif
+
+        for (int x = 0; x < width; ) {
+            const int X = x + cx + STEP;
+            const int i = LIM(X / STEP, 0, gw_ - 2);
+            // the last cell is extended to the end of the row
+            const int xend = (i == gw_ - 2) ? width : LIM((i + 1) * STEP - cx - STEP, x + 1, width);
+
+            // the displacement is linear within the cell
+            const float ax = vlerp(gx0, gx1, i);
+            const float sx = (vlerp(gx0, gx1, i + 1) - ax) / STEP;
+            const float ay = vlerp(gy0, gy1, i);
+            const float sy = (vlerp(gy0, gy1, i + 1) - ay) / STEP;
+            const float off = X - i * STEP;
+            float bx = ax + sx * off;
+            float by = ay + sy * off;
+
+#ifdef __SSE2__
+            if (xend - x >= 4) {
+                const vfloat sxv = F2V(sx);
+                const vfloat syv = F2V(sy);
+                vfloat bxv = F2V(bx) + sxv * rampv;
+                vfloat byv = F2V(by) + syv * rampv;
+                for (; x < xend - 3; x += 4) {
+                    STVFU(dx[x], bxv);
+                    STVFU(dy[x], byv);
+                    bxv += sxv * fourv;
+                    byv += syv * fourv;
+                    bx += 4.f * sx;
+                    by += 4.f * sy;
+                }
+            }
+#endif
+            for (; x < xend; ++x) {
+                dx[x] = bx;
+                dy[x] = by;
+                bx += sx;
+                by += sy;
+            }
+        }
+    }
+
+private:
+    int gw_;
+    int gh_;
+    std::vector<float> dx_[4];
+    std::vector<float> dy_[4];
+};
+
+// meshes are shared across preview updates and batch jobs with the same
+// lens setup
+Cache<Glib::ustring, std::shared_ptr<const LensDisplacementMesh>> lens_mesh_cache(8);
+
+
+std::shared_ptr<const LensDisplacementMesh> get_lens_mesh(const Glib::ustring &lens_id, const LensCorrection *corr, int W, int H, double scale, bool distortion, bool ca, bool multiThread)
+{
+    if (lens_id.empty() || !corr) {
+        return nullptr;
+    }
+
+    std::ostringstream buf;
+    buf.precision(17);
+    buf << lens_id << "|" << scale << "|" << distortion << "|" << ca;
+    const Glib::ustring key = buf.str();
+
+    std::shared_ptr<const LensDisplacementMesh> ret;
+    if (!lens_mesh_cache.get(key, ret)) {
+        ret = std::make_shared<const LensDisplacementMesh>(corr, W, H, scale, distortion, ca, multiThread);
+        lens_mesh_cache.set(key, ret);
+    }
+    return ret;
+}
+
+
+// identifies the lens correction computed by transform(), for caching
+// the displacement meshes
+Glib::ustring get_lens_id(const ProcParams *params, const FramesMetaData *metadata, int oW, int oH, int rawRotationDeg)
+{
+    const auto &lp = params->lensProf;
+    std::ostringstream buf;
+    buf.precision(9);
+    buf << int(lp.lcMode) << "|" << lp.lcpFile << "|" << lp.lfCameraMake << "|"
+        << lp.lfCameraModel << "|" << lp.lfLens << "|"
+        << metadata->getMake() << "|" << metadata->getModel() << "|" << metadata->getLens() << "|"
+        << metadata->getFocalLen() << "|" << metadata->getFocalLen35mm() << "|"
+        << metadata->getFocusDist() << "|" << metadata->getFNumber() << "|"
+        << oW << "x" << oH << "|" << params->coarse.rotate << "|"
+        << params->coarse.hflip << "|" << params->coarse.vflip << "|" << rawRotationDeg;
+    if (lp.useExif()) {
+        // the correction data is read from the file itself
+        buf << "|" << metadata->getFileName();
+    }
+    return buf.str();
+}
+
 } // namespace
 
 
@@ -578,6 +758,8 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
         }
     }
 
+    const Glib::ustring lens_id = pLCPMap ? get_lens_id(params, metadata, oW, oH, rawRotationDeg) : Glib::ustring();
+
     if (needsCA() || scale == 1) {
         highQuality = true;
     }
@@ -592,7 +774,13 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
         transformLuminanceOnly(original, transformed, cx, cy, oW, oH, fW, fH, false);
     } else {
         std::unique_ptr<Imagefloat> logimg;
-        if (do_encode) {
+        if (do_encode && in_place) {
+            // the caller doesn't need the input anymore, encode it in place
+            if (needs_luminance) {
+                transformLuminanceOnly(original, original, sx, sy, oW, oH, fW, fH, false);
+            }
+            encode(original, original, multiThread);
+        } else if (do_encode) {
             logimg.reset(new Imagefloat(original->getWidth(), original->getHeight()));
             if (needs_luminance) {
                 transformLuminanceOnly(original, logimg.get(), cx, cy, oW, oH, fW, fH, false);
@@ -614,7 +802,7 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
         }
         
         if (needs_transform_general) {
-            transformGeneral(highQuality, original, dest, dest_x, dest_y, sx, sy, oW, oH, fW, fH, pLCPMap.get());
+            transformGeneral(highQuality, original, dest, dest_x, dest_y, sx, sy, oW, oH, fW, fH, pLCPMap.get(), lens_id);
         } else {
             dest = original;
         }
@@ -628,7 +816,7 @@ void ImProcFunctions::transform(Imagefloat* original, Imagefloat* transformed, i
                 dest_x = sx;
                 dest_y = sy;
             }
-            transformLCPCAOnly(dest, out, dest_x, dest_y, pLCPMap.get());
+            transformLCPCAOnly(dest, out, dest_x, dest_y, oW, oH, pLCPMap.get(), lens_id);
             if (needs_perspective) {
                 tmpimg.reset(out);
                 dest = out;
@@ -1051,7 +1239,7 @@ void ImProcFunctions::transformLuminanceOnly(Imagefloat* original, Imagefloat* t
 }
 
 
-void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap)
+void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, Imagefloat *transformed, int cx, int cy, int sx, int sy, int oW, int oH, int fW, int fH, const LensCorrection *pLCPMap, const Glib::ustring &lens_id)
 {
     // set up stuff, depending on the mode we are
     bool enableLCPDist = pLCPMap && params->lensProf.useDist;
@@ -1104,6 +1292,9 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
 
     double ascale = params->commonTrans.autofill ? getTransformAutoFill (oW, oH, pLCPMap) : 1.0;
 
+    const auto mesh = enableLCPDist ? get_lens_mesh(lens_id, pLCPMap, oW, oH, ascale, true, false, multiThread) : nullptr;
+    const int W = transformed->getWidth();
+
     const bool use_enc = highQuality;
     constexpr float invalid = 0.f;
 
@@ -1117,14 +1308,31 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
     // main cycle
     bool darkening = (params->vignetting.amount <= 0.0);
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+    #pragma omp parallel if (multiThread)
 #endif
+{
+    std::vector<float> mesh_dx(mesh ? W : 0);
+    std::vector<float> mesh_dy(mesh ? W : 0);
 
+#ifdef _OPENMP
+    #pragma omp for
+#endif
     for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
+        if (cancelled()) {
+            continue;
+        }
+        if (mesh) {
+            mesh->getRow(LensDisplacementMesh::DISTORTION, y, cx, cy, W, mesh_dx.data(), mesh_dy.data());
+        }
+
+        for (int x = 0; x < W; x++) {
             double x_d = x, y_d = y;
 
-            if (enableLCPDist) {
+            if (mesh) {
+                // must be first transform
+                x_d = ascale * x + mesh_dx[x];
+                y_d = ascale * y + mesh_dy[x];
+            } else if (enableLCPDist) {
                 pLCPMap->correctDistortion(x_d, y_d, cx, cy, ascale); // must be first transform
             } else {
                 x_d *= ascale;
@@ -1250,9 +1458,10 @@ void ImProcFunctions::transformGeneral(bool highQuality, Imagefloat *original, I
         }
     }
 }
+}
 
 
-void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, const LensCorrection *pLCPMap)
+void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *transformed, int cx, int cy, int oW, int oH, const LensCorrection *pLCPMap, const Glib::ustring &lens_id)
 {
     assert(pLCPMap && params->lensProf.useCA && pLCPMap->isCACorrectionAvailable());
 
@@ -1266,17 +1475,40 @@ void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *trans
     chTrans[1] = transformed->g.ptrs;
     chTrans[2] = transformed->b.ptrs;
 
+    const auto mesh = get_lens_mesh(lens_id, pLCPMap, oW, oH, 1.0, false, true, multiThread);
+    const int W = transformed->getWidth();
+
 #ifdef _OPENMP
-    #pragma omp parallel for if (multiThread)
+    #pragma omp parallel if (multiThread)
 #endif
+{
+    std::vector<float> mesh_dx(mesh ? 3 * W : 0);
+    std::vector<float> mesh_dy(mesh ? 3 * W : 0);
 
+#ifdef _OPENMP
+    #pragma omp for
+#endif
     for (int y = 0; y < transformed->getHeight(); y++) {
-        for (int x = 0; x < transformed->getWidth(); x++) {
+        if (cancelled()) {
+            continue;
+        }
+        if (mesh) {
+            for (int c = 0; c < 3; ++c) {
+                mesh->getRow(LensDisplacementMesh::Channel(LensDisplacementMesh::CA_RED + c), y, cx, cy, W, &mesh_dx[c * W], &mesh_dy[c * W]);
+            }
+        }
+
+        for (int x = 0; x < W; x++) {
             for (int c = 0; c < 3; c++) {
                 double Dx = x;
                 double Dy = y;
-                
-                pLCPMap->correctCA(Dx, Dy, cx, cy, c);
+
+                if (mesh) {
+                    Dx += mesh_dx[c * W + x];
+                    Dy += mesh_dy[c * W + x];
+                } else {
+                    pLCPMap->correctCA(Dx, Dy, cx, cy, c);
+                }
 
                 // Extract integer and fractions of coordinates
                 int xc = (int)Dx;
@@ -1308,6 +1540,7 @@ void ImProcFunctions::transformLCPCAOnly(Imagefloat *original, Imagefloat *trans
         }
     }
 }
+}
 
 
 double ImProcFunctions::getTransformAutoFill (int oW, int oH, const LensCorrection *pLCPMap)
@@ -70,7 +70,8 @@ void LabImage::allocLab(size_t w, size_t h)
     a = new float*[h];
     b = new float*[h];
 
-    data = new float [w * h * 3];
+    buffer.resize(w * h * 3);
+    data = buffer.data;
     float * index = data;
 
     for (size_t i = 0; i < h; i++) {
@@ -95,7 +96,7 @@ void LabImage::deleteLab()
     delete [] L;
     delete [] a;
     delete [] b;
-    delete [] data;
+    buffer.resize(0);
 }
 
 void LabImage::reallocLab()
@@ -19,6 +19,8 @@
 #ifndef _LABIMAGE_H_
 #define _LABIMAGE_H_
 
+#include "alignedbuffer.h"
+
 namespace rtengine
 {
 
@@ -27,6 +29,8 @@ class LabImage
 private:
     void allocLab(size_t w, size_t h);
 
+    AlignedBuffer<float> buffer;
+
 public:
     int W, H;
     float * data;
@@ -34,10 +34,18 @@
 #include "rt_math.h"
 #include "opthelper.h"
 #include "rescale.h"
+#include "settings.h"
 #include "../rtgui/multilangmgr.h"
+#include "../rtgui/threadutils.h"
+#include <cstring>
+#include <list>
+#include <memory>
+#include <sstream>
 
 namespace rtengine {
 
+extern const Settings *settings;
+
 using procparams::AreaMask;
 using procparams::Mask;
 using procparams::DrawnMask;
@@ -800,10 +808,347 @@ bool mask_postprocess(int width, int height, float scale, const array2D<float> &
 }
 
 
+void copy_mask(const array2D<float> &src, array2D<float> &dst, bool multithread)
+{
+    const int W = src.width();
+    const int H = src.height();
+    dst(W, H);
+#ifdef _OPENMP
+#   pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        std::copy(src[y], src[y] + W, dst[y]);
+    }
+}
+
+
+// returns true if the drawn mask layers of a and b (before their opacity is
+// applied) can differ only because of the strokes after the first n
+bool same_drawn_settings(const DrawnMask &a, const DrawnMask &b, size_t &n)
+{
+    if (a.enabled != b.enabled || a.feather != b.feather || a.smoothness != b.smoothness || a.contrast != b.contrast || a.mode != b.mode) {
+        return false;
+    }
+    n = 0;
+    while (n < a.strokes.size() && n < b.strokes.size() && a.strokes[n] == b.strokes[n]) {
+        ++n;
+    }
+    return true;
+}
+
+
+// computes in mask the layer of new_mask, from the layer prev of old_mask
+// (see same_drawn_settings()), by regenerating only the area that the strokes
+// after the first n can affect. Returns false if that area is too large for
+// this to pay off, or if the changed strokes affect the whole layer
+bool update_drawn_mask(int ox, int oy, int width, int height, const DrawnMask &old_mask, const DrawnMask &new_mask, size_t n, const array2D<float> &prev, const array2D<float> &guide, bool multithread, array2D<float> &mask)
+{
+    const int W = guide.width();
+    const int H = guide.height();
+
+    if (new_mask.smoothness > 0.f) {
+        // the smoothing radius depends on all the strokes, and its tails
+        // reach well beyond any practical bounding box
+        return false;
+    }
+
+    // bounding box of the changed strokes (see StrokeEval in
+    // generate_drawn_mask())
+    int x1 = W, y1 = H, x2 = -1, y2 = -1;
+    const auto add =
+        [&](const DrawnMask::Stroke &s) -> void
+        {
+            const int r = std::min(width, height) * s.radius * 0.25;
+            const int cx = width * s.x - ox;
+            const int cy = height * s.y - oy;
+            x1 = std::min(x1, cx - r);
+            y1 = std::min(y1, cy - r);
+            x2 = std::max(x2, cx + r);
+            y2 = std::max(y2, cy + r);
+        };
+    for (size_t i = n; i < old_mask.strokes.size(); ++i) {
+        add(old_mask.strokes[i]);
+    }
+    for (size_t i = n; i < new_mask.strokes.size(); ++i) {
+        add(new_mask.strokes[i]);
+    }
+
+    // how far the feathering spreads the changes (the guided filter runs two
+    // box filters of the given radius, possibly on a subsampled grid)
+    int reach = 2;
+    if (new_mask.feather > 0) {
+        const int radius = int(new_mask.feather / 100.0 * std::min(width, height) * 0.1 + 0.5);
+        if (radius > 0) {
+            // the subsampled grid of the window matches that of the whole
+            // layer only if the layer size is a multiple of the factor
+            const int s = guidedFilterSubsampling(W, H, radius);
+            if (W % s != 0 || H % s != 0) {
+                return false;
+            }
+            reach += 2 * radius + 10;
+        }
+    }
+
+    // area to update
+    x1 = std::max(x1 - reach, 0);
+    y1 = std::max(y1 - reach, 0);
+    x2 = std::min(x2 + reach, W - 1);
+    y2 = std::min(y2 + reach, H - 1);
+
+    if (x1 > x2 || y1 > y2) {
+        copy_mask(prev, mask, multithread);
+        return true;
+    }
+
+    // area to regenerate, so that the one to update is computed as in the
+    // whole layer. It is aligned to a multiple of all the subsampling factors
+    // of guidedFilter(), and made larger than 600 pixels (if the layer is) so
+    // that the same factor as for the whole layer is used (see
+    // guidedFilterSubsampling())
+    constexpr int grid = 60;
+    constexpr int min_size = 11 * grid;
+    int wx1 = std::max(x1 - reach, 0) / grid * grid;
+    int wy1 = std::max(y1 - reach, 0) / grid * grid;
+    int wx2 = std::min((x2 + reach) / grid * grid + grid, W) - 1;
+    int wy2 = std::min((y2 + reach) / grid * grid + grid, H) - 1;
+    if (std::max(W, H) > 600 && std::max(wx2 - wx1, wy2 - wy1) < 600) {
+        if (W > 600) {
+            wx2 = std::min(wx1 + min_size, W) - 1;
+            wx1 = std::min(wx1, std::max(wx2 + 1 - min_size, 0) / grid * grid);
+        } else {
+            wy2 = std::min(wy1 + min_size, H) - 1;
+            wy1 = std::min(wy1, std::max(wy2 + 1 - min_size, 0) / grid * grid);
+        }
+    }
+    const int ww = wx2 - wx1 + 1;
+    const int wh = wy2 - wy1 + 1;
+    if (size_t(ww) * wh > size_t(W) * H / 2) {
+        return false;
+    }
+
+    array2D<float> wguide(ww, wh);
+    for (int y = 0; y < wh; ++y) {
+        std::copy(guide[y + wy1] + wx1, guide[y + wy1] + wx1 + ww, wguide[y]);
+    }
+    array2D<float> wmask;
+    if (!generate_drawn_mask(ox + wx1, oy + wy1, width, height, new_mask, wguide, multithread, wmask)) {
+        return false;
+    }
+
+    copy_mask(prev, mask, multithread);
+
+#ifdef _OPENMP
+#   pragma omp parallel for if (multithread)
+#endif
+    for (int y = y1; y <= y2; ++y) {
+        std::copy(wmask[y - wy1] + (x1 - wx1), wmask[y - wy1] + (x2 - wx1) + 1, mask[y] + x1);
+    }
+
+    return true;
+}
+
+
+inline uint64_t hash_data(const void *data, size_t size, uint64_t h)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(uint64_t));
+        h = (h ^ v) * 0x100000001b3ULL;
+    }
+    for (; size > 0; --size, ++p) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+
+// identifies the input of generateMasks(), apart from the mask parameters
+std::string mask_cache_key(Imagefloat *rgb, int offset_x, int offset_y, int full_width, int full_height, double scale, bool has_Lmask, bool has_abmask, bool multithread)
+{
+    const int W = rgb->getWidth();
+    const int H = rgb->getHeight();
+    constexpr uint64_t basis = 0xcbf29ce484222325ULL;
+
+    std::vector<uint64_t> rows(H);
+#ifdef _OPENMP
+#   pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        uint64_t h = hash_data(rgb->r.ptrs[y], W * sizeof(float), basis);
+        h = hash_data(rgb->g.ptrs[y], W * sizeof(float), h);
+        rows[y] = hash_data(rgb->b.ptrs[y], W * sizeof(float), h);
+    }
+
+    std::ostringstream buf;
+    buf.precision(9);
+    buf << std::hex << hash_data(rows.data(), rows.size() * sizeof(uint64_t), basis) << std::dec
+        << "|" << W << "x" << H << "|" << offset_x << "," << offset_y
+        << "|" << full_width << "x" << full_height << "|" << scale
+        << "|" << int(rgb->mode()) << "|" << rgb->colorSpace().raw()
+        << "|" << has_Lmask << has_abmask;
+    return buf.str();
+}
+
+
+/**
+ * The masks computed by the previous runs of generateMasks() in the editor.
+ *
+ * Each entry keeps the layers a mask is combined from (the parametric part,
+ * and the drawn and area layers), so that when only some of the parameters
+ * change the others are not recomputed. The parametric part is not kept when
+ * it is uniform, and the final mask is kept only when it can't be cheaply
+ * recombined from the layers (see keep_final_mask()).
+ * Entries are identified by the input image (see mask_cache_key()) and the
+ * index of the mask, and the least recently used ones are dropped when the
+ * total size exceeds settings->mask_cache_size.
+ */
+class MaskCache {
+public:
+    typedef std::shared_ptr<const array2D<float>> Layer;
+
+    struct Entry {
+        Mask params;
+        bool has_mask; // see generateMasks()
+        // parametric part, after the contrast threshold (empty if has_mask
+        // is false)
+        Layer base_L;
+        Layer base_ab;
+        Layer drawn;
+        Layer area;
+        // empty unless keep_final_mask()
+        Layer final_L;
+        Layer final_ab;
+
+        size_t size() const
+        {
+            size_t ret = 0;
+            for (auto &l : { base_L, base_ab, drawn, area, final_L, final_ab }) {
+                if (l) {
+                    ret += size_t(l->width()) * l->height() * sizeof(float);
+                }
+            }
+            return ret;
+        }
+    };
+    typedef std::shared_ptr<const Entry> EntryPtr;
+
+    MaskCache(): size_(0) {}
+
+    // returns the entry of mask idx computed with the same params if there
+    // is one, or the most recent entry of mask idx otherwise
+    EntryPtr find(const std::string &key, int idx, const Mask &params)
+    {
+        MyMutex::MyLock lock(mutex_);
+
+        auto found = items_.end();
+        for (auto it = items_.begin(); it != items_.end(); ++it) {
+            if (it->key == key && it->idx == idx) {
+                if (found == items_.end()) {
+                    found = it;
+                }
+                if (it->entry->params == params) {
+                    found = it;
+                    break;
+                }
+            }
+        }
+        if (found == items_.end()) {
+            return nullptr;
+        }
+        items_.splice(items_.begin(), items_, found);
+        return found->entry;
+    }
+
+    void store(const std::string &key, int idx, EntryPtr entry)
+    {
+        MyMutex::MyLock lock(mutex_);
+
+        for (auto it = items_.begin(); it != items_.end(); ) {
+            if (it->key == key && it->idx == idx && it->entry->params == entry->params) {
+                size_ -= it->size;
+                it = items_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        const size_t limit = size_t(std::max(settings->mask_cache_size, 0)) << 20;
+        const size_t sz = entry->size();
+        if (sz > limit) {
+            return;
+        }
+        items_.push_front({ key, idx, entry, sz });
+        size_ += sz;
+        while (size_ > limit) {
+            size_ -= items_.back().size;
+            items_.pop_back();
+        }
+    }
+
+private:
+    struct Item {
+        std::string key;
+        int idx;
+        EntryPtr entry;
+        size_t size;
+    };
+
+    MyMutex mutex_;
+    std::list<Item> items_; // most recently used first
+    size_t size_;
+};
+
+MaskCache mask_cache;
+
+
+// the final mask is worth caching only if mask_postprocess() runs the guided
+// filter on it, the other steps that combine the layers are pointwise
+inline bool keep_final_mask(const Mask &m)
+{
+    return m.posterization && m.smoothing;
+}
+
+
+void show_mask(Imagefloat *rgb, const array2D<float> *blend, bool multithread)
+{
+    const int W = rgb->getWidth();
+    const int H = rgb->getHeight();
+    const auto mode = rgb->mode();
+
+    TMatrix ws = ICCStore::getInstance()->workingSpaceMatrix(rgb->colorSpace());
+    TMatrix iws = ICCStore::getInstance()->workingSpaceInverseMatrix(rgb->colorSpace());
+    float wp[3][3];
+    float iwp[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            wp[i][j] = ws[i][j];
+            iwp[i][j] = iws[i][j];
+        }
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for if (multithread)
+#endif
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            auto v = blend ? (*blend)[y][x] : 0.f;
+            float l, a, b;
+            rgb2lab(mode, rgb->r(y, x), rgb->g(y, x), rgb->b(y, x), l, a, b, wp);
+            a = 0.f;
+            b = v * 42000.f;
+            l = LIM(l + 32768.f * v, 0.f, 32768.f);
+            Color::lab2rgb(l, a, b, rgb->r(y, x), rgb->g(y, x), rgb->b(y, x), iwp);
+        }
+    }
+    rgb->assignMode(Imagefloat::Mode::RGB);
+}
+
+
 } // namespace
 
 
-bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *plistener)
+bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *plistener, bool use_cache)
 {
     int n = masks.size();
     if (show_mask_idx < 0 || show_mask_idx >= n || !masks[show_mask_idx].enabled) {
@@ -859,8 +1204,190 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
     assert(!abmask || abmask->size() == size_t(n));
     assert(!Lmask || Lmask->size() == size_t(n));
 
+    // results of the previous runs that can be reused
+    std::vector<MaskCache::EntryPtr> cached(n);
+    std::string cache_key;
+    if (use_cache && settings->mask_cache_size > 0) {
+        cache_key = mask_cache_key(rgb, offset_x, offset_y, full_width, full_height, scale, Lmask, abmask, multithread);
+        for (int i = begin_idx; i < end_idx; ++i) {
+            cached[i] = mask_cache.find(cache_key, i, masks[i]);
+        }
+    }
+
+    const auto reuse_base =
+        [&](int i) -> bool
+        {
+            return cached[i] && cached[i]->has_mask == has_mask
+                && cached[i]->params.parametricMask == masks[i].parametricMask
+                && cached[i]->params.deltaEMask == masks[i].deltaEMask;
+        };
+    const auto reuse_final =
+        [&](int i) -> bool
+        {
+            return reuse_base(i) && cached[i]->params == masks[i];
+        };
+
+    // masks whose parametric part must be computed
+    std::vector<int> todo;
+    bool all_cached = true;
+    for (int i = begin_idx; i < end_idx; ++i) {
+        if (!reuse_base(i)) {
+            todo.push_back(i);
+        }
+        if (!reuse_final(i)) {
+            all_cached = false;
+        }
+    }
+
+    if (full_width < 0) {
+        full_width = W;
+    }
+    if (full_height < 0) {
+        full_height = H;
+    }
+
+    array2D<float> guide;
+
+    // sets the masks of i to its cached parametric part
+    const auto restore_base =
+        [&](int i) -> void
+        {
+            const auto &cur = cached[i];
+            if (abmask) {
+                if (cur->base_ab) {
+                    copy_mask(*cur->base_ab, (*abmask)[i], multithread);
+                } else {
+                    (*abmask)[i].fill(1.f);
+                }
+            }
+            if (Lmask) {
+                if (cur->base_L) {
+                    copy_mask(*cur->base_L, (*Lmask)[i], multithread);
+                } else {
+                    (*Lmask)[i].fill(1.f);
+                }
+            }
+        };
+
+    // combines the parametric part of mask i with its drawn and area layers,
+    // and applies the curve, inversion and opacity
+    const auto combine =
+        [&](int i, const MaskCache::Layer &drawn, const MaskCache::Layer &area) -> void
+        {
+            const auto &drawnMask = masks[i].drawnMask;
+
+            const auto apply_brush =
+                [&]() -> void
+                {
+                    const bool add = drawnMask.mode != DrawnMask::INTERSECT;
+                    const float alpha = LIM01(drawnMask.opacity);
+                    const auto &dmask = *drawn;
+#ifdef _OPENMP
+#                   pragma omp parallel for if (multithread)
+#endif
+                    for (int y = 0; y < H; ++y) {
+                        for (int x = 0; x < W; ++x) {
+                            const float f = alpha * dmask[y][x];
+                            if (add) {
+                                if (abmask) {
+                                    (*abmask)[i][y][x] = LIM01((*abmask)[i][y][x] + f);
+                                }
+                                if (Lmask) {
+                                    (*Lmask)[i][y][x] = LIM01((*Lmask)[i][y][x] + f);
+                                }
+                            } else {
+                                if (abmask) {
+                                    (*abmask)[i][y][x] *= f;
+                                }
+                                if (Lmask) {
+                                    (*Lmask)[i][y][x] *= f;
+                                }
+                            }
+                        }
+                    }
+                };
+
+            if (drawn && drawnMask.mode == DrawnMask::ADD_BOUNDED) {
+                apply_brush();
+            }
+
+            if (area) {
+                const auto &am = *area;
+#ifdef _OPENMP
+#               pragma omp parallel for if (multithread)
+#endif
+                for (int y = 0; y < H; ++y) {
+                    for (int x = 0; x < W; ++x) {
+                        if (abmask) {
+                            (*abmask)[i][y][x] *= am[y][x];
+                        }
+                        if (Lmask) {
+                            (*Lmask)[i][y][x] *= am[y][x];
+                        }
+                    }
+                }
+            }
+
+            if (drawn && drawnMask.mode != DrawnMask::ADD_BOUNDED) {
+                apply_brush();
+            }
+
+            // the guide is needed only if keep_final_mask(masks[i]), so it
+            // can be empty when the mask is recombined from the cache
+            const auto &curve = masks[i].curve;
+            auto posterization = masks[i].posterization;
+            auto smoothing = masks[i].smoothing;
+            if (abmask) {
+                mask_postprocess(full_width, full_height, scale, guide, curve, posterization, smoothing, multithread, (*abmask)[i]);
+            }
+            if (Lmask) {
+                mask_postprocess(full_width, full_height, scale, guide, curve, posterization, smoothing, multithread, (*Lmask)[i]);
+            }
+
+            if (masks[i].inverted) {
+#ifdef _OPENMP
+#               pragma omp parallel for if (multithread)
+#endif
+                for (int y = 0; y < H; ++y) {
+                    for (int x = 0; x < W; ++x) {
+                        if (abmask) {
+                            (*abmask)[i][y][x] = 1.f - (*abmask)[i][y][x];
+                        }
+                        if (Lmask) {
+                            (*Lmask)[i][y][x] = 1.f - (*Lmask)[i][y][x];
+                        }
+                    }
+                }
+            }
+            if (masks[i].opacity < 100) {
+                const float b = LIM01(float(masks[i].opacity) / 100.f);
+#ifdef _OPENMP
+#               pragma omp parallel for if (multithread)
+#endif
+                for (int y = 0; y < H; ++y) {
+                    for (int x = 0; x < W; ++x) {
+                        if (abmask) {
+                            (*abmask)[i][y][x] *= b;
+                        }
+                        if (Lmask) {
+                            (*Lmask)[i][y][x] *= b;
+                        }
+                    }
+                }
+            }
+        };
+
     bool has_lmask = false;
     for (int i = begin_idx; i < end_idx; ++i) {
+        if (reuse_final(i) && keep_final_mask(masks[i])) {
+            if (abmask) {
+                copy_mask(*cached[i]->final_ab, (*abmask)[i], multithread);
+            }
+            if (Lmask) {
+                copy_mask(*cached[i]->final_L, (*Lmask)[i], multithread);
+            }
+            continue;
+        }
         if (abmask) {
             (*abmask)[i](W, H, ARRAY2D_CLEAR_DATA);
         }
@@ -868,9 +1395,21 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
             (*Lmask)[i](W, H, ARRAY2D_CLEAR_DATA);
             has_lmask = true;
         }
+        if (reuse_final(i)) {
+            restore_base(i);
+            combine(i, cached[i]->drawn, cached[i]->area);
+        }
+    }
+
+    if (all_cached) {
+        if (show_mask_idx >= 0) {
+            show_mask(rgb, abmask ? &(*abmask)[show_mask_idx] : (Lmask ? &(*Lmask)[show_mask_idx] : nullptr), multithread);
+            return false;
+        }
+        return true;
     }
 
-    array2D<float> guide(W, H);
+    guide(W, H);
     TMatrix ws = ICCStore::getInstance()->workingSpaceMatrix(rgb->colorSpace());
     float wp[3][3];
     for (int i = 0; i < 3; ++i) {
@@ -880,7 +1419,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
     }
 
     array2D<float> LL;
-    if (has_lmask) {
+    if (has_lmask && !todo.empty()) {
         LL(W, H);
 
         constexpr float base_posterization = 40.f;
@@ -923,6 +1462,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
     constexpr float c_factor = 327.68f / 48000.f;
 
     DeltaEEvaluator dE(masks);
+    const bool eval = has_mask && !todo.empty();
 
 #ifdef _OPENMP
 #       pragma omp parallel if (multithread)
@@ -943,7 +1483,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
             for (int x = 0; x < W; ++x) {
                 rgb2lab(mode, rgb->r(y, x), rgb->g(y, x), rgb->b(y, x), lBuffer[x], aBuffer[x], bBuffer[x], wp);
             }
-            if (has_mask) {
+            if (eval) {
                 // vectorized precalculation
                 Color::Lab2Lch(aBuffer, bBuffer, cBuffer, hBuffer, W);
                 for (int x = 0; x < W; ++x) {
@@ -968,7 +1508,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
                 //     l = intp(ldetail, LL[y][x], l);
                 // }
 
-                if (has_mask) {
+                if (eval) {
 #ifdef __SSE2__
                     // use precalculated values
                     const float c = cBuffer[x];
@@ -987,7 +1527,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
                     }
                     h = xlin2log(h, 3.f);
 
-                    for (int i = begin_idx; i < end_idx; ++i) {
+                    for (int i : todo) {
                         auto &hm = hmask[i];
                         auto &cm = cmask[i];
                         auto &lm = lmask[i];
@@ -1016,7 +1556,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
 
         static constexpr float NO_BLUR = -10.f;
         
-        for (int i = begin_idx; i < end_idx; ++i) {
+        for (int i : todo) {
             float blur = masks[i].parametricMask.enabled ? masks[i].parametricMask.blur : 0.f;
             if (blur > NO_BLUR) {
                 blur = blur < 0.f ? -1.f/blur : 1.f + blur;
@@ -1055,7 +1595,7 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
             }
         }
     } else {
-        for (int i = begin_idx; i < end_idx; ++i) {
+        for (int i : todo) {
             if (Lmask) {
                 (*Lmask)[i].fill(1.f);
             }
@@ -1065,54 +1605,9 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
         }
     }
 
-    if (full_width < 0) {
-        full_width = W;
-    }
-    if (full_height < 0) {
-        full_height = H;
-    }
-
     array2D<float> amask;
 
-    const auto apply_brush =
-        [&](bool add_bounded) -> void
-        {
-            for (int i = begin_idx; i < end_idx; ++i) {
-                if ((masks[i].drawnMask.mode == DrawnMask::ADD_BOUNDED) != add_bounded) {
-                    continue;
-                }
-                if (generate_drawn_mask(offset_x, offset_y, full_width, full_height, masks[i].drawnMask, guide, multithread, amask)) {
-                    const bool add = masks[i].drawnMask.mode != DrawnMask::INTERSECT;
-                    const float alpha = LIM01(masks[i].drawnMask.opacity);
-#ifdef _OPENMP
-#                   pragma omp parallel for if (multithread)
-#endif
-                    for (int y = 0; y < H; ++y) {
-                        for (int x = 0; x < W; ++x) {
-                            const float f = alpha * amask[y][x];
-                            if (add) {
-                                if (abmask) {
-                                    (*abmask)[i][y][x] = LIM01((*abmask)[i][y][x] + f);
-                                }
-                                if (Lmask) {
-                                    (*Lmask)[i][y][x] = LIM01((*Lmask)[i][y][x] + f);
-                                }
-                            } else {
-                                if (abmask) {
-                                    (*abmask)[i][y][x] *= f;
-                                }
-                                if (Lmask) {
-                                    (*Lmask)[i][y][x] *= f;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        };
-    
-
-    for (int i = begin_idx; i < end_idx; ++i) {
+    for (int i : todo) {
         if (masks[i].parametricMask.enabled && 
             contrast_threshold_mask(full_width, full_height, scale, guide, masks[i].parametricMask.contrastThreshold, masks[i].parametricMask.blur, multithread, amask)) {
             bool neg = masks[i].parametricMask.contrastThreshold < 0;
@@ -1133,101 +1628,96 @@ bool generateMasks(Imagefloat *rgb, const std::vector<Mask> &masks, int offset_x
         }
     }
 
-    apply_brush(true);
-    
+    const auto copy_layer =
+        [&](const array2D<float> &src) -> MaskCache::Layer
+        {
+            auto ret = std::make_shared<array2D<float>>();
+            copy_mask(src, *ret, multithread);
+            return ret;
+        };
+
     for (int i = begin_idx; i < end_idx; ++i) {
-        if (generate_area_mask(offset_x, offset_y, full_width, full_height, guide, masks[i].areaMask, scale, multithread, amask, plistener)) {
-#ifdef _OPENMP
-#           pragma omp parallel for if (multithread)
-#endif
-            for (int y = 0; y < H; ++y) {
-                for (int x = 0; x < W; ++x) {
-                    if (abmask) {
-                        (*abmask)[i][y][x] *= amask[y][x];
-                    }
-                    if (Lmask) {
-                        (*Lmask)[i][y][x] *= amask[y][x];
-                    }
-                }
-            }
+        if (reuse_final(i)) {
+            continue;
         }
-    }
 
-    apply_brush(false);
-
-    for (int i = begin_idx; i < end_idx; ++i) {
-        const auto &curve = masks[i].curve;
-        auto posterization = masks[i].posterization;
-        auto smoothing = masks[i].smoothing;
-        if (abmask) {
-            mask_postprocess(full_width, full_height, scale, guide, curve, posterization, smoothing, multithread, (*abmask)[i]);
+        const auto &cur = cached[i];
+        std::shared_ptr<MaskCache::Entry> entry;
+        if (!cache_key.empty()) {
+            entry = std::make_shared<MaskCache::Entry>();
+            entry->params = masks[i];
+            entry->has_mask = has_mask;
         }
-        if (Lmask) {
-            mask_postprocess(full_width, full_height, scale, guide, curve, posterization, smoothing, multithread, (*Lmask)[i]);
+
+        if (reuse_base(i)) {
+            restore_base(i);
+            if (entry) {
+                entry->base_ab = cur->base_ab;
+                entry->base_L = cur->base_L;
+            }
+        } else if (entry && has_mask) {
+            if (abmask) {
+                entry->base_ab = copy_layer((*abmask)[i]);
+            }
+            if (Lmask) {
+                entry->base_L = copy_layer((*Lmask)[i]);
+            }
         }
-    }
-    
-    for (int i = begin_idx; i < end_idx; ++i) {
-        if (masks[i].inverted) {
-#ifdef _OPENMP
-#           pragma omp parallel for if (multithread)
-#endif
-            for (int y = 0; y < H; ++y) {
-                for (int x = 0; x < W; ++x) {
-                    if (abmask) {
-                        (*abmask)[i][y][x] = 1.f - (*abmask)[i][y][x];
-                    }
-                    if (Lmask) {
-                        (*Lmask)[i][y][x] = 1.f - (*Lmask)[i][y][x];
+
+        // drawn layer: reused if only its opacity changed, and updated only
+        // around the changed strokes if the other strokes are the same
+        const auto &drawnMask = masks[i].drawnMask;
+        MaskCache::Layer drawn;
+        if (!drawnMask.isTrivial()) {
+            size_t n = 0;
+            if (cur && cur->drawn && same_drawn_settings(cur->params.drawnMask, drawnMask, n)) {
+                if (n == drawnMask.strokes.size() && n == cur->params.drawnMask.strokes.size()) {
+                    drawn = cur->drawn;
+                } else {
+                    auto d = std::make_shared<array2D<float>>();
+                    if (update_drawn_mask(offset_x, offset_y, full_width, full_height, cur->params.drawnMask, drawnMask, n, *cur->drawn, guide, multithread, *d)) {
+                        drawn = d;
                     }
                 }
             }
-        }
-        if (masks[i].opacity < 100) {
-            const float b = LIM01(float(masks[i].opacity) / 100.f);
-#ifdef _OPENMP
-#           pragma omp parallel for if (multithread)
-#endif
-            for (int y = 0; y < H; ++y) {
-                for (int x = 0; x < W; ++x) {
-                    if (abmask) {
-                        (*abmask)[i][y][x] *= b;
-                    }
-                    if (Lmask) {
-                        (*Lmask)[i][y][x] *= b;
-                    }
+            if (!drawn) {
+                auto d = std::make_shared<array2D<float>>();
+                if (generate_drawn_mask(offset_x, offset_y, full_width, full_height, drawnMask, guide, multithread, *d)) {
+                    drawn = d;
                 }
             }
         }
-    }
 
-    if (show_mask_idx >= 0) {
-        TMatrix iws = ICCStore::getInstance()->workingSpaceInverseMatrix(rgb->colorSpace());
-        float iwp[3][3];
-        for (int i = 0; i < 3; ++i) {
-            for (int j = 0; j < 3; ++j) {
-                iwp[i][j] = iws[i][j];
+        // area layer
+        MaskCache::Layer area;
+        if (cur && cur->params.areaMask == masks[i].areaMask) {
+            area = cur->area;
+        } else {
+            auto a = std::make_shared<array2D<float>>();
+            if (generate_area_mask(offset_x, offset_y, full_width, full_height, guide, masks[i].areaMask, scale, multithread, *a, plistener)) {
+                area = a;
             }
         }
-        
-        auto *smask = abmask ? abmask : Lmask;
-        
-#ifdef _OPENMP
-        #pragma omp parallel for if (multithread)
-#endif
-        for (int y = 0; y < H; ++y) {
-            for (int x = 0; x < W; ++x) {
-                auto blend = smask ? (*smask)[show_mask_idx][y][x] : 0.f;
-                float l, a, b;
-                rgb2lab(mode, rgb->r(y, x), rgb->g(y, x), rgb->b(y, x), l, a, b, wp);
-                a = 0.f;
-                b = blend * 42000.f;
-                l = LIM(l + 32768.f * blend, 0.f, 32768.f);
-                Color::lab2rgb(l, a, b, rgb->r(y, x), rgb->g(y, x), rgb->b(y, x), iwp);
+
+        combine(i, drawn, area);
+
+        if (entry) {
+            entry->drawn = drawn;
+            entry->area = area;
+            if (keep_final_mask(masks[i])) {
+                if (abmask) {
+                    entry->final_ab = copy_layer((*abmask)[i]);
+                }
+                if (Lmask) {
+                    entry->final_L = copy_layer((*Lmask)[i]);
+                }
             }
+            mask_cache.store(cache_key, i, entry);
         }
-        rgb->assignMode(Imagefloat::Mode::RGB);
+    }
 
+    if (show_mask_idx >= 0) {
+        show_mask(rgb, abmask ? &(*abmask)[show_mask_idx] : (Lmask ? &(*Lmask)[show_mask_idx] : nullptr), multithread);
         return false;
     }
 
@@ -28,7 +28,13 @@
 
 namespace rtengine {
 
-bool generateMasks(Imagefloat *rgb, const std::vector<procparams::Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *pl);
+// if use_cache is true, the masks (and their drawn, area and parametric
+// parts) are taken from the results of the previous calls when their
+// parameters and the input image did not change, and the drawn ones
+// without smoothness are updated only around the changed strokes. Meant for
+// the editor, where the masks are edited interactively (see
+// settings->mask_cache_size)
+bool generateMasks(Imagefloat *rgb, const std::vector<procparams::Mask> &masks, int offset_x, int offset_y, int full_width, int full_height, double scale, bool multithread, int show_mask_idx, std::vector<array2D<float>> *Lmask, std::vector<array2D<float>> *abmask, ProgressListener *pl, bool use_cache=false);
 
 enum class MasksEditID { H = 0, C, L };
 void fillPipetteMasks(Imagefloat *rgb, PlanarWhateverData<float> *editWhatever, MasksEditID id, bool multithread);
@@ -132,6 +132,29 @@ inline unsigned char* fdata(ssize_t offset, IMFILE* f)
     return (unsigned char*)f->data + offset;
 }
 
+/*
+  Moves the cursor forward to pos, for decoders that read the data directly
+  from f->data (e.g. with a rtengine::BitReader). The skipped bytes are
+  accounted for in the progress bar, so calling this once per row gives
+  row-granularity progress reporting.
+ */
+inline void imfile_consume(IMFILE* f, ssize_t pos)
+{
+    if (pos <= f->pos || pos > f->size) {
+        return;
+    }
+
+    if (f->plistener) {
+        f->progress_current += pos - f->pos;
+
+        if (f->progress_current >= f->progress_next) {
+            imfile_update_progress(f);
+        }
+    }
+
+    f->pos = pos;
+}
+
 int fscanf (IMFILE* f, const char* s ...);
 char* fgets (char* s, ssize_t n, IMFILE* f);
 
@@ -0,0 +1,232 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "perftrace.h"
+#include "bufferpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#include <glib/gstdio.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace rtengine { namespace perf {
+
+namespace {
+
+thread_local Trace *current_trace = nullptr;
+std::atomic<int> next_tid(1);
+
+
+int thread_id()
+{
+    thread_local int tid = next_tid++;
+    return tid;
+}
+
+
+double now()
+{
+    static const auto origin = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+
+std::string escape(const std::string &s)
+{
+    std::string res;
+    res.reserve(s.size());
+    for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            res += buf;
+        } else {
+            res += c;
+        }
+    }
+    return res;
+}
+
+} // namespace
+
+
+void Trace::add(Event &&event)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(std::move(event));
+}
+
+
+std::vector<Event> Trace::events() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return events_;
+}
+
+
+TraceScope::TraceScope(Trace *trace):
+    prev_(current_trace)
+{
+    current_trace = trace;
+}
+
+
+TraceScope::~TraceScope()
+{
+    current_trace = prev_;
+}
+
+
+Scope::Scope(const char *category, const char *name):
+    trace_(current_trace)
+{
+    if (trace_) {
+        event_.name = name;
+        event_.category = category;
+        start();
+    }
+}
+
+
+Scope::Scope(const char *category, const std::string &name):
+    trace_(current_trace)
+{
+    if (trace_) {
+        event_.name = name;
+        event_.category = category;
+        start();
+    }
+}
+
+
+void Scope::start()
+{
+#ifdef _OPENMP
+    event_.threads = omp_get_max_threads();
+#else
+    event_.threads = 1;
+#endif
+    event_.tid = thread_id();
+    event_.bytes = buffer_pool::total_allocated();
+    event_.start = now();
+}
+
+
+Scope::~Scope()
+{
+    if (trace_) {
+        event_.duration = now() - event_.start;
+        event_.bytes = buffer_pool::total_allocated() - event_.bytes;
+        trace_->add(std::move(event_));
+    }
+}
+
+
+Trace *current()
+{
+    return current_trace;
+}
+
+
+bool write_json(const std::string &fname, const std::vector<const Trace *> &traces)
+{
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    const char *sep = "\n";
+    int pid = 0;
+    for (auto t : traces) {
+        if (!t) {
+            continue;
+        }
+        ++pid;
+        out << sep << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"args\": {\"name\": \"" << escape(t->label()) << "\"}}";
+        sep = ",\n";
+        for (const auto &e : t->events()) {
+            out << sep << "{\"name\": \"" << escape(e.name) << "\", \"cat\": \"" << e.category
+                << "\", \"ph\": \"X\", \"pid\": " << pid << ", \"tid\": " << e.tid
+                << ", \"ts\": " << int64_t(e.start) << ", \"dur\": " << int64_t(e.duration)
+                << ", \"args\": {\"threads\": " << e.threads << ", \"bytes\": " << e.bytes << "}}";
+        }
+    }
+    out << "\n]}\n";
+
+    FILE *f = g_fopen(fname.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+    const std::string data = out.str();
+    const bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return (fclose(f) == 0) && ok;
+}
+
+
+std::string summary(const Trace &trace, size_t max_events)
+{
+    auto events = trace.events();
+    if (events.empty()) {
+        return "";
+    }
+
+    // the scopes are recorded when they end, so the enclosing ones come
+    // after the nested ones; an event is outermost if no other event
+    // contains it
+    double total = 0;
+    for (const auto &e : events) {
+        bool outer = true;
+        for (const auto &o : events) {
+            if (&o != &e && o.start <= e.start && o.start + o.duration >= e.start + e.duration && o.duration > e.duration) {
+                outer = false;
+                break;
+            }
+        }
+        if (outer) {
+            total += e.duration;
+        }
+    }
+
+    std::sort(events.begin(), events.end(),
+              [](const Event &a, const Event &b) -> bool
+              {
+                  return a.duration > b.duration;
+              });
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1);
+    out << trace.label() << ": " << total / 1000.0 << " ms";
+    for (size_t i = 0; i < events.size() && i < max_events; ++i) {
+        const auto &e = events[i];
+        out << "\n" << e.category << "/" << e.name << ": " << e.duration / 1000.0
+            << " ms, " << e.threads << " threads, " << double(e.bytes) / (1 << 20) << " MB";
+    }
+    return out.str();
+}
+
+}} // namespace rtengine::perf
@@ -0,0 +1,111 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+namespace rtengine { namespace perf {
+
+/******************************************************************************
+ * Lightweight tracing of the processing of an image.
+ *
+ * A Trace is activated for the calling thread with a TraceScope, and then
+ * every Scope created by the same thread while it is active records an
+ * event with its wall time, the thread that created it, the number of
+ * threads available to OpenMP, and the bytes allocated through
+ * AlignedBuffer during the scope. The allocation counter is process-wide,
+ * so that the allocations of the OpenMP workers are included; when several
+ * images are processed concurrently, it also includes those of the other
+ * jobs. When no trace is active (the default), a Scope costs only a
+ * thread-local read.
+ *
+ * Traces can be exported in the Chrome trace-event format (a JSON file that
+ * can be loaded by chrome://tracing or https://ui.perfetto.dev), one
+ * process per trace, or summarized as text (e.g. for the editor).
+ ******************************************************************************/
+
+struct Event {
+    std::string name;
+    const char *category;
+    double start;     // in microseconds, from an arbitrary process-wide origin
+    double duration;  // in microseconds
+    int tid;          // small process-wide id of the recording thread
+    int threads;
+    size_t bytes;
+};
+
+
+class Trace {
+public:
+    explicit Trace(const std::string &label): label_(label) {}
+
+    void add(Event &&event);
+    const std::string &label() const { return label_; }
+    std::vector<Event> events() const;
+
+private:
+    std::string label_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+};
+
+
+class TraceScope {
+public:
+    explicit TraceScope(Trace *trace);
+    ~TraceScope();
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    Trace *prev_;
+};
+
+
+class Scope {
+public:
+    Scope(const char *category, const char *name);
+    Scope(const char *category, const std::string &name);
+    ~Scope();
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    void start();
+
+    Trace *trace_;
+    Event event_;
+};
+
+
+/// the trace active for the calling thread, or nullptr
+Trace *current();
+
+/// writes the given traces to fname in the Chrome trace-event format
+bool write_json(const std::string &fname, const std::vector<const Trace *> &traces);
+
+/// a human-readable summary of the trace: the total time of the outermost
+/// events, followed by the max_events slowest events, one per line
+std::string summary(const Trace &trace, size_t max_events=10);
+
+}} // namespace rtengine::perf
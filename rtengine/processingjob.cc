@@ -33,6 +33,15 @@ ProcessingJob* ProcessingJob::create (InitialImage* initialImage, const procpara
     return new ProcessingJobImpl (initialImage, pparams, fast);
 }
 
+ProcessingJob::Output::Output(const procparams::ProcParams &pparams):
+    resize(pparams.resize),
+    prsharpening(pparams.prsharpening),
+    outputProfile(pparams.icm.outputProfile),
+    outputIntent(pparams.icm.outputIntent),
+    outputBPC(pparams.icm.outputBPC)
+{
+}
+
 void ProcessingJob::destroy (ProcessingJob* job)
 {
 
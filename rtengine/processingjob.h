@@ -35,6 +35,7 @@ public:
     procparams::ProcParams pparams;
     bool fast;
     bool use_batch_profile;
+    std::vector<Output> outputs;
 
     ProcessingJobImpl (const Glib::ustring& fn, bool iR, const procparams::ProcParams& pp, bool ff, bool ubp=true)
         : fname(fn), isRaw(iR), initialImage(nullptr), pparams(pp), fast(ff), use_batch_profile(ubp) {}
@@ -53,6 +54,7 @@ public:
     }
 
     bool fastPipeline() const override { return fast; }
+    void addOutput(const Output &out) override { outputs.push_back(out); }
 };
 
 }
@@ -17,16 +17,109 @@
 #include "utils.h"
 #include "metadata.h"
 #include "image8.h"
+#include "perftrace.h"
 
 #ifdef ART_USE_LIBRAW
 # include <libraw.h>
 #endif // ART_USE_LIBRAW
 
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
 
 namespace rtengine {
 
 extern const Settings *settings;
-extern MyMutex *librawMutex;
+
+namespace {
+
+#ifdef _OPENMP
+
+/*
+ * LibRaw runs OpenMP parallel regions inside unpack() and raw2image(), and
+ * so do some of the internal decoders (e.g. the tiled DNG ones). If
+ * several instances decode at the same time with a full team of threads
+ * each, the machine gets heavily oversubscribed. Instead of serializing the
+ * decoders, we split the available threads among them: each decoder gets
+ * its share of the threads (according to the number of decoders running
+ * and the expected concurrency set with RawImage::setMaxConcurrentDecoders),
+ * capped by the threads that are still free. Decoders never wait: when no
+ * thread is free they run with a single one, so the oversubscription is
+ * bounded by the number of concurrent decoders.
+ */
+class DecoderThreadScheduler {
+public:
+    class Slot {
+    public:
+        explicit Slot(DecoderThreadScheduler &parent):
+            parent_(parent),
+            prev_(omp_get_max_threads()),
+            num_(parent.acquire())
+        {
+            omp_set_num_threads(num_);
+        }
+
+        ~Slot()
+        {
+            omp_set_num_threads(prev_);
+            parent_.release(num_);
+        }
+
+    private:
+        DecoderThreadScheduler &parent_;
+        int prev_;
+        int num_;
+    };
+
+    static DecoderThreadScheduler &getInstance()
+    {
+        static DecoderThreadScheduler instance;
+        return instance;
+    }
+
+    void setMaxConcurrent(int n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_concurrent_ = std::max(n, 1);
+    }
+
+private:
+    DecoderThreadScheduler():
+        total_(std::max(omp_get_num_procs(), 1)), used_(0), active_(0),
+        max_concurrent_(1) {}
+
+    int acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++active_;
+        const int share = total_ / std::max(active_, max_concurrent_);
+        const int n = std::max(std::min(share, total_ - used_), 1);
+        used_ += n;
+        return n;
+    }
+
+    void release(int n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        used_ -= n;
+        --active_;
+    }
+
+    const int total_;
+    int used_;
+    int active_;
+    int max_concurrent_;
+    std::mutex mutex_;
+};
+
+#endif // _OPENMP
+
+} // namespace
 
 
 RawImage::RawImage(const Glib::ustring &name)
@@ -51,6 +144,14 @@ RawImage::RawImage(const Glib::ustring &name)
 }
 
 
+void RawImage::setMaxConcurrentDecoders(int n)
+{
+#ifdef _OPENMP
+    DecoderThreadScheduler::getInstance().setMaxConcurrent(n);
+#endif
+}
+
+
 RawImage::~RawImage()
 {
     if (ifp) {
@@ -765,7 +866,18 @@ int RawImage::loadRaw (bool loadData, unsigned int imageNum, bool closeFile, Pro
 
             // Load raw pixels data
             fseek(ifp, data_offset, SEEK_SET);
-            (this->*load_raw)();
+            {
+#ifdef _OPENMP
+                // only the decoders running parallel regions get a share of
+                // the threads, the others don't need to take one
+                std::unique_ptr<DecoderThreadScheduler::Slot> slot;
+                if (has_parallel_decoder()) {
+                    slot.reset(new DecoderThreadScheduler::Slot(DecoderThreadScheduler::getInstance()));
+                }
+#endif
+                perf::Scope scope("decode", "internal");
+                (this->*load_raw)();
+            }
         } else {
 #ifdef ART_USE_LIBRAW
             libraw_->imgdata.rawparams.shot_select = shot_select;
@@ -776,8 +888,9 @@ int RawImage::loadRaw (bool loadData, unsigned int imageNum, bool closeFile, Pro
             }
             {
 #ifdef LIBRAW_USE_OPENMP
-                MyMutex::MyLock lock(*librawMutex);
+                DecoderThreadScheduler::Slot slot(DecoderThreadScheduler::getInstance());
 #endif
+                perf::Scope scope("decode", "libraw");
                 err = libraw_->unpack();
             }
             if (err) {
@@ -796,7 +909,7 @@ int RawImage::loadRaw (bool loadData, unsigned int imageNum, bool closeFile, Pro
                 }
             } else {
 #ifdef LIBRAW_USE_OPENMP
-                MyMutex::MyLock lock(*librawMutex);
+                DecoderThreadScheduler::Slot slot(DecoderThreadScheduler::getInstance());
 #endif
                 float_raw_image = nullptr;
                 err = libraw_->raw2image();
@@ -85,6 +85,9 @@ public:
     bool has_gain_map(std::vector<uint8_t> *out_buf) const;
 
     static void initCameraConstants(Glib::ustring baseDir);
+    // number of images expected to be decoded at the same time, used to
+    // split the OpenMP threads among the concurrent decoders (default 1)
+    static void setMaxConcurrentDecoders(int n);
     std::string get_filename() const { return filename; }
     int get_width() const { return width; }
     int get_height() const { return height; }
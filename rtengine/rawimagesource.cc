@@ -18,6 +18,7 @@
  */
 #include <cmath>
 #include <iostream>
+#include <sstream>
 
 #include "rtengine.h"
 #include "rawimagesource.h"
@@ -37,6 +38,9 @@
 #include "pdaflinesfilter.h"
 #include "camconst.h"
 #include "lensexif.h"
+#include "demosaiccache.h"
+#include "perftrace.h"
+#include "utils.h"
 #include "../rtgui/multilangmgr.h"
 #define BENCHMARK
 #include "StopWatch.h"
@@ -608,6 +612,8 @@ RawImageSource::RawImageSource ()
     , fuji(false)
     , d1x(false)
     , border(4)
+    , cancel_token(nullptr)
+    , useDemosaicCache(false)
     , chmax{}
     , hlmax{}
     , clmax{}
@@ -1473,6 +1479,7 @@ int RawImageSource::load (const Glib::ustring &fname, bool firstFrameOnly)
 void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lensProf, const CoarseTransformParams& coarse, bool prepareDenoise, const ColorTemp &wb)
 {
 //    BENCHFUN
+    perf::Scope scope("raw", "preprocess");
     MyTime t1, t2;
     t1.set();
 
@@ -1564,6 +1571,25 @@ void RawImageSource::preprocess(const RAWParams &raw, const LensProfParams &lens
         printf( "Flat Field Correction:%s\n", rif->get_filename().c_str());
     }
 
+    preprocessKey.clear();
+    if (useDemosaicCache && demosaic_cache::enabled()) {
+        // everything the preprocessed raw data depends on: the file
+        // identity, the raw params, the calibration frames and the wb
+        ProcParams pp;
+        pp.raw = raw;
+        pp.lensProf = lensProf;
+        pp.coarse = coarse;
+        std::ostringstream key;
+        key << getMD5(fileName, true) << "\n" << pp.to_data()
+            << "\n" << currFrame
+            << "\n" << (rid ? rid->get_filename() : Glib::ustring())
+            << "\n" << (rif ? rif->get_filename() : Glib::ustring());
+        for (int i = 0; i < 4; ++i) {
+            key << " " << ref_pre_mul[i];
+        }
+        preprocessKey = key.str();
+    }
+
     if(numFrames == 4) {
         int bufferNumber = 0;
         for(unsigned int i=0; i<4; ++i) {
@@ -1850,6 +1876,26 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
     MyTime t1, t2;
     t1.set();
 
+    perf::Scope scope("demosaic", ri->getSensorType() == ST_BAYER ? RAWParams::BayerSensor::getMethodString(raw.bayersensor.method) : ri->getSensorType() == ST_FUJI_XTRANS ? RAWParams::XTransSensor::getMethodString(raw.xtranssensor.method) : Glib::ustring("none"));
+
+    // the fast methods are not worth caching, and pixel shift depends on
+    // more than the rgb planes
+    const bool cacheable = !preprocessKey.empty()
+        && ((ri->getSensorType() == ST_BAYER && raw.bayersensor.method != RAWParams::BayerSensor::Method::FAST && raw.bayersensor.method != RAWParams::BayerSensor::Method::MONO && raw.bayersensor.method != RAWParams::BayerSensor::Method::NONE && raw.bayersensor.method != RAWParams::BayerSensor::Method::PIXELSHIFT)
+            || (ri->getSensorType() == ST_FUJI_XTRANS && raw.xtranssensor.method != RAWParams::XTransSensor::Method::FAST && raw.xtranssensor.method != RAWParams::XTransSensor::Method::MONO && raw.xtranssensor.method != RAWParams::XTransSensor::Method::NONE));
+    std::string cacheKey;
+    if (cacheable) {
+        ProcParams pp;
+        pp.raw = raw;
+        std::ostringstream key;
+        key << preprocessKey << "\n" << pp.to_data() << "\n" << autoContrast << " " << border << "\n" << demosaic_cache::VERSION;
+        cacheKey = Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, key.str());
+        if (demosaic_cache::load(cacheKey, W, H, red, green, blue, contrastThreshold)) {
+            rgbSourceModified = false;
+            return;
+        }
+    }
+
     double raw_expos = raw.enable_whitepoint ? raw.expos : 1.0;
 
     if (ri->getSensorType() == ST_BAYER) {
@@ -1945,6 +1991,10 @@ void RawImageSource::demosaic(const RAWParams &raw, bool autoContrast, double &c
 
     rgbSourceModified = false;
 
+    if (cacheable && !is_cancelled(cancel_token)) {
+        demosaic_cache::store(cacheKey, W, H, red, green, blue, contrastThreshold);
+    }
+
 
     if( settings->verbose ) {
         if (getSensorType() == ST_BAYER) {
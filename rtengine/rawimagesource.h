@@ -66,6 +66,9 @@ protected:
     bool fuji;
     bool d1x;
     int border;
+    const CancellationToken *cancel_token;
+    bool useDemosaicCache;
+    std::string preprocessKey; // identifies the input of demosaic() in the demosaic cache, empty if not cacheable
     float chmax[4], hlmax[4], clmax[4];
     double initialGain; // initial gain calculated after scale_colors
     double camInitialGain;
@@ -125,6 +128,8 @@ public:
     void HLRecovery_Global(const ExposureParams &hrp) override;
     void refinement(int PassCount);
     void setBorder(unsigned int rawBorder) override {border = rawBorder;}
+    void setCancellationToken(const CancellationToken *token) override { cancel_token = token; }
+    void setUseDemosaicCache(bool yes) override { useDemosaicCache = yes; }
     bool isRGBSourceModified() const override
     {
         return rgbSourceModified;   // tracks whether cached rgb output of demosaic has been modified
@@ -111,6 +111,9 @@ void RawImageSource::rcd_demosaic()
 #endif
     for (int tr = 0; tr < numTh; ++tr) {
         for (int tc = 0; tc < numTw; ++tc) {
+            if (is_cancelled(cancel_token)) {
+                continue;
+            }
             const int rowStart = tr * tileSizeN;
             const int rowEnd = std::min(rowStart + tileSize, H);
             if (rowStart + tileBorder == rowEnd - tileBorder) {
@@ -0,0 +1,357 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resample.h"
+#include "imagefloat.h"
+#include "alignedbuffer.h"
+#include "cache.h"
+#include "opthelper.h"
+#include "rt_math.h"
+#include "sleef.h"
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#ifdef _OPENMP
+#   include <omp.h>
+#endif
+
+namespace rtengine {
+
+namespace {
+
+inline float Lanc(float x, float a)
+{
+    if (x * x < 1e-6f) {
+        return 1.0f;
+    } else if (x * x > a * a) {
+        return 0.0f;
+    } else {
+        x = static_cast<float> (rtengine::RT_PI) * x;
+        return a * xsinf (x) * xsinf (x / a) / (x * x);
+    }
+}
+
+
+inline float Mitchell(float x)
+{
+    constexpr float B = 1.f / 3.f;
+    constexpr float C = 1.f / 3.f;
+
+    x = std::abs(x);
+    if (x < 1.f) {
+        return ((12.f - 9.f * B - 6.f * C) * x * x * x + (-18.f + 12.f * B + 6.f * C) * x * x + (6.f - 2.f * B)) / 6.f;
+    } else if (x < 2.f) {
+        return ((-B - 6.f * C) * x * x * x + (6.f * B + 30.f * C) * x * x + (-12.f * B - 48.f * C) * x + (8.f * B + 24.f * C)) / 6.f;
+    } else {
+        return 0.f;
+    }
+}
+
+
+/**
+ * Weights for resampling a line of src_size samples into one of dst_size
+ * samples. For each output sample j, the weights of the source samples
+ * [begin[j], begin[j] + taps) are in weights[j * taps]. taps is a multiple of
+ * 4, and begin[j] + taps <= src_size whenever taps <= src_size, so that the
+ * horizontal pass can read whole vectors from the source rows; the non-zero
+ * weights are those of the samples in [first[j], last[j]).
+ */
+class ResampleKernel {
+public:
+    ResampleKernel(int src_size, int dst_size, float scale, ResampleFilter filter);
+
+    int taps;
+    std::vector<int> begin;
+    std::vector<int> first;
+    std::vector<int> last;
+    AlignedBuffer<float> weights;
+};
+
+
+ResampleKernel::ResampleKernel(int src_size, int dst_size, float scale, ResampleFilter filter):
+    taps(0),
+    begin(dst_size),
+    first(dst_size),
+    last(dst_size),
+    weights()
+{
+    const float delta = 1.0f / scale;
+    const float sc = min(scale, 1.0f);
+
+    float radius = 3.f;
+    switch (filter) {
+    case ResampleFilter::LANCZOS2: radius = 2.f; break;
+    case ResampleFilter::MITCHELL: radius = 2.f; break;
+    case ResampleFilter::BOX: radius = 0.5f + 0.5f * sc; break;
+    default: break;
+    }
+    // half-width of the kernel in source samples
+    const float r = radius / sc;
+
+    taps = (static_cast<int>(2.f * r) + 1 + 3) & ~3;
+    weights.resize(size_t(taps) * dst_size);
+    std::fill(weights.data, weights.data + size_t(taps) * dst_size, 0.f);
+
+    for (int j = 0; j < dst_size; ++j) {
+        // x coord of the center of pixel on src image
+        const float x0 = (static_cast<float>(j) + 0.5f) * delta - 0.5f;
+
+        first[j] = max(0, static_cast<int>(floorf(x0 - r)) + 1);
+        last[j] = max(first[j] + 1, min(src_size, static_cast<int>(floorf(x0 + r)) + 1));
+        if (first[j] >= src_size) {
+            first[j] = src_size - 1;
+            last[j] = src_size;
+        }
+        begin[j] = taps <= src_size ? min(first[j], src_size - taps) : 0;
+
+        float *w = weights.data + size_t(taps) * j - begin[j];
+        float ws = 0.f;
+
+        for (int jj = first[j]; jj < last[j]; ++jj) {
+            const float z = sc * (x0 - static_cast<float>(jj));
+            switch (filter) {
+            case ResampleFilter::LANCZOS3:
+                w[jj] = Lanc(z, 3.f);
+                break;
+            case ResampleFilter::LANCZOS2:
+                w[jj] = Lanc(z, 2.f);
+                break;
+            case ResampleFilter::MITCHELL:
+                w[jj] = Mitchell(z);
+                break;
+            case ResampleFilter::BOX:
+                // overlap of the source pixel with the footprint of the
+                // output one, in output pixel units
+                w[jj] = max(0.f, min(z + 0.5f * sc, 0.5f) - max(z - 0.5f * sc, -0.5f));
+                break;
+            }
+            ws += w[jj];
+        }
+
+        if (ws == 0.f) {
+            // can happen only with the box filter at the borders: take the
+            // nearest sample
+            const int jj = LIM(static_cast<int>(x0 + 0.5f), first[j], last[j] - 1);
+            w[jj] = 1.f;
+            ws = 1.f;
+        }
+
+        // normalize weights
+        for (int jj = first[j]; jj < last[j]; ++jj) {
+            w[jj] /= ws;
+        }
+    }
+}
+
+
+// kernels are shared across batch jobs and renditions with the same sizes
+Cache<std::string, std::shared_ptr<const ResampleKernel>> kernel_cache(16);
+
+std::shared_ptr<const ResampleKernel> get_kernel(int src_size, int dst_size, float scale, ResampleFilter filter)
+{
+    std::ostringstream buf;
+    buf.precision(9);
+    buf << src_size << "|" << dst_size << "|" << scale << "|" << int(filter);
+    const std::string key = buf.str();
+
+    std::shared_ptr<const ResampleKernel> ret;
+    if (!kernel_cache.get(key, ret)) {
+        ret = std::make_shared<const ResampleKernel>(src_size, dst_size, scale, filter);
+        kernel_cache.set(key, ret);
+    }
+    return ret;
+}
+
+
+// horizontal pass: filters src (which must be readable up to
+// kernel.begin[j] + kernel.taps for all j) into dst
+void resample_row(const ResampleKernel &kernel, const float *src, float *dst, int dst_size)
+{
+    const int taps = kernel.taps;
+    const int *begin = &kernel.begin[0];
+    const float *w = kernel.weights.data;
+
+    for (int j = 0; j < dst_size; ++j, w += taps) {
+        const float *s = src + begin[j];
+#ifdef __SSE2__
+        vfloat sumv = ZEROV;
+        for (int k = 0; k < taps; k += 4) {
+            sumv += LVFU(s[k]) * LVF(w[k]);
+        }
+        dst[j] = vhadd(sumv);
+#else
+        float sum = 0.f;
+        for (int k = 0; k < taps; ++k) {
+            sum += s[k] * w[k];
+        }
+        dst[j] = sum;
+#endif
+    }
+}
+
+
+// vertical pass: output row i of the plane from the rows of the ring buffer.
+// rows is scratch space for kernel.taps row pointers
+void resample_column(const ResampleKernel &kernel, int i, float **ring, int ring_size, const float **rows, float *dst, int dst_size)
+{
+    const int y0 = kernel.first[i];
+    const int n = kernel.last[i] - y0;
+    const float *w = kernel.weights.data + size_t(kernel.taps) * i + (y0 - kernel.begin[i]);
+
+    for (int k = 0; k < n; ++k) {
+        rows[k] = ring[(y0 + k) % ring_size];
+    }
+
+    int j = 0;
+#ifdef __SSE2__
+    for (; j < dst_size - 3; j += 4) {
+        vfloat sumv = ZEROV;
+        for (int k = 0; k < n; ++k) {
+            sumv += F2V(w[k]) * LVFU(rows[k][j]);
+        }
+        STVFU(dst[j], sumv);
+    }
+#endif
+    for (; j < dst_size; ++j) {
+        float sum = 0.f;
+        for (int k = 0; k < n; ++k) {
+            sum += w[k] * rows[k][j];
+        }
+        dst[j] = sum;
+    }
+}
+
+
+struct OutputState {
+    std::shared_ptr<const ResampleKernel> hkernel;
+    std::shared_ptr<const ResampleKernel> vkernel;
+    int width;
+    int height;
+};
+
+} // namespace
+
+
+void resample(const Imagefloat *src, const std::vector<ResampleOutput> &out, bool multithread)
+{
+    const int sW = src->getWidth();
+    const int sH = src->getHeight();
+
+    std::vector<OutputState> state;
+    for (auto &o : out) {
+        state.emplace_back();
+        auto &s = state.back();
+        s.width = o.img->getWidth();
+        s.height = o.img->getHeight();
+        s.hkernel = get_kernel(sW, s.width, o.scale, o.filter);
+        s.vkernel = get_kernel(sH, s.height, o.scale, o.filter);
+        o.img->assignMode(src->mode());
+    }
+
+    float **const splanes[3] = { src->r.ptrs, src->g.ptrs, src->b.ptrs };
+
+#ifdef _OPENMP
+#   pragma omp parallel if (multithread)
+#endif
+    {
+#ifdef _OPENMP
+        const int nbands = omp_get_num_threads();
+        const int band = omp_get_thread_num();
+#else
+        const int nbands = 1;
+        const int band = 0;
+#endif
+        const size_t n = out.size();
+
+        // per output: rows [i0, i1) produced by this band, next row to
+        // produce, and source rows [y0, y1) needed for them
+        std::vector<int> i0(n), i1(n), next(n), y0(n), y1(n);
+        std::vector<AlignedBuffer<float>> ringbuf(n);
+        std::vector<std::vector<float *>> ring(n);
+        int ystart = sH, yend = 0;
+        int maxtaps = 0;
+        int maxvtaps = 0;
+
+        for (size_t o = 0; o < n; ++o) {
+            const auto &s = state[o];
+            const auto &vk = *s.vkernel;
+            i0[o] = int(int64_t(s.height) * band / nbands);
+            i1[o] = int(int64_t(s.height) * (band + 1) / nbands);
+            next[o] = i0[o];
+            if (i0[o] < i1[o]) {
+                y0[o] = vk.first[i0[o]];
+                y1[o] = vk.last[i1[o] - 1];
+                ystart = min(ystart, y0[o]);
+                yend = max(yend, y1[o]);
+
+                const size_t stride = (s.width + 3) & ~3;
+                ringbuf[o].resize(3 * vk.taps * stride);
+                ring[o].resize(3 * vk.taps);
+                for (int k = 0; k < 3 * vk.taps; ++k) {
+                    ring[o][k] = ringbuf[o].data + k * stride;
+                }
+            }
+            maxtaps = max(maxtaps, s.hkernel->taps);
+            maxvtaps = max(maxvtaps, vk.taps);
+        }
+
+        // row pointers for resample_column
+        std::vector<const float *> rows(maxvtaps);
+
+        // copy of the source row, for sources narrower than the kernel
+        AlignedBuffer<float> linebuf(maxtaps > sW ? maxtaps : 0);
+        if (linebuf.data) {
+            std::fill(linebuf.data, linebuf.data + maxtaps, 0.f);
+        }
+
+        for (int y = ystart; y < yend; ++y) {
+            for (size_t o = 0; o < n; ++o) {
+                if (y < y0[o] || y >= y1[o]) {
+                    continue;
+                }
+                const auto &s = state[o];
+                const int rsize = s.vkernel->taps;
+
+                for (int c = 0; c < 3; ++c) {
+                    const float *line = splanes[c][y];
+                    if (s.hkernel->taps > sW) {
+                        std::copy(line, line + sW, linebuf.data);
+                        line = linebuf.data;
+                    }
+                    resample_row(*s.hkernel, line, ring[o][c * rsize + y % rsize], s.width);
+                }
+
+                float **const dplanes[3] = { out[o].img->r.ptrs, out[o].img->g.ptrs, out[o].img->b.ptrs };
+
+                for (; next[o] < i1[o] && s.vkernel->last[next[o]] - 1 <= y; ++next[o]) {
+                    for (int c = 0; c < 3; ++c) {
+                        resample_column(*s.vkernel, next[o], &ring[o][c * rsize], rsize, rows.data(), dplanes[c][next[o]], s.width);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void resample(const Imagefloat *src, Imagefloat *dst, float scale, ResampleFilter filter, bool multithread)
+{
+    resample(src, { ResampleOutput(dst, scale, filter) }, multithread);
+}
+
+} // namespace rtengine
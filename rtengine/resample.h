@@ -0,0 +1,66 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace rtengine {
+
+class Imagefloat;
+
+/******************************************************************************
+ * Separable resampling of Imagefloat planes.
+ *
+ * Each source row is first filtered horizontally, and the result is kept in a
+ * ring buffer as tall as the vertical kernel; output rows are produced by the
+ * vertical pass as soon as all the rows they depend on are in the buffer. The
+ * source is therefore read only once, also when several outputs are
+ * requested. The image is split in horizontal bands, one per thread.
+ *
+ * The kernel tables (start position and normalized weights of each output
+ * sample) depend only on the source and destination sizes, the scale and the
+ * filter, and are shared through a process-wide cache.
+ *
+ * The planes are resampled as they are, in the current mode of the source.
+ ******************************************************************************/
+
+enum class ResampleFilter {
+    LANCZOS3,
+    LANCZOS2,
+    MITCHELL, // Mitchell-Netravali, B = C = 1/3
+    BOX       // area average when downscaling, linear when upscaling
+};
+
+struct ResampleOutput {
+    Imagefloat *img; // allocated with the desired output size
+    float scale;     // output / input size, usually img width / src width
+    ResampleFilter filter;
+
+    ResampleOutput(Imagefloat *i, float s, ResampleFilter f=ResampleFilter::LANCZOS3):
+        img(i), scale(s), filter(f) {}
+};
+
+// resamples src into all the given outputs, in a single pass over src. The
+// outputs are set to the same mode as src
+void resample(const Imagefloat *src, const std::vector<ResampleOutput> &out, bool multithread);
+
+// convenience overload for a single output
+void resample(const Imagefloat *src, Imagefloat *dst, float scale, ResampleFilter filter, bool multithread);
+
+} // namespace rtengine
@@ -37,6 +37,7 @@
 #include "sleef.h"
 #include "../rtgui/threadutils.h"
 #include "imagefloat.h"
+#include "fftwplans.h"
 
 #define BENCHMARK
 #include "StopWatch.h"
@@ -742,7 +743,7 @@ void do_convolution(fftwf_plan fwd_plan, fftwf_plan inv_plan, fftwf_complex *ker
         }
     }
 
-    fftwf_execute(fwd_plan);
+    fftwf_execute_dft_r2c(fwd_plan, buf, buf_fft);
 
 #ifdef _OPENMP
 #   pragma omp parallel for if (multithread)
@@ -757,7 +758,7 @@ void do_convolution(fftwf_plan fwd_plan, fftwf_plan inv_plan, fftwf_complex *ker
         }
     }
 
-    fftwf_execute(inv_plan);
+    fftwf_execute_dft_c2r(inv_plan, buf_fft, buf);
 
     const int K = 2 * kernel_radius;
     const float norm = pH * pW;
@@ -792,9 +793,8 @@ fftwf_complex *prepare_kernel(const array2D<float> &kernel, float *buf, int pW,
         }
     }
 
-    auto plan = fftwf_plan_dft_r2c_2d(pH, pW, buf, kernel_fft, FFTW_ESTIMATE);
-    fftwf_execute(plan);
-    fftwf_destroy_plan(plan);
+    auto plan = fftw::plan_dft_r2c_2d(pH, pW, buf, kernel_fft, FFTW_MEASURE);
+    fftwf_execute_dft_r2c(plan, buf, kernel_fft);
 
     return kernel_fft;
 }
@@ -826,13 +826,6 @@ struct ConvolutionData {
         if (K == kernel.height()) {
             MyMutex::MyLock lock(*fftwMutex);
 
-#ifdef RT_FFTW3F_OMP
-            if (multithread) {
-                fftwf_init_threads();
-                fftwf_plan_with_nthreads(omp_get_num_procs());
-            }
-#endif
-            
             this->W = W;
             this->H = H;
             pW = find_fast_dim(W + K);
@@ -842,19 +835,25 @@ struct ConvolutionData {
             buf_fft = fftwf_alloc_complex(pH * (pW / 2 + 1));
             kernel_fft = prepare_kernel(kernel, buf, pW, pH, false);
 
-            fwd_plan = fftwf_plan_dft_r2c_2d(pH, pW, buf, buf_fft, FFTW_ESTIMATE);
-            inv_plan = fftwf_plan_dft_c2r_2d(pH, pW, buf_fft, buf, FFTW_ESTIMATE);
+            get_plans();
         }
     }
 
+    // the plans are owned by the fftw plan cache, and they are valid only
+    // while fftwMutex is held
+    void get_plans()
+    {
+#ifdef _OPENMP
+        const int nthreads = multithread ? omp_get_num_procs() : 1;
+#else
+        const int nthreads = 1;
+#endif
+        fwd_plan = fftw::plan_dft_r2c_2d(pH, pW, buf, buf_fft, FFTW_MEASURE, nthreads);
+        inv_plan = fftw::plan_dft_c2r_2d(pH, pW, buf_fft, buf, FFTW_MEASURE, nthreads);
+    }
+
     ~ConvolutionData()
     {
-        if (inv_plan) {
-            fftwf_destroy_plan(inv_plan);
-        }
-        if (fwd_plan) {
-            fftwf_destroy_plan(fwd_plan);
-        }
         if (kernel_fft) {
             fftwf_free(kernel_fft);
         }
@@ -888,6 +887,9 @@ void Convolution::operator()(float **src, float **dst)
     ConvolutionData *d = static_cast<ConvolutionData *>(data_);
     MyMutex::MyLock lock(*fftwMutex);
 
+    if (d->kernel_fft) {
+        d->get_plans();
+    }
     do_convolution(d->fwd_plan, d->inv_plan, d->kernel_fft, d->K/2, d->pH, d->pW, d->buf, d->buf_fft, d->W, d->H, src, dst, d->multithread);
 }
 
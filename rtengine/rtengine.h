@@ -500,6 +500,10 @@ public:
 
     virtual void        updateUnLock() = 0;
 
+    /** Returns a human-readable summary of the timings of the last preview
+      * update (see perf::summary), or an empty string if none was done yet */
+    virtual std::string getPerfSummary() = 0;
+
     /** Creates and returns a Crop instance that acts as a window on the image
       * @param editDataProvider pointer to the EditDataProvider that communicates with the EditSubscriber
       * @return a pointer to the Crop object that handles the image data trough its own pipeline */
@@ -588,6 +592,24 @@ public:
     static void destroy (ProcessingJob* job);
 
     virtual bool fastPipeline() const = 0;
+
+    /** Parameters of an additional output of a job (see addOutput). They replace the corresponding ProcParams of the
+      * job in the steps that are performed separately for each output. */
+    struct Output {
+        procparams::ResizeParams resize;
+        procparams::SharpeningParams prsharpening;
+        Glib::ustring outputProfile;
+        RenderingIntent outputIntent;
+        bool outputBPC;
+
+        /** Initializes the output with the values of pparams */
+        explicit Output(const procparams::ProcParams &pparams);
+    };
+
+    /** Adds an output to the job. Only processImageOutputs produces the additional outputs, which share the
+      * decoding, demosaicing and processing of the image: just the resizing, the post-resize sharpening and the
+      * conversion to the output profile are performed for each of them. */
+    virtual void addOutput(const Output &out) = 0;
 };
 
 /** This function performs all the image processing steps corresponding to the given ProcessingJob. It returns when it is ready, so it can be slow.
@@ -598,6 +620,12 @@ public:
    * @return the resulting image, with the output profile applied, exif and iptc data set. You have to save it or you can access the pixel data directly.  */
 IImagefloat* processImage (ProcessingJob* job, int& errorCode, ProgressListener* pl = nullptr, bool flush = false);
 
+/** Like processImage, but it also produces the additional outputs of the job (see ProcessingJob::addOutput). The resizing
+   * for all the outputs is performed in a single pass over the processed image.
+   * @return the resulting images, the one corresponding to the ProcParams of the job first, followed by the additional
+   * outputs in the order in which they were added; or an empty vector if an error occurred */
+std::vector<IImagefloat*> processImageOutputs (ProcessingJob* job, int& errorCode, ProgressListener* pl = nullptr, bool flush = false);
+
 /** This class is used to control the batch processing. The class implementing this interface will be called when the full processing of an
    * image is ready and the next job to process is needed. */
 class BatchProcessingListener : public ProgressListener
@@ -610,6 +638,25 @@ public:
     virtual ProcessingJob* imageReady(IImagefloat* img) = 0;
 
     virtual const procparams::PartialProfile *getBatchProfile() = 0;
+
+    /** Pipelined batch processing. If this returns true, the decoding of the next job, the processing of the current one
+      * and the saving of the previous one are performed concurrently on separate workers, and the functions below are
+      * used instead of imageReady. */
+    virtual bool usePipeline() { return false; }
+    /** Pipelined mode: returns the job following the last one handed out, or NULL if there are no more jobs to start.
+      * It is called from the decoding stage, while the previous jobs might still be processed or saved. */
+    virtual ProcessingJob* nextJob() { return nullptr; }
+    /** Pipelined mode: the oldest job that has not been processed yet is about to enter the processing stage. The
+      * progress reported with setProgress refers to it from now on. It is called for every job handed out, also after
+      * saveImage returned false.
+      * @return false if the batch processing was stopped after the job was handed out: the job is then not processed,
+      * and it is left to the listener unchanged (apart from its decoded image, which is released) */
+    virtual bool jobStarted() { return true; }
+    /** Pipelined mode: called from the saving stage with the result of each job, in the order in which the jobs were
+      * handed out.
+      * @param img is the result of the job, or NULL if the processing failed
+      * @return false if the batch processing should stop (after the jobs already in flight) */
+    virtual bool saveImage(IImagefloat* img) { return false; }
 };
 /** This function performs all the image processing steps corresponding to the given ProcessingJob. It runs in the background, thus it returns immediately,
    * When it finishes, it calls the BatchProcessingListener with the resulting image and asks for the next job. It the listener gives a new job, it goes on
@@ -617,6 +664,7 @@ public:
    * The ProcessingJob passed becomes invalid, you can not use it any more.
    * @param job the ProcessingJob to cancel.
    * @param bpl is the BatchProcessingListener that is called when the image is ready or the next job is needed. It also acts as a ProgressListener.
+   * If bpl->usePipeline() is true, decoding, processing and saving of consecutive jobs overlap (see BatchProcessingListener).
    **/
 void startBatchProcessing (ProcessingJob* job, BatchProcessingListener* bpl);
 
@@ -1487,45 +1487,35 @@ unsigned char* Thumbnail::getGrayscaleHistEQ (int trim_width)
     return tmpdata;
 }
 
-bool Thumbnail::writeImage (const Glib::ustring& fname)
+bool Thumbnail::writeImage(std::string &out)
 {
 
     if (!thumbImg) {
         return false;
     }
 
-    Glib::ustring fullFName = fname + ".rtti";
-
-    FILE* f = g_fopen (fullFName.c_str (), "wb");
-
-    if (!f) {
-        return false;
-    }
-
-    fwrite (thumbImg->getType(), sizeof (char), strlen (thumbImg->getType()), f);
-    fputc ('\n', f);
+    out = thumbImg->getType();
+    out += '\n';
     guint32 w = guint32 (thumbImg->getWidth());
     guint32 h = guint32 (thumbImg->getHeight());
-    fwrite (&w, sizeof (guint32), 1, f);
-    fwrite (&h, sizeof (guint32), 1, f);
+    out.append(reinterpret_cast<const char *>(&w), sizeof(guint32));
+    out.append(reinterpret_cast<const char *>(&h), sizeof(guint32));
 
     if (thumbImg->getType() == sImage8) {
         Image8 *image = static_cast<Image8*> (thumbImg);
-        image->writeData (f);
+        image->writeData(out);
     } else if (thumbImg->getType() == sImage16) {
         Image16 *image = static_cast<Image16*> (thumbImg);
-        image->writeData (f);
+        image->writeData(out);
     } else if (thumbImg->getType() == sImagefloat) {
         Imagefloat *image = static_cast<Imagefloat*> (thumbImg);
-        image->writeData (f);
+        image->writeData(out);
     }
 
-    //thumbImg->writeData(f);
-    fclose (f);
     return true;
 }
 
-bool Thumbnail::readImage (const Glib::ustring& fname)
+bool Thumbnail::readImage(const std::string &data)
 {
 
     if (thumbImg) {
@@ -1533,59 +1523,53 @@ bool Thumbnail::readImage (const Glib::ustring& fname)
         thumbImg = nullptr;
     }
 
-    Glib::ustring fullFName = fname + ".rtti";
-
-    if (!Glib::file_test(fullFName, Glib::FILE_TEST_EXISTS)) {
-        return false;
-    }
-
-    FILE* f = g_fopen(fullFName.c_str (), "rb");
-
-    if (!f) {
+    const size_t eol = data.find('\n');
+    // 30 -> arbitrary size, but should be enough for all image type's name
+    if (eol == std::string::npos || eol > 30) {
         return false;
     }
 
-    char imgType[31];  // 30 -> arbitrary size, but should be enough for all image type's name
-    fgets(imgType, 30, f);
-    imgType[strlen(imgType) - 1] = '\0'; // imgType has a \n trailing character, so we overwrite it by the \0 char
-
-    guint32 width, height;
+    const std::string imgType = data.substr(0, eol);
+    const char *p = data.data() + eol + 1;
+    size_t size = data.size() - eol - 1;
 
-    if (fread(&width, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        width = 0;
-    }
+    guint32 width = 0, height = 0;
 
-    if (fread(&height, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        height = 0;
+    if (size >= 2 * sizeof(guint32)) {
+        memcpy(&width, p, sizeof(guint32));
+        memcpy(&height, p + sizeof(guint32), sizeof(guint32));
+        p += 2 * sizeof(guint32);
+        size -= 2 * sizeof(guint32);
     }
 
     bool success = false;
 
     if (std::min(width , height) > 0) {
-        if (!strcmp(imgType, sImage8)) {
+        if (imgType == sImage8) {
             Image8 *image = new Image8(width, height);
-            image->readData(f);
+            success = image->readData(p, size);
             thumbImg = image;
-            success = true;
-        } else if (!strcmp(imgType, sImage16)) {
+        } else if (imgType == sImage16) {
             Image16 *image = new Image16(width, height);
-            image->readData(f);
+            success = image->readData(p, size);
             thumbImg = image;
-            success = true;
-        } else if (!strcmp(imgType, sImagefloat)) {
+        } else if (imgType == sImagefloat) {
             Imagefloat *image = new Imagefloat(width, height);
-            image->readData(f);
+            success = image->readData(p, size);
             thumbImg = image;
-            success = true;
         } else {
-            printf ("readImage: Unsupported image type \"%s\"!\n", imgType);
+            printf ("readImage: Unsupported image type \"%s\"!\n", imgType.c_str());
         }
     }
-    fclose(f);
+
+    if (!success) {
+        delete thumbImg;
+        thumbImg = nullptr;
+    }
     return success;
 }
 
-bool Thumbnail::readData  (const Glib::ustring& fname)
+bool Thumbnail::readData(const std::string &data)
 {
     setlocale (LC_NUMERIC, "C"); // to set decimal point to "."
     Glib::KeyFile keyFile;
@@ -1594,7 +1578,7 @@ bool Thumbnail::readData  (const Glib::ustring& fname)
         MyMutex::MyLock thmbLock (thumbMutex);
 
         try {
-            keyFile.load_from_file (fname);
+            keyFile.load_from_data(data);
         } catch (Glib::Error&) {
             return false;
         }
@@ -1670,18 +1654,18 @@ bool Thumbnail::readData  (const Glib::ustring& fname)
         return true;
     } catch (Glib::Error &err) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::readData / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf ("Thumbnail::readData / Error code %d while reading values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::readData / Unknown exception while trying to load \"%s\"!\n", fname.c_str());
+            printf ("Thumbnail::readData / Unknown exception while trying to load data!\n");
         }
     }
 
     return false;
 }
 
-bool Thumbnail::writeData  (const Glib::ustring& fname)
+bool Thumbnail::writeData(std::string &data)
 {
     MyMutex::MyLock thmbLock (thumbMutex);
 
@@ -1692,7 +1676,9 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
         Glib::KeyFile keyFile;
 
         try {
-            keyFile.load_from_file (fname);
+            if (!data.empty()) {
+                keyFile.load_from_data(data);
+            }
         } catch (Glib::Error&) {}
 
         keyFile.set_double  ("LiveThumbData", "CamWBRed", camwbRed);
@@ -1716,11 +1702,11 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
 
     } catch (Glib::Error& err) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Error code %d while reading values from \"%s\":\n%s\n", err.code(), fname.c_str(), err.what().c_str());
+            printf ("Thumbnail::writeData / Error code %d while reading values:\n%s\n", err.code(), err.what().c_str());
         }
     } catch (...) {
         if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Unknown exception while trying to save \"%s\"!\n", fname.c_str());
+            printf ("Thumbnail::writeData / Unknown exception while trying to save data!\n");
         }
     }
 
@@ -1728,64 +1714,33 @@ bool Thumbnail::writeData  (const Glib::ustring& fname)
         return false;
     }
 
-    FILE *f = g_fopen (fname.c_str (), "wt");
-
-    if (!f) {
-        if (options.rtSettings.verbose) {
-            printf ("Thumbnail::writeData / Error: unable to open file \"%s\" with write access!\n", fname.c_str());
-        }
-
-        return false;
-    } else {
-        fprintf (f, "%s", keyData.c_str ());
-        fclose (f);
-    }
-
+    data = keyData.raw();
     return true;
 }
 
-bool Thumbnail::readEmbProfile  (const Glib::ustring& fname)
+bool Thumbnail::readEmbProfile(const std::string &data)
 {
 
     embProfileData = nullptr;
     embProfile = nullptr;
     embProfileLength = 0;
 
-    FILE* f = g_fopen (fname.c_str (), "rb");
-
-    if (f) {
-        if (!fseek (f, 0, SEEK_END)) {
-            int profileLength = ftell (f);
-
-            if (profileLength > 0) {
-                embProfileLength = profileLength;
-
-                if (!fseek (f, 0, SEEK_SET)) {
-                    embProfileData = new unsigned char[embProfileLength];
-                    embProfileLength = fread (embProfileData, 1, embProfileLength, f);
-                    embProfile = cmsOpenProfileFromMem (embProfileData, embProfileLength);
-                }
-            }
-        }
-
-        fclose (f);
-        return embProfile != nullptr;
+    if (!data.empty()) {
+        embProfileLength = data.size();
+        embProfileData = new unsigned char[embProfileLength];
+        memcpy(embProfileData, data.data(), embProfileLength);
+        embProfile = cmsOpenProfileFromMem(embProfileData, embProfileLength);
     }
 
-    return false;
+    return embProfile != nullptr;
 }
 
-bool Thumbnail::writeEmbProfile (const Glib::ustring& fname)
+bool Thumbnail::writeEmbProfile(std::string &out)
 {
 
     if (embProfileData) {
-        FILE* f = g_fopen (fname.c_str (), "wb");
-
-        if (f) {
-            fwrite (embProfileData, 1, embProfileLength, f);
-            fclose (f);
-            return true;
-        }
+        out.assign(reinterpret_cast<const char *>(embProfileData), embProfileLength);
+        return true;
     }
 
     return false;
@@ -90,14 +90,17 @@ public:
     void getSpotWB(const procparams::ProcParams& params, int x, int y, int rect, ColorTemp &out);
 
     unsigned char* getGrayscaleHistEQ (int trim_width);
-    bool writeImage (const Glib::ustring& fname);
-    bool readImage (const Glib::ustring& fname);
 
-    bool readData  (const Glib::ustring& fname);
-    bool writeData  (const Glib::ustring& fname);
+    // (de)serialization of the cached data, to and from memory buffers.
+    // writeData updates the LiveThumbData section of the given key file data
+    bool writeImage(std::string &out);
+    bool readImage(const std::string &data);
 
-    bool readEmbProfile  (const Glib::ustring& fname);
-    bool writeEmbProfile (const Glib::ustring& fname);
+    bool readData(const std::string &data);
+    bool writeData(std::string &data);
+
+    bool readEmbProfile(const std::string &data);
+    bool writeEmbProfile(std::string &out);
 
     unsigned char* getImage8Data();  // accessor to the 8bit image if it is one, which should be the case for the "Inspector" mode.
 
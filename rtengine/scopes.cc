@@ -0,0 +1,511 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scopes.h"
+#include "image8.h"
+#include "imagefloat.h"
+#include "iccstore.h"
+#include "color.h"
+#include "settings.h"
+#include "alignedbuffer.h"
+#include "rt_math.h"
+#include "sleef.h"
+#include "opthelper.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+namespace rtengine {
+
+extern const Settings* settings;
+
+namespace {
+
+constexpr uint16_t NO_BIN = 0xFFFF;
+
+// the profile used for the H-C vectorscope, prefixed by 'W' when it is
+// applied with the working space matrix, or by 'O' when with lcms
+Glib::ustring hc_profile(const procparams::ColorManagementParams &icm)
+{
+    if (settings->HistogramWorking) {
+        return "W" + icm.workingProfile;
+    } else if (icm.outputProfile.empty() || icm.outputProfile == procparams::ColorManagementParams::NoICMString) {
+        return "OsRGB";
+    } else {
+        return "O" + icm.outputProfile;
+    }
+}
+
+
+inline uint64_t hash_data(const void *data, size_t size, uint64_t h)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(uint64_t));
+        h = (h ^ v) * 0x100000001b3ULL;
+    }
+    for (; size > 0; --size, ++p) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+
+inline void add_bin(array2D<int> &scope, uint16_t bin, int delta)
+{
+    if (bin != NO_BIN) {
+        scope[bin / Scopes::VECTORSCOPE_SIZE][bin % Scopes::VECTORSCOPE_SIZE] += delta;
+    }
+}
+
+} // namespace
+
+
+// conversion of the preview in the output profile to Lab, for the H-C
+// vectorscope
+class Scopes::HCConverter {
+public:
+    explicit HCConverter(const procparams::ColorManagementParams &icm):
+        transform_(nullptr)
+    {
+        const Glib::ustring profile = hc_profile(icm);
+        const Glib::ustring name(profile, 1, Glib::ustring::npos);
+        cmsHPROFILE oprof = profile[0] == 'O' ? ICCStore::getInstance()->getProfile(name) : nullptr;
+
+        if (oprof) {
+            cmsUInt32Number flags = cmsFLAGS_NOOPTIMIZE | cmsFLAGS_NOCACHE; // NOCACHE is important for thread safety
+
+            if (icm.outputBPC) {
+                flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
+            }
+
+            lcmsMutex->lock();
+            cmsHPROFILE LabIProf = cmsCreateLab4Profile(nullptr);
+            transform_ = cmsCreateTransform(oprof, TYPE_RGB_8, LabIProf, TYPE_Lab_FLT, icm.outputIntent, flags);
+            cmsCloseProfile(LabIProf);
+            lcmsMutex->unlock();
+        } else {
+            // RGB2Lab does not normalize by the D50 white point, unlike
+            // XYZ2Lab: fold that into the matrix
+            TMatrix wprof = ICCStore::getInstance()->workingSpaceMatrix(name);
+            const float white[3] = { Color::D50x, 1.f, Color::D50z };
+            for (int i = 0; i < 3; ++i) {
+                for (int j = 0; j < 3; ++j) {
+                    wp_[i][j] = wprof[i][j] / white[i];
+                }
+            }
+        }
+    }
+
+    ~HCConverter()
+    {
+        if (transform_) {
+            cmsDeleteTransform(transform_);
+        }
+    }
+
+    // converts w pixels of src. buf must hold 3 * w values
+    void operator()(const unsigned char *src, int w, float *L, float *a, float *b, float *buf) const
+    {
+        if (transform_) {
+            cmsDoTransform(transform_, src, buf, w);
+            for (int j = 0; j < w; ++j) {
+                L[j] = buf[3 * j] * 327.68f;
+                a[j] = buf[3 * j + 1] * 327.68f;
+                b[j] = buf[3 * j + 2] * 327.68f;
+            }
+        } else {
+            // lab2rgb uses gamma2curve, which is gammatab_srgb.
+            constexpr float rgb_factor = 65355.f / 255.f;
+            const auto &igamma = Color::igammatab_srgb;
+            float *R = buf;
+            float *G = buf + w;
+            float *B = buf + 2 * w;
+            for (int j = 0; j < w; ++j) {
+                R[j] = igamma[rgb_factor * src[3 * j]];
+                G[j] = igamma[rgb_factor * src[3 * j + 1]];
+                B[j] = igamma[rgb_factor * src[3 * j + 2]];
+            }
+            Color::RGB2Lab(R, G, B, L, a, b, wp_, w);
+        }
+    }
+
+private:
+    cmsHTRANSFORM transform_;
+    float wp_[3][3];
+};
+
+
+bool Scopes::Key::operator==(const Key &other) const
+{
+    return x1 == other.x1 && y1 == other.y1 && x2 == other.x2 && y2 == other.y2
+        && img_width == other.img_width
+        && lab_mode == other.lab_mode && lab_space == other.lab_space
+        && hc_profile == other.hc_profile && hc_intent == other.hc_intent && hc_bpc == other.hc_bpc;
+}
+
+
+Scopes::Scopes():
+    histRed(256),
+    histGreen(256),
+    histBlue(256),
+    histLuma(256),
+    histChroma(256),
+    vectorscopeHC(VECTORSCOPE_SIZE, VECTORSCOPE_SIZE),
+    vectorscopeHS(VECTORSCOPE_SIZE, VECTORSCOPE_SIZE),
+    vectorscopeScale(0),
+    waveformRed(0, 0),
+    waveformGreen(0, 0),
+    waveformBlue(0, 0),
+    waveformLuma(0, 0),
+    waveformScale(0),
+    key_{0, 0, 0, 0, 0, 0, "", "", 0, false},
+    valid_(0)
+{
+}
+
+
+void Scopes::reset()
+{
+    valid_ = 0;
+    waveformRed.free();
+    waveformGreen.free();
+    waveformBlue.free();
+    waveformLuma.free();
+    std::vector<uint64_t>().swap(hash_);
+    std::vector<uint8_t>().swap(rgb_);
+    std::vector<uint8_t>().swap(luma_);
+    std::vector<uint8_t>().swap(chroma_);
+    std::vector<uint8_t>().swap(wluma_);
+    std::vector<uint16_t>().swap(hc_);
+    std::vector<uint16_t>().swap(hs_);
+}
+
+
+void Scopes::clear(int kinds)
+{
+    if (kinds & HISTOGRAM) {
+        histRed.clear();
+        histGreen.clear();
+        histBlue.clear();
+        histLuma.clear();
+        histChroma.clear();
+    }
+    if (kinds & VECTORSCOPE_HC) {
+        vectorscopeHC.fill(0);
+    }
+    if (kinds & VECTORSCOPE_HS) {
+        vectorscopeHS.fill(0);
+    }
+    if (kinds & WAVEFORM) {
+        const int W = key_.x2 - key_.x1;
+        if (waveformRed.width() != W) {
+            waveformRed(W, 256);
+            waveformGreen(W, 256);
+            waveformBlue(W, 256);
+            waveformLuma(W, 256);
+        }
+        waveformRed.fill(0);
+        waveformGreen.fill(0);
+        waveformBlue.fill(0);
+        waveformLuma.fill(0);
+    }
+}
+
+
+void Scopes::update(int kinds, const Image8 *img, Imagefloat *lab, int x1, int y1, int x2, int y2, const procparams::ColorManagementParams &icm)
+{
+    const Key key = { x1, y1, x2, y2, img->getWidth(), int(lab->mode()), lab->colorSpace(), hc_profile(icm), int(icm.outputIntent), icm.outputBPC };
+    if (!(key == key_)) {
+        key_ = key;
+        valid_ = 0;
+    }
+
+    const int W = x2 - x1;
+    const int H = y2 - y1;
+    const int num_tiles = (W + TILE_WIDTH - 1) / TILE_WIDTH;
+    const size_t num_pixels = size_t(W) * H;
+    const int img_width = img->getWidth();
+
+    // scopes computed from scratch, and scopes updated only where the image
+    // changed
+    const int full = kinds & ~valid_;
+    const int incremental = kinds & valid_;
+    clear(full);
+
+    hash_.resize(size_t(num_tiles) * H);
+    if (kinds & (HISTOGRAM | WAVEFORM)) {
+        rgb_.resize(3 * num_pixels);
+    }
+    if (kinds & HISTOGRAM) {
+        luma_.resize(num_pixels);
+        chroma_.resize(num_pixels);
+    }
+    if (kinds & WAVEFORM) {
+        wluma_.resize(num_pixels);
+    }
+    if (kinds & VECTORSCOPE_HC) {
+        hc_.resize(num_pixels);
+    }
+    if (kinds & VECTORSCOPE_HS) {
+        hs_.resize(num_pixels);
+    }
+
+    std::unique_ptr<HCConverter> hc_converter(kinds & VECTORSCOPE_HC ? new HCConverter(icm) : nullptr);
+
+    if ((kinds & (HISTOGRAM | WAVEFORM)) && W > 0 && H > 0) {
+        // initialize the working space matrices of lab before going parallel
+        float L, a, b;
+        lab->getLab(y1, x1, L, a, b);
+    }
+
+    constexpr int size = VECTORSCOPE_SIZE;
+    constexpr float hc_norm_factor = size / (128.f * 655.36f);
+    constexpr float luma_factor = 255.f / 32768.f;
+    bool changed = false;
+
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        int hist[5][256] = {};
+        array2D<int> hc(kinds & VECTORSCOPE_HC ? size : 0, kinds & VECTORSCOPE_HC ? size : 0, ARRAY2D_CLEAR_DATA);
+        array2D<int> hs(kinds & VECTORSCOPE_HS ? size : 0, kinds & VECTORSCOPE_HS ? size : 0, ARRAY2D_CLEAR_DATA);
+        AlignedBuffer<float> buffer(6 * TILE_WIDTH);
+        float *L = buffer.data;
+        float *a = L + TILE_WIDTH;
+        float *b = a + TILE_WIDTH;
+        float *tmp = b + TILE_WIDTH;
+        bool thread_changed = false;
+
+#ifdef _OPENMP
+        #pragma omp for schedule(dynamic) nowait
+#endif
+        for (int t = 0; t < num_tiles; ++t) {
+            const int x = x1 + t * TILE_WIDTH;
+            const int w = std::min(TILE_WIDTH, x2 - x);
+
+            for (int i = 0; i < H; ++i) {
+                const int y = y1 + i;
+                const unsigned char *src = img->data + 3 * (size_t(y) * img_width + x);
+
+                uint64_t h = hash_data(src, 3 * w, 0xcbf29ce484222325ULL);
+                h = hash_data(lab->r(y) + x, w * sizeof(float), h);
+                h = hash_data(lab->g(y) + x, w * sizeof(float), h);
+                h = hash_data(lab->b(y) + x, w * sizeof(float), h);
+                uint64_t &old_h = hash_[size_t(t) * H + i];
+                const bool row_changed = h != old_h;
+                old_h = h;
+                thread_changed = thread_changed || row_changed;
+
+                // scopes to update for this row, and the ones among them
+                // whose previous counts must be removed
+                const int todo = full | (row_changed ? incremental : 0);
+                const int sub = todo & incremental;
+                if (!todo) {
+                    continue;
+                }
+
+                const size_t ofs = size_t(i) * W + (x - x1);
+                const int wx = x - x1;
+
+                if (todo & (HISTOGRAM | WAVEFORM)) {
+                    uint8_t *rgb = &rgb_[3 * ofs];
+                    for (int j = 0; j < w; ++j) {
+                        const int xx = wx + j;
+                        if (sub & HISTOGRAM) {
+                            --hist[0][rgb[3 * j]];
+                            --hist[1][rgb[3 * j + 1]];
+                            --hist[2][rgb[3 * j + 2]];
+                        }
+                        if (sub & WAVEFORM) {
+                            --waveformRed[rgb[3 * j]][xx];
+                            --waveformGreen[rgb[3 * j + 1]][xx];
+                            --waveformBlue[rgb[3 * j + 2]][xx];
+                        }
+                        if (todo & HISTOGRAM) {
+                            ++hist[0][src[3 * j]];
+                            ++hist[1][src[3 * j + 1]];
+                            ++hist[2][src[3 * j + 2]];
+                        }
+                        if (todo & WAVEFORM) {
+                            ++waveformRed[src[3 * j]][xx];
+                            ++waveformGreen[src[3 * j + 1]][xx];
+                            ++waveformBlue[src[3 * j + 2]][xx];
+                        }
+                    }
+                    std::copy(src, src + 3 * w, rgb);
+
+                    lab->getLab(y, x, w, L, a, b);
+
+                    if (todo & HISTOGRAM) {
+                        uint8_t *luma = &luma_[ofs];
+                        uint8_t *chroma = &chroma_[ofs];
+                        for (int j = 0; j < w; ++j) {
+                            if (sub & HISTOGRAM) {
+                                --hist[3][luma[j]];
+                                --hist[4][chroma[j]];
+                            }
+                            luma[j] = LIM<int>(L[j] / 128.f, 0, 255);
+                            chroma[j] = LIM<int>(std::sqrt(SQR(a[j]) + SQR(b[j])) / 188.f, 0, 255); // 188 = 48000/256
+                            ++hist[3][luma[j]];
+                            ++hist[4][chroma[j]];
+                        }
+                    }
+
+                    if (todo & WAVEFORM) {
+                        uint8_t *wluma = &wluma_[ofs];
+                        for (int j = 0; j < w; ++j) {
+                            const int xx = wx + j;
+                            if (sub & WAVEFORM) {
+                                --waveformLuma[wluma[j]][xx];
+                            }
+                            wluma[j] = LIM<int>(L[j] * luma_factor, 0, 255);
+                            ++waveformLuma[wluma[j]][xx];
+                        }
+                    }
+                }
+
+                if (todo & VECTORSCOPE_HC) {
+                    uint16_t *bins = &hc_[ofs];
+                    (*hc_converter)(src, w, L, a, b, tmp);
+                    for (int j = 0; j < w; ++j) {
+                        if (sub & VECTORSCOPE_HC) {
+                            add_bin(hc, bins[j], -1);
+                        }
+                        const int col = hc_norm_factor * a[j] + size / 2 + 0.5f;
+                        const int row = hc_norm_factor * b[j] + size / 2 + 0.5f;
+                        bins[j] = col >= 0 && col < size && row >= 0 && row < size ? row * size + col : NO_BIN;
+                        add_bin(hc, bins[j], 1);
+                    }
+                }
+
+                if (todo & VECTORSCOPE_HS) {
+                    // L, a and b hold the rows and columns of the pixels
+                    float *rows = L;
+                    float *cols = a;
+                    int j = 0;
+#ifdef __SSE2__
+                    const vfloat f257v = F2V(257.f);
+                    const vfloat twopiv = F2V(2.f * RT_PI_F);
+                    const vfloat halfsizev = F2V(size / 2);
+                    for (; j < w - 3; j += 4) {
+                        const unsigned char *s = src + 3 * j;
+                        const vfloat redv = _mm_setr_ps(s[0], s[3], s[6], s[9]) * f257v;
+                        const vfloat greenv = _mm_setr_ps(s[1], s[4], s[7], s[10]) * f257v;
+                        const vfloat bluev = _mm_setr_ps(s[2], s[5], s[8], s[11]) * f257v;
+                        vfloat hv, sv, lv;
+                        Color::rgb2hsl(redv, greenv, bluev, hv, sv, lv);
+                        const vfloat2 sincosval = xsincosf(twopiv * hv);
+                        STVFU(cols[j], sv * sincosval.y * halfsizev + halfsizev);
+                        STVFU(rows[j], sv * sincosval.x * halfsizev + halfsizev);
+                    }
+#endif
+                    for (; j < w; ++j) {
+                        const float red = 257.f * src[3 * j];
+                        const float green = 257.f * src[3 * j + 1];
+                        const float blue = 257.f * src[3 * j + 2];
+                        float hh, ss, ll;
+                        Color::rgb2hslfloat(red, green, blue, hh, ss, ll);
+                        const auto sincosval = xsincosf(2.f * RT_PI_F * hh);
+                        cols[j] = ss * sincosval.y * (size / 2) + size / 2;
+                        rows[j] = ss * sincosval.x * (size / 2) + size / 2;
+                    }
+
+                    uint16_t *bins = &hs_[ofs];
+                    for (j = 0; j < w; ++j) {
+                        if (sub & VECTORSCOPE_HS) {
+                            add_bin(hs, bins[j], -1);
+                        }
+                        const int col = cols[j];
+                        const int row = rows[j];
+                        bins[j] = col >= 0 && col < size && row >= 0 && row < size ? row * size + col : NO_BIN;
+                        add_bin(hs, bins[j], 1);
+                    }
+                }
+            }
+        }
+
+#ifdef _OPENMP
+        #pragma omp critical
+#endif
+        {
+            changed = changed || thread_changed;
+
+            if (kinds & HISTOGRAM) {
+                for (int k = 0; k < 256; ++k) {
+                    histRed[k] += hist[0][k];
+                    histGreen[k] += hist[1][k];
+                    histBlue[k] += hist[2][k];
+                    histLuma[k] += hist[3][k];
+                    histChroma[k] += hist[4][k];
+                }
+            }
+            if (kinds & VECTORSCOPE_HC) {
+                for (int y = 0; y < size; ++y) {
+#ifdef _OPENMP
+#                   pragma omp simd
+#endif
+                    for (int x = 0; x < size; ++x) {
+                        vectorscopeHC[y][x] += hc[y][x];
+                    }
+                }
+            }
+            if (kinds & VECTORSCOPE_HS) {
+                for (int y = 0; y < size; ++y) {
+#ifdef _OPENMP
+#                   pragma omp simd
+#endif
+                    for (int x = 0; x < size; ++x) {
+                        vectorscopeHS[y][x] += hs[y][x];
+                    }
+                }
+            }
+        }
+    }
+
+    // the hashes now describe the new image, so the scopes which were not
+    // updated are stale if anything changed
+    if (changed) {
+        valid_ &= kinds;
+    }
+    valid_ |= kinds;
+
+    if (!(valid_ & (HISTOGRAM | WAVEFORM))) {
+        std::vector<uint8_t>().swap(rgb_);
+    }
+    if (!(valid_ & HISTOGRAM)) {
+        std::vector<uint8_t>().swap(luma_);
+        std::vector<uint8_t>().swap(chroma_);
+    }
+    if (!(valid_ & WAVEFORM)) {
+        std::vector<uint8_t>().swap(wluma_);
+    }
+    if (!(valid_ & VECTORSCOPE_HC)) {
+        std::vector<uint16_t>().swap(hc_);
+    }
+    if (!(valid_ & VECTORSCOPE_HS)) {
+        std::vector<uint16_t>().swap(hs_);
+    }
+
+    vectorscopeScale = W * H;
+    waveformScale = H;
+}
+
+} // namespace rtengine
@@ -0,0 +1,119 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "LUT.h"
+#include "array2D.h"
+#include "procparams.h"
+#include <cstdint>
+#include <vector>
+
+namespace rtengine {
+
+class Image8;
+class Imagefloat;
+
+/******************************************************************************
+ * Computation of the scopes shown in the histogram panel of the editor: the
+ * L, chroma and RGB histograms, the H-C and H-S vectorscopes and the
+ * waveforms.
+ *
+ * All the requested scopes are computed in a single parallel pass over the
+ * region of the preview, split in tiles of TILE_WIDTH columns. Each thread
+ * accumulates histograms and vectorscopes in its own buffers, which are then
+ * summed; waveforms are updated directly, as tiles do not share columns.
+ *
+ * The update is incremental: for each row of each tile, the engine keeps a
+ * hash of the input pixels and the bins they were counted in, so that only
+ * the parts of the region that changed since the previous update are
+ * converted again (their old counts are subtracted, the new ones added).
+ ******************************************************************************/
+
+class Scopes {
+public:
+    enum Kind {
+        HISTOGRAM = 1 << 0,
+        VECTORSCOPE_HC = 1 << 1,
+        VECTORSCOPE_HS = 1 << 2,
+        WAVEFORM = 1 << 3
+    };
+
+    static constexpr int VECTORSCOPE_SIZE = 128;
+    static constexpr int TILE_WIDTH = 128;
+
+    Scopes();
+
+    // updates the scopes in kinds (a combination of Kind) for the region
+    // [x1, x2) x [y1, y2) of the preview. img is the preview in the output
+    // profile (see ImProcFunctions::rgb2out), from which the RGB histograms,
+    // the vectorscopes and the RGB waveforms are computed; lab is the preview
+    // in the working space, from which the L and chroma histograms and the
+    // luma waveform are computed
+    void update(int kinds, const Image8 *img, Imagefloat *lab, int x1, int y1, int x2, int y2, const procparams::ColorManagementParams &icm);
+
+    // forgets the previous data, so that the next update is a full one. The
+    // waveforms are freed
+    void reset();
+
+    LUTu histRed;
+    LUTu histGreen;
+    LUTu histBlue;
+    LUTu histLuma;
+    LUTu histChroma;
+    array2D<int> vectorscopeHC;
+    array2D<int> vectorscopeHS;
+    int vectorscopeScale;
+    array2D<int> waveformRed;
+    array2D<int> waveformGreen;
+    array2D<int> waveformBlue;
+    array2D<int> waveformLuma;
+    int waveformScale;
+
+private:
+    class HCConverter;
+
+    struct Key {
+        int x1, y1, x2, y2;
+        int img_width;
+        int lab_mode;
+        Glib::ustring lab_space;
+        Glib::ustring hc_profile;
+        int hc_intent;
+        bool hc_bpc;
+
+        bool operator==(const Key &other) const;
+    };
+
+    void clear(int kinds);
+
+    Key key_;
+    // scopes whose data corresponds to the hashes in hash_
+    int valid_;
+    // one hash per tile row, tile-major
+    std::vector<uint64_t> hash_;
+    // per-pixel data of the previous update, row-major within the region
+    std::vector<uint8_t> rgb_;
+    std::vector<uint8_t> luma_;
+    std::vector<uint8_t> chroma_;
+    std::vector<uint8_t> wluma_;
+    std::vector<uint16_t> hc_;
+    std::vector<uint16_t> hs_;
+};
+
+} // namespace rtengine
@@ -75,6 +75,15 @@ public:
     int thread_pool_size;
 
     bool ctl_scripts_fast_preview;
+    bool fuse_pointwise_ops; ///< Run consecutive pointwise steps of the pipeline in a single pass over the image
+    int buffer_pool_size; ///< Maximum amount of memory (in MB) kept by the buffer pool for reuse after being freed. 0 disables the pool
+    int export_in_place_threshold; ///< Estimated memory usage (in MB) of an image being exported above which the processing is done in place where possible. This is not a limit. 0 means never
+
+    Glib::ustring fftw_wisdom_file; ///< Where the FFTW wisdom is persisted across sessions. If empty, it is not saved
+    Glib::ustring demosaic_cache_dir; ///< Where the demosaiced images are cached for the editor
+    int demosaic_cache_size; ///< Maximum size (in MB) of the demosaic cache. 0 disables it
+    int mask_cache_size; ///< Maximum size (in MB) of the cache of the masks generated in the editor. 0 disables it
+    bool icc_lut_transforms; ///< Apply the lcms transforms to the monitor and output profiles through cached 3D LUTs (see icclut.h)
 
     /** Creates a new instance of Settings.
       * @return a pointer to the new Settings instance. */
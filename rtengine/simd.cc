@@ -0,0 +1,164 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simd.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+namespace rtengine { namespace simd {
+
+#ifdef ART_SIMD_AVX2
+const Kernels *get_avx2_kernels();
+#endif
+#ifdef ART_SIMD_AVX512
+const Kernels *get_avx512_kernels();
+#endif
+
+namespace {
+
+bool cpu_supports(Path path)
+{
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+    switch (path) {
+    case Path::AVX512:
+        return __builtin_cpu_supports("avx512f");
+    case Path::AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    default:
+        return true;
+    }
+#else
+    return path == Path::SSE2;
+#endif
+}
+
+
+const Kernels *kernels_for(Path path)
+{
+    switch (path) {
+#ifdef ART_SIMD_AVX512
+    case Path::AVX512:
+        return get_avx512_kernels();
+#endif
+#ifdef ART_SIMD_AVX2
+    case Path::AVX2:
+        return get_avx2_kernels();
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+
+class Dispatcher {
+public:
+    static Dispatcher &get()
+    {
+        static Dispatcher instance;
+        return instance;
+    }
+
+    Path path;
+    const Kernels *kernels;
+
+private:
+    Dispatcher():
+        path(Path::SSE2),
+        kernels(nullptr)
+    {
+        Path max_path = Path::AVX512;
+        const char *env = std::getenv("ART_SIMD");
+        if (env) {
+            if (strcmp(env, "sse2") == 0) {
+                max_path = Path::SSE2;
+            } else if (strcmp(env, "avx2") == 0) {
+                max_path = Path::AVX2;
+            }
+        }
+
+        for (auto p : { Path::AVX512, Path::AVX2 }) {
+            if (p <= max_path && cpu_supports(p) && kernels_for(p)) {
+                path = p;
+                kernels = kernels_for(p);
+                break;
+            }
+        }
+    }
+};
+
+} // namespace
+
+
+void init(int verbose)
+{
+    const Path path = get_path();
+    if (verbose) {
+        std::cout << "SIMD code path: " << get_path_name(path)
+                  << " (" << get_vector_width(path) << " floats per vector)" << std::endl;
+    }
+}
+
+
+Path get_path()
+{
+    return Dispatcher::get().path;
+}
+
+
+const char *get_path_name(Path path)
+{
+    switch (path) {
+    case Path::AVX512:
+        return "AVX-512";
+    case Path::AVX2:
+        return "AVX2+FMA";
+    default:
+#ifdef __SSE2__
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+}
+
+
+int get_vector_width(Path path)
+{
+    switch (path) {
+    case Path::AVX512:
+        return 16;
+    case Path::AVX2:
+        return 8;
+    default:
+#ifdef __SSE2__
+        return 4;
+#else
+        return 1;
+#endif
+    }
+}
+
+
+const Kernels *get_kernels()
+{
+    return Dispatcher::get().kernels;
+}
+
+}} // namespace rtengine::simd
@@ -0,0 +1,79 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+/******************************************************************************
+ * Runtime dispatch of SIMD kernels.
+ *
+ * The bulk of the engine is compiled for the baseline instruction set (SSE2
+ * on x86-64), with 4-wide vfloat operations. A few hot kernels are also
+ * compiled for AVX2+FMA (8-wide) and AVX-512 (16-wide), in separate
+ * translation units built with the corresponding compiler flags (see
+ * simdkernels.h). The widest path supported by the CPU is chosen once at
+ * startup. The ART_SIMD environment variable ("sse2", "avx2" or "avx512") can
+ * be used to restrict the choice, e.g. for benchmarking.
+ *
+ * NOTE: this header is included by the ISA-specific translation units, so it
+ * must not pull in any header with inline functions or templates that are
+ * also used elsewhere (otherwise the linker might pick e.g. an AVX-512
+ * version of such functions for the whole program)
+ ******************************************************************************/
+
+namespace rtengine { namespace simd {
+
+enum class Path {
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+struct Kernels {
+    /// number of columns processed by each call of the *_block kernels
+    int block_width;
+
+    /// out[i] = lut[in[i]] with linear interpolation, clipping at both bounds
+    /// (same semantics as LUTf::operator[](vfloat)). maxs is the LUT size - 2
+    void (*lut_interpolate)(const float *lut, int maxs, const float *in, float *out, int n);
+
+    /// in-place vertical box blur of block_width columns starting at col.
+    /// buf must have room for (radius + 1) * block_width floats
+    void (*boxblur_vertical_block)(float **data, int col, int radius, int H, float *buf);
+
+    /// converts W pixels from XYZ to 8-bit interleaved RGB, with the given
+    /// XYZ->RGB matrix and gamma LUT of 65536 entries
+    void (*xyz2rgb8)(const float *x, const float *y, const float *z, std::uint8_t *dst, int W, const float m[3][3], const float *gamma_lut);
+};
+
+/// detects the SIMD path to use and reports it in verbose mode
+void init(int verbose);
+
+/// the selected path
+Path get_path();
+const char *get_path_name(Path path);
+
+/// the vector width (number of floats) of the given path
+int get_vector_width(Path path);
+
+/// the kernels of the selected path, or nullptr if the baseline (SSE2) code
+/// has to be used
+const Kernels *get_kernels();
+
+}} // namespace rtengine::simd
@@ -0,0 +1,59 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// AVX2+FMA (8-wide) version of the runtime-dispatched kernels. Compiled with
+// -mavx2 -mfma, see rtengine/CMakeLists.txt
+
+#include <immintrin.h>
+#include "simd.h"
+
+namespace rtengine { namespace simd { namespace {
+
+struct V {
+    typedef __m256 type;
+    typedef __m256i itype;
+    static constexpr int N = 8;
+
+    static inline type loadu(const float *p) { return _mm256_loadu_ps(p); }
+    static inline void storeu(float *p, type v) { _mm256_storeu_ps(p, v); }
+    static inline type set1(float f) { return _mm256_set1_ps(f); }
+    static inline type min(type a, type b) { return _mm256_min_ps(a, b); }
+    static inline type max(type a, type b) { return _mm256_max_ps(a, b); }
+    static inline itype cvtt(type a) { return _mm256_cvttps_epi32(a); }
+    static inline type cvt(itype a) { return _mm256_cvtepi32_ps(a); }
+    static inline type gather(const float *base, itype idx) { return _mm256_i32gather_ps(base, idx, 4); }
+    static inline itype iset1(int i) { return _mm256_set1_epi32(i); }
+    static inline itype iadd(itype a, itype b) { return _mm256_add_epi32(a, b); }
+    static inline itype isub(itype a, itype b) { return _mm256_sub_epi32(a, b); }
+    static inline itype iadd1(itype a) { return _mm256_add_epi32(a, _mm256_set1_epi32(1)); }
+    static inline itype isrl8(itype a) { return _mm256_srli_epi32(a, 8); }
+    static inline void storei(std::int32_t *p, itype v) { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v); }
+};
+
+}}} // namespace rtengine::simd
+
+#include "simdkernels.h"
+
+namespace rtengine { namespace simd {
+
+const Kernels *get_avx2_kernels()
+{
+    return &kernels;
+}
+
+}} // namespace rtengine::simd
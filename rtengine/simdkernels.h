@@ -0,0 +1,218 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Generic implementation of the runtime-dispatched SIMD kernels (see
+// simd.h). This file is included by the ISA-specific translation units
+// (simd_avx2.cc, simd_avx512.cc) after defining, in an anonymous namespace,
+// a struct V with the vector type and the primitive operations:
+//
+//   V::type, V::itype   -- float and int32 vectors
+//   V::N                -- number of floats in a vector
+//   V::loadu, V::storeu, V::set1, V::min, V::max -- float operations
+//   V::cvtt, V::cvt -- conversions between float and int32 (truncating)
+//   V::gather -- table lookup with int32 indices
+//   V::iset1, V::iadd, V::isub, V::iadd1, V::isrl8, V::storei -- int32 ops
+//
+// Arithmetic on V::type uses the GCC/Clang vector extensions, like vfloat in
+// the rest of the code. Everything here must have internal linkage, and only
+// compiler intrinsics can be used (see the note in simd.h).
+
+namespace rtengine { namespace simd { namespace {
+
+// number of independent vectors processed together by the block kernels, to
+// hide the latency of the recursive filters
+constexpr int K = 2;
+constexpr int BW = K * V::N;
+
+typedef V::type vt;
+typedef V::itype vit;
+
+
+// clamps value in [low;high], returns low if value is NaN (like vclampf)
+inline vt clamp(vt value, vt low, vt high)
+{
+    return V::max(V::min(high, value), low);
+}
+
+
+inline float clamp(float value, float low, float high)
+{
+    return value < high ? (value > low ? value : low) : (value == value ? high : low);
+}
+
+
+inline vt lut_interpolate(const float *lut, vt maxsv, vt sizev, vt x)
+{
+    const vt zero = V::set1(0.f);
+    const vit idx = V::cvtt(clamp(x, zero, maxsv));
+    const vt lower = V::gather(lut, idx);
+    const vt upper = V::gather(lut, V::iadd1(idx));
+    const vt diff = clamp(x, zero, sizev) - V::cvt(idx);
+    return diff * upper + (V::set1(1.f) - diff) * lower;
+}
+
+
+inline float lut_interpolate(const float *lut, int maxs, float x)
+{
+    const int idx = int(clamp(x, 0.f, float(maxs)));
+    const float diff = clamp(x, 0.f, float(maxs + 1)) - float(idx);
+    return diff * lut[idx + 1] + (1.f - diff) * lut[idx];
+}
+
+
+void lut_interpolate_kernel(const float *lut, int maxs, const float *in, float *out, int n)
+{
+    const vt maxsv = V::set1(maxs);
+    const vt sizev = V::set1(maxs + 1);
+
+    int i = 0;
+    for (; i <= n - V::N; i += V::N) {
+        V::storeu(out + i, lut_interpolate(lut, maxsv, sizev, V::loadu(in + i)));
+    }
+    for (; i < n; ++i) {
+        out[i] = lut_interpolate(lut, maxs, in[i]);
+    }
+}
+
+
+// port of the vector part of the vertical pass of boxblur(float **, float
+// **, int, int, int, bool) (boxblur.h), see there for details
+void boxblur_vertical_block_kernel(float **data, int col, int radius, int H, float *buf)
+{
+    const vt onev = V::set1(1.f);
+    vt lenv = V::set1(radius + 1);
+    vt tempv[K];
+
+    for (int k = 0; k < K; ++k) {
+        const int x = col + k * V::N;
+        tempv[k] = V::loadu(&data[0][x]);
+        V::storeu(buf + k * V::N, tempv[k]);
+        for (int i = 1; i <= radius; ++i) {
+            tempv[k] = tempv[k] + V::loadu(&data[i][x]);
+        }
+        tempv[k] = tempv[k] / lenv;
+        V::storeu(&data[0][x], tempv[k]);
+    }
+
+    for (int row = 1; row <= radius; ++row) {
+        const vt lenp1v = lenv + onev;
+        for (int k = 0; k < K; ++k) {
+            const int x = col + k * V::N;
+            V::storeu(buf + row * BW + k * V::N, V::loadu(&data[row][x]));
+            tempv[k] = (tempv[k] * lenv + V::loadu(&data[row + radius][x])) / lenp1v;
+            V::storeu(&data[row][x], tempv[k]);
+        }
+        lenv = lenp1v;
+    }
+
+    const vt rlenv = onev / lenv;
+    int pos = 0;
+    for (int row = radius + 1; row < H - radius; ++row) {
+        for (int k = 0; k < K; ++k) {
+            const int x = col + k * V::N;
+            float *b = buf + pos * BW + k * V::N;
+            const vt oldVal = V::loadu(b);
+            V::storeu(b, V::loadu(&data[row][x]));
+            tempv[k] = tempv[k] + (V::loadu(&data[row + radius][x]) - oldVal) * rlenv;
+            V::storeu(&data[row][x], tempv[k]);
+        }
+        ++pos;
+        pos = pos <= radius ? pos : 0;
+    }
+
+    for (int row = H - radius; row < H; ++row) {
+        const vt lenm1v = lenv - onev;
+        for (int k = 0; k < K; ++k) {
+            const int x = col + k * V::N;
+            tempv[k] = (tempv[k] * lenv - V::loadu(buf + pos * BW + k * V::N)) / lenm1v;
+            V::storeu(&data[row][x], tempv[k]);
+        }
+        lenv = lenm1v;
+        ++pos;
+        pos = pos <= radius ? pos : 0;
+    }
+}
+
+
+// same as uint16ToUint8Rounded (rt_math.h)
+inline vit to_uint8_rounded(vit i)
+{
+    const vit i128 = V::iadd(i, V::iset1(128));
+    return V::isrl8(V::isub(i128, V::isrl8(i128)));
+}
+
+
+inline int to_uint8_rounded(int i)
+{
+    return ((i + 128) - ((i + 128) >> 8)) >> 8;
+}
+
+
+// port of copyAndClamp (iprgb2out.cc)
+void xyz2rgb8_kernel(const float *x, const float *y, const float *z, std::uint8_t *dst, int W, const float m[3][3], const float *gamma_lut)
+{
+    constexpr int maxs = 65534;
+    const vt maxsv = V::set1(maxs);
+    const vt sizev = V::set1(maxs + 1);
+    const vt zero = V::set1(0.f);
+    const vt maxval = V::set1(65535.f);
+    vt mv[3][3];
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            mv[i][j] = V::set1(m[i][j]);
+        }
+    }
+
+    alignas(64) std::int32_t rgb[3][V::N];
+
+    int j = 0;
+    for (; j <= W - V::N; j += V::N) {
+        const vt xv = V::loadu(x + j);
+        const vt yv = V::loadu(y + j);
+        const vt zv = V::loadu(z + j);
+        for (int c = 0; c < 3; ++c) {
+            vt v = mv[c][0] * xv + mv[c][1] * yv + mv[c][2] * zv;
+            v = lut_interpolate(gamma_lut, maxsv, sizev, clamp(v, zero, maxval));
+            V::storei(rgb[c], to_uint8_rounded(V::cvtt(v)));
+        }
+        std::uint8_t *d = dst + 3 * j;
+        for (int i = 0; i < V::N; ++i) {
+            d[0] = rgb[0][i];
+            d[1] = rgb[1][i];
+            d[2] = rgb[2][i];
+            d += 3;
+        }
+    }
+    for (; j < W; ++j) {
+        for (int c = 0; c < 3; ++c) {
+            float v = m[c][0] * x[j] + m[c][1] * y[j] + m[c][2] * z[j];
+            v = lut_interpolate(gamma_lut, maxs, clamp(v, 0.f, 65535.f));
+            dst[3 * j + c] = to_uint8_rounded(int(v));
+        }
+    }
+}
+
+
+const Kernels kernels = {
+    BW,
+    lut_interpolate_kernel,
+    boxblur_vertical_block_kernel,
+    xyz2rgb8_kernel
+};
+
+}}} // namespace rtengine::simd
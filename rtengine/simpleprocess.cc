@@ -30,8 +30,13 @@
 #include "../rtgui/multilangmgr.h"
 #include "mytime.h"
 #include "rescale.h"
+#include "resample.h"
 #include "metadata.h"
 #include "threadpool.h"
+#include "perftrace.h"
+#include <atomic>
+#include <thread>
+#include <queue>
 
 #undef THREAD_PRIORITY_NORMAL
 
@@ -43,7 +48,7 @@ namespace {
 class ImageProcessor {
 public:
     ImageProcessor(ProcessingJob* pjob,int &errorCode, ProgressListener *pl,
-                   bool flush):
+                   bool flush, bool all_outputs):
         job(static_cast<ProcessingJobImpl*>(pjob)),
         errorCode(errorCode),
         pl(pl),
@@ -58,11 +63,17 @@ public:
         pp(0, 0, 0, 0, 0),
         dnstore(),
         pipeline_scale(1.0),
+        in_place(false),
+        cropped(false),
         stop(false)
     {
+        outputs.emplace_back(job->pparams);
+        if (all_outputs) {
+            outputs.insert(outputs.end(), job->outputs.begin(), job->outputs.end());
+        }
     }
 
-    Imagefloat *operator()()
+    std::vector<Imagefloat *> operator()()
     {
         if (!job->fast) {
             return normal_pipeline();
@@ -72,14 +83,14 @@ public:
     }
 
 private:
-    Imagefloat *normal_pipeline()
+    std::vector<Imagefloat *> normal_pipeline()
     {
         if (settings->verbose) {
             std::cout << "Processing with the normal pipeline" << std::endl;
         }
         
         if (!stage_init(false)) {
-            return nullptr;
+            return {};
         }
 
         stage_denoise();
@@ -87,9 +98,10 @@ private:
         return stage_finish(false);
     }
 
-    Imagefloat *fast_pipeline()
+    std::vector<Imagefloat *> fast_pipeline()
     {
-        if (!job->pparams.resize.enabled) {
+        // the early resizing can't be shared by outputs of different sizes
+        if (!job->pparams.resize.enabled || outputs.size() > 1) {
             return normal_pipeline();
         }
 
@@ -100,7 +112,7 @@ private:
         //pl = nullptr;
 
         if (!stage_init(true)) {
-            return nullptr;
+            return {};
         }
 
         stage_early_resize();
@@ -111,6 +123,7 @@ private:
 
     bool stage_init(bool is_fast)
     {
+        perf::Scope scope("stage", "init");
         errorCode = 0;
 
         if (pl) {
@@ -177,6 +190,8 @@ private:
 
         ipf_p.reset (new ImProcFunctions (&params, true));
         ImProcFunctions &ipf = * (ipf_p.get());
+        in_place = use_in_place(fw, fh);
+        ipf.setInPlace(in_place);
         scale_factor = 1.0;
         if (is_fast) {
             int imw, imh;
@@ -285,6 +300,7 @@ private:
 
     void stage_denoise()
     {
+        perf::Scope scope("stage", "denoise");
         procparams::ProcParams& params = job->pparams;
         ImProcFunctions &ipf = *(ipf_p.get());
 
@@ -310,6 +326,7 @@ private:
 
     void stage_transform()
     {
+        perf::Scope scope("stage", "transform");
         procparams::ProcParams &params = job->pparams;
         ImProcFunctions &ipf = *(ipf_p.get());
 
@@ -327,12 +344,19 @@ private:
             }
             
             Imagefloat *trImg = nullptr;
+            int cx = 0, cy = 0, cw = fw, ch = fh;
             if (ipf.needsLuminanceOnly()) {
                 trImg = img;
             } else {
-                trImg = new Imagefloat(fw, fh, img);
+                if (in_place && params.crop.enabled) {
+                    // transform only the cropped area, so that the
+                    // full-size transformed image is never allocated
+                    get_crop_area(fw, fh, cx, cy, cw, ch);
+                    cropped = true;
+                }
+                trImg = new Imagefloat(cw, ch, img);
             }
-            ipf.transform(img, trImg, 0, 0, 0, 0, fw, fh, fw, fh,
+            ipf.transform(img, trImg, cx, cy, 0, 0, fw, fh, fw, fh,
                           imgsrc->getMetaData(), imgsrc->getRotateDegree(), true);
             if (trImg != img) {
                 delete img;
@@ -341,37 +365,37 @@ private:
         }
     }
 
-    Imagefloat *stage_finish(bool is_fast)
+    std::vector<Imagefloat *> stage_finish(bool is_fast)
     {
+        perf::Scope scope("stage", "finish");
         procparams::ProcParams& params = job->pparams;
         ImProcFunctions &ipf = * (ipf_p.get());
 
-        int cx = 0, cy = 0, cw = img->getWidth(), ch = img->getHeight();
         if (params.crop.enabled) {
-            int iw = img->getWidth();
-            int ih = img->getHeight();
-
-            cx = params.crop.x * scale_factor + 0.5;
-            cy = params.crop.y * scale_factor + 0.5;
-            cw = std::min(int(params.crop.w * scale_factor + 0.5), iw - cx);
-            ch = std::min(int(params.crop.h * scale_factor + 0.5), ih - cy);
+            // if already cropped, the image had size fw x fh before
+            const int iw = cropped ? fw : img->getWidth();
+            const int ih = cropped ? fh : img->getHeight();
+            int cx, cy, cw, ch;
+            get_crop_area(iw, ih, cx, cy, cw, ch);
 
             ipf.setViewport(cx, cy, iw, ih);
 
-            Imagefloat *tmpimg = new Imagefloat(cw, ch, img);
+            if (!cropped) {
+                Imagefloat *tmpimg = new Imagefloat(cw, ch, img);
 #ifdef _OPENMP
-#           pragma omp parallel for
+#               pragma omp parallel for
 #endif
-            for (int row = 0; row < ch; row++) {
-                for (int col = 0; col < cw; col++) {
-                    tmpimg->r(row, col) = img->r(row + cy, col + cx);
-                    tmpimg->g(row, col) = img->g(row + cy, col + cx);
-                    tmpimg->b(row, col) = img->b(row + cy, col + cx);
+                for (int row = 0; row < ch; row++) {
+                    for (int col = 0; col < cw; col++) {
+                        tmpimg->r(row, col) = img->r(row + cy, col + cx);
+                        tmpimg->g(row, col) = img->g(row + cy, col + cx);
+                        tmpimg->b(row, col) = img->b(row + cy, col + cx);
+                    }
                 }
-            }
 
-            delete img;
-            img = tmpimg;
+                delete img;
+                img = tmpimg;
+            }
         }
 
         DCPProfile::ApplyState as;
@@ -391,76 +415,146 @@ private:
             pl->setProgress (0.60);
         }
 
-        if (params.resize.enabled) {
-            if (!is_fast) {
-                int imw, imh;
-                double scale = ipf.resizeScale(&params, fw, fh, imw, imh);
-                bool allow_upscaling = params.resize.allowUpscaling || params.resize.dataspec == 0;
-                if (scale < 1.0 || (scale > 1.0 && allow_upscaling)) {
-                    Imagefloat *resized = new Imagefloat(imw, imh, img);
-                    ipf.Lanczos(img, resized, scale);
-                    delete img;
-                    img = resized;
-                }
+        const std::vector<Imagefloat *> resized = stage_resize(is_fast);
+
+        Exiv2Metadata info(imgsrc->getFileName());
+        if (params.metadata.mode == MetaDataParams::EDIT) {
+            info.setExif(params.metadata.exif);
+            info.setIptc(params.metadata.iptc);
+            if (!(params.metadata.exifKeys.size() == 1 && params.metadata.exifKeys[0] == "*")) {
+                info.setExifKeys(&(params.metadata.exifKeys));
             }
-        }
-        if (params.prsharpening.enabled) {
-            ipf.setScale(1);
-            ipf.prsharpening(img);
+            info.setOutputRating(params, options.thumbnail_rating_mode != Options::ThumbnailRatingMode::PROCPARAMS);
         }
 
-        Imagefloat *readyImg = ipf.rgb2out(img, params.icm);
+        // the working image is used directly by the last output that is
+        // not resized, the others get a copy of it
+        int last_full = -1;
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            if (!resized[i]) {
+                last_full = i;
+            }
+        }
 
-        if (settings->verbose) {
-            printf ("Output profile_: \"%s\"\n", params.icm.outputProfile.c_str());
+        std::vector<Imagefloat *> ret;
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            Imagefloat *oimg = resized[i];
+            if (!oimg) {
+                oimg = int(i) == last_full ? img : img->copy();
+            }
+            ret.push_back(stage_output(outputs[i], oimg, info));
         }
 
-        delete img;
+        if (last_full < 0) {
+            delete img;
+        }
         img = nullptr;
 
         if (pl) {
             pl->setProgress (0.70);
         }
 
-        Exiv2Metadata info(imgsrc->getFileName());
-        switch (params.metadata.mode) {
-        case MetaDataParams::TUNNEL:
-            readyImg->setMetadata(info);
-            break;
-        case MetaDataParams::EDIT:
-            info.setExif(params.metadata.exif);
-            info.setIptc(params.metadata.iptc);
-            if (!(params.metadata.exifKeys.size() == 1 && params.metadata.exifKeys[0] == "*")) {
-                info.setExifKeys(&(params.metadata.exifKeys));
+        if (!job->initialImage) {
+            ii->decreaseRef ();
+        }
+
+        delete job;
+
+        if (pl) {
+            pl->setProgress (0.75);
+        }
+
+        return ret;
+    }
+
+    // resizes the working image for all the outputs, in a single pass.
+    // Returns nullptr for the outputs that are not resized
+    std::vector<Imagefloat *> stage_resize(bool is_fast)
+    {
+        perf::Scope scope("stage", "resize");
+        procparams::ProcParams& params = job->pparams;
+        ImProcFunctions &ipf = * (ipf_p.get());
+
+        std::vector<Imagefloat *> ret(outputs.size(), nullptr);
+        if (is_fast) {
+            // already done by stage_early_resize
+            return ret;
+        }
+
+        std::vector<ResampleOutput> resampled;
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            if (!outputs[i].resize.enabled) {
+                continue;
+            }
+            params.resize = outputs[i].resize;
+            int imw, imh;
+            double scale = ipf.resizeScale(&params, fw, fh, imw, imh);
+            bool allow_upscaling = params.resize.allowUpscaling || params.resize.dataspec == 0;
+            if (scale < 1.0 || (scale > 1.0 && allow_upscaling)) {
+                ret[i] = new Imagefloat(imw, imh, img);
+                resampled.emplace_back(ret[i], scale);
             }
-            info.setOutputRating(params, options.thumbnail_rating_mode != Options::ThumbnailRatingMode::PROCPARAMS);
-            readyImg->setMetadata(info);
-            break;
-        default: // case MetaDataParams::STRIP
-            // nothing to do
-            break;
         }
+        params.resize = outputs[0].resize;
 
+        if (!resampled.empty()) {
+            ipf.resize(img, resampled);
+        }
+
+        return ret;
+    }
+
+    // post-resize sharpening and conversion to the output profile of one
+    // output. oimg is consumed
+    Imagefloat *stage_output(const ProcessingJob::Output &out, Imagefloat *oimg, const Exiv2Metadata &info)
+    {
+        procparams::ProcParams& params = job->pparams;
+        ImProcFunctions &ipf = * (ipf_p.get());
+
+        params.prsharpening = out.prsharpening;
+        if (params.prsharpening.enabled) {
+            ipf.setScale(1);
+            ipf.prsharpening(oimg);
+        }
+
+        ColorManagementParams icm = params.icm;
+        icm.outputProfile = out.outputProfile;
+        icm.outputIntent = out.outputIntent;
+        icm.outputBPC = out.outputBPC;
+
+        Imagefloat *readyImg = ipf.rgb2out(oimg, icm, in_place);
+
+        if (settings->verbose) {
+            printf ("Output profile_: \"%s\"\n", icm.outputProfile.c_str());
+        }
+
+        if (readyImg != oimg) {
+            delete oimg;
+        }
+
+        if (params.metadata.mode != MetaDataParams::STRIP) {
+            readyImg->setMetadata(info);
+        }
 
         // Setting the output curve to readyImg
-        if (params.icm.outputProfile != "" && params.icm.outputProfile != ColorManagementParams::NoICMString && params.icm.outputProfile != ColorManagementParams::NoProfileString) {
+        if (icm.outputProfile != "" && icm.outputProfile != ColorManagementParams::NoICMString && icm.outputProfile != ColorManagementParams::NoProfileString) {
 
-            cmsHPROFILE jprof = ICCStore::getInstance()->getProfile (params.icm.outputProfile); //get outProfile
+            cmsHPROFILE jprof = ICCStore::getInstance()->getProfile (icm.outputProfile); //get outProfile
 
             if (jprof == nullptr) {
                 if (settings->verbose) {
-                    printf ("\"%s\" ICC output profile not found!\n - use LCMS2 substitution\n", params.icm.outputProfile.c_str());
+                    printf ("\"%s\" ICC output profile not found!\n - use LCMS2 substitution\n", icm.outputProfile.c_str());
                 }
             } else {
                 if (settings->verbose) {
-                    printf ("Using \"%s\" output profile\n", params.icm.outputProfile.c_str());
+                    printf ("Using \"%s\" output profile\n", icm.outputProfile.c_str());
                 }
 
-                ProfileContent pc = ICCStore::getInstance()->getContent (params.icm.outputProfile);
+                ProfileContent pc = ICCStore::getInstance()->getContent (icm.outputProfile);
                 readyImg->setOutputProfile (pc.getData().c_str(), pc.getData().size());
             }
-        } else if (params.icm.outputProfile == ColorManagementParams::NoProfileString) {
-            cmsHPROFILE wp = ICCStore::getInstance()->workingSpace(params.icm.workingProfile);
+        } else if (icm.outputProfile == ColorManagementParams::NoProfileString) {
+            cmsHPROFILE wp = ICCStore::getInstance()->workingSpace(icm.workingProfile);
             ProfileContent wpc(wp);
             readyImg->setOutputProfile(wpc.getData().c_str(), wpc.getData().size());
         } else {
@@ -468,21 +562,12 @@ private:
             readyImg->setOutputProfile(nullptr, 0);
         }
 
-        if (!job->initialImage) {
-            ii->decreaseRef ();
-        }
-
-        delete job;
-
-        if (pl) {
-            pl->setProgress (0.75);
-        }
-
         return readyImg;
     }
 
     void stage_early_resize()
     {
+        perf::Scope scope("stage", "early_resize");
         procparams::ProcParams& params = job->pparams;
         ImProcFunctions &ipf = * (ipf_p.get());
 
@@ -522,6 +607,48 @@ private:
         fh = imh;
     }
 
+    // crop rectangle in the coordinates of a working image of size iw x ih
+    void get_crop_area(int iw, int ih, int &cx, int &cy, int &cw, int &ch)
+    {
+        const procparams::CropParams &crop = job->pparams.crop;
+        cx = crop.x * scale_factor + 0.5;
+        cy = crop.y * scale_factor + 0.5;
+        cw = std::min(int(crop.w * scale_factor + 0.5), iw - cx);
+        ch = std::min(int(crop.h * scale_factor + 0.5), ih - cy);
+    }
+
+    // Decides whether to export in place, avoiding the largest full-size
+    // temporary images: the geometric transformations work in place and
+    // produce only the cropped area, and the conversion to the output profile
+    // overwrites the working image. This reduces the peak memory usage, but
+    // it doesn't enforce any limit. The estimate covers the demosaiced data
+    // of the image source plus the working image and up to three full-size
+    // copies made by the transformations.
+    // A strip-by-strip export under a hard cap is not possible with the
+    // current pipeline: demosaicing, the geometric transformations (random
+    // access to the source), the multi-scale operations (denoise, local
+    // contrast, dehaze, tone equalizer, guided smoothing) and the CTL
+    // scripts all take whole Imagefloat frames, so each of them would need
+    // a strip-aware variant first
+    bool use_in_place(int w, int h)
+    {
+        const size_t threshold = size_t(settings->export_in_place_threshold) << 20;
+        if (!threshold) {
+            return false;
+        }
+
+        const size_t frame = size_t(w) * size_t(h) * 3 * sizeof(float);
+        const size_t estimate = 5 * frame;
+        const bool ret = estimate > threshold;
+
+        if (ret && settings->verbose) {
+            std::cout << "Estimated memory usage of " << (estimate >> 20)
+                      << " MB is above " << settings->export_in_place_threshold
+                      << " MB, exporting in place" << std::endl;
+        }
+        return ret;
+    }
+
     void adjust_procparams(double scale_factor)
     {
         procparams::ProcParams &params = job->pparams;
@@ -545,6 +672,8 @@ private:
     int& errorCode;
     ProgressListener* pl;
     bool flush;
+    // the first one corresponds to the ProcParams of the job
+    std::vector<ProcessingJob::Output> outputs;
 
     // internal state
     std::unique_ptr<ImProcFunctions> ipf_p;
@@ -563,6 +692,8 @@ private:
     Imagefloat *img;
 
     double pipeline_scale;
+    bool in_place;
+    bool cropped; // true if the crop was already applied by stage_transform
     bool stop;
 };
 
@@ -571,8 +702,17 @@ private:
 
 IImagefloat* processImage (ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool flush)
 {
-    ImageProcessor proc (pjob, errorCode, pl, flush);
-    return proc();
+    ImageProcessor proc (pjob, errorCode, pl, flush, false);
+    const auto res = proc();
+    return res.empty() ? nullptr : res[0];
+}
+
+
+std::vector<IImagefloat*> processImageOutputs (ProcessingJob* pjob, int& errorCode, ProgressListener* pl, bool flush)
+{
+    ImageProcessor proc (pjob, errorCode, pl, flush, true);
+    const auto res = proc();
+    return std::vector<IImagefloat*>(res.begin(), res.end());
 }
 
 void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl)
@@ -604,10 +744,148 @@ void batchProcessingThread (ProcessingJob* job, BatchProcessingListener* bpl)
 }
 
 
+namespace {
+
+// bounded FIFO used to hand over work between the stages of the batch
+// processing pipeline
+template <class T>
+class StageQueue: public NonCopyable {
+public:
+    explicit StageQueue(size_t capacity): capacity_(capacity) {}
+
+    void push(T v)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() -> bool { return queue_.size() < capacity_; });
+        queue_.push(v);
+        cond_.notify_all();
+    }
+
+    T pop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() -> bool { return !queue_.empty(); });
+        T ret = queue_.front();
+        queue_.pop();
+        cond_.notify_all();
+        return ret;
+    }
+
+private:
+    size_t capacity_;
+    std::queue<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+
+struct ProcessedImage {
+    bool last;
+    IImagefloat *img;
+};
+
+} // namespace
+
+
+/*
+ * Three-stage batch processing: a decoder thread loads the raw data of the
+ * next job, the calling thread processes the current one, and a saver thread
+ * encodes and writes the previous result. The stages are connected by queues
+ * of size 1, so at most five images are in flight at any time: one being
+ * decoded (or waiting to be queued), one in each queue, one being processed
+ * and one being saved.
+ */
+void batchProcessingPipeline(ProcessingJob *job, BatchProcessingListener *bpl)
+{
+    StageQueue<ProcessingJob *> decoded(1);
+    StageQueue<ProcessedImage> processed(1);
+    std::atomic<bool> stop(false);
+
+    const auto decode =
+        [&]() -> void
+        {
+            ProcessingJob *cur = job;
+            while (cur) {
+                auto j = static_cast<ProcessingJobImpl *>(cur);
+                auto p = bpl->getBatchProfile();
+                if (p && j->use_batch_profile) {
+                    p->applyTo(j->pparams);
+                }
+                if (!j->initialImage) {
+                    int errorCode = 0;
+                    InitialImage *ii = InitialImage::load(j->fname, j->isRaw, &errorCode);
+                    if (!errorCode) {
+                        // the job takes ownership of ii. In case of errors,
+                        // we let processImage try again and report them
+                        j->initialImage = ii;
+                    }
+                }
+                decoded.push(cur);
+                cur = stop ? nullptr : bpl->nextJob();
+            }
+            decoded.push(nullptr);
+        };
+
+    const auto save =
+        [&]() -> void
+        {
+            while (true) {
+                ProcessedImage r = processed.pop();
+                if (r.last) {
+                    break;
+                }
+                bool ok = false;
+                try {
+                    ok = bpl->saveImage(r.img);
+                } catch (Glib::Exception &ex) {
+                    bpl->error(ex.what());
+                }
+                if (!ok) {
+                    stop = true;
+                }
+            }
+        };
+
+    std::thread decoder(decode);
+    std::thread saver(save);
+    
+    while (ProcessingJob *cur = decoded.pop()) {
+        // the listener must hear about every job it handed out, also after
+        // a failed save: the jobs already in flight are processed unless it
+        // refuses to start them
+        if (!bpl->jobStarted()) {
+            // the batch processing was stopped: the job stays with the
+            // listener, and it is decoded again when it is started
+            stop = true;
+            auto j = static_cast<ProcessingJobImpl *>(cur);
+            if (j->initialImage) {
+                j->initialImage->decreaseRef();
+                j->initialImage = nullptr;
+            }
+            continue;
+        }
+        int errorCode;
+        IImagefloat *img = processImage(cur, errorCode, bpl, true);
+        if (errorCode) {
+            img = nullptr;
+        }
+        processed.push({false, img});
+    }
+    processed.push({true, nullptr});
+
+    decoder.join();
+    saver.join();
+}
+
+
 void startBatchProcessing(ProcessingJob *job, BatchProcessingListener *bpl)
 {
     if (bpl) {
-        ThreadPool::add_task(ThreadPool::Priority::NORMAL, sigc::bind(sigc::ptr_fun(batchProcessingThread), job, bpl));
+        if (bpl->usePipeline()) {
+            ThreadPool::add_task(ThreadPool::Priority::NORMAL, sigc::bind(sigc::ptr_fun(batchProcessingPipeline), job, bpl));
+        } else {
+            ThreadPool::add_task(ThreadPool::Priority::NORMAL, sigc::bind(sigc::ptr_fun(batchProcessingThread), job, bpl));
+        }
     }
 
 }
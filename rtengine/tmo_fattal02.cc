@@ -75,6 +75,7 @@
 #include "rt_algo.h"
 #include "rescale.h"
 #include "ipdenoise.h"
+#include "fftwplans.h"
 
 namespace rtengine
 {
@@ -728,6 +729,17 @@ void tmo_fattal02 (size_t width,
 // for both solvers.
 
 
+// number of threads for the parallel execution of fft routines
+inline int fftw_threads(bool multithread)
+{
+#ifdef _OPENMP
+    return multithread ? omp_get_num_procs() : 1;
+#else
+    return 1;
+#endif
+}
+
+
 // returns T = EVy A EVx^tr
 // note, modifies input data
 void transform_ev2normal (Array2Df *A, Array2Df *T, bool multithread)
@@ -767,11 +779,11 @@ void transform_ev2normal (Array2Df *A, Array2Df *T, bool multithread)
     // fftwf_free(in);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d (height, width, A->data(), T->data(),
-                           FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute (p);
-    fftwf_destroy_plan (p);
+    // the plan is owned by the fftw plan cache. The sizes here are
+    // arbitrary, so FFTW_MEASURE could be very slow for unlucky ones
+    fftwf_plan p = fftw::plan_r2r_2d(height, width, A->data(), T->data(),
+                                     FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE, fftw_threads(multithread));
+    fftwf_execute_r2r(p, A->data(), T->data());
 }
 
 
@@ -783,11 +795,11 @@ void transform_normal2ev (Array2Df *A, Array2Df *T, bool multithread)
     assert ((int)T->getCols() == width && (int)T->getRows() == height);
 
     // executes 2d discrete cosine transform
-    fftwf_plan p;
-    p = fftwf_plan_r2r_2d (height, width, A->data(), T->data(),
-                           FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE);
-    fftwf_execute (p);
-    fftwf_destroy_plan (p);
+    // the plan is owned by the fftw plan cache. The sizes here are
+    // arbitrary, so FFTW_MEASURE could be very slow for unlucky ones
+    fftwf_plan p = fftw::plan_r2r_2d(height, width, A->data(), T->data(),
+                                     FFTW_REDFT00, FFTW_REDFT00, FFTW_ESTIMATE, fftw_threads(multithread));
+    fftwf_execute_r2r(p, A->data(), T->data());
 
     // need to scale the output matrix to get the right transform
     float factor = (1.0f / ((height - 1) * (width - 1)));
@@ -878,18 +890,6 @@ void solve_pde_fft (Array2Df *F, Array2Df *U, Array2Df *buf, bool multithread)/*
     assert ((int)U->getCols() == width && (int)U->getRows() == height);
     assert (buf->getCols() == width && buf->getRows() == height);
 
-    // activate parallel execution of fft routines
-#ifdef RT_FFTW3F_OMP
-
-    if (multithread) {
-        fftwf_init_threads();
-        fftwf_plan_with_nthreads(omp_get_num_procs());
-    }
-
-// #else
-//   fftwf_plan_with_nthreads( 2 );
-#endif
-
     // in general there might not be a solution to the Poisson pde
     // with Neumann boundary conditions unless the boundary satisfies
     // an integral condition, this function modifies the boundary so that
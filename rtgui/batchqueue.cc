@@ -46,7 +46,10 @@ BatchQueue::BatchQueue (FileCatalog* aFileCatalog):
     fileCatalog(aFileCatalog),
     sequence(0),
     listener(nullptr),
-    batch_profile_(nullptr)
+    batch_profile_(nullptr),
+    pipelined_(false),
+    pipeline_stop_(false),
+    in_flight_started_(0)
 {
     fileCatalog->setBatchQueue(this);
     
@@ -229,7 +232,7 @@ void BatchQueue::addEntries (const std::vector<BatchQueueEntry*>& entries, bool
             auto pos = fd.end ();
 
             if (head)
-                pos = std::find_if (fd.begin (), fd.end (), [] (const ThumbBrowserEntryBase* fdEntry) { return !fdEntry->processing; });
+                pos = std::find_if (fd.begin (), fd.end (), [this] (const ThumbBrowserEntryBase* fdEntry) { return !isBusy(fdEntry); });
 
             fd.insert (pos, entry);
 
@@ -439,7 +442,7 @@ void BatchQueue::cancelItems(const std::vector<ThumbBrowserEntryBase*>& items, b
 
             const auto entry = static_cast<BatchQueueEntry*> (item);
 
-            if (entry->processing)
+            if (isBusy(entry))
                 continue;
 
             const auto pos = std::find (fd.begin (), fd.end (), entry);
@@ -509,7 +512,7 @@ void BatchQueue::headItems (const std::vector<ThumbBrowserEntryBase*>& items)
 
             const auto entry = static_cast<BatchQueueEntry*> (*item);
 
-            if (entry->processing)
+            if (isBusy(entry))
                 continue;
 
             const auto pos = std::find (fd.begin (), fd.end (), entry);
@@ -520,7 +523,7 @@ void BatchQueue::headItems (const std::vector<ThumbBrowserEntryBase*>& items)
             fd.erase (pos);
 
             // find the first item that is not under processing
-            const auto newPos = std::find_if (fd.begin (), fd.end (), [] (const ThumbBrowserEntryBase* fdEntry) { return !fdEntry->processing; });
+            const auto newPos = std::find_if (fd.begin (), fd.end (), [this] (const ThumbBrowserEntryBase* fdEntry) { return !isBusy(fdEntry); });
 
             fd.insert (newPos, entry);
         }
@@ -540,7 +543,7 @@ void BatchQueue::tailItems (const std::vector<ThumbBrowserEntryBase*>& items)
 
             const auto entry = static_cast<BatchQueueEntry*> (item);
 
-            if (entry->processing)
+            if (isBusy(entry))
                 continue;
 
             const auto pos = std::find (fd.begin (), fd.end (), entry);
@@ -603,13 +606,28 @@ void BatchQueue::openItemInEditor(ThumbBrowserEntryBase* item)
 void BatchQueue::startProcessing ()
 {
 
-    if (!processing) {
+    if (!isRunning()) {
         MYWRITERLOCK(l, entryRW);
 
         if (!fd.empty()) {
             BatchQueueEntry* next;
 
             next = static_cast<BatchQueueEntry*>(fd[0]);
+
+            pipelined_ = options.batch_queue_pipeline;
+            pipeline_stop_ = false;
+            in_flight_.clear();
+            in_flight_started_ = 0;
+            sequence = 0;
+            if (pipelined_) {
+                // the entry is tagged as processing by jobStarted()
+                in_flight_.push_back(next);
+                MYWRITERLOCK_RELEASE(l);
+                rtengine::startBatchProcessing(next->job, this);
+                notifyListener();
+                return;
+            }
+
             // tag it as processing and set sequence
             next->processing = true;
             next->sequence = sequence = 1;
@@ -666,7 +684,7 @@ void BatchQueue::setProgressState(bool inProcessing)
 
 void BatchQueue::error(const Glib::ustring& descr)
 {
-    if (processing && processing->processing) {
+    if (!pipelined_ && processing && processing->processing) {
         // restore failed thumb
         BatchQueueButtonSet* bqbs = new BatchQueueButtonSet (processing);
         bqbs->setButtonListener (this);
@@ -679,7 +697,7 @@ void BatchQueue::error(const Glib::ustring& descr)
 
     if (listener) {
         BatchQueueListener* const bql = listener;
-        const bool running = processing;
+        const bool running = isRunning();
         int qsize = 0;
         {
             MYREADERLOCK(l, entryRW);
@@ -870,36 +888,36 @@ Glib::ustring calcAutoFileNameBase(const Glib::ustring& origFileName, rtengine::
 } // namespace
 
 
-rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
+void BatchQueue::saveEntryImage(BatchQueueEntry *entry, rtengine::IImagefloat *img, rtengine::ProgressListener *pl)
 {
     // save image img
     Glib::ustring fname;
     SaveFormat saveFormat;
 
-    if (processing->outFileName == "") { // auto file name
-        Glib::ustring s = calcAutoFileNameBase(processing->filename, processing->params, processing->sequence);
+    if (entry->outFileName == "") { // auto file name
+        Glib::ustring s = calcAutoFileNameBase(entry->filename, entry->params, entry->sequence);
         saveFormat = options.saveFormatBatch;
         fname = autoCompleteFileName(s, saveFormat.format);
     } else { // use the save-as filename with automatic completion for uniqueness
-        if (processing->forceFormatOpts) {
-            saveFormat = processing->saveFormat;
+        if (entry->forceFormatOpts) {
+            saveFormat = entry->saveFormat;
         } else {
             saveFormat = options.saveFormatBatch;
         }
 
         // The output filename's extension is forced to the current or selected output format,
         // despite what the user have set in the fielneame's field of the "Save as" dialgo box
-        fname = autoCompleteFileName (removeExtension(processing->outFileName), saveFormat.format);
-        //fname = autoCompleteFileName (removeExtension(processing->outFileName), getExtension(processing->outFileName));
+        fname = autoCompleteFileName (removeExtension(entry->outFileName), saveFormat.format);
+        //fname = autoCompleteFileName (removeExtension(entry->outFileName), getExtension(entry->outFileName));
     }
 
     //printf ("fname=%s, %s\n", fname.c_str(), removeExtension(fname).c_str());
 
     if (img && fname != "") {
         int err = 0;
-        processing->processing = false;
+        entry->processing = false;
 
-        img->setSaveProgressListener(this);
+        img->setSaveProgressListener(pl);
 
         if (saveFormat.format == "tif") {
             err = img->saveAsTIFF (fname, saveFormat.tiffBits, saveFormat.tiffFloat, saveFormat.tiffUncompressed);
@@ -908,7 +926,7 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
         } else if (saveFormat.format == "jpg") {
             err = img->saveAsJPEG (fname, saveFormat.jpegQuality, saveFormat.jpegSubSamp);
         } else {
-            err = rtengine::ImageIOManager::getInstance()->save(img, saveFormat.format, fname, this) ? 0 : 1;
+            err = rtengine::ImageIOManager::getInstance()->save(img, saveFormat.format, fname, pl) ? 0 : 1;
         }
 
         img->free ();
@@ -920,25 +938,66 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
         if (saveFormat.saveParams) {
             // We keep the extension to avoid overwriting the profile when we have
             // the same output filename with different extension
-            //processing->params.save (removeExtension(fname) + paramFileExtension);
-            if (batch_profile_ && processing->use_batch_profile) {
-                batch_profile_->applyTo(processing->params);
+            //entry->params.save (removeExtension(fname) + paramFileExtension);
+            if (batch_profile_ && entry->use_batch_profile) {
+                batch_profile_->applyTo(entry->params);
             }
             auto sidecar = fname + ".out" + paramFileExtension;
             if (!options.params_out_embed) {
-                processing->params.save(this, sidecar);
-            } else if (processing->params.saveEmbedded(this, fname) != 0) {
+                entry->params.save(this, sidecar);
+            } else if (entry->params.saveEmbedded(this, fname) != 0) {
                 error(Glib::ustring::compose(M("PROCPARAMS_EMBEDDED_SAVE_WARNING"), fname, sidecar));
-                processing->params.save(this, sidecar);
+                entry->params.save(this, sidecar);
             }
         }
 
-        if (processing->thumbnail) {
-            processing->thumbnail->imageDeveloped ();
-            processing->thumbnail->imageRemovedFromQueue ();
+        if (entry->thumbnail) {
+            entry->thumbnail->imageDeveloped ();
+            entry->thumbnail->imageRemovedFromQueue ();
+        }
+    }
+}
+
+
+void BatchQueue::entryDone(const Glib::ustring &processedParams)
+{
+    if (saveBatchQueue ()) {
+        ::g_remove (processedParams.c_str ());
+
+        // Delete all files in directory batch when finished, just to be sure to remove zombies
+        auto isEmpty = false;
+
+        {
+            MYREADERLOCK(l, entryRW);
+            isEmpty = fd.empty();
+        }
+
+        if (isEmpty) {
+
+            const auto batchdir = Glib::build_filename (options.rtdir, "batch");
+
+            try {
+
+                auto dir = Gio::File::create_for_path (batchdir);
+                auto enumerator = dir->enumerate_children ("standard::name");
+
+                while (auto file = enumerator->next_file ()) {
+                    ::g_remove (Glib::build_filename (batchdir, file->get_name ()).c_str ());
+                }
+
+            } catch (Glib::Exception&) {}
         }
     }
 
+    redraw ();
+    notifyListener ();
+}
+
+
+rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
+{
+    saveEntryImage(processing, img, this);
+
     // save temporary params file name: delete as last thing
     Glib::ustring processedParams = processing->savedParamsFile;
 
@@ -983,38 +1042,178 @@ rtengine::ProcessingJob* BatchQueue::imageReady(rtengine::IImagefloat* img)
         processing->removeButtonSet ();
     }
 
-    if (saveBatchQueue ()) {
-        ::g_remove (processedParams.c_str ());
+    entryDone(processedParams);
 
-        // Delete all files in directory batch when finished, just to be sure to remove zombies
-        auto isEmpty = false;
+    return processing ? processing->job : nullptr;
+}
 
-        {
-            MYREADERLOCK(l, entryRW);
-            isEmpty = fd.empty();
+
+bool BatchQueue::usePipeline()
+{
+    return pipelined_;
+}
+
+
+rtengine::ProcessingJob *BatchQueue::nextJob()
+{
+    BatchQueueEntry *next = nullptr;
+    
+    {
+        MYWRITERLOCK(l, entryRW);
+
+        if (pipeline_stop_ || !listener || !listener->canStartNext()) {
+            return nullptr;
         }
 
-        if (isEmpty) {
+        // the entries in flight are always at the head of the queue. They
+        // are tagged as processing only when their processing starts (see
+        // jobStarted())
+        auto it = std::find_if(fd.begin(), fd.end(), [this](const ThumbBrowserEntryBase *e) { return !isBusy(e); });
+        if (it == fd.end()) {
+            return nullptr;
+        }
 
-            const auto batchdir = Glib::build_filename (options.rtdir, "batch");
+        next = static_cast<BatchQueueEntry *>(*it);
+        in_flight_.push_back(next);
+    }
 
-            try {
+    return next->job;
+}
 
-                auto dir = Gio::File::create_for_path (batchdir);
-                auto enumerator = dir->enumerate_children ("standard::name");
 
-                while (auto file = enumerator->next_file ()) {
-                    ::g_remove (Glib::build_filename (batchdir, file->get_name ()).c_str ());
+bool BatchQueue::jobStarted()
+{
+    BatchQueueEntry *next = nullptr;
+    bool stopped = false;
+
+    {
+        MYWRITERLOCK(l, entryRW);
+
+        if (in_flight_started_ >= in_flight_.size()) {
+            return false;
+        }
+
+        next = in_flight_[in_flight_started_];
+        if (pipeline_stop_ || !listener || !listener->canStartNext()) {
+            // the queue was stopped after the entry was handed out: leave it
+            // in the queue as it is
+            in_flight_.erase(in_flight_.begin() + in_flight_started_);
+            stopped = true;
+        } else {
+            ++in_flight_started_;
+            next->processing = true;
+            next->sequence = ++sequence;
+            processing = next;
+
+            // remove from selection
+            if (next->selected) {
+                auto pos = std::find(selected.begin(), selected.end(), next);
+
+                if (pos != selected.end()) {
+                    selected.erase(pos);
                 }
 
-            } catch (Glib::Exception&) {}
+                next->selected = false;
+            }
         }
     }
 
-    redraw ();
-    notifyListener ();
+    if (stopped) {
+        notifyListener();
+        return false;
+    }
 
-    return processing ? processing->job : nullptr;
+    {
+        // ButtonSet have Cairo::Surface which might be rendered while we're trying to delete them
+        GThreadLock lock;
+        next->removeButtonSet();
+    }
+
+    redraw();
+
+    return true;
+}
+
+
+bool BatchQueue::isBusy(const ThumbBrowserEntryBase *entry) const
+{
+    return entry->processing || std::find(in_flight_.begin(), in_flight_.end(), entry) != in_flight_.end();
+}
+
+
+bool BatchQueue::saveImage(rtengine::IImagefloat *img)
+{
+    BatchQueueEntry *entry = nullptr;
+    {
+        MYREADERLOCK(l, entryRW);
+        entry = in_flight_.front();
+    }
+
+    Glib::ustring errmsg;
+    if (img) {
+        try {
+            // no progress reporting for saving, setProgress refers to the
+            // entry being processed
+            saveEntryImage(entry, img, nullptr);
+        } catch (Glib::Exception &exc) {
+            errmsg = exc.what();
+        }
+    } else {
+        errmsg = M("MAIN_MSG_CANNOTLOAD");
+    }
+
+    if (!errmsg.empty()) {
+        // restore the failed entry and stop the queue after the entries
+        // already in flight
+        {
+            MYWRITERLOCK(l, entryRW);
+            
+            in_flight_.pop_front();
+            --in_flight_started_;
+            if (processing == entry) {
+                processing = nullptr;
+            }
+            pipeline_stop_ = true;
+        }
+
+        BatchQueueButtonSet* bqbs = new BatchQueueButtonSet(entry);
+        bqbs->setButtonListener(this);
+        entry->addButtonSet(bqbs);
+        entry->processing = false;
+        entry->job = rtengine::ProcessingJob::create(entry->filename, entry->thumbnail->getType() == FT_Raw, entry->params);
+        redraw();
+        
+        error(errmsg);
+        return false;
+    }
+
+    Glib::ustring processedParams = entry->savedParamsFile;
+
+    bool ret = true;
+    {
+        MYWRITERLOCK(l, entryRW);
+
+        in_flight_.pop_front();
+        --in_flight_started_;
+        if (processing == entry) {
+            processing = nullptr;
+        }
+        ret = !pipeline_stop_;
+
+        fd.erase(std::find(fd.begin(), fd.end(), entry));
+        delete entry;
+    }
+
+    entryDone(processedParams);
+
+    return ret;
+}
+
+
+bool BatchQueue::isRunning()
+{
+    MYREADERLOCK(l, entryRW);
+    return processing || !in_flight_.empty();
 }
 
 
@@ -1081,7 +1280,7 @@ void BatchQueue::buttonPressed (LWButton* button, int actionCode, void* actionDa
 
 void BatchQueue::notifyListener ()
 {
-    const bool queueRunning = processing;
+    const bool queueRunning = isRunning();
     if (listener) {
         BatchQueueListener* const bql = listener;
 
@@ -20,6 +20,7 @@
 #define _BATCHQUEUE_
 
 #include <set>
+#include <deque>
 
 #include <gtkmm.h>
 
@@ -73,6 +74,10 @@ public:
     void setProgressState(bool inProcessing) override;
     void error(const Glib::ustring& descr) override;
     rtengine::ProcessingJob* imageReady(rtengine::IImagefloat* img) override;
+    bool usePipeline() override;
+    rtengine::ProcessingJob* nextJob() override;
+    bool jobStarted() override;
+    bool saveImage(rtengine::IImagefloat* img) override;
 
     void rightClicked (ThumbBrowserEntryBase* entry) override;
     void doubleClicked (ThumbBrowserEntryBase* entry) override;
@@ -103,6 +108,9 @@ private:
     Glib::ustring getTempFilenameForParams( const Glib::ustring &filename );
     bool saveBatchQueue ();
     void notifyListener ();
+    bool isRunning();
+    void saveEntryImage(BatchQueueEntry *entry, rtengine::IImagefloat *img, rtengine::ProgressListener *pl);
+    void entryDone(const Glib::ustring &processedParams);
 
     using ThumbBrowserBase::redrawEntryNeeded;
 
@@ -130,6 +138,18 @@ private:
     const rtengine::procparams::PartialProfile *batch_profile_;
 
     std::unordered_map<std::string, std::string> format2ext_;
+
+    // true if entry is being processed, or has been handed out to the engine
+    // for decoding. Such entries can't be moved or removed
+    bool isBusy(const ThumbBrowserEntryBase *entry) const;
+
+    // pipelined processing: the entries handed out to the engine and not
+    // saved yet, in order, and how many of them have started processing.
+    // Only the started ones are marked as processing
+    bool pipelined_;
+    bool pipeline_stop_;
+    std::deque<BatchQueueEntry*> in_flight_;
+    size_t in_flight_started_;
 };
 
 #endif
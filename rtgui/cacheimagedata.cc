@@ -18,6 +18,7 @@
  *  along with RawTherapee.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "cacheimagedata.h"
+#include "cachemanager.h"
 #include <vector>
 #include <glib/gstdio.h>
 #include "version.h"
@@ -45,7 +46,8 @@ int CacheImageData::load (const Glib::ustring& fname)
     Glib::KeyFile keyFile;
 
     try {
-        if (keyFile.load_from_file (fname)) {
+        std::string data;
+        if (cacheMgr->readFile(fname, data) && keyFile.load_from_data(data)) {
 
             if (keyFile.has_group ("General")) {
                 if (keyFile.has_key ("General", "MD5")) {
@@ -229,7 +231,10 @@ int CacheImageData::save (const Glib::ustring& fname)
     Glib::KeyFile keyFile;
 
     try {
-        keyFile.load_from_file (fname);
+        std::string data;
+        if (cacheMgr->readFile(fname, data)) {
+            keyFile.load_from_data(data);
+        }
     } catch (Glib::Error&) {}
 
     keyFile.set_string  ("General", "MD5", md5);
@@ -301,18 +306,14 @@ int CacheImageData::save (const Glib::ustring& fname)
         return 1;
     }
 
-    FILE *f = g_fopen (fname.c_str (), "wt");
-
-    if (!f) {
+    if (!cacheMgr->writeFile(fname, keyData.raw())) {
         if (options.rtSettings.verbose) {
-            printf("CacheImageData::save / Error: unable to open file \"%s\" with write access!\n", fname.c_str());
+            printf("CacheImageData::save / Error: unable to write \"%s\"!\n", fname.c_str());
         }
 
         return 1;
-    } else {
-        fprintf (f, "%s", keyData.c_str ());
-        fclose (f);
-        return 0;
     }
+
+    return 0;
 }
 
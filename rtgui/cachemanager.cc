@@ -20,6 +20,7 @@
 
 #include <memory>
 #include <iostream>
+#include <algorithm>
 
 #include <glib/gstdio.h>
 #include <giomm.h>
@@ -44,6 +45,25 @@ constexpr const char* cacheDirs[] = {
     "data"
 };
 
+// minimum amount of garbage in the cache pack for triggering a compaction
+constexpr uint64_t packCompactionThreshold = 64 * 1024 * 1024;
+
+
+// split the name of a "data" entry (basename.md5.txt)
+bool parseDataName(const Glib::ustring &name, Glib::ustring &fname, Glib::ustring &md5)
+{
+    constexpr auto md5_size = 32;
+    const auto name_size = name.size();
+
+    if (name_size < md5_size + 5) {
+        return false;
+    }
+
+    fname = name.substr(0, name_size - md5_size - 5);
+    md5 = name.substr(name_size - md5_size - 4, md5_size);
+    return true;
+}
+
 } // namespace
 
 CacheManager::CacheManager():
@@ -75,6 +95,12 @@ void CacheManager::init()
     if (error != 0 && options.rtSettings.verbose) {
         std::cerr << "Failed to create all cache directories: " << g_strerror(errno) << std::endl;
     }
+
+    if (options.cache_packed) {
+        pack_.reset(new CachePack(baseDir));
+    } else {
+        pack_.reset();
+    }
 }
 
 
@@ -196,13 +222,13 @@ void CacheManager::renameEntry(const std::string& oldfilename, const std::string
 
     const auto newmd5 = getMD5(newfilename);
 
-    auto error = g_rename(getCacheFileName("profiles", oldfilename, paramFileExtension, oldmd5).c_str(), getCacheFileName("profiles", newfilename, paramFileExtension, newmd5).c_str());
-    error |= g_rename(getCacheFileName("images", oldfilename, ".rtti", oldmd5).c_str(), getCacheFileName("images", newfilename, ".rtti", newmd5).c_str());
-    error |= g_rename(getCacheFileName("embprofiles", oldfilename, ".icc", oldmd5).c_str(), getCacheFileName("embprofiles", newfilename, ".icc", newmd5).c_str());
-    error |= g_rename(getCacheFileName("data", oldfilename, ".txt", oldmd5).c_str(), getCacheFileName("data", newfilename, ".txt", newmd5).c_str());
-    error |= g_rename(getCacheFileName("images", oldfilename, ".artt", oldmd5).c_str(), getCacheFileName("images", newfilename, ".artt", newmd5).c_str());
+    bool error = g_rename(getCacheFileName("profiles", oldfilename, paramFileExtension, oldmd5).c_str(), getCacheFileName("profiles", newfilename, paramFileExtension, newmd5).c_str()) != 0;
+    error |= !renameFile(getCacheFileName("images", oldfilename, ".rtti", oldmd5), getCacheFileName("images", newfilename, ".rtti", newmd5));
+    error |= !renameFile(getCacheFileName("embprofiles", oldfilename, ".icc", oldmd5), getCacheFileName("embprofiles", newfilename, ".icc", newmd5));
+    error |= !renameFile(getCacheFileName("data", oldfilename, ".txt", oldmd5), getCacheFileName("data", newfilename, ".txt", newmd5));
+    error |= !renameFile(getCacheFileName("images", oldfilename, ".artt", oldmd5), getCacheFileName("images", newfilename, ".artt", newmd5));
     
-    if (error != 0 && options.rtSettings.verbose) {
+    if (error && options.rtSettings.verbose) {
         std::cerr << "Failed to rename all files for cache entry '" << oldfilename << "': " << g_strerror(errno) << std::endl;
     }
 
@@ -237,6 +263,10 @@ void CacheManager::closeCache() const
     MyMutex::MyLock lock(mutex);
 
     applyCacheSizeLimitation();
+
+    if (pack_) {
+        pack_->flush();
+    }
 }
 
 
@@ -247,6 +277,10 @@ void CacheManager::clearAll() const
     for (const auto& cacheDir : cacheDirs) {
         deleteDir(cacheDir);
     }
+
+    if (pack_) {
+        pack_->clear("");
+    }
 }
 
 
@@ -257,6 +291,11 @@ void CacheManager::clearImages() const
     deleteDir("data");
     deleteDir("images");
     deleteDir("aehistograms");
+
+    if (pack_) {
+        pack_->clear("data/");
+        pack_->clear("images/");
+    }
 }
 
 
@@ -293,19 +332,19 @@ void CacheManager::deleteFiles(const Glib::ustring& fname, const std::string& md
         return;
     }
 
-    auto error = g_remove(getCacheFileName("images", fname, ".rtti", md5).c_str());
-    error |= g_remove(getCacheFileName("embprofiles", fname, ".icc", md5).c_str());
-    error |= g_remove(getCacheFileName("images", fname, ".artt", md5).c_str());
+    bool error = !removeFile(getCacheFileName("images", fname, ".rtti", md5));
+    error |= !removeFile(getCacheFileName("embprofiles", fname, ".icc", md5));
+    error |= !removeFile(getCacheFileName("images", fname, ".artt", md5));
 
     if (purgeData) {
-        error |= g_remove(getCacheFileName("data", fname, ".txt", md5).c_str());
+        error |= !removeFile(getCacheFileName("data", fname, ".txt", md5));
     }
 
     if (purgeProfile) {
-        error |= g_remove(getCacheFileName("profiles", fname, paramFileExtension, md5).c_str());
+        error |= g_remove(getCacheFileName("profiles", fname, paramFileExtension, md5).c_str()) != 0;
     }
 
-    if (error != 0 && options.rtSettings.verbose) {
+    if (error && options.rtSettings.verbose) {
         std::cerr << "Failed to delete all files for cache entry '" << fname << "': " << g_strerror(errno) << std::endl;
     }
 }
@@ -330,6 +369,11 @@ Glib::ustring CacheManager::getCacheFileName(const Glib::ustring& subDir,
 
 void CacheManager::applyCacheSizeLimitation() const
 {
+    if (pack_) {
+        applyPackSizeLimitation();
+        return;
+    }
+
     // first count files without fetching file name and timestamp.
     std::size_t numFiles = 0;
     try {
@@ -377,20 +421,29 @@ void CacheManager::applyCacheSizeLimitation() const
     auto cacheEntries = files.size();
 
     for (auto entry = files.begin(); cacheEntries-- > options.maxCacheEntries; ++entry) {
+        Glib::ustring fname, md5;
+        if (parseDataName(entry->first, fname, md5)) {
+            deleteFiles(fname, md5, true, false);
+        }
+    }
+}
 
-        const auto& name = entry->first;
 
-        constexpr auto md5_size = 32;
-        const auto name_size = name.size();
+void CacheManager::applyPackSizeLimitation() const
+{
+    // the pack index already has the LRU order, no need to scan anything
+    const auto keys = pack_->getLRUKeys("data/");
 
-        if (name_size < md5_size + 5) {
-            continue;
+    for (size_t i = 0; i + options.maxCacheEntries < keys.size(); ++i) {
+        Glib::ustring fname, md5;
+        if (parseDataName(keys[i].substr(5), fname, md5)) {
+            deleteFiles(fname, md5, true, false);
         }
+    }
 
-        const auto fname = name.substr(0, name_size - md5_size - 5);
-        const auto md5 = name.substr(name_size - md5_size - 4, md5_size);
-
-        deleteFiles(fname, md5, true, false);
+    const auto garbage = pack_->getGarbageSize();
+    if (garbage > packCompactionThreshold && garbage > pack_->getLiveSize()) {
+        pack_->compact();
     }
 }
 
@@ -412,3 +465,74 @@ bool CacheManager::getImageData(const Glib::ustring &fname, CacheImageData &out)
 
     return true;
 }
+
+
+std::string CacheManager::getPackKey(const Glib::ustring &fname) const
+{
+    std::string key = fname;
+    const std::string dir = baseDir;
+
+    if (key.size() > dir.size() && key.compare(0, dir.size(), dir) == 0 && G_IS_DIR_SEPARATOR(key[dir.size()])) {
+        key.erase(0, dir.size() + 1);
+    }
+#ifdef WIN32
+    std::replace(key.begin(), key.end(), '\\', '/');
+#endif
+    return key;
+}
+
+
+bool CacheManager::readFile(const Glib::ustring &fname, std::string &out) const
+{
+    if (pack_) {
+        return pack_->get(getPackKey(fname), out);
+    }
+
+    gchar *contents = nullptr;
+    gsize length = 0;
+    if (!g_file_get_contents(fname.c_str(), &contents, &length, nullptr)) {
+        return false;
+    }
+    out.assign(contents, length);
+    g_free(contents);
+    return true;
+}
+
+
+bool CacheManager::writeFile(const Glib::ustring &fname, const std::string &data) const
+{
+    if (pack_) {
+        return pack_->put(getPackKey(fname), data);
+    }
+
+    FILE *f = g_fopen(fname.c_str(), "wb");
+    if (!f) {
+        if (options.rtSettings.verbose) {
+            std::cerr << "unable to open file " << fname << " with write access" << std::endl;
+        }
+        return false;
+    }
+    const bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    return (fclose(f) == 0) && ok;
+}
+
+
+bool CacheManager::removeFile(const Glib::ustring &fname) const
+{
+    if (pack_) {
+        return pack_->remove(getPackKey(fname));
+    }
+
+    return g_remove(fname.c_str()) == 0;
+}
+
+
+bool CacheManager::renameFile(const Glib::ustring &oldname, const Glib::ustring &newname) const
+{
+    if (pack_) {
+        std::string data;
+        return pack_->get(getPackKey(oldname), data) && pack_->put(getPackKey(newname), data) && pack_->remove(getPackKey(oldname));
+    }
+
+    return g_rename(oldname.c_str(), newname.c_str()) == 0;
+}
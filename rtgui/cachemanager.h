@@ -21,6 +21,7 @@
 
 #include <string>
 #include <map>
+#include <memory>
 
 #include <glibmm/ustring.h>
 
@@ -28,6 +29,7 @@
 #include "../rtengine/rtengine.h"
 #include "threadutils.h"
 #include "cacheimagedata.h"
+#include "cachepack.h"
 
 class Thumbnail;
 
@@ -38,11 +40,15 @@ private:
     Glib::ustring    baseDir;
     mutable MyMutex  mutex;
     rtengine::ProgressListener *pl_;
+    std::unique_ptr<CachePack> pack_;
 
     void deleteDir   (const Glib::ustring& dirName) const;
     void deleteFiles (const Glib::ustring& fname, const std::string& md5, bool purgeData, bool purgeProfile) const;
 
     void applyCacheSizeLimitation () const;
+    void applyPackSizeLimitation () const;
+    std::string getPackKey(const Glib::ustring &fname) const;
+    bool renameFile(const Glib::ustring &oldname, const Glib::ustring &newname) const;
 
 public:
     CacheManager();
@@ -72,6 +78,14 @@ public:
                                    const Glib::ustring& md5) const;
 
     bool getImageData(const Glib::ustring &fn, CacheImageData &out);
+
+    // Access to the contents of the files returned by getCacheFileName. With
+    // the packed cache enabled (options.cache_packed), these are stored in a
+    // single pack file instead, keyed by the path relative to the cache
+    // directory. Profiles are always stored as individual files
+    bool readFile(const Glib::ustring &fname, std::string &out) const;
+    bool writeFile(const Glib::ustring &fname, const std::string &data) const;
+    bool removeFile(const Glib::ustring &fname) const;
 };
 
 #define cacheMgr CacheManager::getInstance()
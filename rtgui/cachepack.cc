@@ -0,0 +1,497 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cachepack.h"
+#include "options.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+
+#include <glibmm.h>
+#include <glib/gstdio.h>
+
+namespace {
+
+const char *const PACK_MAGIC = "ARTPACK1";
+const char *const INDEX_MAGIC = "ARTPIDX1";
+constexpr size_t MAGIC_SIZE = 8;
+constexpr uint32_t REMOVED = 0xFFFFFFFF;
+
+
+int pack_seek(FILE *f, uint64_t pos)
+{
+#ifdef WIN32
+    return _fseeki64(f, pos, SEEK_SET);
+#else
+    return fseeko(f, pos, SEEK_SET);
+#endif
+}
+
+
+int pack_seek_end(FILE *f)
+{
+#ifdef WIN32
+    return _fseeki64(f, 0, SEEK_END);
+#else
+    return fseeko(f, 0, SEEK_END);
+#endif
+}
+
+
+uint64_t pack_tell(FILE *f)
+{
+#ifdef WIN32
+    return _ftelli64(f);
+#else
+    return ftello(f);
+#endif
+}
+
+
+template <class T>
+bool read_val(FILE *f, T &val)
+{
+    return fread(&val, sizeof(T), 1, f) == 1;
+}
+
+
+template <class T>
+bool write_val(FILE *f, const T &val)
+{
+    return fwrite(&val, sizeof(T), 1, f) == 1;
+}
+
+
+bool read_str(FILE *f, uint32_t size, std::string &out)
+{
+    out.resize(size);
+    return size == 0 || fread(&out[0], 1, size, f) == size;
+}
+
+
+bool replace_file(const Glib::ustring &src, const Glib::ustring &dst)
+{
+#ifdef WIN32
+    // rename doesn't overwrite existing files on Windows
+    g_remove(dst.c_str());
+#endif
+    return g_rename(src.c_str(), dst.c_str()) == 0;
+}
+
+} // namespace
+
+
+CachePack::CachePack(const Glib::ustring &dir):
+    pack_fname_(Glib::build_filename(dir, "cache.pack")),
+    index_fname_(Glib::build_filename(dir, "cache.pack.idx")),
+    pack_(nullptr),
+    pack_size_(0),
+    garbage_(0),
+    clock_(0),
+    dirty_(false)
+{
+    if (open_pack() && !load_index()) {
+        rebuild_index();
+    }
+}
+
+
+CachePack::~CachePack()
+{
+    flush();
+    if (pack_) {
+        fclose(pack_);
+    }
+}
+
+
+bool CachePack::open_pack()
+{
+    pack_ = g_fopen(pack_fname_.c_str(), "r+b");
+    if (pack_) {
+        char buf[MAGIC_SIZE];
+        if (fread(buf, 1, MAGIC_SIZE, pack_) == MAGIC_SIZE && memcmp(buf, PACK_MAGIC, MAGIC_SIZE) == 0 && pack_seek_end(pack_) == 0) {
+            pack_size_ = pack_tell(pack_);
+            return true;
+        }
+        fclose(pack_);
+        if (options.rtSettings.verbose) {
+            std::cerr << "invalid cache pack " << pack_fname_ << ", discarding it" << std::endl;
+        }
+    }
+
+    pack_ = g_fopen(pack_fname_.c_str(), "w+b");
+    if (!pack_) {
+        if (options.rtSettings.verbose) {
+            std::cerr << "failed to create cache pack " << pack_fname_ << std::endl;
+        }
+        return false;
+    }
+    fwrite(PACK_MAGIC, 1, MAGIC_SIZE, pack_);
+    fflush(pack_);
+    pack_size_ = MAGIC_SIZE;
+    g_remove(index_fname_.c_str());
+    return true;
+}
+
+
+bool CachePack::load_index()
+{
+    FILE *f = g_fopen(index_fname_.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+
+    bool ok = false;
+    char buf[MAGIC_SIZE];
+    uint64_t pack_size = 0, garbage = 0;
+    uint32_t count = 0;
+    if (fread(buf, 1, MAGIC_SIZE, f) == MAGIC_SIZE && memcmp(buf, INDEX_MAGIC, MAGIC_SIZE) == 0 &&
+        read_val(f, pack_size) && read_val(f, garbage) && read_val(f, clock_) && read_val(f, count) &&
+        pack_size == pack_size_) {
+        ok = true;
+        std::string key;
+        for (uint32_t i = 0; ok && i < count; ++i) {
+            uint32_t keysz = 0;
+            Entry e;
+            ok = read_val(f, keysz) && read_str(f, keysz, key) &&
+                read_val(f, e.offset) && read_val(f, e.size) && read_val(f, e.atime) &&
+                e.offset + e.size <= pack_size_;
+            if (ok) {
+                index_[key] = e;
+            }
+        }
+        garbage_ = garbage;
+    }
+    fclose(f);
+
+    if (!ok) {
+        index_.clear();
+        garbage_ = 0;
+        clock_ = 0;
+    }
+    return ok;
+}
+
+
+bool CachePack::rebuild_index()
+{
+    index_.clear();
+    garbage_ = 0;
+    clock_ = 0;
+
+    if (pack_seek(pack_, MAGIC_SIZE) != 0) {
+        return false;
+    }
+
+    uint64_t pos = MAGIC_SIZE;
+    std::string key;
+    while (pos < pack_size_) {
+        uint32_t keysz = 0, valsz = 0;
+        if (!read_val(pack_, keysz) || !read_val(pack_, valsz) || !read_str(pack_, keysz, key)) {
+            break;
+        }
+        pos += 2 * sizeof(uint32_t) + keysz;
+
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            garbage_ += it->second.size;
+        }
+
+        if (valsz == REMOVED) {
+            if (it != index_.end()) {
+                index_.erase(it);
+            }
+        } else {
+            if (pos + valsz > pack_size_ || pack_seek(pack_, pos + valsz) != 0) {
+                break;
+            }
+            index_[key] = Entry{pos, valsz, ++clock_};
+            pos += valsz;
+        }
+    }
+
+    if (pos != pack_size_) {
+        // truncated record at the end (e.g. after a crash): drop it. Since
+        // we don't truncate the file, it just becomes garbage
+        garbage_ += pack_size_ - pos;
+    }
+
+    dirty_ = true;
+    return true;
+}
+
+
+bool CachePack::save_index()
+{
+    const Glib::ustring tmpname = index_fname_ + ".tmp";
+    FILE *f = g_fopen(tmpname.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    uint32_t count = index_.size();
+    bool ok = fwrite(INDEX_MAGIC, 1, MAGIC_SIZE, f) == MAGIC_SIZE &&
+        write_val(f, pack_size_) && write_val(f, garbage_) && write_val(f, clock_) && write_val(f, count);
+    for (auto it = index_.begin(); ok && it != index_.end(); ++it) {
+        uint32_t keysz = it->first.size();
+        const Entry &e = it->second;
+        ok = write_val(f, keysz) && fwrite(it->first.data(), 1, keysz, f) == keysz &&
+            write_val(f, e.offset) && write_val(f, e.size) && write_val(f, e.atime);
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || !replace_file(tmpname, index_fname_)) {
+        g_remove(tmpname.c_str());
+        return false;
+    }
+    dirty_ = false;
+    return true;
+}
+
+
+bool CachePack::append(const std::string &key, const char *value, uint32_t size, uint64_t &offset)
+{
+    if (!pack_ || pack_seek(pack_, pack_size_) != 0) {
+        return false;
+    }
+
+    uint32_t keysz = key.size();
+    uint32_t valsz = value ? size : REMOVED;
+    bool ok = write_val(pack_, keysz) && write_val(pack_, valsz) && fwrite(key.data(), 1, keysz, pack_) == keysz;
+    if (ok && value) {
+        ok = fwrite(value, 1, size, pack_) == size;
+    }
+    ok = (fflush(pack_) == 0) && ok;
+
+    if (!ok) {
+        // leave the partial record as garbage, and continue after it
+        uint64_t end = pack_seek_end(pack_) == 0 ? pack_tell(pack_) : pack_size_;
+        garbage_ += end - pack_size_;
+        pack_size_ = end;
+        return false;
+    }
+
+    offset = pack_size_ + 2 * sizeof(uint32_t) + keysz;
+    pack_size_ = offset + (value ? size : 0);
+    dirty_ = true;
+    return true;
+}
+
+
+bool CachePack::get(const std::string &key, std::string &out)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    auto it = index_.find(key);
+    if (it == index_.end() || !pack_) {
+        return false;
+    }
+
+    Entry &e = it->second;
+    if (pack_seek(pack_, e.offset) != 0 || !read_str(pack_, e.size, out)) {
+        return false;
+    }
+    e.atime = ++clock_;
+    dirty_ = true;
+    return true;
+}
+
+
+bool CachePack::put(const std::string &key, const std::string &value)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    uint64_t offset = 0;
+    if (!append(key, value.data(), value.size(), offset)) {
+        return false;
+    }
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        garbage_ += it->second.size;
+    }
+    index_[key] = Entry{offset, uint32_t(value.size()), ++clock_};
+    return true;
+}
+
+
+bool CachePack::remove(const std::string &key)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return false;
+    }
+
+    uint64_t offset = 0;
+    if (!append(key, nullptr, 0, offset)) {
+        return false;
+    }
+    garbage_ += it->second.size;
+    index_.erase(it);
+    return true;
+}
+
+
+void CachePack::clear(const std::string &prefix)
+{
+    MyMutex::MyLock lock(mutex_);
+
+    if (prefix.empty()) {
+        // drop everything: start from a fresh pack
+        index_.clear();
+        if (pack_) {
+            fclose(pack_);
+            pack_ = nullptr;
+        }
+        g_remove(pack_fname_.c_str());
+        garbage_ = 0;
+        open_pack();
+        dirty_ = true;
+        return;
+    }
+
+    uint64_t offset = 0;
+    for (auto it = index_.begin(); it != index_.end(); ) {
+        if (it->first.compare(0, prefix.size(), prefix) == 0 && append(it->first, nullptr, 0, offset)) {
+            garbage_ += it->second.size;
+            it = index_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+
+std::vector<std::string> CachePack::getLRUKeys(const std::string &prefix) const
+{
+    MyMutex::MyLock lock(mutex_);
+
+    std::vector<std::pair<int64_t, const std::string *>> keys;
+    for (auto &p : index_) {
+        if (p.first.compare(0, prefix.size(), prefix) == 0) {
+            keys.emplace_back(p.second.atime, &p.first);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<std::string> ret;
+    ret.reserve(keys.size());
+    for (auto &k : keys) {
+        ret.push_back(*k.second);
+    }
+    return ret;
+}
+
+
+uint64_t CachePack::getLiveSize() const
+{
+    MyMutex::MyLock lock(mutex_);
+    return pack_size_ - garbage_;
+}
+
+
+uint64_t CachePack::getGarbageSize() const
+{
+    MyMutex::MyLock lock(mutex_);
+    return garbage_;
+}
+
+
+void CachePack::flush()
+{
+    MyMutex::MyLock lock(mutex_);
+
+    if (dirty_ && pack_) {
+        save_index();
+    }
+}
+
+
+void CachePack::compact()
+{
+    MyMutex::MyLock lock(mutex_);
+
+    if (!pack_) {
+        return;
+    }
+
+    const Glib::ustring tmpname = pack_fname_ + ".tmp";
+    FILE *out = g_fopen(tmpname.c_str(), "wb");
+    if (!out) {
+        return;
+    }
+
+    // copy the live values in offset order, to read the old pack sequentially
+    std::vector<std::pair<uint64_t, std::unordered_map<std::string, Entry>::iterator>> entries;
+    for (auto it = index_.begin(); it != index_.end(); ++it) {
+        entries.emplace_back(it->second.offset, it);
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const decltype(entries)::value_type &a, const decltype(entries)::value_type &b) -> bool
+              {
+                  return a.first < b.first;
+              });
+
+    std::unordered_map<std::string, Entry> new_index;
+    uint64_t pos = MAGIC_SIZE;
+    bool ok = fwrite(PACK_MAGIC, 1, MAGIC_SIZE, out) == MAGIC_SIZE;
+    std::string value;
+    for (size_t i = 0; ok && i < entries.size(); ++i) {
+        const std::string &key = entries[i].second->first;
+        const Entry &e = entries[i].second->second;
+        uint32_t keysz = key.size();
+        ok = pack_seek(pack_, e.offset) == 0 && read_str(pack_, e.size, value) &&
+            write_val(out, keysz) && write_val(out, e.size) && fwrite(key.data(), 1, keysz, out) == keysz &&
+            fwrite(value.data(), 1, e.size, out) == e.size;
+        pos += 2 * sizeof(uint32_t) + keysz;
+        new_index[key] = Entry{pos, e.size, e.atime};
+        pos += e.size;
+    }
+    ok = (fclose(out) == 0) && ok;
+
+    if (!ok) {
+        g_remove(tmpname.c_str());
+        return;
+    }
+
+    fclose(pack_);
+    pack_ = nullptr;
+    if (!replace_file(tmpname, pack_fname_)) {
+        g_remove(tmpname.c_str());
+    }
+
+    if (options.rtSettings.verbose) {
+        std::cout << "compacted cache pack: " << pack_size_ << " -> " << pos << " bytes" << std::endl;
+    }
+
+    index_.clear();
+    garbage_ = 0;
+    if (open_pack()) {
+        if (pack_size_ == pos) {
+            index_.swap(new_index);
+        } else {
+            rebuild_index();
+        }
+    }
+    dirty_ = true;
+    save_index();
+}
@@ -0,0 +1,92 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdint>
+
+#include <glibmm/ustring.h>
+
+#include "../rtengine/noncopyable.h"
+#include "threadutils.h"
+
+/******************************************************************************
+ * Append-only packed key-value store, used as an alternative backend for the
+ * file browser cache, to avoid having one file per image in each cache
+ * subdirectory.
+ *
+ * All the values are stored in a single pack file, as a sequence of records:
+ *
+ *   key size (uint32)
+ *   value size (uint32), or 0xFFFFFFFF for a removed key
+ *   key
+ *   value
+ *
+ * An index file maps each key to the position of its latest value, together
+ * with the time of its last access (used for LRU eviction). The index is
+ * rewritten by flush(); if it is missing or out of date, it is rebuilt by
+ * scanning the pack. Overwritten and removed values are garbage in the pack,
+ * and are reclaimed by compact().
+ ******************************************************************************/
+class CachePack: public rtengine::NonCopyable {
+public:
+    explicit CachePack(const Glib::ustring &dir);
+    ~CachePack();
+
+    bool get(const std::string &key, std::string &out);
+    bool put(const std::string &key, const std::string &value);
+    bool remove(const std::string &key);
+    void clear(const std::string &prefix);
+
+    // the keys starting with prefix, least recently used first
+    std::vector<std::string> getLRUKeys(const std::string &prefix) const;
+
+    // size of the live data and of the garbage in the pack, in bytes
+    uint64_t getLiveSize() const;
+    uint64_t getGarbageSize() const;
+
+    void flush();
+    void compact();
+
+private:
+    struct Entry {
+        uint64_t offset; // of the value in the pack
+        uint32_t size;
+        int64_t atime;
+    };
+
+    bool open_pack();
+    bool load_index();
+    bool rebuild_index();
+    bool save_index();
+    bool append(const std::string &key, const char *value, uint32_t size, uint64_t &offset);
+
+    Glib::ustring pack_fname_;
+    Glib::ustring index_fname_;
+    FILE *pack_;
+    uint64_t pack_size_;
+    uint64_t garbage_;
+    int64_t clock_;
+    bool dirty_;
+    std::unordered_map<std::string, Entry> index_;
+    mutable MyMutex mutex_;
+};
@@ -1467,6 +1467,11 @@ void EditorPanel::refreshProcessingState (bool inProcessingP)
         val = 0.0;
         str = "PROGRESSBAR_READY";
 
+        // the timings of the last update, shown when hovering the progress bar
+        if (ipc) {
+            progressLabel->set_tooltip_text(ipc->getPerfSummary());
+        }
+
 #ifdef WIN32
 
         // Maybe accessing "parent", which is a Gtk object, can justify to get the Gtk lock...
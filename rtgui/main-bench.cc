@@ -0,0 +1,1042 @@
+/* -*- C++ -*-
+ *
+ *  This file is part of ART.
+ *
+ *  ART is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  ART is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with ART.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * ART-bench: reproducible benchmarks of the processing engine.
+ *
+ * The input images are synthesized deterministically (a mix of gradients,
+ * a zone plate, sharp edges and pseudo-random noise) and written as
+ * uncompressed Bayer and X-Trans DNG files in a temporary directory, so that
+ * they go through the same decoding path as real raw files and no sample
+ * files are needed. Each kernel is timed at every requested image size and
+ * thread count, and the results are written as JSON.
+ *
+ * With -c, a few correctness checks of the engine are run instead.
+ */
+
+#ifdef __GNUC__
+#if defined(__FAST_MATH__)
+#error Using the -ffast-math CFLAG is known to lead to problems. Disable it to compile ART.
+#endif
+#endif
+
+#include "config.h"
+#include <giomm.h>
+#include <glib/gstdio.h>
+#include <tiffio.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <locale.h>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "options.h"
+#include "../rtengine/rtengine.h"
+#include "../rtengine/imagesource.h"
+#include "../rtengine/improcfun.h"
+#include "../rtengine/imagefloat.h"
+#include "../rtengine/image8.h"
+#include "../rtengine/array2D.h"
+#include "../rtengine/gauss.h"
+#include "../rtengine/boxblur.h"
+#include "../rtengine/guidedfilter.h"
+#include "../rtengine/ipdenoise.h"
+#include "../rtengine/masks.h"
+#include "../rtengine/resample.h"
+#include "../rtengine/scopes.h"
+#include "../rtengine/procparams.h"
+#include "../rtengine/settings.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#else
+#include <windows.h>
+#include <process.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+extern Options options;
+
+// stores path to data files
+Glib::ustring argv0;
+Glib::ustring creditsPath;
+Glib::ustring licensePath;
+Glib::ustring argv1;
+
+namespace {
+
+using rtengine::procparams::ProcParams;
+using rtengine::procparams::RAWParams;
+using rtengine::array2D;
+
+enum class Sensor { BAYER, XTRANS };
+
+const char *sensor_name(Sensor s)
+{
+    return s == Sensor::BAYER ? "bayer" : "xtrans";
+}
+
+
+//-----------------------------------------------------------------------------
+// synthetic raw data
+//-----------------------------------------------------------------------------
+
+constexpr int BLACK_LEVEL = 256;
+constexpr int WHITE_LEVEL = 16383;
+
+// RGGB
+const uint8_t bayer_cfa[4] = { 0, 1, 1, 2 };
+
+const uint8_t xtrans_cfa[36] = {
+    1, 1, 0, 1, 1, 2,
+    1, 1, 2, 1, 1, 0,
+    2, 0, 1, 0, 2, 1,
+    1, 1, 2, 1, 1, 0,
+    1, 1, 0, 1, 1, 2,
+    0, 2, 1, 2, 0, 1
+};
+
+
+// integer hash of (x, y, c), used as a deterministic noise source that does
+// not depend on the order in which the pixels are generated
+inline uint32_t hash(uint32_t x, uint32_t y, uint32_t c)
+{
+    uint32_t h = x * 0x9E3779B1u ^ (y + 0x7F4A7C15u) * 0x85EBCA77u ^ (c + 1) * 0xC2B2AE3Du;
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return h;
+}
+
+
+// value in [0, 1] of channel c of the synthetic scene at (x, y)
+float scene(int x, int y, int c, int W, int H)
+{
+    const float fx = float(x) / W;
+    const float fy = float(y) / H;
+
+    // smooth, channel-dependent gradient
+    float v = 0.05f + 0.4f * (c == 0 ? fx : c == 1 ? 0.5f * (fx + fy) : fy);
+
+    // zone plate in the upper-left quadrant, for aliasing and fine detail
+    if (fx < 0.5f && fy < 0.5f) {
+        const float dx = fx - 0.25f, dy = (fy - 0.25f) * H / W;
+        v += 0.2f * std::sin(1500.f * (dx * dx + dy * dy));
+    }
+
+    // coloured blocks with sharp edges in the lower-right quadrant
+    if (fx >= 0.5f && fy >= 0.5f) {
+        const int bx = x / 64, by = y / 64;
+        v = 0.1f + 0.6f * float(hash(bx, by, c) & 0xff) / 255.f;
+    }
+
+    // a few specular highlights, to exercise the clipped paths
+    if ((x / 128 + y / 128) % 11 == 0 && (x % 128) < 8 && (y % 128) < 8) {
+        v = 1.f;
+    }
+
+    // noise
+    v += 0.02f * (float(hash(x, y, c) & 0xffff) / 65535.f - 0.5f);
+
+    return std::max(0.f, std::min(v, 1.f));
+}
+
+
+/**
+ * Minimal little-endian TIFF/DNG writer with a single IFD containing an
+ * uncompressed 16-bit CFA image.
+ */
+class DNGWriter {
+public:
+    void add(uint16_t tag, uint16_t type, const std::vector<uint32_t> &values)
+    {
+        entries_.push_back({tag, type, values, ""});
+    }
+
+    void add(uint16_t tag, const std::string &ascii)
+    {
+        entries_.push_back({tag, 2, {}, ascii});
+    }
+
+    bool write(const std::string &fname, const std::vector<uint16_t> &data, int H)
+    {
+        constexpr uint16_t LONG = 4;
+        add(273, LONG, { 0 }); // StripOffsets, patched below
+        add(278, LONG, { uint32_t(H) });
+        add(279, LONG, { uint32_t(data.size() * sizeof(uint16_t)) });
+        std::sort(entries_.begin(), entries_.end(),
+                  [](const Entry &a, const Entry &b) -> bool
+                  {
+                      return a.tag < b.tag;
+                  });
+
+        const uint32_t ifd_size = 2 + 12 * entries_.size() + 4;
+        const uint32_t extra_offset = 8 + ifd_size;
+        std::string ifd, extra;
+        put16(ifd, entries_.size());
+        for (auto &e : entries_) {
+            std::string value = encode(e);
+            put16(ifd, e.tag);
+            put16(ifd, e.type);
+            put32(ifd, e.type == 2 ? e.ascii.size() + 1 : e.values.size() / (is_rational(e.type) ? 2 : 1));
+            if (value.size() <= 4) {
+                value.resize(4, '\0');
+                ifd += value;
+            } else {
+                put32(ifd, extra_offset + extra.size());
+                extra += value;
+                if (extra.size() & 1) {
+                    extra += '\0';
+                }
+            }
+        }
+        put32(ifd, 0);
+
+        // the image data starts right after the extra values
+        const uint32_t data_offset = extra_offset + extra.size();
+        for (size_t i = 0; i < entries_.size(); ++i) {
+            if (entries_[i].tag == 273) {
+                std::string off;
+                put32(off, data_offset);
+                ifd.replace(2 + 12 * i + 8, 4, off);
+            }
+        }
+
+        FILE *f = g_fopen(fname.c_str(), "wb");
+        if (!f) {
+            return false;
+        }
+        std::string header("II*\0", 4);
+        put32(header, 8);
+        bool ok = fwrite(header.data(), 1, header.size(), f) == header.size()
+            && fwrite(ifd.data(), 1, ifd.size(), f) == ifd.size()
+            && fwrite(extra.data(), 1, extra.size(), f) == extra.size()
+            && fwrite(data.data(), sizeof(uint16_t), data.size(), f) == data.size();
+        return (fclose(f) == 0) && ok;
+    }
+
+private:
+    struct Entry {
+        uint16_t tag;
+        uint16_t type;
+        std::vector<uint32_t> values; // numerator/denominator pairs for rationals
+        std::string ascii;
+    };
+
+    static bool is_rational(uint16_t type) { return type == 5 || type == 10; }
+
+    static void put16(std::string &s, uint32_t v)
+    {
+        s += char(v & 0xff);
+        s += char((v >> 8) & 0xff);
+    }
+
+    static void put32(std::string &s, uint32_t v)
+    {
+        put16(s, v & 0xffff);
+        put16(s, v >> 16);
+    }
+
+    static std::string encode(const Entry &e)
+    {
+        std::string res;
+        switch (e.type) {
+        case 1: // BYTE
+            for (auto v : e.values) {
+                res += char(v);
+            }
+            break;
+        case 2: // ASCII
+            res = e.ascii;
+            res += '\0';
+            break;
+        case 3: // SHORT
+            for (auto v : e.values) {
+                put16(res, v);
+            }
+            break;
+        default: // LONG, RATIONAL, SRATIONAL
+            for (auto v : e.values) {
+                put32(res, v);
+            }
+            break;
+        }
+        return res;
+    }
+
+    std::vector<Entry> entries_;
+};
+
+
+bool write_synthetic_dng(const std::string &fname, Sensor sensor, int W, int H)
+{
+    const int period = sensor == Sensor::BAYER ? 2 : 6;
+    const uint8_t *cfa = sensor == Sensor::BAYER ? bayer_cfa : xtrans_cfa;
+
+    std::vector<uint16_t> data(size_t(W) * H);
+#ifdef _OPENMP
+#   pragma omp parallel for
+#endif
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            const int c = cfa[(y % period) * period + (x % period)];
+            const float v = scene(x, y, c, W, H);
+            data[size_t(y) * W + x] = BLACK_LEVEL + int(v * (WHITE_LEVEL - BLACK_LEVEL) + 0.5f);
+        }
+    }
+
+    constexpr uint16_t BYTE = 1, SHORT = 3, LONG = 4, RATIONAL = 5, SRATIONAL = 10;
+    // XYZ -> camera matrix of the synthetic camera (that of linear sRGB),
+    // in units of 1/10000
+    const int32_t color_matrix[9] = {
+        32406, -15372, -4986,
+        -9689, 18758, 415,
+        557, -2040, 10570
+    };
+    std::vector<uint32_t> cm;
+    for (auto v : color_matrix) {
+        cm.push_back(uint32_t(v));
+        cm.push_back(10000);
+    }
+
+    DNGWriter dng;
+    dng.add(254, LONG, { 0 });                        // NewSubFileType
+    dng.add(256, LONG, { uint32_t(W) });              // ImageWidth
+    dng.add(257, LONG, { uint32_t(H) });              // ImageLength
+    dng.add(258, SHORT, { 16 });                      // BitsPerSample
+    dng.add(259, SHORT, { 1 });                       // Compression
+    dng.add(262, SHORT, { 32803 });                   // PhotometricInterpretation (CFA)
+    dng.add(271, "ART");                              // Make
+    dng.add(272, "Synthetic");                        // Model
+    dng.add(274, SHORT, { 1 });                       // Orientation
+    dng.add(277, SHORT, { 1 });                       // SamplesPerPixel
+    dng.add(284, SHORT, { 1 });                       // PlanarConfiguration
+    dng.add(33421, SHORT, { uint32_t(period), uint32_t(period) }); // CFARepeatPatternDim
+    dng.add(33422, BYTE, std::vector<uint32_t>(cfa, cfa + period * period)); // CFAPattern
+    dng.add(50706, BYTE, { 1, 4, 0, 0 });             // DNGVersion
+    dng.add(50707, BYTE, { 1, 1, 0, 0 });             // DNGBackwardVersion
+    dng.add(50708, "ART Synthetic");                  // UniqueCameraModel
+    dng.add(50714, LONG, { uint32_t(BLACK_LEVEL) });  // BlackLevel
+    dng.add(50717, LONG, { uint32_t(WHITE_LEVEL) });  // WhiteLevel
+    dng.add(50721, SRATIONAL, cm);                    // ColorMatrix1
+    dng.add(50728, RATIONAL, { 1, 2, 1, 1, 2, 3 });   // AsShotNeutral
+    dng.add(50778, SHORT, { 21 });                    // CalibrationIlluminant1 (D65)
+
+    return dng.write(fname, data, H);
+}
+
+
+//-----------------------------------------------------------------------------
+// timing and results
+//-----------------------------------------------------------------------------
+
+struct Result {
+    std::string kernel;
+    std::string sensor;
+    int width;
+    int height;
+    int threads;
+    std::vector<double> times; // in milliseconds
+};
+
+
+class Bench {
+public:
+    Bench(int runs, const std::string &filter):
+        runs_(std::max(runs, 1)),
+        filter_(filter)
+    {}
+
+    bool wanted(const std::string &kernel) const
+    {
+        return filter_.empty() || kernel.find(filter_) != std::string::npos;
+    }
+
+    // runs setup() and then times body(), once for warming up and then
+    // runs_ times
+    void run(const std::string &kernel, Sensor sensor, int W, int H, int threads,
+             const std::function<void()> &setup, const std::function<void()> &body)
+    {
+        if (!wanted(kernel)) {
+            return;
+        }
+        Result res{kernel, sensor_name(sensor), W, H, threads, {}};
+        for (int i = 0; i <= runs_; ++i) {
+            setup();
+            const auto start = std::chrono::steady_clock::now();
+            body();
+            const auto end = std::chrono::steady_clock::now();
+            if (i > 0) {
+                res.times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            }
+        }
+        const double best = *std::min_element(res.times.begin(), res.times.end());
+        std::cerr << "  " << kernel << " [" << res.sensor << " " << W << "x" << H
+                  << ", " << threads << " threads]: " << best << " ms" << std::endl;
+        results_.push_back(std::move(res));
+    }
+
+    void run(const std::string &kernel, Sensor sensor, int W, int H, int threads, const std::function<void()> &body)
+    {
+        run(kernel, sensor, W, H, threads, []() {}, body);
+    }
+
+    std::string to_json() const
+    {
+        std::ostringstream out;
+        out.precision(4);
+        out << std::fixed;
+        out << "{\n  \"version\": \"" << versionString << "\",\n"
+            << "  \"runs\": " << runs_ << ",\n"
+#ifdef _OPENMP
+            << "  \"max_threads\": " << omp_get_num_procs() << ",\n"
+#else
+            << "  \"max_threads\": 1,\n"
+#endif
+            << "  \"results\": [";
+        const char *sep = "\n";
+        for (const auto &r : results_) {
+            auto t = r.times;
+            std::sort(t.begin(), t.end());
+            const double median = t.size() % 2 ? t[t.size() / 2] : 0.5 * (t[t.size() / 2 - 1] + t[t.size() / 2]);
+            const double mpix = double(r.width) * r.height / 1e6;
+            out << sep << "    {\"kernel\": \"" << r.kernel << "\", \"sensor\": \"" << r.sensor
+                << "\", \"width\": " << r.width << ", \"height\": " << r.height
+                << ", \"threads\": " << r.threads
+                << ", \"min_ms\": " << t.front() << ", \"median_ms\": " << median
+                << ", \"max_ms\": " << t.back()
+                << ", \"mpix_per_s\": " << mpix / (t.front() / 1000.0) << "}";
+            sep = ",\n";
+        }
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+private:
+    int runs_;
+    std::string filter_;
+    std::vector<Result> results_;
+};
+
+
+//-----------------------------------------------------------------------------
+// the benchmarks
+//-----------------------------------------------------------------------------
+
+void set_threads(int n)
+{
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#endif
+}
+
+
+std::vector<std::pair<int, std::string>> demosaic_methods(Sensor sensor)
+{
+    std::vector<std::pair<int, std::string>> res;
+    if (sensor == Sensor::BAYER) {
+        using M = RAWParams::BayerSensor::Method;
+        for (auto m : { M::AMAZE, M::RCD, M::LMMSE, M::IGV, M::AMAZEBILINEAR, M::RCDBILINEAR, M::VNG4, M::FAST, M::MONO, M::AMAZEVNG4, M::RCDVNG4, M::DCB, M::DCBBILINEAR, M::DCBVNG4, M::AHD, M::EAHD, M::HPHD }) {
+            res.emplace_back(int(m), RAWParams::BayerSensor::getMethodString(m).raw());
+        }
+    } else {
+        using M = RAWParams::XTransSensor::Method;
+        for (auto m : { M::FOUR_PASS, M::THREE_PASS, M::TWO_PASS, M::ONE_PASS, M::FAST, M::MONO }) {
+            res.emplace_back(int(m), RAWParams::XTransSensor::getMethodString(m).raw());
+        }
+    }
+    return res;
+}
+
+
+void bench_sensor(Bench &bench, const std::string &fname, Sensor sensor, int threads)
+{
+    const bool multithread = threads > 1;
+
+    ProcParams params;
+    int err = 0;
+    rtengine::InitialImage *ii = rtengine::InitialImage::load(fname, true, &err);
+    if (!ii) {
+        std::cerr << "ERROR: cannot load " << fname << " (error " << err << ")" << std::endl;
+        return;
+    }
+    rtengine::ImageSource *imgsrc = ii->getImageSource();
+
+    int fw = 0, fh = 0;
+    imgsrc->setBorder(sensor == Sensor::BAYER ? params.raw.bayersensor.border : params.raw.xtranssensor.border);
+    imgsrc->getFullSize(fw, fh, TR_NONE);
+    const rtengine::ColorTemp wb = imgsrc->getWB();
+
+    bench.run("preprocess", sensor, fw, fh, threads,
+              [&]() { imgsrc->preprocess(params.raw, params.lensProf, params.coarse, false, wb); });
+
+    for (const auto &m : demosaic_methods(sensor)) {
+        if (sensor == Sensor::BAYER) {
+            params.raw.bayersensor.method = RAWParams::BayerSensor::Method(m.first);
+        } else {
+            params.raw.xtranssensor.method = RAWParams::XTransSensor::Method(m.first);
+        }
+        double contrast = 0;
+        bench.run("demosaic/" + m.second, sensor, fw, fh, threads,
+                  [&]() { imgsrc->demosaic(params.raw, false, contrast); });
+    }
+
+    // the remaining kernels operate on RGB data and are run only once per size
+    if (sensor != Sensor::BAYER) {
+        ii->decreaseRef();
+        return;
+    }
+
+    // make sure the image source holds a demosaiced image
+    params.raw.bayersensor.method = RAWParams::BayerSensor::Method::AMAZE;
+    {
+        double contrast = 0;
+        imgsrc->demosaic(params.raw, false, contrast);
+    }
+    const PreviewProps pp(0, 0, fw, fh, 1);
+    std::unique_ptr<rtengine::Imagefloat> base(new rtengine::Imagefloat(fw, fh));
+    imgsrc->getImage(wb, TR_NONE, base.get(), pp, params.exposure, params.raw);
+    base->assignColorSpace(params.icm.workingProfile);
+    imgsrc->convertColorSpace(base.get(), params.icm, wb);
+
+    array2D<float> src(fw, fh, base->g.ptrs);
+    array2D<float> dst(fw, fh);
+    array2D<float> guide(fw, fh, base->r.ptrs);
+
+    // the three variants of the cache-blocked filter: the recursive one in
+    // single precision (sigma < 25) and in double precision (sigma < 100),
+    // and the box approximation
+    for (int sigma : {5, 60, 150}) {
+        bench.run("gaussianBlur/" + std::to_string(sigma), sensor, fw, fh, threads,
+                  [&]() {
+#ifdef _OPENMP
+#                     pragma omp parallel if (multithread)
+#endif
+                      gaussianBlur(src, dst, fw, fh, sigma);
+                  });
+    }
+
+    bench.run("boxblur", sensor, fw, fh, threads,
+              [&]() { rtengine::boxblur(static_cast<float **>(src), static_cast<float **>(dst), 8, fw, fh, multithread); });
+
+    bench.run("guidedFilter", sensor, fw, fh, threads,
+              [&]() { rtengine::guidedFilter(guide, src, dst, 8, 0.001f, multithread); });
+
+    bench.run("NLMeans", sensor, fw, fh, threads,
+              [&]() {
+                  for (int y = 0; y < fh; ++y) {
+                      std::copy(src[y], src[y] + fw, dst[y]);
+                  }
+              },
+              [&]() { rtengine::denoise::NLMeans(dst, 65535.f, 50, 80, 1.f, multithread); });
+
+    std::unique_ptr<rtengine::Imagefloat> img;
+    {
+        ProcParams dnparams;
+        dnparams.denoise.enabled = true;
+        dnparams.denoise.luminance = 20;
+        dnparams.denoise.chrominanceMethod = rtengine::procparams::DenoiseParams::ChrominanceMethod::MANUAL;
+        dnparams.denoise.chrominance = 15;
+        rtengine::ImProcFunctions ipf(&dnparams, multithread);
+        rtengine::ImProcFunctions::DenoiseInfoStore dnstore;
+        bench.run("RGB_denoise", sensor, fw, fh, threads,
+                  [&]() { img.reset(base->copy()); },
+                  [&]() { ipf.denoise(imgsrc, wb, img.get(), dnstore, dnparams.denoise); });
+    }
+
+    {
+        rtengine::ImProcFunctions ipf(&params, multithread);
+        const int rw = fw / 2, rh = fh / 2;
+        bench.run("Lanczos", sensor, fw, fh, threads,
+                  [&]() { img.reset(new rtengine::Imagefloat(rw, rh)); },
+                  [&]() { ipf.Lanczos(base.get(), img.get(), 0.5f); });
+
+        bench.run("resample_Mitchell", sensor, fw, fh, threads,
+                  [&]() { img.reset(new rtengine::Imagefloat(rw, rh)); },
+                  [&]() { rtengine::resample(base.get(), img.get(), 0.5f, rtengine::ResampleFilter::MITCHELL, multithread); });
+
+        // three web sizes from one source, in a single pass
+        std::unique_ptr<rtengine::Imagefloat> img2, img3;
+        bench.run("resample_multi", sensor, fw, fh, threads,
+                  [&]() {
+                      img.reset(new rtengine::Imagefloat(rw, rh));
+                      img2.reset(new rtengine::Imagefloat(fw / 4, fh / 4));
+                      img3.reset(new rtengine::Imagefloat(fw / 8, fh / 8));
+                  },
+                  [&]() {
+                      rtengine::resample(base.get(), {
+                              rtengine::ResampleOutput(img.get(), 0.5f),
+                              rtengine::ResampleOutput(img2.get(), 0.25f),
+                              rtengine::ResampleOutput(img3.get(), 0.125f)
+                          }, multithread);
+                  });
+    }
+
+    {
+        ProcParams trparams;
+        trparams.rotate.enabled = true;
+        trparams.rotate.degree = 3.5;
+        rtengine::ImProcFunctions ipf(&trparams, multithread);
+        bench.run("transformGeneral", sensor, fw, fh, threads,
+                  [&]() { img.reset(new rtengine::Imagefloat(fw, fh, base.get())); },
+                  [&]() { ipf.transform(base.get(), img.get(), 0, 0, 0, 0, fw, fh, fw, fh, imgsrc->getMetaData(), imgsrc->getRotateDegree(), true); });
+    }
+
+    {
+        // the scopes of the editor, on an 8-bit preview made from base:
+        // computed from scratch, and updated after an edit of a 256x256
+        // region
+        rtengine::Image8 preview(fw, fh);
+        for (int y = 0; y < fh; ++y) {
+            for (int x = 0; x < fw; ++x) {
+                unsigned char *p = preview.data + 3 * (size_t(y) * fw + x);
+                p[0] = rtengine::LIM(int(base->r(y, x)) >> 8, 0, 255);
+                p[1] = rtengine::LIM(int(base->g(y, x)) >> 8, 0, 255);
+                p[2] = rtengine::LIM(int(base->b(y, x)) >> 8, 0, 255);
+            }
+        }
+
+        using rtengine::Scopes;
+        constexpr int kinds = Scopes::HISTOGRAM | Scopes::VECTORSCOPE_HC | Scopes::VECTORSCOPE_HS | Scopes::WAVEFORM;
+        Scopes scopes;
+        bench.run("scopes/full", sensor, fw, fh, threads,
+                  [&]() { scopes.reset(); },
+                  [&]() { scopes.update(kinds, &preview, base.get(), 0, 0, fw, fh, params.icm); });
+
+        const int ex = std::max(fw / 2 - 128, 0), ey = std::max(fh / 2 - 128, 0);
+        bench.run("scopes/local_edit", sensor, fw, fh, threads,
+                  [&]() {
+                      for (int y = ey; y < std::min(ey + 256, fh); ++y) {
+                          for (int x = ex; x < std::min(ex + 256, fw); ++x) {
+                              preview.data[3 * (size_t(y) * fw + x)] ^= 1;
+                          }
+                      }
+                  },
+                  [&]() { scopes.update(kinds, &preview, base.get(), 0, 0, fw, fh, params.icm); });
+    }
+
+    img.reset();
+    base.reset();
+    ii->decreaseRef();
+}
+
+
+void bench_pipeline(Bench &bench, const std::string &fname, Sensor sensor, int W, int H, int threads)
+{
+    ProcParams params;
+    bench.run("processImage", sensor, W, H, threads,
+              [&]() {
+                  int err = 0;
+                  rtengine::ProcessingJob *job = rtengine::ProcessingJob::create(fname, true, params);
+                  rtengine::IImagefloat *res = rtengine::processImage(job, err, nullptr);
+                  if (res) {
+                      res->free();
+                  } else {
+                      std::cerr << "ERROR: processing failed for " << fname << std::endl;
+                  }
+              });
+}
+
+
+//-----------------------------------------------------------------------------
+// correctness checks
+//-----------------------------------------------------------------------------
+
+/**
+ * Listener of the pipelined batch processing that behaves like BatchQueue
+ * when a save fails: the first save fails once several jobs are in flight,
+ * and the jobs that did not start yet are refused.
+ */
+class FailingSaveListener: public rtengine::BatchProcessingListener {
+public:
+    explicit FailingSaveListener(const std::vector<rtengine::ProcessingJob *> &jobs):
+        jobs_(jobs),
+        handed_out_(1),
+        started_(0),
+        saved_(0),
+        stopped_(false)
+    {}
+
+    void setProgress(double p) override {}
+    void setProgressStr(const Glib::ustring &str) override {}
+    void setProgressState(bool inProcessing) override {}
+    void error(const Glib::ustring &descr) override {}
+
+    rtengine::ProcessingJob *imageReady(rtengine::IImagefloat *img) override { return nullptr; }
+    const rtengine::procparams::PartialProfile *getBatchProfile() override { return nullptr; }
+    bool usePipeline() override { return true; }
+
+    rtengine::ProcessingJob *nextJob() override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (stopped_ || handed_out_ == jobs_.size()) {
+            return nullptr;
+        }
+        cond_.notify_all();
+        return jobs_[handed_out_++];
+    }
+
+    bool jobStarted() override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const size_t idx = started_ + dropped_.size();
+        if (stopped_) {
+            dropped_.push_back(jobs_[idx]);
+        } else {
+            ++started_;
+        }
+        cond_.notify_all();
+        return !stopped_;
+    }
+
+    bool saveImage(rtengine::IImagefloat *img) override
+    {
+        if (img) {
+            img->free();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (saved_ == 0) {
+            cond_.wait_for(lock, std::chrono::seconds(10), [this]() -> bool { return handed_out_ >= 3; });
+            stopped_ = true;
+        }
+        ++saved_;
+        cond_.notify_all();
+        return !stopped_;
+    }
+
+    // waits until every job handed out was either saved or refused, and
+    // returns false on timeout
+    bool wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return cond_.wait_for(lock, std::chrono::seconds(30),
+                              [this]() -> bool
+                              {
+                                  return stopped_ && started_ + dropped_.size() == handed_out_ && saved_ == started_;
+                              });
+    }
+
+    size_t handed_out() const { return handed_out_; }
+    size_t started() const { return started_; }
+    const std::vector<rtengine::ProcessingJob *> &dropped() const { return dropped_; }
+
+private:
+    std::vector<rtengine::ProcessingJob *> jobs_;
+    size_t handed_out_;
+    size_t started_;
+    size_t saved_;
+    bool stopped_;
+    std::vector<rtengine::ProcessingJob *> dropped_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+
+// a save failing while several jobs are in flight: the listener must be told
+// about each job it handed out, either by starting it or by refusing it
+bool check_batch_pipeline_failed_save(const std::string &tmpdir)
+{
+    ProcParams params;
+    std::vector<rtengine::ProcessingJob *> jobs;
+    for (int i = 0; i < 8; ++i) {
+        // missing files, so that the jobs are quick to fail
+        const std::string fname = Glib::build_filename(tmpdir, "missing-" + std::to_string(i) + ".dng");
+        jobs.push_back(rtengine::ProcessingJob::create(fname, true, params));
+    }
+
+    // not deleted: the listener is used by the pipeline threads until they
+    // exit, which the engine does not report
+    auto bpl = new FailingSaveListener(jobs);
+    rtengine::startBatchProcessing(jobs[0], bpl);
+
+    if (!bpl->wait()) {
+        std::cerr << "batch pipeline: timed out, " << bpl->handed_out() << " jobs handed out, "
+                  << bpl->started() << " started, " << bpl->dropped().size() << " refused" << std::endl;
+        return false;
+    }
+    const bool ok = bpl->handed_out() >= 3 && !bpl->dropped().empty();
+    if (!ok) {
+        std::cerr << "batch pipeline: the failed save did not happen with several jobs in flight ("
+                  << bpl->handed_out() << " handed out)" << std::endl;
+    }
+    for (auto j : bpl->dropped()) {
+        rtengine::ProcessingJob::destroy(j);
+    }
+    return ok;
+}
+
+
+// adding strokes to a feathered drawn mask: the mask updated from the cache
+// must match the one generated from scratch. The sizes that are not a
+// multiple of the subsampling factor of the feathering can't be updated
+// incrementally (see update_drawn_mask() in masks.cc)
+bool check_mask_cache_drawn_update(int W, int H)
+{
+    rtengine::Imagefloat rgb(W, H);
+    for (int y = 0; y < H; ++y) {
+        for (int x = 0; x < W; ++x) {
+            rgb.r(y, x) = 65535.f * scene(x, y, 0, W, H);
+            rgb.g(y, x) = 65535.f * scene(x, y, 1, W, H);
+            rgb.b(y, x) = 65535.f * scene(x, y, 2, W, H);
+        }
+    }
+
+    std::vector<rtengine::procparams::Mask> masks(1);
+    auto &dm = masks[0].drawnMask;
+    dm.enabled = true;
+    dm.mode = rtengine::procparams::DrawnMask::ADD;
+    for (int i = 0; i < 40; ++i) {
+        rtengine::procparams::DrawnMask::Stroke s;
+        s.x = 0.2 + 0.003 * i;
+        s.y = 0.3 + 0.002 * i;
+        s.radius = 0.2;
+        dm.strokes.push_back(s);
+    }
+
+    bool ok = true;
+    for (int feather : { 30, 80 }) {
+        dm.feather = feather;
+        dm.strokes.resize(40);
+        std::vector<array2D<float>> cached(1), full(1);
+        // fills the cache
+        rtengine::generateMasks(&rgb, masks, 0, 0, W, H, 1.0, true, -1, nullptr, &cached, nullptr, true);
+
+        for (int i = 0; i < 10; ++i) {
+            rtengine::procparams::DrawnMask::Stroke s;
+            s.x = 0.6 + 0.004 * i;
+            s.y = 0.6;
+            s.radius = 0.2;
+            s.opacity = 0.8;
+            dm.strokes.push_back(s);
+        }
+        rtengine::generateMasks(&rgb, masks, 0, 0, W, H, 1.0, true, -1, nullptr, &cached, nullptr, true);
+        rtengine::generateMasks(&rgb, masks, 0, 0, W, H, 1.0, true, -1, nullptr, &full, nullptr, false);
+
+        float maxdiff = 0.f;
+        for (int y = 0; y < H; ++y) {
+            for (int x = 0; x < W; ++x) {
+                maxdiff = std::max(maxdiff, std::abs(cached[0][y][x] - full[0][y][x]));
+            }
+        }
+        // well below one 8-bit level
+        if (maxdiff > 1e-3f) {
+            std::cerr << "mask cache, " << W << "x" << H << ", feather " << feather
+                      << ": the updated mask differs by " << maxdiff << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+
+int run_checks(const std::string &tmpdir)
+{
+    int failed = 0;
+    const auto check =
+        [&](const char *name, const std::function<bool()> &f) -> void
+        {
+            const bool ok = f();
+            std::cerr << "  " << name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+            if (!ok) {
+                ++failed;
+            }
+        };
+
+    check("batch pipeline, failed save", [&]() { return check_batch_pipeline_failed_save(tmpdir); });
+
+    options.rtSettings.mask_cache_size = 256;
+    for (const auto &sz : std::vector<std::pair<int, int>>{ {1800, 1200}, {2000, 1333}, {1001, 701} }) {
+        const std::string name = "mask cache, drawn mask update, " + std::to_string(sz.first) + "x" + std::to_string(sz.second);
+        check(name.c_str(), [&]() { return check_mask_cache_drawn_update(sz.first, sz.second); });
+    }
+
+    return failed ? 1 : 0;
+}
+
+
+bool parse_size(const char *s, int &W, int &H)
+{
+    if (sscanf(s, "%dx%d", &W, &H) != 2 || W < 64 || H < 64) {
+        std::cerr << "invalid size: " << s << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+void print_help(const char *name)
+{
+    std::cout << "Usage: " << name << " [options]\n\n"
+              << "Runs the engine benchmarks on synthetic Bayer and X-Trans raw data\n"
+              << "and writes the timings as JSON.\n\n"
+              << "Options:\n"
+              << "  -s <W>x<H>   image size (can be repeated; default: 2048x1536 and 6000x4000)\n"
+              << "  -t <n>       number of threads (can be repeated; default: 1 and all)\n"
+              << "  -r <n>       number of timed runs per benchmark (default: 3)\n"
+              << "  -k <name>    run only the benchmarks whose name contains <name>\n"
+              << "  -o <file>    write the results to <file> instead of stdout\n"
+              << "  -c           run the correctness checks instead of the benchmarks\n"
+              << "  -h           show this help\n";
+}
+
+} // namespace
+
+
+int main(int argc, char **argv)
+{
+    setlocale(LC_ALL, "");
+    setlocale(LC_NUMERIC, "C"); // to set decimal point to "."
+
+    Gio::init();
+
+    argv0 = DATA_SEARCH_PATH;
+    creditsPath = CREDITS_SEARCH_PATH;
+    licensePath = LICENCE_SEARCH_PATH;
+    options.rtSettings.lensfunDbDirectory = LENSFUN_DB_PATH;
+
+    std::vector<std::pair<int, int>> sizes;
+    std::vector<int> threads;
+    int runs = 3;
+    std::string filter;
+    std::string outname;
+    bool checks = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string a = argv[i];
+        const bool has_arg = i + 1 < argc;
+        if (a == "-h" || a == "--help") {
+            print_help(argv[0]);
+            return 0;
+        } else if (a == "-s" && has_arg) {
+            int W = 0, H = 0;
+            if (!parse_size(argv[++i], W, H)) {
+                return 1;
+            }
+            sizes.emplace_back(W, H);
+        } else if (a == "-t" && has_arg) {
+            threads.push_back(std::max(atoi(argv[++i]), 1));
+        } else if (a == "-r" && has_arg) {
+            runs = atoi(argv[++i]);
+        } else if (a == "-k" && has_arg) {
+            filter = argv[++i];
+        } else if (a == "-o" && has_arg) {
+            outname = argv[++i];
+        } else if (a == "-c") {
+            checks = true;
+        } else {
+            std::cerr << "invalid argument: " << a << std::endl;
+            print_help(argv[0]);
+            return 1;
+        }
+    }
+
+    if (sizes.empty()) {
+        sizes = { {2048, 1536}, {6000, 4000} };
+    }
+    if (threads.empty()) {
+        threads.push_back(1);
+#ifdef _OPENMP
+        if (omp_get_num_procs() > 1) {
+            threads.push_back(omp_get_num_procs());
+        }
+#endif
+    }
+
+    try {
+        Options::load(true, 0);
+    } catch (Options::Error &e) {
+        std::cerr << "Error: " << e.get_msg() << std::endl;
+        return 2;
+    }
+    // don't let the caches interfere with the measurements
+    options.rtSettings.demosaic_cache_size = 0;
+
+    TIFFSetWarningHandler(nullptr);
+
+#ifdef WIN32
+    const int pid = _getpid();
+#else
+    const int pid = getpid();
+#endif
+    const std::string tmpdir = Glib::build_filename(Glib::get_tmp_dir(), "ART-bench-" + std::to_string(pid));
+    if (g_mkdir_with_parents(tmpdir.c_str(), 0700) != 0) {
+        std::cerr << "ERROR: cannot create " << tmpdir << std::endl;
+        return 2;
+    }
+
+    if (checks) {
+        const int ret = run_checks(tmpdir);
+        g_rmdir(tmpdir.c_str());
+        rtengine::cleanup();
+        return ret;
+    }
+
+    Bench bench(runs, filter);
+    int ret = 0;
+
+    for (const auto &sz : sizes) {
+        const int W = sz.first, H = sz.second;
+        for (Sensor sensor : { Sensor::BAYER, Sensor::XTRANS }) {
+            const std::string fname = Glib::build_filename(tmpdir, Glib::ustring::compose("%1-%2x%3.dng", sensor_name(sensor), W, H));
+            if (!write_synthetic_dng(fname, sensor, W, H)) {
+                std::cerr << "ERROR: cannot write " << fname << std::endl;
+                ret = 2;
+                continue;
+            }
+            for (int n : threads) {
+                set_threads(n);
+                std::cerr << sensor_name(sensor) << " " << W << "x" << H << ", " << n << " threads" << std::endl;
+                bench_sensor(bench, fname, sensor, n);
+                bench_pipeline(bench, fname, sensor, W, H, n);
+            }
+            g_remove(fname.c_str());
+        }
+    }
+    g_rmdir(tmpdir.c_str());
+
+    const std::string json = bench.to_json();
+    if (outname.empty()) {
+        std::cout << json;
+    } else {
+        FILE *f = g_fopen(outname.c_str(), "wb");
+        if (!f || fwrite(json.data(), 1, json.size(), f) != json.size()) {
+            std::cerr << "ERROR: cannot write " << outname << std::endl;
+            ret = 2;
+        }
+        if (f) {
+            fclose(f);
+        }
+    }
+
+    rtengine::cleanup();
+    return ret;
+}
@@ -44,9 +44,13 @@
 #include "makeicc.h"
 #include "../rtengine/clutstore.h"
 #include "../rtengine/settings.h"
+#include "../rtengine/rawimage.h"
+#include "../rtengine/simd.h"
+#include "../rtengine/perftrace.h"
 
 #ifndef WIN32
 #include <glibmm/fileutils.h>
+#include <unistd.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <glibmm/threads.h>
@@ -58,6 +62,14 @@
 
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <map>
+#include <memory>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #ifdef WITH_MIMALLOC
 #  include <mimalloc.h>
@@ -88,6 +100,159 @@ bool check_partial_profile(const PartialProfile &pp)
     return pp->applyTo(params);
 }
 
+
+// default memory budget for parallel mode (-J): 3/4 of the physical RAM,
+// or 0 (i.e. unlimited) if we can't determine it
+size_t default_memory_budget()
+{
+#ifdef WIN32
+    MEMORYSTATUSEX st;
+    st.dwLength = sizeof(st);
+    if (GlobalMemoryStatusEx(&st)) {
+        return size_t(st.ullTotalPhys / 4 * 3);
+    }
+#elif defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pagesize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pagesize > 0) {
+        return size_t(pages) / 4 * 3 * size_t(pagesize);
+    }
+#endif
+    return 0;
+}
+
+
+/**
+ * Bounds the amount of memory used by the concurrent jobs in parallel
+ * mode. Each job reserves an estimate of its peak memory usage before
+ * loading the image, blocking until enough of the budget is available, and
+ * corrects it once the image is loaded. A single job is always allowed to
+ * run, even if its estimate exceeds the budget.
+ */
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit): limit_(limit), used_(0) {}
+
+    // rough estimate of the peak memory needed to process an image of the
+    // given size: a handful of full-resolution float RGB buffers
+    static size_t estimate(int width, int height)
+    {
+        constexpr size_t num_buffers = 6;
+        return size_t(std::max(width, 1)) * size_t(std::max(height, 1)) * 3 * sizeof(float) * num_buffers;
+    }
+
+    size_t acquire(size_t amount)
+    {
+        if (!limit_) {
+            return 0;
+        }
+        amount = std::min(amount, limit_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [&]() -> bool { return used_ + amount <= limit_; });
+        used_ += amount;
+        return amount;
+    }
+
+    // replaces a reservation of reserved with one of amount, without
+    // blocking: a job that has already loaded its image must be able to
+    // proceed. Returns the new reservation
+    size_t adjust(size_t reserved, size_t amount)
+    {
+        if (!limit_) {
+            return 0;
+        }
+        amount = std::min(amount, limit_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        used_ = used_ + amount - reserved;
+        if (amount < reserved) {
+            cond_.notify_all();
+        }
+        return amount;
+    }
+
+    void release(size_t amount)
+    {
+        if (amount) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            used_ -= amount;
+            cond_.notify_all();
+        }
+    }
+
+private:
+    size_t limit_;
+    size_t used_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+
+/**
+ * An additional output of each image (see --rendition). Empty or negative
+ * fields take the value of the main output, or of the processing profile.
+ */
+struct Rendition {
+    Glib::ustring suffix;
+    int size;           // of the long edge, 0 for no resizing
+    std::string type;
+    int bits;
+    bool isFloat;
+    int compression;
+    Glib::ustring icc;
+    int sharpen;        // post-resize sharpening: -1 as in the profile
+    Glib::ustring ext;  // file extension for type, set after parsing
+
+    Rendition(): size(0), bits(-1), isFloat(false), compression(-1), sharpen(-1) {}
+};
+
+
+// parses a comma-separated list of key=value pairs, e.g.
+// "suffix=_web,size=2048,type=jpg,quality=85,icc=RTv4_sRGB,sharpen=1"
+bool parse_rendition(const Glib::ustring &spec, Rendition &out)
+{
+    out = Rendition();
+    for (size_t start = 0; start <= spec.size(); ) {
+        size_t end = spec.find(',', start);
+        if (end == Glib::ustring::npos) {
+            end = spec.size();
+        }
+        const Glib::ustring item = spec.substr(start, end - start);
+        start = end + 1;
+
+        auto pos = item.find('=');
+        if (pos == Glib::ustring::npos) {
+            return false;
+        }
+        Glib::ustring key = item.substr(0, pos);
+        Glib::ustring val = item.substr(pos + 1);
+        if (key == "suffix") {
+            out.suffix = val;
+        } else if (key == "size") {
+            out.size = atoi(val.c_str());
+        } else if (key == "type") {
+            out.type = val.lowercase();
+        } else if (key == "bits") {
+            out.isFloat = (val == "16f" || val == "32");
+            out.bits = atoi(val.c_str());
+            if (out.bits != 8 && out.bits != 16 && out.bits != 32) {
+                return false;
+            }
+        } else if (key == "quality") {
+            out.compression = atoi(val.c_str());
+            if (out.compression < 0 || out.compression > 100) {
+                return false;
+            }
+        } else if (key == "icc") {
+            out.icc = val;
+        } else if (key == "sharpen") {
+            out.sharpen = atoi(val.c_str()) ? 1 : 0;
+        } else {
+            return false;
+        }
+    }
+    return !out.suffix.empty() && out.size >= 0;
+}
+
 } // namespace
 
 
@@ -129,6 +294,82 @@ int check_lut(int argc, char **argv)
     }
 }
 
+/*
+ * --bench-decode <max-jobs> <raw files...>
+ * Measures the raw decoding throughput with 1, 2, 4, ... up to max-jobs
+ * concurrent decoders, each using its own RawImage instance. With a single
+ * job, the throughput also reflects the parallelism inside the decoder
+ * (e.g. for tiled DNGs); run with OMP_NUM_THREADS=1 to get the sequential
+ * baseline.
+ */
+int bench_decode(int argc, char **argv)
+{
+    if (argc < 4 || atoi(argv[2]) < 1) {
+        std::cout << "invalid arguments to --bench-decode" << std::endl;
+        return 2;
+    }
+
+    const int max_jobs = atoi(argv[2]);
+    std::vector<Glib::ustring> files;
+    for (int i = 3; i < argc; ++i) {
+        files.push_back(fname_to_utf8(argv[i]));
+    }
+
+    std::vector<int> num_jobs;
+    for (int j = 1; j < max_jobs; j *= 2) {
+        num_jobs.push_back(j);
+    }
+    num_jobs.push_back(max_jobs);
+
+    double base_rate = 0;
+    for (int jobs : num_jobs) {
+        const size_t n = std::max(files.size(), size_t(2 * jobs));
+        std::atomic<size_t> next(0);
+        std::atomic<int> failed(0);
+        std::atomic<size_t> pixels(0);
+        rtengine::RawImage::setMaxConcurrentDecoders(jobs);
+
+        const auto work =
+            [&]() -> void
+            {
+                size_t i;
+                while ((i = next++) < n) {
+                    rtengine::RawImage ri(files[i % files.size()]);
+                    if (ri.loadRaw(true)) {
+                        ++failed;
+                    } else {
+                        pixels += size_t(ri.get_width()) * ri.get_height();
+                    }
+                }
+            };
+
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < jobs; ++i) {
+            threads.emplace_back(work);
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (failed) {
+            std::cout << "Error: " << failed << " images could not be decoded" << std::endl;
+            return 1;
+        }
+
+        const double rate = n / std::max(secs, 1e-6);
+        if (jobs == 1) {
+            base_rate = rate;
+        }
+        printf("%3d concurrent decoders: %zu images in %.2f s, %.2f images/s, %.1f Mpix/s, speedup %.2fx\n",
+               jobs, n, secs, rate, pixels / std::max(secs, 1e-6) / 1e6, rate / base_rate);
+    }
+
+    return 0;
+}
+
+
 int main (int argc, char **argv)
 {
 #ifdef WITH_MIMALLOC
@@ -257,12 +498,16 @@ int main (int argc, char **argv)
     // printing RT's version in all case, particularly useful for the 'verbose' mode, but also for the batch processing
     std::cout << RTNAME << ", version " << RTVERSION << ", command line." << std::endl;
 
-    if (argc > 1) {
+    if (argc > 1 && strcmp(argv[1], "--bench-decode") == 0) {
+        ret = bench_decode(argc, argv);
+    } else if (argc > 1) {
         ret = processLineParams (argc, argv);
     } else {
         std::cout << "Terminating without anything to do." << std::endl;
     }
 
+    rtengine::cleanup();
+
     return ret;
 }
 
@@ -284,6 +529,7 @@ std::pair<bool, int> dontLoadCache(int argc, char **argv)
                 break;
             case 'v':
                 std::cout << RTNAME << ", version " << RTVERSION << ", command line." << std::endl;
+                std::cout << "SIMD code path: " << rtengine::simd::get_path_name(rtengine::simd::get_path()) << std::endl;
                 exit(0);
             case '?':
             case 'h':
@@ -316,13 +562,31 @@ std::pair<bool, int> dontLoadCache(int argc, char **argv)
 class ConsoleProgressListener: public rtengine::ProgressListener {
 public:
     ConsoleProgressListener(int num_steps):
-        num_steps_(num_steps), percent_(0) {}
+        num_steps_(num_steps), percent_(0), jobs_done_(0) {}
 
     void incr()
     {
         MyMutex::MyLock l(mutex_);
         percent_ += 100.f / num_steps_;
     }
+
+    // progress of the concurrent jobs in parallel mode: the overall
+    // percentage is computed from the completed jobs plus the partial
+    // progress of the ones still running
+    void setJobProgress(size_t job, double p)
+    {
+        MyMutex::MyLock l(mutex_);
+        jobs_[job] = p;
+        print_jobs_progress();
+    }
+
+    void jobDone(size_t job)
+    {
+        MyMutex::MyLock l(mutex_);
+        jobs_.erase(job);
+        ++jobs_done_;
+        print_jobs_progress();
+    }
     
     void setProgress(double p)
     {
@@ -363,9 +627,38 @@ public:
     }
     
 private:
+    void print_jobs_progress()
+    {
+        double p = jobs_done_;
+        for (auto &j : jobs_) {
+            p += j.second;
+        }
+        if (progress) {
+            std::cout << "\n" << rtengine::LIM(int(p * 100 / num_steps_), 0, 99) << std::endl;
+        }
+    }
+    
     MyMutex mutex_;
     int num_steps_;
     int percent_;
+    int jobs_done_;
+    std::map<size_t, double> jobs_;
+};
+
+
+class JobProgressListener: public rtengine::ProgressListener {
+public:
+    JobProgressListener(ConsoleProgressListener &parent, size_t job):
+        parent_(parent), job_(job) {}
+
+    void setProgress(double p) { parent_.setJobProgress(job_, p); }
+    void setProgressStr(const Glib::ustring &str) {}
+    void setProgressState(bool inProcessing) {}
+    void error(const Glib::ustring &msg) { parent_.error(msg); }
+
+private:
+    ConsoleProgressListener &parent_;
+    size_t job_;
 };
 
 
@@ -389,7 +682,10 @@ int processLineParams ( int argc, char **argv )
     int bits = -1;
     bool isFloat = false;
     std::string outputType = "";
-    unsigned errors = 0;
+    int num_jobs = 1;
+    size_t max_memory = default_memory_budget();
+    std::string traceFile;
+    std::vector<Rendition> renditions;
 
     for ( int iArg = 1; iArg < argc; iArg++) {
         Glib::ustring currParam (argv[iArg]);
@@ -403,7 +699,25 @@ int processLineParams ( int argc, char **argv )
         if ( currParam.at (0) == '-' && currParam.size() > 1) {
             switch ( currParam.at (1) ) {
             case '-':
-                // GTK --argument, we're skipping it
+                if (currParam == "--trace") {
+                    if (iArg + 1 < argc) {
+                        ++iArg;
+                        traceFile = argv[iArg];
+                    } else {
+                        std::cerr << "Error: the --trace switch requires a mandatory value!" << std::endl;
+                        return -3;
+                    }
+                } else if (currParam == "--rendition") {
+                    Rendition r;
+                    if (iArg + 1 < argc && parse_rendition(argv[iArg+1], r)) {
+                        ++iArg;
+                        renditions.push_back(r);
+                    } else {
+                        std::cerr << "Error: the --rendition switch requires a valid specification!" << std::endl;
+                        return -3;
+                    }
+                }
+                // other GTK --arguments, we're skipping them
                 break;
 
             case 'O':
@@ -547,6 +861,51 @@ int processLineParams ( int argc, char **argv )
                 fast_export = true;
                 break;
 
+            case 'J':
+                if (currParam.length() == 2) {
+                    std::cerr << "Error: the -J switch requires a mandatory value!" << std::endl;
+                    return -3;
+                }
+
+                num_jobs = atoi(currParam.substr(2).c_str());
+
+                if (num_jobs < 1) {
+                    std::cerr << "Error: the value accompanying the -J switch has to be a positive integer!" << std::endl;
+                    return -3;
+                }
+
+                break;
+
+            case 'M':
+                if (currParam.length() == 2) {
+                    std::cerr << "Error: the -M switch requires a mandatory value!" << std::endl;
+                    return -3;
+                } else {
+                    int mb = atoi(currParam.substr(2).c_str());
+                    if (mb < 0) {
+                        std::cerr << "Error: the value accompanying the -M switch has to be a non-negative integer!" << std::endl;
+                        return -3;
+                    }
+                    max_memory = size_t(mb) << 20;
+                }
+
+                break;
+
+            case 'L':
+                if (currParam.length() == 2) {
+                    std::cerr << "Error: the -L switch requires a mandatory value!" << std::endl;
+                    return -3;
+                } else {
+                    int mb = atoi(currParam.substr(2).c_str());
+                    if (mb < 0) {
+                        std::cerr << "Error: the value accompanying the -L switch has to be a non-negative integer!" << std::endl;
+                        return -3;
+                    }
+                    options.rtSettings.export_in_place_threshold = mb;
+                }
+
+                break;
+
             case 'T':
                 if (currParam.size() > 2) {
                     outputType = currParam.substr(2).lowercase();
@@ -759,181 +1118,378 @@ int processLineParams ( int argc, char **argv )
         std::thread(monitor).detach();
     }
 
-    for ( size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
-        cpl.incr();
-
-        // Has to be reinstanciated at each profile to have a ProcParams object with default values
-        rtengine::procparams::ProcParams currentParams;
+    if (outputType.empty()) {
+        outputType = "jpg";
+    }
 
-        Glib::ustring inputFile = inputFiles[iFile];
-        //cpl.info(Glib::ustring::compose("Output is %1-bit %2.", bits, (isFloat ? "floating-point" : "integer")));
-        if (progress) {
-            cpl.msg(Glib::ustring::compose("Processing: %1 (%2/%3)", inputFile, iFile+1, inputFiles.size()));
-        } else {
-            cpl.info(Glib::ustring::compose("Processing: %1", inputFile));
-        }
-        
-        rtengine::InitialImage* ii = nullptr;
-        rtengine::ProcessingJob* job = nullptr;
-        int errorCode;
-        bool isRaw = false;
+    Glib::ustring oext = output_ext[outputType];
+    if (oext.empty()) {
+        oext = outputType;
+    }
 
-        Glib::ustring outputFile;
+    if (leaveUntouched && !renditions.empty()) {
+        std::cerr << "Error: the --rendition switch cannot be used when writing to /dev/null!" << std::endl;
+        return -3;
+    }
 
-        if (outputType.empty()) {
-            outputType = "jpg";
+    for (auto &r : renditions) {
+        if (r.type.empty()) {
+            r.type = outputType;
+            if (r.bits < 0) {
+                r.bits = bits;
+                r.isFloat = isFloat;
+            }
         }
-
-        auto oext = output_ext[outputType];
-        if (oext.empty()) {
-            oext = outputType;
+        // resolved here, as output_ext is read concurrently by the workers
+        auto it = output_ext.find(r.type);
+        if (it == output_ext.end()) {
+            std::cerr << "Error: unknown output type \"" << r.type << "\" for rendition \"" << r.suffix << "\"!" << std::endl;
+            return -3;
         }
+        r.ext = it->second.empty() ? Glib::ustring(r.type) : it->second;
+        if (r.bits < 0) {
+            r.bits = (r.type == "jpg" || r.type == "png") ? 8 : (r.type == "tif" ? 16 : 32);
+            r.isFloat = r.bits == 32;
+        }
+        if (r.compression < 0) {
+            if (r.type == "jpg") {
+                r.compression = outputType == "jpg" ? compression : 92;
+            } else if (r.type == "tif") {
+                r.compression = outputType == "tif" ? compression : 0;
+            }
+        }
+    }
 
-        if (outputPath.empty()) {
-            Glib::ustring s = inputFile;
-            Glib::ustring::size_type ext = s.find_last_of('.');
-            outputFile = s.substr(0, ext) + "." + oext;
-        } else if (outputDirectory) {
-            Glib::ustring s = Glib::path_get_basename(inputFile);
-            Glib::ustring::size_type ext = s.find_last_of('.');
-            outputFile = Glib::build_filename(outputPath, s.substr(0, ext) + "." + oext);
-        } else {
-            if (leaveUntouched) {
-                outputFile = outputPath;
+    const auto save_image =
+        [&](rtengine::IImagefloat *img, const std::string &type, const Glib::ustring &fname, int bits, bool isFloat, int compression) -> int
+        {
+            rtengine::perf::Scope scope("io", "save");
+            if (type == "jpg") {
+                return img->saveAsJPEG(fname, compression, subsampling);
+            } else if (type == "tif") {
+                return img->saveAsTIFF(fname, bits, isFloat, compression == 0);
+            } else if (type == "png") {
+                return img->saveAsPNG(fname, bits);
+            } else {
+                return rtengine::ImageIOManager::getInstance()->save(img, type, fname, nullptr) ? 0 : 1;
+                //return img->saveToFile(fname);
+            }
+        };
+
+    const bool parallel = num_jobs > 1 && inputFiles.size() > 1;
+    MemoryBudget membudget(parallel ? max_memory : 0);
+    std::atomic<unsigned> errors(0);
+    std::vector<std::unique_ptr<rtengine::perf::Trace>> traces(traceFile.empty() ? 0 : inputFiles.size());
+
+    // processes inputFiles[iFile]; the progress listener is per-job in
+    // parallel mode, and the shared console listener otherwise
+    const auto process_file =
+        [&](size_t iFile, rtengine::ProgressListener *jpl) -> void
+        {
+            // Has to be reinstanciated at each profile to have a ProcParams object with default values
+            rtengine::procparams::ProcParams currentParams;
+
+            Glib::ustring inputFile = inputFiles[iFile];
+
+            std::unique_ptr<rtengine::perf::TraceScope> traceScope;
+            if (!traceFile.empty()) {
+                traces[iFile].reset(new rtengine::perf::Trace(inputFile));
+                traceScope.reset(new rtengine::perf::TraceScope(traces[iFile].get()));
+            }
+            rtengine::perf::Scope imageScope("image", "total");
+
+            //cpl.info(Glib::ustring::compose("Output is %1-bit %2.", bits, (isFloat ? "floating-point" : "integer")));
+            if (progress || parallel) {
+                cpl.msg(Glib::ustring::compose("Processing: %1 (%2/%3)", inputFile, iFile+1, inputFiles.size()));
             } else {
-                Glib::ustring s = outputPath;
+                cpl.info(Glib::ustring::compose("Processing: %1", inputFile));
+            }
+        
+            rtengine::InitialImage* ii = nullptr;
+            rtengine::ProcessingJob* job = nullptr;
+            int errorCode;
+            bool isRaw = false;
+
+            Glib::ustring outputFile;
+
+            if (outputPath.empty()) {
+                Glib::ustring s = inputFile;
                 Glib::ustring::size_type ext = s.find_last_of('.');
                 outputFile = s.substr(0, ext) + "." + oext;
+            } else if (outputDirectory) {
+                Glib::ustring s = Glib::path_get_basename(inputFile);
+                Glib::ustring::size_type ext = s.find_last_of('.');
+                outputFile = Glib::build_filename(outputPath, s.substr(0, ext) + "." + oext);
+            } else {
+                if (leaveUntouched) {
+                    outputFile = outputPath;
+                } else {
+                    Glib::ustring s = outputPath;
+                    Glib::ustring::size_type ext = s.find_last_of('.');
+                    outputFile = s.substr(0, ext) + "." + oext;
+                }
             }
-        }
 
-        if (inputFile == outputFile) {
-            cpl.error(Glib::ustring::compose("cannot overwrite: %1", inputFile));
-            continue;
-        }
+            if (inputFile == outputFile) {
+                cpl.error(Glib::ustring::compose("cannot overwrite: %1", inputFile));
+                return;
+            }
 
-        if (!overwriteFiles && Glib::file_test(outputFile, Glib::FILE_TEST_EXISTS ) ) {
-            cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", outputFile));
-            continue;
-        }
+            if (!overwriteFiles && Glib::file_test(outputFile, Glib::FILE_TEST_EXISTS ) ) {
+                cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", outputFile));
+                return;
+            }
 
-        // Load the image
-        isRaw = true;
-        Glib::ustring ext = getExtension(inputFile).lowercase();
+            std::vector<Glib::ustring> renditionFiles;
+            const Glib::ustring base = outputFile.substr(0, outputFile.find_last_of('.'));
+            for (auto &r : renditions) {
+                renditionFiles.push_back(base + r.suffix + "." + r.ext);
+                if (!overwriteFiles && Glib::file_test(renditionFiles.back(), Glib::FILE_TEST_EXISTS)) {
+                    cpl.error(Glib::ustring::compose("%1 already exists: use -Y option to overwrite. This image has been skipped.", renditionFiles.back()));
+                    return;
+                }
+            }
 
-        if (ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || rtengine::ImageIOManager::getInstance()->canLoad(ext)) {
-            isRaw = false;
-        }
+            // wait until there is enough room in the memory budget for
+            // processing this image. The size is taken from the metadata, so
+            // that the budget bounds also the memory used by decoding
+            size_t reserved = 0;
+            if (parallel) {
+                int w = 0, h = 0;
+                std::unique_ptr<rtengine::FramesMetaData> md(rtengine::FramesMetaData::fromFile(inputFile));
+                if (md) {
+                    md->getDimensions(w, h);
+                }
+                if (w <= 0 || h <= 0) {
+                    // unknown size: assume a common 24 MP sensor
+                    w = 6000;
+                    h = 4000;
+                }
+                reserved = membudget.acquire(MemoryBudget::estimate(w, h));
+            }
 
-        ii = rtengine::InitialImage::load(inputFile, isRaw, &errorCode, nullptr);
+            // Load the image
+            isRaw = true;
+            Glib::ustring ext = getExtension(inputFile).lowercase();
 
-        if (!ii) {
-            errors++;
-            cpl.error(Glib::ustring::compose("impossible to load file: %1", inputFile));
-            continue;
-        }
+            if (ext == "jpg" || ext == "jpeg" || ext == "tif" || ext == "tiff" || ext == "png" || rtengine::ImageIOManager::getInstance()->canLoad(ext)) {
+                isRaw = false;
+            }
 
-        if (useDefault) {
-            if (isRaw) {
-                if (options.defProfRaw == Options::DEFPROFILE_DYNAMIC) {
-                    rawParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
-                }
+            {
+                rtengine::perf::Scope scope("io", "load");
+                ii = rtengine::InitialImage::load(inputFile, isRaw, &errorCode, nullptr);
+            }
+
+            if (!ii) {
+                errors++;
+                cpl.error(Glib::ustring::compose("impossible to load file: %1", inputFile));
+                membudget.release(reserved);
+                return;
+            }
+
+            if (useDefault) {
+                // dynamic profiles are resolved per image, so that concurrent
+                // jobs don't step on each other
+                PartialProfile dynParams;
+                if (isRaw) {
+                    if (options.defProfRaw == Options::DEFPROFILE_DYNAMIC) {
+                        dynParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                    }
                 
-                cpl.info("Merging default raw processing profile.");
-                rawParams->applyTo(currentParams);
-            } else {
-                if (options.defProfImg == Options::DEFPROFILE_DYNAMIC) {
-                    imgParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                    cpl.info("Merging default raw processing profile.");
+                    (dynParams ? dynParams : rawParams)->applyTo(currentParams);
+                } else {
+                    if (options.defProfImg == Options::DEFPROFILE_DYNAMIC) {
+                        dynParams = ProfileStore::getInstance()->loadDynamicProfile(ii->getMetaData());
+                    }
+
+                    cpl.info("Merging default non-raw processing profile.");
+                    (dynParams ? dynParams : imgParams)->applyTo(currentParams);
+                }
+            }
+
+            bool sideCarFound = false;
+            unsigned int i = 0;
+
+            // Iterate the procparams file list in order to build the final ProcParams
+            do {
+                if (sideProcParams && i == sideCarFilePos) {
+                    // using the sidecar file
+                    Glib::ustring sideProcessingParams = options.getParamFile(inputFile);
+
+                    // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
+                    if (!Glib::file_test(sideProcessingParams, Glib::FILE_TEST_EXISTS) || currentParams.load(nullptr, sideProcessingParams)) {
+                        cpl.info(Glib::ustring::compose("Warning: sidecar file requested but not found for: %1", sideProcessingParams));
+                    } else {
+                        sideCarFound = true;
+                        cpl.info("Merging sidecar procparams.");
+                    }
+                }
+
+                if (processingParams.size() > i) {
+                    cpl.info(Glib::ustring::compose("Merging procparams #%1", i));
+                    processingParams[i]->applyTo(currentParams);
                 }
 
-                cpl.info("Merging default non-raw processing profile.");
-                imgParams->applyTo(currentParams);
+                i++;
+            } while (i < processingParams.size() + (sideProcParams ? 1 : 0));
+
+            if (sideProcParams && !sideCarFound && skipIfNoSidecar) {
+                delete ii;
+                errors++;
+                cpl.error(Glib::ustring::compose("no sidecar procparams found for: %1", inputFile));
+                membudget.release(reserved);
+                return;
             }
-        }
 
-        bool sideCarFound = false;
-        unsigned int i = 0;
+            auto p = rtengine::ImageIOManager::getInstance()->getSaveProfile(outputType);
+            if (p) {
+                p->applyTo(currentParams);
+            }
 
-        // Iterate the procparams file list in order to build the final ProcParams
-        do {
-            if (sideProcParams && i == sideCarFilePos) {
-                // using the sidecar file
-                Glib::ustring sideProcessingParams = options.getParamFile(inputFile);
+            // correct the reservation with the actual size of the image
+            if (parallel) {
+                int w = 0, h = 0;
+                ii->getMetaData()->getDimensions(w, h);
+                reserved = membudget.adjust(reserved, MemoryBudget::estimate(w, h));
+            }
 
-                // the "load" method don't reset the procparams values anymore, so values found in the procparam file override the one of currentParams
-                if (!Glib::file_test(sideProcessingParams, Glib::FILE_TEST_EXISTS) || currentParams.load(nullptr, sideProcessingParams)) {
-                    cpl.info(Glib::ustring::compose("Warning: sidecar file requested but not found for: %1", sideProcessingParams));
-                } else {
-                    sideCarFound = true;
-                    cpl.info("Merging sidecar procparams.");
+            job = create_processing_job(ii, currentParams, fast_export);
+
+            if (!job) {
+                errors++;
+                cpl.error(Glib::ustring::compose("impossible to create processing job for: %1", inputFile));
+                ii->decreaseRef();
+                membudget.release(reserved);
+                return;
+            }
+
+            for (size_t i = 0; i < renditionFiles.size(); ++i) {
+                const Rendition &r = renditions[i];
+                rtengine::ProcessingJob::Output out(currentParams);
+                out.resize.enabled = r.size > 0;
+                if (r.size > 0) {
+                    out.resize.appliesTo = "Cropped area";
+                    out.resize.dataspec = 3;
+                    out.resize.unit = rtengine::procparams::ResizeParams::PX;
+                    out.resize.width = out.resize.height = r.size;
+                    out.resize.allowUpscaling = false;
+                }
+                if (!r.icc.empty()) {
+                    out.outputProfile = r.icc;
                 }
+                if (r.sharpen >= 0) {
+                    out.prsharpening.enabled = r.sharpen;
+                }
+                job->addOutput(out);
             }
 
-            if (processingParams.size() > i) {
-                cpl.info(Glib::ustring::compose("Merging procparams #%1", i));
-                processingParams[i]->applyTo(currentParams);
+            // Process image
+            std::vector<rtengine::IImagefloat *> extraImages;
+            rtengine::IImagefloat *resultImage = nullptr;
+            if (renditionFiles.empty()) {
+                resultImage = rtengine::processImage(job, errorCode, jpl);
+            } else {
+                extraImages = rtengine::processImageOutputs(job, errorCode, jpl);
+                if (!extraImages.empty()) {
+                    resultImage = extraImages[0];
+                    extraImages.erase(extraImages.begin());
+                }
             }
 
-            i++;
-        } while (i < processingParams.size() + (sideProcParams ? 1 : 0));
+            if (!resultImage) {
+                errors++;
+                cpl.error(Glib::ustring::compose("failure in processing: %1", inputFile));
+                rtengine::ProcessingJob::destroy(job);
+                membudget.release(reserved);
+                return;
+            }
 
-        if (sideProcParams && !sideCarFound && skipIfNoSidecar) {
-            delete ii;
-            errors++;
-            cpl.error(Glib::ustring::compose("no sidecar procparams found for: %1", inputFile));
-            continue;
-        }
+            // save image to disk
+            errorCode = save_image(resultImage, outputType, outputFile, bits, isFloat, compression);
 
-        auto p = rtengine::ImageIOManager::getInstance()->getSaveProfile(outputType);
-        if (p) {
-            p->applyTo(currentParams);
-        }
+            for (size_t i = 0; i < extraImages.size(); ++i) {
+                const Rendition &r = renditions[i];
+                if (save_image(extraImages[i], r.type, renditionFiles[i], r.bits, r.isFloat, r.compression)) {
+                    errors++;
+                    cpl.error(Glib::ustring::compose("failure in saving to: %1", renditionFiles[i]));
+                }
+                extraImages[i]->free();
+            }
 
-        job = create_processing_job(ii, currentParams, fast_export);
+            if (errorCode) {
+                errors++;
+                cpl.error(Glib::ustring::compose("failure in saving to: %1", outputFile));
+            } else {
+                if (copyParamsFile) {
+                    Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
+                    if (!options.params_out_embed || currentParams.saveEmbedded(jpl, outputFile) != 0) {
+                        currentParams.save(jpl, outputProcessingParams);
+                    }
+                }
+            }
 
-        if (!job) {
-            errors++;
-            cpl.error(Glib::ustring::compose("impossible to create processing job for: %1", inputFile));
             ii->decreaseRef();
-            continue;
-        }
+            resultImage->free();
+            membudget.release(reserved);
 
-        // Process image
-        rtengine::IImagefloat *resultImage = rtengine::processImage(job, errorCode, pl);
-
-        if (!resultImage) {
-            errors++;
-            cpl.error(Glib::ustring::compose("failure in processing: %1", inputFile));
-            rtengine::ProcessingJob::destroy(job);
-            continue;
-        }
+            if (parallel && !progress) {
+                cpl.info(Glib::ustring::compose("Done: %1 -> %2", inputFile, outputFile));
+            }
+        };
 
-        // save image to disk
-        if (outputType == "jpg") {
-            errorCode = resultImage->saveAsJPEG(outputFile, compression, subsampling);
-        } else if (outputType == "tif") {
-            errorCode = resultImage->saveAsTIFF(outputFile, bits, isFloat, compression == 0);
-        } else if (outputType == "png") {
-            errorCode = resultImage->saveAsPNG(outputFile, bits);
-        } else {
-            errorCode = rtengine::ImageIOManager::getInstance()->save(resultImage, outputType, outputFile, nullptr) ? 0 : 1;
-            //errorCode = resultImage->saveToFile(outputFile);
+    if (!parallel) {
+        for (size_t iFile = 0; iFile < inputFiles.size(); iFile++) {
+            cpl.incr();
+            process_file(iFile, pl);
         }
+    } else {
+        const size_t njobs = std::min(size_t(num_jobs), inputFiles.size());
+#ifdef _OPENMP
+        const int nthreads = omp_get_num_procs();
+#else
+        const int nthreads = 1;
+#endif
+        std::atomic<size_t> next(0);
+        rtengine::RawImage::setMaxConcurrentDecoders(njobs);
 
-        if (errorCode) {
-            errors++;
-            cpl.error(Glib::ustring::compose("failure in saving to: %1", outputFile));
-        } else {
-            if (copyParamsFile) {
-                Glib::ustring outputProcessingParams = outputFile + paramFileExtension;
-                if (!options.params_out_embed || currentParams.saveEmbedded(pl, outputFile) != 0) {
-                    currentParams.save(pl, outputProcessingParams);
+        const auto worker =
+            [&](size_t idx) -> void
+            {
+#ifdef _OPENMP
+                // split the OpenMP threads evenly among the concurrent jobs;
+                // the setting is per-thread, so it only affects this worker
+                const int t = nthreads / int(njobs) + (int(idx) < nthreads % int(njobs) ? 1 : 0);
+                omp_set_num_threads(std::max(t, 1));
+#endif
+                size_t iFile;
+                while ((iFile = next++) < inputFiles.size()) {
+                    JobProgressListener jpl(cpl, iFile);
+                    process_file(iFile, progress ? &jpl : nullptr);
+                    cpl.jobDone(iFile);
                 }
-            }
+            };
+
+        cpl.info(Glib::ustring::compose("Processing %1 images with %2 concurrent jobs (%3 threads each)", inputFiles.size(), njobs, std::max(nthreads / int(njobs), 1)));
+        
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < njobs; ++i) {
+            workers.emplace_back(worker, i);
+        }
+        for (auto &w : workers) {
+            w.join();
         }
+    }
 
-        ii->decreaseRef();
-        resultImage->free();
+    if (!traceFile.empty()) {
+        std::vector<const rtengine::perf::Trace *> tv;
+        for (auto &t : traces) {
+            tv.push_back(t.get());
+        }
+        if (!rtengine::perf::write_json(traceFile, tv)) {
+            std::cerr << "Error: could not write the trace to " << traceFile << std::endl;
+        }
     }
 
     if (progress) {
@@ -462,6 +462,8 @@ void Options::setDefaults()
     thumb_delay_update = false;
     thumb_lazy_caching = true;
     thumb_cache_processed = false;
+    batch_queue_pipeline = true;
+    cache_packed = false;
     profile_append_mode = false;
     maxInspectorBuffers = 2; //  a rather conservative value for low specced systems...
     inspectorDelay = 0;
@@ -592,6 +594,12 @@ void Options::setDefaults()
 #endif
     rtSettings.thread_pool_size = 0;
     rtSettings.ctl_scripts_fast_preview = true;
+    rtSettings.fuse_pointwise_ops = true;
+    rtSettings.buffer_pool_size = 512;
+    rtSettings.export_in_place_threshold = 0;
+    rtSettings.demosaic_cache_size = 0;
+    rtSettings.mask_cache_size = 256;
+    rtSettings.icc_lut_transforms = false;
     show_exiftool_makernotes = false;
 
     browser_width_for_inspector = 0;
@@ -1160,9 +1168,41 @@ void Options::readFromFile(Glib::ustring fname)
                     thumb_cache_processed = keyFile.get_boolean("Performance", "ThumbCacheProcessed");
                 }
 
+                if (keyFile.has_key("Performance", "BatchQueuePipeline")) {
+                    batch_queue_pipeline = keyFile.get_boolean("Performance", "BatchQueuePipeline");
+                }
+
+                if (keyFile.has_key("Performance", "PackedCache")) {
+                    cache_packed = keyFile.get_boolean("Performance", "PackedCache");
+                }
+
                 if (keyFile.has_key("Performance", "CTLScriptsFastPreview")) {
                     rtSettings.ctl_scripts_fast_preview = keyFile.get_boolean("Performance", "CTLScriptsFastPreview");
                 }
+
+                if (keyFile.has_key("Performance", "FusePointwiseOps")) {
+                    rtSettings.fuse_pointwise_ops = keyFile.get_boolean("Performance", "FusePointwiseOps");
+                }
+
+                if (keyFile.has_key("Performance", "BufferPoolSize")) {
+                    rtSettings.buffer_pool_size = std::max(keyFile.get_integer("Performance", "BufferPoolSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "ExportInPlaceThreshold")) {
+                    rtSettings.export_in_place_threshold = std::max(keyFile.get_integer("Performance", "ExportInPlaceThreshold"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "DemosaicCacheSize")) {
+                    rtSettings.demosaic_cache_size = std::max(keyFile.get_integer("Performance", "DemosaicCacheSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "MaskCacheSize")) {
+                    rtSettings.mask_cache_size = std::max(keyFile.get_integer("Performance", "MaskCacheSize"), 0);
+                }
+
+                if (keyFile.has_key("Performance", "ICCLutTransforms")) {
+                    rtSettings.icc_lut_transforms = keyFile.get_boolean("Performance", "ICCLutTransforms");
+                }
             }
 
             if (keyFile.has_group("Inspector")) {
@@ -1938,7 +1978,15 @@ void Options::saveToFile(Glib::ustring fname)
         keyFile.set_boolean("Performance", "ThumbDelayUpdate", thumb_delay_update);
         keyFile.set_boolean("Performance", "ThumbLazyCaching", thumb_lazy_caching);
         keyFile.set_boolean("Performance", "ThumbCacheProcessed", thumb_cache_processed);
+        keyFile.set_boolean("Performance", "BatchQueuePipeline", batch_queue_pipeline);
+        keyFile.set_boolean("Performance", "PackedCache", cache_packed);
         keyFile.set_boolean("Performance", "CTLScriptsFastPreview", rtSettings.ctl_scripts_fast_preview);
+        keyFile.set_boolean("Performance", "FusePointwiseOps", rtSettings.fuse_pointwise_ops);
+        keyFile.set_integer("Performance", "BufferPoolSize", rtSettings.buffer_pool_size);
+        keyFile.set_integer("Performance", "ExportInPlaceThreshold", rtSettings.export_in_place_threshold);
+        keyFile.set_integer("Performance", "DemosaicCacheSize", rtSettings.demosaic_cache_size);
+        keyFile.set_integer("Performance", "MaskCacheSize", rtSettings.mask_cache_size);
+        keyFile.set_boolean("Performance", "ICCLutTransforms", rtSettings.icc_lut_transforms);
         
         keyFile.set_integer("Performance", "WBPreviewMode", wb_preview_mode);
         keyFile.set_integer("Inspector", "Mode", int(rtSettings.thumbnail_inspector_mode));
@@ -2395,6 +2443,8 @@ void Options::load(bool lightweight, int verbose)
 
     langMgr.load(options.language, {user_locale_translation, localeTranslation, user_language_translation, languageTranslation, user_default_translation, defaultTranslation});
 
+    options.rtSettings.fftw_wisdom_file = Glib::build_filename(options.cacheBaseDir, "fftw_wisdom");
+    options.rtSettings.demosaic_cache_dir = Glib::build_filename(options.cacheBaseDir, "demosaic");
     rtengine::init(&options.rtSettings, argv0, rtdir, !lightweight);
 }
 
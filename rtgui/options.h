@@ -358,6 +358,8 @@ public:
     bool thumb_delay_update;
     bool thumb_lazy_caching;
     bool thumb_cache_processed;
+    bool batch_queue_pipeline; // overlap decoding, processing and saving of consecutive queue entries
+    bool cache_packed; // store the file browser cache in a single pack file (see CachePack)
     bool profile_append_mode;  // Used as reminder for the ProfilePanel "mode"
     prevdemo_t prevdemo; // Demosaicing method used for the <100% preview
     bool serializeTiffRead;
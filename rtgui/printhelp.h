@@ -45,9 +45,10 @@ inline void ART_print_help(std::ostream &out, const char *progname, bool gui)
         out << "  " << pn << " <other options> -c <dir>|<files>   Convert files in batch with your own settings." << std::endl;
         out << "  " << pn << " --make-icc <make-icc options>   Build an ICC output color profile." << std::endl;
         out << "  " << pn << " --check-lut <lut-filename>   Check the validity of the given LUT file." << std::endl;
+        out << "  " << pn << " --bench-decode <max-jobs> <raw files>   Measure the raw decoding throughput with up to max-jobs concurrent decoders." << std::endl;
         out << std::endl;
         out << "Options:" << std::endl;
-        out << "  " << pn << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one" << paramFileExtension << "> [-p <two" << paramFileExtension << "> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> | -Ttype ] [-Y] [-f] -c <input>" << std::endl;
+        out << "  " << pn << "[-o <output>|-O <output>] [-q] [-a] [-s|-S] [-p <one" << paramFileExtension << "> [-p <two" << paramFileExtension << "> ...] ] [-d] [ -j[1-100] -js<1-3> | -t[z] -b<8|16|16f|32> | -n -b<8|16> | -Ttype ] [-Y] [-f] [-J<n> [-M<mb>]] [-L<mb>] [--trace <file>] [--rendition <spec> ...] -c <input>" << std::endl;
         out << std::endl;
         out << "  -c <files>       Specify one or more input files or folders. When specifying\n"
             << "                   folders, ART will look for image file types which comply with\n"
@@ -98,8 +99,37 @@ inline void ART_print_help(std::ostream &out, const char *progname, bool gui)
             << "                   by a user-defined custom image saver." << std::endl;
         out << "  -Y               Overwrite output if present." << std::endl;
         out << "  -f               Use the custom fast-export processing pipeline." << std::endl;
+        out << "  -J<n>            Process up to n images concurrently. The available CPU\n"
+            << "                   threads are split evenly among the concurrent jobs.\n"
+            << "                   The output is the same as when processing serially." << std::endl;
+        out << "  -M<mb>           Memory budget (in MB) for the concurrent jobs of -J.\n"
+            << "                   New images are started only when the estimated memory\n"
+            << "                   usage fits in the budget. Default: 3/4 of the physical\n"
+            << "                   memory. 0 means unlimited." << std::endl;
+        out << "  -L<mb>           Prefer in-place export above <mb> MB: images whose estimated\n"
+            << "                   memory usage is above it are processed in place where\n"
+            << "                   possible, to reduce the peak memory usage. This is not a\n"
+            << "                   hard limit. Default: the value of ExportInPlaceThreshold\n"
+            << "                   in the options file. 0 means never." << std::endl;
         out << "  -V               Verbose output." << std::endl;
         out << "  --progress       Show progress info in a format compatible with zenity." << std::endl;
+        out << "  --trace <file>   Save the timing of the processing steps of each image to\n"
+            << "                   file, in the Chrome trace-event JSON format (viewable with\n"
+            << "                   chrome://tracing or https://ui.perfetto.dev)." << std::endl;
+        out << "  --rendition <spec>\n"
+            << "                   Save an additional output of each image, sharing all the\n"
+            << "                   processing except resizing, post-resize sharpening and\n"
+            << "                   conversion to the output profile. Can be repeated.\n"
+            << "                   spec is a comma-separated list of key=value pairs:\n"
+            << "                     suffix=<s>   appended to the output file name (required)\n"
+            << "                     size=<px>    long edge, 0 (default) for no resizing\n"
+            << "                     type=<t>     jpg, tif, png or a custom type\n"
+            << "                     bits=<b>     8, 16, 16f or 32\n"
+            << "                     quality=<q>  JPEG quality, or TIFF compression (0/1)\n"
+            << "                     icc=<name>   output profile\n"
+            << "                     sharpen=<0|1> post-resize sharpening\n"
+            << "                   Unset values are taken from the main output.\n"
+            << "                   Example: --rendition suffix=_web,size=2048,type=jpg" << std::endl;
         out << std::endl;
         out << "Your " << pparamsExt << " files can be incomplete, ART will build the final values as follows:" << std::endl;
         out << "  1- A new processing profile is created using neutral values," << std::endl;
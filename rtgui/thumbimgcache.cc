@@ -23,118 +23,117 @@
 #include "options.h"
 #include <iostream>
 #include <glib/gstdio.h>
+#include <cstring>
 
 extern Options options;
 
 namespace art { namespace thumbimgcache {
 
-/******************************************************************************
- * file format:
- *
- * "ART\n" header
- * monitor hash
- * size of the procparams
- * compressed procparams
- * width
- * height
- * image data
- ******************************************************************************/
-rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h)
-{
-    if (!options.thumb_cache_processed) {
-        return nullptr;
-    }
-    
-    Glib::ustring fname = cache_fname + ".artt";
+namespace {
 
-    if (!Glib::file_test(fname, Glib::FILE_TEST_EXISTS)) {
-        return nullptr;
-    }
+const char *const MAGIC = "ART2\n";
+constexpr size_t MAGIC_SIZE = 5;
+constexpr size_t MONITOR_HASH_SIZE = 33;
+constexpr size_t DIGEST_SIZE = 32;
+constexpr size_t HEADER_SIZE = MAGIC_SIZE + MONITOR_HASH_SIZE + DIGEST_SIZE + 2 * sizeof(guint32);
 
-    FILE *f = g_fopen(fname.c_str(), "rb");
 
-    if (!f) {
+std::string params_digest(const rtengine::procparams::ProcParams &pparams)
+{
+    return Glib::Checksum::compute_checksum(Glib::Checksum::CHECKSUM_MD5, pparams.to_data());
+}
+
+
+rtengine::Image8 *read_image(const char *data, size_t size, const std::string &monitor_hash, const std::string &digest, int h)
+{
+    if (size < HEADER_SIZE) {
         return nullptr;
     }
 
     // header
-    char buffer[64];
-    fgets(buffer, 5, f);
-    if (strcmp(buffer, "ART\n") != 0) {
+    if (memcmp(data, MAGIC, MAGIC_SIZE) != 0) {
         return nullptr;
     }
+    data += MAGIC_SIZE;
 
     // monitor hash
-    if (fread(buffer, sizeof(char), 33, f) < 33) {
+    if (monitor_hash.size() != MONITOR_HASH_SIZE || memcmp(data, monitor_hash.c_str(), MONITOR_HASH_SIZE) != 0) {
         return nullptr;
     }
-    buffer[33] = '\0';
-    if (strcmp(buffer, rtengine::ICCStore::getInstance()->getThumbnailMonitorHash().c_str()) != 0) {
-        fclose(f);
+    data += MONITOR_HASH_SIZE;
+
+    // procparams digest
+    if (digest.size() != DIGEST_SIZE || memcmp(data, digest.c_str(), DIGEST_SIZE) != 0) {
         return nullptr;
     }
+    data += DIGEST_SIZE;
+
+    guint32 width = 0, height = 0;
+    memcpy(&width, data, sizeof(guint32));
+    data += sizeof(guint32);
+    memcpy(&height, data, sizeof(guint32));
+    data += sizeof(guint32);
 
-    // size of the profile data
-    guint32 profsz = 0;
-    if (fread(&profsz, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
+    if (std::min(width, height) <= 0 || guint32(h) != height) {
         return nullptr;
     }
 
-    rtengine::procparams::ProcParams imgparams;
-    {
-        std::vector<uint8_t> profzdata(profsz);
-        if (fread(&profzdata[0], sizeof(uint8_t), profsz, f) < profsz) {
-            fclose(f);
-            return nullptr;
-        }
-        std::string profdata = rtengine::decompress(profzdata);
-        if (!imgparams.from_data(profdata.c_str())) {
-            fclose(f);
-            return nullptr;
-        }
-    }
-    if (imgparams != pparams) {
-        fclose(f);
+    const size_t rowsz = size_t(width) * 3;
+    if (size - HEADER_SIZE < rowsz * height) {
         return nullptr;
     }
 
-    guint32 width = 0, height = 0;
+    rtengine::Image8 *image = new rtengine::Image8(width, height);
+    for (guint32 i = 0; i < height; ++i) {
+        memcpy(image->r(i), data + i * rowsz, rowsz);
+    }
 
-    if (fread(&width, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
+    return image;
+}
+
+} // namespace
+
+
+rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h)
+{
+    if (!options.thumb_cache_processed) {
         return nullptr;
     }
+    
+    Glib::ustring fname = cache_fname + ".artt";
+    const std::string monitor_hash = rtengine::ICCStore::getInstance()->getThumbnailMonitorHash();
+    rtengine::Image8 *image = nullptr;
 
-    if (fread(&height, 1, sizeof(guint32), f) < sizeof(guint32)) {
-        fclose(f);
-        return nullptr;
+    if (options.cache_packed) {
+        std::string data;
+        if (cacheMgr->readFile(fname, data)) {
+            image = read_image(data.data(), data.size(), monitor_hash, params_digest(pparams), h);
+        }
+        if (image && options.rtSettings.verbose > 1) {
+            std::cout << "read from cache pack: " << fname << " " << image->getWidth() << "x" << image->getHeight() << std::endl;
+        }
+        return image;
     }
 
-    if (std::min(width , height) <= 0) {
-        fclose(f);
+    if (!Glib::file_test(fname, Glib::FILE_TEST_EXISTS)) {
         return nullptr;
     }
 
-    if (guint32(h) != height) {
-        fclose(f);
+    GError *err = nullptr;
+    GMappedFile *mf = g_mapped_file_new(fname.c_str(), FALSE, &err);
+
+    if (!mf) {
+        if (err) {
+            g_error_free(err);
+        }
         return nullptr;
     }
 
-    rtengine::Image8 *image = new rtengine::Image8(width, height);
-    image->readData(f);
-    fclose(f);
-
-    // if (guint32(h) < height) {
-    //     int w = int(float(width) * float(guint32(h) / height));
-    //     rtengine::Image8 *resized = new rtengine::Image8(w, h);
-    //     image->resizeImgTo<>(w, h, rtengine::TI_Nearest, resized);
-    //     delete image;
-    //     image = resized;
-    // }
+    image = read_image(g_mapped_file_get_contents(mf), g_mapped_file_get_length(mf), monitor_hash, params_digest(pparams), h);
+    g_mapped_file_unref(mf);
 
-    if (options.rtSettings.verbose > 1) {
-        std::cout << "read from cache: " << fname << " " << width << "x" << height << std::endl;
+    if (image && options.rtSettings.verbose > 1) {
+        std::cout << "read from cache: " << fname << " " << image->getWidth() << "x" << image->getHeight() << std::endl;
     }
 
     return image;
@@ -148,27 +147,27 @@ bool store(const Glib::ustring &cache_fname, const rtengine::procparams::ProcPar
     }
     
     Glib::ustring fname = cache_fname + ".artt";
-    FILE *f = g_fopen(fname.c_str(), "wb");
-
-    if (!f) {
-        return false;
-    }
 
-    fputs("ART\n", f);
-    fputs(rtengine::ICCStore::getInstance()->getThumbnailMonitorHash().c_str(), f);
-    std::vector<uint8_t> profzdata = rtengine::compress(pparams.to_data(), 1);
-    guint32 profsz = guint32(profzdata.size());
-    fwrite(&profsz, sizeof(guint32), 1, f);
-    fwrite(&profzdata[0], sizeof(uint8_t), profsz, f);
+    std::string monitor_hash = rtengine::ICCStore::getInstance()->getThumbnailMonitorHash();
+    std::string digest = params_digest(pparams);
+    monitor_hash.resize(MONITOR_HASH_SIZE, '0');
+    digest.resize(DIGEST_SIZE, '0');
 
     guint32 w = guint32(img->getWidth());
     guint32 h = guint32(img->getHeight());
-    fwrite(&w, sizeof(guint32), 1, f);
-    fwrite(&h, sizeof(guint32), 1, f);
 
-    img->writeData(f);
+    std::string data;
+    data.reserve(HEADER_SIZE + size_t(w) * h * 3);
+    data.append(MAGIC, MAGIC_SIZE);
+    data += monitor_hash;
+    data += digest;
+    data.append(reinterpret_cast<const char *>(&w), sizeof(guint32));
+    data.append(reinterpret_cast<const char *>(&h), sizeof(guint32));
+    img->writeData(data);
 
-    fclose(f);
+    if (!cacheMgr->writeFile(fname, data)) {
+        return false;
+    }
 
     if (options.rtSettings.verbose > 1) {
         std::cout << "saved in cache: " << fname << " " << w << "x" << h << std::endl;
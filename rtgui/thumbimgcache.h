@@ -32,13 +32,17 @@ namespace art { namespace thumbimgcache {
 /******************************************************************************
  * file format:
  *
- * "ART\n" header
- * monitor hash
- * size of the procparams
- * compressed procparams
+ * "ART2\n" header
+ * monitor hash (33 bytes)
+ * MD5 digest of the serialized procparams (32 bytes)
  * width
  * height
  * image data
+ *
+ * Validating an entry requires only to compare the fixed-size header, so
+ * the procparams are never parsed on load. The file is memory-mapped, so
+ * that the pixel data is copied directly from the page cache (unless the
+ * packed cache is in use, see CacheManager::readFile).
  ******************************************************************************/
 rtengine::IImage8 *load(const Glib::ustring &cache_fname, const rtengine::procparams::ProcParams &pparams, int h);
 
@@ -884,14 +884,15 @@ void Thumbnail::_loadThumbnail(bool firstTrial, bool info_only)
     tpp->isRaw = (cfs.format == (int) FT_Raw);
 
     // load supplementary data
-    bool succ = tpp->readData (getCacheFileName ("data", ".txt"));
+    std::string data;
+    bool succ = cachemgr->readFile(getCacheFileName("data", ".txt"), data) && tpp->readData(data);
 
     if (succ) {
         tpp->getAutoWBMultipliers(cfs.redAWBMul, cfs.greenAWBMul, cfs.blueAWBMul);
     }
 
     // thumbnail image
-    succ = succ && tpp->readImage (getCacheFileName ("images", ""));
+    succ = succ && cachemgr->readFile(getCacheFileName("images", ".rtti"), data) && tpp->readImage(data);
 
     if (!succ && firstTrial) {
         _generateThumbnailImage(false, info_only);
@@ -912,7 +913,10 @@ void Thumbnail::_loadThumbnail(bool firstTrial, bool info_only)
 
     if ( cfs.thumbImgType == CacheImageData::FULL_THUMBNAIL ) {
         // load embedded profile
-        tpp->readEmbProfile (getCacheFileName ("embprofiles", ".icc"));
+        if (!cachemgr->readFile(getCacheFileName("embprofiles", ".icc"), data)) {
+            data.clear();
+        }
+        tpp->readEmbProfile(data);
 
         tpp->init ();
     }
@@ -951,16 +955,28 @@ void Thumbnail::_saveThumbnail ()
         return;
     }
 
-    g_remove (getCacheFileName ("images", ".rtti").c_str ());
+    std::string data;
 
     // save thumbnail image
-    tpp->writeImage (getCacheFileName ("images", ""));
+    if (tpp->writeImage(data)) {
+        cachemgr->writeFile(getCacheFileName("images", ".rtti"), data);
+    } else {
+        cachemgr->removeFile(getCacheFileName("images", ".rtti"));
+    }
 
     // save embedded profile
-    tpp->writeEmbProfile (getCacheFileName ("embprofiles", ".icc"));
+    if (tpp->writeEmbProfile(data)) {
+        cachemgr->writeFile(getCacheFileName("embprofiles", ".icc"), data);
+    }
 
     // save supplementary data
-    tpp->writeData (getCacheFileName ("data", ".txt"));
+    const auto dataFile = getCacheFileName("data", ".txt");
+    if (!cachemgr->readFile(dataFile, data)) {
+        data.clear();
+    }
+    if (tpp->writeData(data)) {
+        cachemgr->writeFile(dataFile, data);
+    }
 }
 
 /*